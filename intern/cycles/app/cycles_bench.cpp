@@ -0,0 +1,510 @@
+/*
+ * Copyright 2011-2013 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "buffers.h"
+#include "camera.h"
+#include "device.h"
+#include "scene.h"
+#include "session.h"
+
+#include "util_args.h"
+#include "util_foreach.h"
+#include "util_function.h"
+#include "util_path.h"
+#include "util_progress.h"
+#include "util_stats.h"
+#include "util_string.h"
+#include "util_task.h"
+#include "util_thread.h"
+#include "util_time.h"
+
+#include "cycles_xml.h"
+
+/* Benchmark
+ *
+ * Renders a fixed set of XML scenes in background mode and reports the time
+ * spent in each stage as JSON, so that performance can be compared between
+ * versions. Stages are measured from the session progress status, which the
+ * session and scene managers update as they go. */
+
+CCL_NAMESPACE_BEGIN
+
+/* scenes in the bench directory used when no files are specified */
+static const char *bench_default_scenes[] = {
+	"glass.xml",
+	"sss.xml",
+	"interior.xml",
+	"many_lights.xml",
+	"instancing.xml",
+	NULL
+};
+
+struct Options {
+	vector<string> filepaths;
+	string scenes_dir;
+	string output;
+	int width, height;
+	int repeat;
+	SceneParams scene_params;
+	SessionParams session_params;
+	bool quiet;
+} options;
+
+struct BenchResult {
+	string name;
+	string filepath;
+	bool success;
+
+	int width, height;
+	int samples;
+
+	double load_time;
+	double kernel_time;
+	double sync_time;
+	double bvh_time;
+	double render_time;
+	double total_time;
+
+	/* device memory breakdown as JSON */
+	string memory;
+
+	BenchResult()
+	{
+		success = false;
+		width = 0;
+		height = 0;
+		samples = 0;
+		load_time = 0.0;
+		kernel_time = 0.0;
+		sync_time = 0.0;
+		bvh_time = 0.0;
+		render_time = 0.0;
+		total_time = 0.0;
+	}
+};
+
+/* Stage Timer
+ *
+ * Accumulates the time between progress updates into the stage matching the
+ * status that was active during that time. */
+
+class StageTimer {
+public:
+	enum Stage {
+		STAGE_OTHER = 0,
+		STAGE_KERNEL,
+		STAGE_SYNC,
+		STAGE_BVH,
+		STAGE_RENDER,
+		STAGE_ERROR,
+		STAGE_NUM
+	};
+
+	StageTimer()
+	{
+		for(int i = 0; i < STAGE_NUM; i++)
+			times[i] = 0.0;
+
+		stage = STAGE_OTHER;
+		last_time = time_dt();
+		error = false;
+	}
+
+	void update(Progress *progress)
+	{
+		string status, substatus;
+		progress->get_status(status, substatus);
+
+		thread_scoped_lock lock(mutex);
+
+		double current_time = time_dt();
+		times[stage] += current_time - last_time;
+		last_time = current_time;
+
+		stage = stage_from_status(status, substatus);
+
+		if(stage == STAGE_ERROR)
+			error = true;
+	}
+
+	void finish()
+	{
+		thread_scoped_lock lock(mutex);
+
+		times[stage] += time_dt() - last_time;
+		stage = STAGE_OTHER;
+	}
+
+	double times[STAGE_NUM];
+	bool error;
+
+protected:
+	static bool status_begins(const string& status, const char *prefix)
+	{
+		return status.compare(0, strlen(prefix), prefix) == 0;
+	}
+
+	static Stage stage_from_status(const string& status, const string& substatus)
+	{
+		if(status_begins(status, "Error"))
+			return STAGE_ERROR;
+		if(status_begins(status, "Loading render kernels"))
+			return STAGE_KERNEL;
+		if(status_begins(status, "Path Tracing"))
+			return STAGE_RENDER;
+		if(status_begins(status, "Updating")) {
+			if(status.find("BVH") != string::npos || substatus.find("BVH") != string::npos)
+				return STAGE_BVH;
+			return STAGE_SYNC;
+		}
+
+		return STAGE_OTHER;
+	}
+
+	thread_mutex mutex;
+	Stage stage;
+	double last_time;
+};
+
+static void bench_print(const string& str)
+{
+	if(!options.quiet) {
+		fprintf(stderr, "%s\n", str.c_str());
+		fflush(stderr);
+	}
+}
+
+/* tile buffers are only freed by the session when a write callback is set */
+static void bench_write_render_tile(RenderTile& rtile)
+{
+}
+
+/* override the resolution of the scene file, with the viewplane fit to the
+ * new aspect the same way as when reading the film from xml */
+static void bench_camera_resize(Camera *cam, int width, int height)
+{
+	cam->width = width;
+	cam->height = height;
+
+	float aspect = (float)cam->width/(float)cam->height;
+
+	if(cam->width >= cam->height) {
+		cam->viewplane.left = -aspect;
+		cam->viewplane.right = aspect;
+		cam->viewplane.bottom = -1.0f;
+		cam->viewplane.top = 1.0f;
+	}
+	else {
+		cam->viewplane.left = -1.0f;
+		cam->viewplane.right = 1.0f;
+		cam->viewplane.bottom = -1.0f/aspect;
+		cam->viewplane.top = 1.0f/aspect;
+	}
+
+	cam->need_update = true;
+}
+
+static bool bench_scene(const string& filepath, BenchResult& result)
+{
+	SessionParams session_params = options.session_params;
+	double start_time = time_dt();
+
+	/* load scene */
+	Scene *scene = new Scene(options.scene_params, session_params.device);
+	xml_read_file(scene, filepath.c_str());
+
+	result.load_time = time_dt() - start_time;
+
+	if(options.width || options.height) {
+		bench_camera_resize(scene->camera,
+			(options.width)? options.width: scene->camera->width,
+			(options.height)? options.height: scene->camera->height);
+	}
+
+	result.width = scene->camera->width;
+	result.height = scene->camera->height;
+	result.samples = session_params.samples;
+
+	BufferParams buffer_params;
+	buffer_params.width = scene->camera->width;
+	buffer_params.height = scene->camera->height;
+	buffer_params.full_width = scene->camera->width;
+	buffer_params.full_height = scene->camera->height;
+
+	/* render */
+	StageTimer timer;
+	Session *session = new Session(session_params);
+
+	session->scene = scene;
+	session->write_render_tile_cb = function_bind(&bench_write_render_tile, _1);
+	session->progress.set_update_callback(function_bind(&StageTimer::update, &timer, &session->progress));
+	session->reset(buffer_params, session_params.samples);
+
+	session->start();
+	session->wait();
+
+	timer.finish();
+
+	result.success = !timer.error && !session->progress.get_cancel();
+	result.kernel_time = timer.times[StageTimer::STAGE_KERNEL];
+	result.sync_time = timer.times[StageTimer::STAGE_SYNC] + timer.times[StageTimer::STAGE_BVH];
+	result.bvh_time = timer.times[StageTimer::STAGE_BVH];
+	result.render_time = timer.times[StageTimer::STAGE_RENDER];
+	result.memory = session->stats.mem_json("\t\t\t");
+
+	/* session owns the scene */
+	delete session;
+
+	result.total_time = time_dt() - start_time;
+
+	return result.success;
+}
+
+/* JSON */
+
+static string json_results(const vector<BenchResult>& results)
+{
+	DeviceInfo& device = options.session_params.device;
+	string json = "{\n";
+
+	json += string_printf("\t\"device\": \"%s\",\n", json_escape(device.description).c_str());
+	json += string_printf("\t\"device_type\": \"%s\",\n", Device::string_from_type(device.type).c_str());
+	json += string_printf("\t\"threads\": %d,\n", TaskScheduler::num_threads());
+	json += string_printf("\t\"shading_system\": \"%s\",\n",
+		(options.scene_params.shadingsystem == SceneParams::OSL)? "osl": "svm");
+	json += string_printf("\t\"repeat\": %d,\n", options.repeat);
+	json += "\t\"scenes\": [\n";
+
+	for(size_t i = 0; i < results.size(); i++) {
+		const BenchResult& result = results[i];
+
+		double num_paths = (double)result.width*(double)result.height*(double)result.samples;
+		double samples_per_second = (result.render_time > 0.0)? result.samples/result.render_time: 0.0;
+		double paths_per_second = (result.render_time > 0.0)? num_paths/result.render_time: 0.0;
+
+		json += "\t\t{\n";
+		json += string_printf("\t\t\t\"name\": \"%s\",\n", json_escape(result.name).c_str());
+		json += string_printf("\t\t\t\"file\": \"%s\",\n", json_escape(result.filepath).c_str());
+		json += string_printf("\t\t\t\"success\": %s,\n", (result.success)? "true": "false");
+		json += string_printf("\t\t\t\"width\": %d,\n", result.width);
+		json += string_printf("\t\t\t\"height\": %d,\n", result.height);
+		json += string_printf("\t\t\t\"samples\": %d,\n", result.samples);
+		json += string_printf("\t\t\t\"load_time\": %.6f,\n", result.load_time);
+		json += string_printf("\t\t\t\"kernel_load_time\": %.6f,\n", result.kernel_time);
+		json += string_printf("\t\t\t\"sync_time\": %.6f,\n", result.sync_time);
+		json += string_printf("\t\t\t\"bvh_build_time\": %.6f,\n", result.bvh_time);
+		json += string_printf("\t\t\t\"render_time\": %.6f,\n", result.render_time);
+		json += string_printf("\t\t\t\"total_time\": %.6f,\n", result.total_time);
+		json += string_printf("\t\t\t\"samples_per_second\": %.6f,\n", samples_per_second);
+		json += string_printf("\t\t\t\"paths_per_second\": %.2f,\n", paths_per_second);
+		json += string_printf("\t\t\t\"memory\": %s\n", (result.memory != "")? result.memory.c_str(): "null");
+		json += (i == results.size()-1)? "\t\t}\n": "\t\t},\n";
+	}
+
+	json += "\t]\n";
+	json += "}\n";
+
+	return json;
+}
+
+/* Options */
+
+static int files_parse(int argc, const char *argv[])
+{
+	for(int i = 0; i < argc; i++)
+		options.filepaths.push_back(argv[i]);
+
+	return 0;
+}
+
+static void options_parse(int argc, const char **argv)
+{
+	options.width = 0;
+	options.height = 0;
+	options.repeat = 1;
+	options.quiet = false;
+	options.output = "";
+#ifdef CYCLES_BENCH_SCENES_DIR
+	options.scenes_dir = CYCLES_BENCH_SCENES_DIR;
+#else
+	options.scenes_dir = "bench";
+#endif
+
+	options.session_params.samples = 64;
+
+	/* device names */
+	string device_names = "";
+	string devicename = "cpu";
+
+	vector<DeviceType>& types = Device::available_types();
+
+	foreach(DeviceType type, types) {
+		if(device_names != "")
+			device_names += ", ";
+
+		device_names += Device::string_from_type(type);
+	}
+
+	/* parse options */
+	ArgParse ap;
+	bool help = false;
+	string ssname = "svm";
+
+	ap.options ("Usage: cycles_bench [options] [file.xml ...]",
+		"%*", files_parse, "",
+		"--device %s", &devicename, ("Devices to use: " + device_names).c_str(),
+		"--shadingsys %s", &ssname, "Shading system to use: svm, osl",
+		"--samples %d", &options.session_params.samples, "Number of samples to render",
+		"--threads %d", &options.session_params.threads, "CPU Rendering Threads",
+		"--width  %d", &options.width, "Override scene width in pixel",
+		"--height %d", &options.height, "Override scene height in pixel",
+		"--repeat %d", &options.repeat, "Render every scene this many times and report the fastest run",
+		"--scenes %s", &options.scenes_dir, "Directory with the default benchmark scenes",
+		"--output %s", &options.output, "File path to write JSON results to, instead of standard output",
+		"--quiet", &options.quiet, "Don't print progress messages",
+		"--help", &help, "Print help message",
+		NULL);
+
+	if(ap.parse(argc, argv) < 0) {
+		fprintf(stderr, "%s\n", ap.geterror().c_str());
+		ap.usage();
+		exit(EXIT_FAILURE);
+	}
+	else if(help) {
+		ap.usage();
+		exit(EXIT_SUCCESS);
+	}
+
+	if(ssname == "osl")
+		options.scene_params.shadingsystem = SceneParams::OSL;
+	else if(ssname == "svm")
+		options.scene_params.shadingsystem = SceneParams::SVM;
+
+	/* always render in background with full tiles, like a final render */
+	options.session_params.background = true;
+	options.session_params.progressive = false;
+	options.session_params.start_resolution = INT_MAX;
+
+	/* find matching device */
+	DeviceType device_type = Device::type_from_string(devicename.c_str());
+	vector<DeviceInfo>& devices = Device::available_devices();
+	bool device_available = false;
+
+	foreach(DeviceInfo& device, devices) {
+		if(device_type == device.type) {
+			options.session_params.device = device;
+			device_available = true;
+			break;
+		}
+	}
+
+	/* handle invalid configurations */
+	if(options.session_params.device.type == DEVICE_NONE || !device_available) {
+		fprintf(stderr, "Unknown device: %s\n", devicename.c_str());
+		exit(EXIT_FAILURE);
+	}
+#ifdef WITH_OSL
+	else if(!(ssname == "osl" || ssname == "svm")) {
+#else
+	else if(!(ssname == "svm")) {
+#endif
+		fprintf(stderr, "Unknown shading system: %s\n", ssname.c_str());
+		exit(EXIT_FAILURE);
+	}
+	else if(options.scene_params.shadingsystem == SceneParams::OSL && options.session_params.device.type != DEVICE_CPU) {
+		fprintf(stderr, "OSL shading system only works with CPU device\n");
+		exit(EXIT_FAILURE);
+	}
+	else if(options.session_params.samples <= 0) {
+		fprintf(stderr, "Invalid number of samples: %d\n", options.session_params.samples);
+		exit(EXIT_FAILURE);
+	}
+	else if(options.repeat <= 0) {
+		fprintf(stderr, "Invalid number of repeats: %d\n", options.repeat);
+		exit(EXIT_FAILURE);
+	}
+
+	/* default scenes */
+	if(options.filepaths.size() == 0) {
+		for(int i = 0; bench_default_scenes[i]; i++)
+			options.filepaths.push_back(path_join(options.scenes_dir, bench_default_scenes[i]));
+	}
+
+	foreach(string& filepath, options.filepaths) {
+		if(!path_exists(filepath)) {
+			fprintf(stderr, "Scene file not found: %s\n", filepath.c_str());
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+CCL_NAMESPACE_END
+
+using namespace ccl;
+
+int main(int argc, const char **argv)
+{
+	path_init();
+	options_parse(argc, argv);
+
+	TaskScheduler::init(options.session_params.threads);
+
+	vector<BenchResult> results;
+	bool success = true;
+
+	foreach(string& filepath, options.filepaths) {
+		BenchResult best;
+
+		for(int i = 0; i < options.repeat; i++) {
+			BenchResult result;
+			result.name = path_filename(filepath);
+			result.filepath = filepath;
+
+			bench_print(string_printf("Rendering %s (%d/%d)", result.name.c_str(), i + 1, options.repeat));
+
+			if(!bench_scene(filepath, result)) {
+				bench_print(string_printf("Failed to render %s", result.name.c_str()));
+				best = result;
+				break;
+			}
+
+			if(i == 0 || result.total_time < best.total_time)
+				best = result;
+		}
+
+		success = success && best.success;
+		results.push_back(best);
+	}
+
+	/* write results */
+	string json = json_results(results);
+
+	TaskScheduler::exit();
+
+	if(options.output == "") {
+		printf("%s", json.c_str());
+	}
+	else if(!path_write_text(options.output, json)) {
+		fprintf(stderr, "Failed to write %s\n", options.output.c_str());
+		return EXIT_FAILURE;
+	}
+
+	return (success)? EXIT_SUCCESS: EXIT_FAILURE;
+}
+
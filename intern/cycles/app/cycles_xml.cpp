@@ -444,6 +444,15 @@ static void xml_read_shader_graph(const XMLReadState& state, Shader *shader, pug
 			xml_read_enum(&diel->distribution, GlassBsdfNode::distribution_enum, node, "distribution");
 			snode = diel;
 		}
+		else if(string_iequals(node.name(), "subsurface_scattering")) {
+			SubsurfaceScatteringNode *sss = new SubsurfaceScatteringNode();
+			ustring falloff;
+
+			if(xml_read_enum(&falloff, SubsurfaceScatteringNode::falloff_enum, node, "falloff"))
+				sss->closure = (ClosureType)SubsurfaceScatteringNode::falloff_enum[falloff];
+
+			snode = sss;
+		}
 		else if(string_iequals(node.name(), "emission")) {
 			EmissionNode *emission = new EmissionNode();
 			xml_read_bool(&emission->total_power, node, "total_power");
@@ -76,6 +76,10 @@ class CyclesRender(bpy.types.RenderEngine):
     def view_draw(self, context):
         engine.draw(self, context.region, context.space_data, context.region_data)
 
+    # memory breakdown per category, None without a session
+    def memory_stats(self):
+        return engine.memory_stats(self)
+
     def update_script_node(self, node):
         if engine.with_osl():
             from . import osl
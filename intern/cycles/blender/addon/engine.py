@@ -59,6 +59,13 @@ def render(engine):
         _cycles.render(engine.session)
 
 
+def memory_stats(engine):
+    import _cycles
+    if getattr(engine, "session", None):
+        return _cycles.memory_stats(engine.session)
+    return None
+
+
 def reset(engine, data, scene):
     import _cycles
     data = data.as_pointer()
@@ -214,6 +214,21 @@ class CyclesRenderSettings(bpy.types.PropertyGroup):
                 default=1,
                 )
 
+        cls.adaptive_threshold = FloatProperty(
+                name="Noise Threshold",
+                description="If non-zero, stop sampling pixels once their estimated noise is below this threshold, "
+                            "remaining samples are spent on noisier pixels (final render on the CPU only)",
+                min=0.0, max=1.0,
+                default=0.0,
+                precision=4,
+                )
+        cls.adaptive_min_samples = IntProperty(
+                name="Min Samples",
+                description="Minimum number of samples taken for every pixel before testing for convergence",
+                min=0, max=4096,
+                default=16,
+                )
+
         cls.sampling_pattern = EnumProperty(
                 name="Sampling Pattern",
                 description="Random sampling pattern used by the integrator",
@@ -387,6 +402,24 @@ class CyclesRenderSettings(bpy.types.PropertyGroup):
                 description="Cache last built BVH to disk for faster re-render if no geometry changed",
                 default=False,
                 )
+        cls.use_texture_cache = BoolProperty(
+                name="Texture Cache",
+                description="Read image textures from disk as needed instead of loading them fully into memory, "
+                            "works best with tiled and mipmapped images (CPU only)",
+                default=False,
+                )
+        cls.texture_cache_size = IntProperty(
+                name="Cache Size",
+                description="Maximum memory used by the texture cache, in megabytes",
+                min=64, max=1048576,
+                default=4096,
+                )
+        cls.use_sorted_shading = BoolProperty(
+                name="Sorted Shading",
+                description="Trace paths of a tile in batches and shade them sorted by material, "
+                            "can be faster for scenes with many materials (CPU only)",
+                default=False,
+                )
         cls.tile_order = EnumProperty(
                 name="Tile Order",
                 description="Tile order for rendering",
@@ -655,7 +688,7 @@ class CyclesMeshSettings(bpy.types.PropertyGroup):
                 )
         cls.dicing_rate = FloatProperty(
                 name="Dicing Rate",
-                description="",
+                description="Size of a micropolygon in pixels, or in object space for panoramic cameras",
                 min=0.001, max=1000.0,
                 default=1.0,
                 )
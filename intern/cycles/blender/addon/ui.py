@@ -118,6 +118,8 @@ class CyclesRender_PT_sampling(CyclesButtonsPanel, Panel):
         sub.label("Settings:")
         sub.prop(cscene, "seed")
         sub.prop(cscene, "sample_clamp")
+        sub.prop(cscene, "adaptive_threshold")
+        sub.prop(cscene, "adaptive_min_samples")
 
         if cscene.progressive == 'PATH':
             col = split.column()
@@ -288,6 +290,16 @@ class CyclesRender_PT_performance(CyclesButtonsPanel, Panel):
         col.label(text="Acceleration structure:")
         col.prop(cscene, "debug_use_spatial_splits")
 
+        col.separator()
+
+        col.prop(cscene, "use_sorted_shading")
+        col.separator()
+
+        col.prop(cscene, "use_texture_cache")
+        sub = col.column()
+        sub.active = cscene.use_texture_cache
+        sub.prop(cscene, "texture_cache_size")
+
 
 class CyclesRender_PT_opengl(CyclesButtonsPanel, Panel):
     bl_label = "OpenGL Render"
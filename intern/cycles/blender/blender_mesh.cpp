@@ -15,6 +15,7 @@
  */
 
  
+#include "camera.h"
 #include "mesh.h"
 #include "object.h"
 #include "scene.h"
@@ -30,19 +31,90 @@
 
 #include "mikktspace.h"
 
+#include "DNA_meshdata_types.h"
+
 CCL_NAMESPACE_BEGIN
 
+/* Mesh Arrays
+ *
+ * The mesh created for rendering stores its vertices, faces and face layers as
+ * contiguous arrays, reading those directly avoids the RNA overhead per element,
+ * which dominates export time for large meshes. */
+
+static const MVert *mesh_verts(BL::Mesh b_mesh)
+{
+	return (b_mesh.vertices.length())? (const MVert*)b_mesh.vertices[0].ptr.data: NULL;
+}
+
+static const MFace *mesh_tessfaces(BL::Mesh b_mesh)
+{
+	return (b_mesh.tessfaces.length())? (const MFace*)b_mesh.tessfaces[0].ptr.data: NULL;
+}
+
+static const MTFace *mesh_tessface_uvs(BL::MeshTextureFaceLayer b_layer)
+{
+	return (b_layer.data.length())? (const MTFace*)b_layer.data[0].ptr.data: NULL;
+}
+
+static const MCol *mesh_tessface_colors(BL::MeshColorLayer b_layer)
+{
+	/* four colors per face */
+	return (b_layer.data.length())? (const MCol*)b_layer.data[0].ptr.data: NULL;
+}
+
+static inline float3 mvert_co(const MVert *mv)
+{
+	return make_float3(mv->co[0], mv->co[1], mv->co[2]);
+}
+
+static inline float3 mvert_normal(const MVert *mv)
+{
+	return make_float3(mv->no[0], mv->no[1], mv->no[2]) * (1.0f/32767.0f);
+}
+
+static inline int mface_num_verts(const MFace *mf)
+{
+	return (mf->v4 == 0)? 3: 4;
+}
+
+static inline float3 mface_normal(const MVert *mvert, const MFace *mf)
+{
+	/* same as normal_tri_v3 and normal_quad_v3 */
+	float3 n;
+
+	if(mf->v4) {
+		float3 d1 = mvert_co(&mvert[mf->v1]) - mvert_co(&mvert[mf->v3]);
+		float3 d2 = mvert_co(&mvert[mf->v2]) - mvert_co(&mvert[mf->v4]);
+		n = cross(d1, d2);
+	}
+	else {
+		float3 n1 = mvert_co(&mvert[mf->v1]) - mvert_co(&mvert[mf->v2]);
+		float3 n2 = mvert_co(&mvert[mf->v2]) - mvert_co(&mvert[mf->v3]);
+		n = cross(n1, n2);
+	}
+
+	float l = len(n);
+	return (l != 0.0f)? n/l: n;
+}
+
+static inline float3 mcol_to_float3(const MCol *mcol)
+{
+	/* red and blue are swapped in tessface colors */
+	return make_float3((unsigned char)mcol->b, (unsigned char)mcol->g, (unsigned char)mcol->r) * (1.0f/255.0f);
+}
+
 /* Tangent Space */
 
 struct MikkUserData {
-	MikkUserData(const BL::Mesh mesh_, const BL::MeshTextureFaceLayer layer_, int num_faces_)
-	: mesh(mesh_), layer(layer_), num_faces(num_faces_)
+	MikkUserData(const MVert *mvert_, const MFace *mface_, const MTFace *mtface_, int num_faces_)
+	: mvert(mvert_), mface(mface_), mtface(mtface_), num_faces(num_faces_)
 	{
 		tangent.resize(num_faces*4);
 	}
 
-	BL::Mesh mesh;
-	BL::MeshTextureFaceLayer layer;
+	const MVert *mvert;
+	const MFace *mface;
+	const MTFace *mtface;
 	int num_faces;
 	vector<float4> tangent;
 };
@@ -56,63 +128,41 @@ static int mikk_get_num_faces(const SMikkTSpaceContext *context)
 static int mikk_get_num_verts_of_face(const SMikkTSpaceContext *context, const int face_num)
 {
 	MikkUserData *userdata = (MikkUserData*)context->m_pUserData;
-	BL::MeshTessFace f = userdata->mesh.tessfaces[face_num];
-	int4 vi = get_int4(f.vertices_raw());
-
-	return (vi[3] == 0)? 3: 4;
+	return mface_num_verts(&userdata->mface[face_num]);
 }
 
 static void mikk_get_position(const SMikkTSpaceContext *context, float P[3], const int face_num, const int vert_num)
 {
 	MikkUserData *userdata = (MikkUserData*)context->m_pUserData;
-	BL::MeshTessFace f = userdata->mesh.tessfaces[face_num];
-	int4 vi = get_int4(f.vertices_raw());
-	BL::MeshVertex v = userdata->mesh.vertices[vi[vert_num]];
-	float3 vP = get_float3(v.co());
-
-	P[0] = vP.x;
-	P[1] = vP.y;
-	P[2] = vP.z;
+	const unsigned int *vi = &userdata->mface[face_num].v1;
+	const MVert *mv = &userdata->mvert[vi[vert_num]];
+
+	P[0] = mv->co[0];
+	P[1] = mv->co[1];
+	P[2] = mv->co[2];
 }
 
 static void mikk_get_texture_coordinate(const SMikkTSpaceContext *context, float uv[2], const int face_num, const int vert_num)
 {
 	MikkUserData *userdata = (MikkUserData*)context->m_pUserData;
-	BL::MeshTextureFace tf = userdata->layer.data[face_num];
-	float3 tfuv;
-	
-	switch (vert_num) {
-		case 0:
-			tfuv = get_float3(tf.uv1());
-			break;
-		case 1:
-			tfuv = get_float3(tf.uv2());
-			break;
-		case 2:
-			tfuv = get_float3(tf.uv3());
-			break;
-		default:
-			tfuv = get_float3(tf.uv4());
-			break;
-	}
-	
-	uv[0] = tfuv.x;
-	uv[1] = tfuv.y;
+	const MTFace *tf = &userdata->mtface[face_num];
+
+	uv[0] = tf->uv[vert_num][0];
+	uv[1] = tf->uv[vert_num][1];
 }
 
 static void mikk_get_normal(const SMikkTSpaceContext *context, float N[3], const int face_num, const int vert_num)
 {
 	MikkUserData *userdata = (MikkUserData*)context->m_pUserData;
-	BL::MeshTessFace f = userdata->mesh.tessfaces[face_num];
+	const MFace *mf = &userdata->mface[face_num];
 	float3 vN;
 
-	if(f.use_smooth()) {
-		int4 vi = get_int4(f.vertices_raw());
-		BL::MeshVertex v = userdata->mesh.vertices[vi[vert_num]];
-		vN = get_float3(v.normal());
+	if(mf->flag & ME_SMOOTH) {
+		const unsigned int *vi = &mf->v1;
+		vN = mvert_normal(&userdata->mvert[vi[vert_num]]);
 	}
 	else {
-		vN = get_float3(f.normal());
+		vN = mface_normal(userdata->mvert, mf);
 	}
 
 	N[0] = vN.x;
@@ -129,8 +179,13 @@ static void mikk_set_tangent_space(const SMikkTSpaceContext *context, const floa
 
 static void mikk_compute_tangents(BL::Mesh b_mesh, BL::MeshTextureFaceLayer b_layer, Mesh *mesh, vector<int>& nverts, bool need_sign, bool active_render)
 {
+	const MTFace *mtface = mesh_tessface_uvs(b_layer);
+
+	if(!mtface)
+		return;
+
 	/* setup userdata */
-	MikkUserData userdata(b_mesh, b_layer, nverts.size());
+	MikkUserData userdata(mesh_verts(b_mesh), mesh_tessfaces(b_mesh), mtface, nverts.size());
 
 	/* setup interface */
 	SMikkTSpaceInterface sm_interface;
@@ -215,38 +270,35 @@ static void create_mesh(Scene *scene, Mesh *mesh, BL::Mesh b_mesh, const vector<
 	int numfaces = b_mesh.tessfaces.length();
 	int numtris = 0;
 
-	BL::Mesh::vertices_iterator v;
-	BL::Mesh::tessfaces_iterator f;
+	const MVert *mvert = mesh_verts(b_mesh);
+	const MFace *mface = mesh_tessfaces(b_mesh);
 
-	for(b_mesh.tessfaces.begin(f); f != b_mesh.tessfaces.end(); ++f) {
-		int4 vi = get_int4(f->vertices_raw());
-		numtris += (vi[3] == 0)? 1: 2;
-	}
+	for(int fi = 0; fi < numfaces; fi++)
+		numtris += (mface[fi].v4 == 0)? 1: 2;
 
 	/* reserve memory */
 	mesh->reserve(numverts, numtris, 0, 0);
 
 	/* create vertex coordinates and normals */
-	int i = 0;
-	for(b_mesh.vertices.begin(v); v != b_mesh.vertices.end(); ++v, ++i)
-		mesh->verts[i] = get_float3(v->co());
-
 	Attribute *attr_N = mesh->attributes.add(ATTR_STD_VERTEX_NORMAL);
 	float3 *N = attr_N->data_float3();
 
-	for(b_mesh.vertices.begin(v); v != b_mesh.vertices.end(); ++v, ++N)
-		*N = get_float3(v->normal());
+	for(int i = 0; i < numverts; i++) {
+		mesh->verts[i] = mvert_co(&mvert[i]);
+		N[i] = mvert_normal(&mvert[i]);
+	}
 
 	/* create faces */
 	vector<int> nverts(numfaces);
-	int fi = 0, ti = 0;
+	int ti = 0;
 
-	for(b_mesh.tessfaces.begin(f); f != b_mesh.tessfaces.end(); ++f, ++fi) {
-		int4 vi = get_int4(f->vertices_raw());
-		int n = (vi[3] == 0)? 3: 4;
-		int mi = clamp(f->material_index(), 0, used_shaders.size()-1);
+	for(int fi = 0; fi < numfaces; fi++) {
+		const MFace *mf = &mface[fi];
+		int4 vi = make_int4(mf->v1, mf->v2, mf->v3, mf->v4);
+		int n = mface_num_verts(mf);
+		int mi = clamp(mf->mat_nr, 0, used_shaders.size()-1);
 		int shader = used_shaders[mi];
-		bool smooth = f->use_smooth();
+		bool smooth = (mf->flag & ME_SMOOTH) != 0;
 
 		if(n == 4) {
 			if(len_squared(cross(mesh->verts[vi[1]] - mesh->verts[vi[0]], mesh->verts[vi[2]] - mesh->verts[vi[0]])) == 0.0f ||
@@ -276,19 +328,18 @@ static void create_mesh(Scene *scene, Mesh *mesh, BL::Mesh b_mesh, const vector<
 			Attribute *attr = mesh->attributes.add(
 				ustring(l->name().c_str()), TypeDesc::TypeColor, ATTR_ELEMENT_CORNER);
 
-			BL::MeshColorLayer::data_iterator c;
+			const MCol *mcol = mesh_tessface_colors(*l);
 			float3 *fdata = attr->data_float3();
-			size_t i = 0;
 
-			for(l->data.begin(c); c != l->data.end(); ++c, ++i) {
-				fdata[0] = color_srgb_to_scene_linear(get_float3(c->color1()));
-				fdata[1] = color_srgb_to_scene_linear(get_float3(c->color2()));
-				fdata[2] = color_srgb_to_scene_linear(get_float3(c->color3()));
+			for(int i = 0; mcol && i < numfaces; i++, mcol += 4) {
+				fdata[0] = color_srgb_to_scene_linear(mcol_to_float3(&mcol[0]));
+				fdata[1] = color_srgb_to_scene_linear(mcol_to_float3(&mcol[1]));
+				fdata[2] = color_srgb_to_scene_linear(mcol_to_float3(&mcol[2]));
 
 				if(nverts[i] == 4) {
 					fdata[3] = fdata[0];
 					fdata[4] = fdata[2];
-					fdata[5] = color_srgb_to_scene_linear(get_float3(c->color4()));
+					fdata[5] = color_srgb_to_scene_linear(mcol_to_float3(&mcol[3]));
 					fdata += 6;
 				}
 				else
@@ -315,20 +366,19 @@ static void create_mesh(Scene *scene, Mesh *mesh, BL::Mesh b_mesh, const vector<
 				else
 					attr = mesh->attributes.add(name, TypeDesc::TypePoint, ATTR_ELEMENT_CORNER);
 
-				BL::MeshTextureFaceLayer::data_iterator t;
+				const MTFace *tf = mesh_tessface_uvs(*l);
 				float3 *fdata = attr->data_float3();
-				size_t i = 0;
 
-				for(l->data.begin(t); t != l->data.end(); ++t, ++i) {
-					fdata[0] =  get_float3(t->uv1());
-					fdata[1] =  get_float3(t->uv2());
-					fdata[2] =  get_float3(t->uv3());
+				for(int i = 0; tf && i < numfaces; i++, tf++) {
+					fdata[0] = make_float3(tf->uv[0][0], tf->uv[0][1], 0.0f);
+					fdata[1] = make_float3(tf->uv[1][0], tf->uv[1][1], 0.0f);
+					fdata[2] = make_float3(tf->uv[2][0], tf->uv[2][1], 0.0f);
 					fdata += 3;
 
 					if(nverts[i] == 4) {
-						fdata[0] =  get_float3(t->uv1());
-						fdata[1] =  get_float3(t->uv3());
-						fdata[2] =  get_float3(t->uv4());
+						fdata[0] = make_float3(tf->uv[0][0], tf->uv[0][1], 0.0f);
+						fdata[1] = make_float3(tf->uv[2][0], tf->uv[2][1], 0.0f);
+						fdata[2] = make_float3(tf->uv[3][0], tf->uv[3][1], 0.0f);
 						fdata += 3;
 					}
 				}
@@ -360,28 +410,33 @@ static void create_mesh(Scene *scene, Mesh *mesh, BL::Mesh b_mesh, const vector<
 		float3 *generated = attr->data_float3();
 		size_t i = 0;
 
+		/* undeformed coordinates are computed on access, so these still go through RNA */
+		BL::Mesh::vertices_iterator v;
 		for(b_mesh.vertices.begin(v); v != b_mesh.vertices.end(); ++v)
 			generated[i++] = get_float3(v->undeformed_co())*size - loc;
 	}
 }
 
-static void create_subd_mesh(Mesh *mesh, BL::Mesh b_mesh, PointerRNA *cmesh, const vector<uint>& used_shaders)
+static void create_subd_mesh(Scene *scene, Mesh *mesh, BL::Mesh b_mesh, PointerRNA *cmesh, const vector<uint>& used_shaders,
+	Transform& tfm, SubdCache *subd_cache, void *cache_key)
 {
 	/* create subd mesh */
 	SubdMesh sdmesh;
 
 	/* create vertices */
-	BL::Mesh::vertices_iterator v;
+	int numverts = b_mesh.vertices.length();
+	int numfaces = b_mesh.tessfaces.length();
+	const MVert *mvert = mesh_verts(b_mesh);
+	const MFace *mface = mesh_tessfaces(b_mesh);
 
-	for(b_mesh.vertices.begin(v); v != b_mesh.vertices.end(); ++v)
-		sdmesh.add_vert(get_float3(v->co()));
+	for(int i = 0; i < numverts; i++)
+		sdmesh.add_vert(mvert_co(&mvert[i]));
 
 	/* create faces */
-	BL::Mesh::tessfaces_iterator f;
-
-	for(b_mesh.tessfaces.begin(f); f != b_mesh.tessfaces.end(); ++f) {
-		int4 vi = get_int4(f->vertices_raw());
-		int n = (vi[3] == 0) ? 3: 4;
+	for(int fi = 0; fi < numfaces; fi++) {
+		const MFace *mf = &mface[fi];
+		int4 vi = make_int4(mf->v1, mf->v2, mf->v3, mf->v4);
+		int n = mface_num_verts(mf);
 		//int shader = used_shaders[f->material_index()];
 
 		if(n == 4)
@@ -400,7 +455,21 @@ static void create_subd_mesh(Mesh *mesh, BL::Mesh b_mesh, PointerRNA *cmesh, con
 	dsplit.camera = NULL;
 	dsplit.dicing_rate = RNA_float_get(cmesh, "dicing_rate");
 
-	sdmesh.tessellate(&dsplit, false, mesh, used_shaders[0], true);
+	/* dice in raster space of the camera, panoramic cameras have no simple
+	 * projection so they keep dicing in object space */
+	Camera *camera = scene->camera;
+
+	if(camera->type != CAMERA_PANORAMA) {
+		camera->update();
+
+		dsplit.camera = camera;
+		dsplit.objecttoworld = tfm;
+	}
+
+	if(subd_cache)
+		subd_cache->tessellate(cache_key, &sdmesh, &dsplit, false, mesh, used_shaders[0], true);
+	else
+		sdmesh.tessellate(&dsplit, false, mesh, used_shaders[0], true);
 }
 
 /* Sync */
@@ -481,8 +550,11 @@ Mesh *BlenderSync::sync_mesh(BL::Object b_ob, bool object_updated, bool hide_tri
 
 		if(b_mesh) {
 			if(render_layer.use_surfaces && !hide_tris) {
-				if(cmesh.data && experimental && RNA_boolean_get(&cmesh, "use_subdivision"))
-					create_subd_mesh(mesh, b_mesh, &cmesh, used_shaders);
+				if(cmesh.data && experimental && RNA_boolean_get(&cmesh, "use_subdivision")) {
+					/* instances share the tessellation made for the first one */
+					Transform tfm = get_transform(b_ob.matrix_world());
+					create_subd_mesh(scene, mesh, b_mesh, &cmesh, used_shaders, tfm, subd_cache, key.ptr.data);
+				}
 				else
 					create_mesh(scene, mesh, b_mesh, used_shaders);
 			}
@@ -549,17 +621,17 @@ void BlenderSync::sync_mesh_motion(BL::Object b_ob, Mesh *mesh, int motion)
 	BL::Mesh b_mesh = object_to_mesh(b_data, b_ob, b_scene, true, !preview, false);
 
 	if(b_mesh) {
-		BL::Mesh::vertices_iterator v;
 		AttributeStandard std = (motion == -1)? ATTR_STD_MOTION_PRE: ATTR_STD_MOTION_POST;
 		Attribute *attr_M = mesh->attributes.add(std);
-		float3 *M = attr_M->data_float3(), *cur_M;
-		size_t i = 0;
+		float3 *M = attr_M->data_float3();
+		size_t numverts = min((size_t)b_mesh.vertices.length(), size);
+		const MVert *mvert = mesh_verts(b_mesh);
 
-		for(b_mesh.vertices.begin(v), cur_M = M; v != b_mesh.vertices.end() && i < size; ++v, cur_M++, i++)
-			*cur_M = get_float3(v->co());
+		for(size_t i = 0; i < numverts; i++)
+			M[i] = mvert_co(&mvert[i]);
 
 		/* if number of vertices changed, or if coordinates stayed the same, drop it */
-		if(i != size || memcmp(M, &mesh->verts[0], sizeof(float3)*size) == 0)
+		if(numverts != size || memcmp(M, &mesh->verts[0], sizeof(float3)*size) == 0)
 			mesh->attributes.remove(std);
 
 		/* hair motion */
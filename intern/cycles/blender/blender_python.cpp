@@ -25,6 +25,7 @@
 #include "util_md5.h"
 #include "util_opengl.h"
 #include "util_path.h"
+#include "util_task.h"
 
 #ifdef WITH_OSL
 #include "osl.h"
@@ -44,6 +45,10 @@ static PyObject *init_func(PyObject *self, PyObject *args)
 	
 	path_init(path, user_path);
 
+	/* render threads should not compete with the user interface and the
+	 * blender task scheduler threads for the cpu */
+	TaskScheduler::set_low_priority(true);
+
 	Py_RETURN_NONE;
 }
 
@@ -133,6 +138,41 @@ static PyObject *render_func(PyObject *self, PyObject *value)
 	Py_RETURN_NONE;
 }
 
+static void dict_set_item_steal(PyObject *dict, const char *key, PyObject *value)
+{
+	PyDict_SetItemString(dict, key, value);
+	Py_DECREF(value);
+}
+
+static PyObject *memory_stats_func(PyObject *self, PyObject *value)
+{
+	BlenderSession *session = (BlenderSession*)PyLong_AsVoidPtr(value);
+	/* the session thread updates the statistics while rendering, only read a copy */
+	Stats stats = session->session->stats.get_copy();
+
+	PyObject *ret = PyDict_New();
+	PyObject *categories = PyDict_New();
+	PyObject *images = PyDict_New();
+
+	dict_set_item_steal(ret, "used", PyLong_FromSize_t(stats.mem_used));
+	dict_set_item_steal(ret, "peak", PyLong_FromSize_t(stats.mem_peak));
+
+	for(int i = 0; i < MEM_NUM_CATEGORIES; i++) {
+		dict_set_item_steal(categories, mem_category_name((MemoryCategory)i),
+			Py_BuildValue("(nn)", (Py_ssize_t)stats.category_used[i], (Py_ssize_t)stats.category_peak[i]));
+	}
+
+	map<string, size_t>::iterator it;
+
+	for(it = stats.image_used.begin(); it != stats.image_used.end(); it++)
+		dict_set_item_steal(images, it->first.c_str(), PyLong_FromSize_t(it->second));
+
+	dict_set_item_steal(ret, "categories", categories);
+	dict_set_item_steal(ret, "images", images);
+
+	return ret;
+}
+
 static PyObject *draw_func(PyObject *self, PyObject *args)
 {
 	PyObject *pysession, *pyv3d, *pyrv3d;
@@ -403,6 +443,7 @@ static PyMethodDef methods[] = {
 	{"create", create_func, METH_VARARGS, ""},
 	{"free", free_func, METH_O, ""},
 	{"render", render_func, METH_O, ""},
+	{"memory_stats", memory_stats_func, METH_O, ""},
 	{"draw", draw_func, METH_VARARGS, ""},
 	{"sync", sync_func, METH_O, ""},
 	{"reset", reset_func, METH_VARARGS, ""},
@@ -14,6 +14,9 @@
  * limitations under the License
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+
 #include "background.h"
 #include "buffers.h"
 #include "camera.h"
@@ -98,12 +101,13 @@ void BlenderSession::create_session()
 	session->set_pause(BlenderSync::get_session_pause(b_scene, background));
 
 	/* create sync */
-	sync = new BlenderSync(b_engine, b_data, b_scene, scene, !background, session->progress, session_params.device.type == DEVICE_CPU);
+	SubdCache *sync_subd_cache = (background && scene_params.persistent_data)? &subd_cache: NULL;
+	sync = new BlenderSync(b_engine, b_data, b_scene, scene, !background, session->progress, session_params.device.type == DEVICE_CPU, sync_subd_cache);
 
 	if(b_v3d) {
-		/* full data sync */
-		sync->sync_data(b_v3d, b_engine.camera_override());
+		/* full data sync, view first since subdivision meshes dice in its raster space */
 		sync->sync_view(b_v3d, b_rv3d, width, height);
+		sync->sync_data(b_v3d, b_engine.camera_override());
 	}
 	else {
 		/* for final render we will do full data sync per render layer, only
@@ -160,10 +164,13 @@ void BlenderSession::reset_session(BL::BlendData b_data_, BL::Scene b_scene_)
 	/* peak memory usage should show current render peak, not peak for all renders
 	 * made by this render session
 	 */
-	session->stats.mem_peak = session->stats.mem_used;
+	session->stats.reset_peak();
+
+	/* free tessellations of meshes not used in the previous render */
+	subd_cache.clear_unused();
 
 	/* sync object should be re-created */
-	sync = new BlenderSync(b_engine, b_data, b_scene, scene, !background, session->progress, session_params.device.type == DEVICE_CPU);
+	sync = new BlenderSync(b_engine, b_data, b_scene, scene, !background, session->progress, session_params.device.type == DEVICE_CPU, &subd_cache);
 
 	/* for final render we will do full data sync per render layer, only
 	 * do some basic syncing here, no objects or materials for speed */
@@ -378,6 +385,12 @@ void BlenderSession::render()
 			}
 		}
 
+		/* per pixel convergence information */
+		if(session_params.adaptive_sampling) {
+			Pass::add(PASS_ADAPTIVE_AUX_BUFFER, passes);
+			Pass::add(PASS_SAMPLE_COUNT, passes);
+		}
+
 		/* free result without merging */
 		end_render_result(b_engine, b_rr, true);
 
@@ -411,6 +424,16 @@ void BlenderSession::render()
 	session->write_render_tile_cb = NULL;
 	session->update_render_tile_cb = NULL;
 
+	/* memory breakdown of the frame for farm resource planning, set the
+	 * CYCLES_MEMORY_STATS environment variable to print it */
+	if(background && getenv("CYCLES_MEMORY_STATS")) {
+		string json = session->stats.mem_json("\t");
+
+		printf("{\n\t\"scene\": \"%s\",\n\t\"frame\": %d,\n\t\"memory\": %s\n}\n",
+			json_escape(b_scene.name()).c_str(), b_scene.frame_current(), json.c_str());
+		fflush(stdout);
+	}
+
 	/* free all memory used (host and device), so we wouldn't leave render
 	 * engine with extra memory allocated
 	 */
@@ -504,14 +527,15 @@ void BlenderSession::synchronize()
 		return;
 	}
 
-	/* data and camera synchronize */
-	sync->sync_data(b_v3d, b_engine.camera_override());
-
+	/* camera and data synchronize, camera first since subdivision meshes
+	 * are diced in its raster space */
 	if(b_rv3d)
 		sync->sync_view(b_v3d, b_rv3d, width, height);
 	else
 		sync->sync_camera(b_render, b_engine.camera_override(), width, height);
 
+	sync->sync_data(b_v3d, b_engine.camera_override());
+
 	/* unlock */
 	session->scene->mutex.unlock();
 
@@ -628,14 +652,23 @@ void BlenderSession::update_status_progress()
 	float progress;
 	double total_time;
 	char time_str[128];
-	float mem_used = (float)session->stats.mem_used / 1024.0f / 1024.0f;
-	float mem_peak = (float)session->stats.mem_peak / 1024.0f / 1024.0f;
+	Stats stats = session->stats.get_copy();
+	float mem_used = (float)stats.mem_used / 1024.0f / 1024.0f;
+	float mem_peak = (float)stats.mem_peak / 1024.0f / 1024.0f;
 
 	get_status(status, substatus);
 	get_progress(progress, total_time);
 
 	timestatus = string_printf("Mem:%.2fM, Peak:%.2fM", mem_used, mem_peak);
 
+	/* largest memory category, full breakdown is in memory_stats() */
+	if(stats.mem_used) {
+		MemoryCategory category = stats.mem_largest_category();
+		float mem_category = (float)stats.category_used[category] / 1024.0f / 1024.0f;
+
+		timestatus += string_printf(" (%s:%.2fM)", mem_category_name(category), mem_category);
+	}
+
 	if(background) {
 		timestatus += " | " + b_scene.name();
 		if(b_rlay_name != "")
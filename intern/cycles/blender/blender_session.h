@@ -21,6 +21,8 @@
 #include "scene.h"
 #include "session.h"
 
+#include "subd_mesh.h"
+
 #include "util_vector.h"
 
 CCL_NAMESPACE_BEGIN
@@ -75,6 +77,9 @@ public:
 	BlenderSync *sync;
 	double last_redraw_time;
 
+	/* tessellated subdivision meshes, kept between renders with persistent data */
+	SubdCache subd_cache;
+
 	BL::RenderEngine b_engine;
 	BL::UserPreferences b_userpref;
 	BL::BlendData b_data;
@@ -40,7 +40,7 @@ CCL_NAMESPACE_BEGIN
 
 /* Constructor */
 
-BlenderSync::BlenderSync(BL::RenderEngine b_engine_, BL::BlendData b_data_, BL::Scene b_scene_, Scene *scene_, bool preview_, Progress &progress_, bool is_cpu_)
+BlenderSync::BlenderSync(BL::RenderEngine b_engine_, BL::BlendData b_data_, BL::Scene b_scene_, Scene *scene_, bool preview_, Progress &progress_, bool is_cpu_, SubdCache *subd_cache_)
 : b_engine(b_engine_),
   b_data(b_data_), b_scene(b_scene_),
   shader_map(&scene_->shaders),
@@ -56,6 +56,7 @@ BlenderSync::BlenderSync(BL::RenderEngine b_engine_, BL::BlendData b_data_, BL::
 	scene = scene_;
 	preview = preview_;
 	is_cpu = is_cpu_;
+	subd_cache = subd_cache_;
 }
 
 BlenderSync::~BlenderSync()
@@ -217,6 +218,9 @@ void BlenderSync::sync_integrator()
 	}
 	
 
+	integrator->adaptive_threshold = get_float(cscene, "adaptive_threshold");
+	integrator->adaptive_min_samples = get_int(cscene, "adaptive_min_samples");
+
 	if(experimental)
 		integrator->sampling_pattern = (SamplingPattern)RNA_enum_get(&cscene, "sampling_pattern");
 
@@ -358,6 +362,9 @@ SceneParams BlenderSync::get_scene_params(BL::Scene b_scene, bool background)
 	else
 		params.persistent_data = false;
 
+	params.use_texture_cache = RNA_boolean_get(&cscene, "use_texture_cache");
+	params.texture_cache_size = RNA_int_get(&cscene, "texture_cache_size");
+
 	return params;
 }
 
@@ -486,6 +493,15 @@ SessionParams BlenderSync::get_session_params(BL::RenderEngine b_engine, BL::Use
 	else
 		params.progressive = true;
 
+	/* adaptive sampling needs all samples of a tile to be rendered at once,
+	 * and is only supported on the CPU */
+	params.adaptive_sampling = (!params.progressive && params.device.type == DEVICE_CPU &&
+	                            get_float(cscene, "adaptive_threshold") > 0.0f);
+
+	/* batched shading sorted by material, only implemented on the CPU */
+	params.sorted_shading = (params.device.type == DEVICE_CPU &&
+	                         get_boolean(cscene, "use_sorted_shading"));
+
 	/* shading system - scene level needs full refresh */
 	int shadingsystem = RNA_boolean_get(&cscene, "shading_system");
 
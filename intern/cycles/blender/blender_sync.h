@@ -45,10 +45,11 @@ class Scene;
 class Shader;
 class ShaderGraph;
 class ShaderNode;
+class SubdCache;
 
 class BlenderSync {
 public:
-	BlenderSync(BL::RenderEngine b_engine_, BL::BlendData b_data, BL::Scene b_scene, Scene *scene_, bool preview_, Progress &progress_, bool is_cpu_);
+	BlenderSync(BL::RenderEngine b_engine_, BL::BlendData b_data, BL::Scene b_scene, Scene *scene_, bool preview_, Progress &progress_, bool is_cpu_, SubdCache *subd_cache_ = NULL);
 	~BlenderSync();
 
 	/* sync */
@@ -116,6 +117,7 @@ private:
 	bool preview;
 	bool experimental;
 	bool is_cpu;
+	SubdCache *subd_cache;
 
 	struct RenderLayerInfo {
 		RenderLayerInfo()
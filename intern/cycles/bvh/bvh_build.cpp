@@ -107,15 +107,40 @@ void BVHBuild::add_reference_mesh(BoundBox& root, BoundBox& center, Mesh *mesh,
 			bounds.grow(lower, mr);
 			bounds.grow(upper, mr);
 
-			if(bounds.valid()) {
-				references.push_back(BVHReference(bounds, j, i, k));
-				root.grow(bounds);
-				center.grow(bounds.center2());
-			}
+			if(bounds.valid())
+				add_reference_curve(root, center, BVHReference(bounds, j, i, k), 0);
 		}
 	}
 }
 
+void BVHBuild::add_reference_curve(BoundBox& root, BoundBox& center, const BVHReference& ref, int depth)
+{
+	/* long diagonal hair segments have bounds that are mostly empty, split
+	 * them in the middle of the largest axis while that reduces the area
+	 * enough to be worth the extra references */
+	if(params.use_curve_split && depth < BVHParams::MAX_CURVE_SPLIT_DEPTH) {
+		const BoundBox& bounds = ref.bounds();
+		float3 size = bounds.size();
+		int dim = (size.x > size.y)? ((size.x > size.z)? 0: 2): ((size.y > size.z)? 1: 2);
+		float pos = 0.5f*(bounds.min[dim] + bounds.max[dim]);
+		BVHReference left, right;
+
+		BVHSpatialSplit::split_reference(this, left, right, ref, dim, pos);
+
+		if(left.bounds().valid() && right.bounds().valid() &&
+		   left.bounds().safe_area() + right.bounds().safe_area() < bounds.safe_area()*params.curve_split_threshold)
+		{
+			add_reference_curve(root, center, left, depth + 1);
+			add_reference_curve(root, center, right, depth + 1);
+			return;
+		}
+	}
+
+	references.push_back(ref);
+	root.grow(ref.bounds());
+	center.grow(ref.bounds().center2());
+}
+
 void BVHBuild::add_reference_object(BoundBox& root, BoundBox& center, Object *ob, int i)
 {
 	references.push_back(BVHReference(ob->bounds, -1, i, false));
@@ -290,6 +315,10 @@ BVHNode* BVHBuild::build_node(const BVHObjectBinning& range, int level)
 		/* make leaf node when threshold reached or SAH tells us */
 		if(params.small_enough_for_leaf(size, level) || (size <= params.max_leaf_size && leafSAH < splitSAH))
 			return create_leaf_node(range);
+
+		/* segments of one strand are adjacent, splitting them gains little */
+		if(size <= params.max_curve_leaf_size && range_within_curve(range))
+			return create_leaf_node(range);
 	}
 
 	/* perform split */
@@ -327,7 +356,9 @@ BVHNode* BVHBuild::build_node(const BVHRange& range, int level)
 
 	/* small enough or too deep => create leaf. */
 	if(!(range.size() > 0 && params.top_level && level == 0)) {
-		if(params.small_enough_for_leaf(range.size(), level)) {
+		if(params.small_enough_for_leaf(range.size(), level) ||
+		   (range.size() <= params.max_curve_leaf_size && range_within_curve(range)))
+		{
 			progress_count += range.size();
 			return create_leaf_node(range);
 		}
@@ -361,6 +392,25 @@ BVHNode* BVHBuild::build_node(const BVHRange& range, int level)
 	return new InnerNode(range.bounds(), leftnode, rightnode);
 }
 
+/* all references in the range are segments, or pieces of segments, of one strand */
+bool BVHBuild::range_within_curve(const BVHRange& range)
+{
+	const BVHReference& first = references[range.start()];
+
+	if(first.prim_index() == -1 || first.prim_segment() == ~0)
+		return false;
+
+	for(int i = 1; i < range.size(); i++) {
+		const BVHReference& ref = references[range.start() + i];
+
+		if(ref.prim_index() != first.prim_index() || ref.prim_object() != first.prim_object() ||
+		   ref.prim_segment() == ~0)
+			return false;
+	}
+
+	return true;
+}
+
 /* Create Nodes */
 
 BVHNode *BVHBuild::create_object_leaf_nodes(const BVHReference *ref, int start, int num)
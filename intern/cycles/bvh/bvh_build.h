@@ -61,6 +61,7 @@ protected:
 
 	/* adding references */
 	void add_reference_mesh(BoundBox& root, BoundBox& center, Mesh *mesh, int i);
+	void add_reference_curve(BoundBox& root, BoundBox& center, const BVHReference& ref, int depth);
 	void add_reference_object(BoundBox& root, BoundBox& center, Object *ob, int i);
 	void add_references(BVHRange& root);
 
@@ -68,6 +69,7 @@ protected:
 	BVHNode *build_node(const BVHRange& range, int level);
 	BVHNode *build_node(const BVHObjectBinning& range, int level);
 	BVHNode *create_leaf_node(const BVHRange& range);
+	bool range_within_curve(const BVHRange& range);
 	BVHNode *create_object_leaf_nodes(const BVHReference *ref, int start, int num);
 
 	/* threads */
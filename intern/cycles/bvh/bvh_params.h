@@ -31,6 +31,11 @@ public:
 	int use_spatial_split;
 	float spatial_split_alpha;
 
+	/* split curve segments into multiple references up front, when the
+	 * summed area of the pieces is below this fraction of the segment area */
+	int use_curve_split;
+	float curve_split_threshold;
+
 	/* SAH costs */
 	float sah_node_cost;
 	float sah_triangle_cost;
@@ -39,6 +44,9 @@ public:
 	int min_leaf_size;
 	int max_leaf_size;
 
+	/* segments of a single hair strand up to this number stay in one leaf */
+	int max_curve_leaf_size;
+
 	/* object or mesh level bvh */
 	int top_level;
 
@@ -54,6 +62,7 @@ public:
 	enum {
 		MAX_DEPTH = 64,
 		MAX_SPATIAL_DEPTH = 48,
+		MAX_CURVE_SPLIT_DEPTH = 3,
 		NUM_SPATIAL_BINS = 32
 	};
 
@@ -62,11 +71,15 @@ public:
 		use_spatial_split = true;
 		spatial_split_alpha = 1e-5f;
 
+		use_curve_split = true;
+		curve_split_threshold = 0.7f;
+
 		sah_node_cost = 1.0f;
 		sah_triangle_cost = 1.0f;
 
 		min_leaf_size = 1;
 		max_leaf_size = 8;
+		max_curve_leaf_size = 4;
 
 		top_level = false;
 		use_cache = false;
@@ -243,6 +243,26 @@ void BVHSpatialSplit::split(BVHBuild *builder, BVHRange& left, BVHRange& right,
 	right = BVHRange(right_bounds, right_start, right_end - right_start);
 }
 
+/* grow bounds by the part of the convex hull of points P below the plane at
+ * pos, or above it for sign -1 */
+static void hull_clip_bounds(BoundBox& bounds, const float3 *P, int num, int dim, float pos, float sign)
+{
+	for(int i = 0; i < num; i++) {
+		float pi = P[i][dim]*sign;
+
+		if(pi <= pos*sign)
+			bounds.grow(P[i]);
+
+		/* hull edge intersects the plane => insert intersection */
+		for(int j = i + 1; j < num; j++) {
+			float pj = P[j][dim]*sign;
+
+			if((pi < pos*sign && pj > pos*sign) || (pi > pos*sign && pj < pos*sign))
+				bounds.grow(lerp(P[i], P[j], clamp((pos*sign - pi) / (pj - pi), 0.0f, 1.0f)));
+		}
+	}
+}
+
 void BVHSpatialSplit::split_reference(BVHBuild *builder, BVHReference& left, BVHReference& right, const BVHReference& ref, int dim, float pos)
 {
 	/* initialize boundboxes */
@@ -281,33 +301,39 @@ void BVHSpatialSplit::split_reference(BVHBuild *builder, BVHReference& left, BVH
 		}
 	}
 	else {
-		/* curve split: NOTE - Currently ignores curve width and needs to be fixed.*/
-		const int k0 = mesh->curves[ref.prim_index()].first_key + ref.prim_segment();
-		const int k1 = k0 + 1;
-		const float3* v0 = &mesh->curve_keys[k0].co;
-		const float3* v1 = &mesh->curve_keys[k1].co;
-
-		float v0p = (*v0)[dim];
-		float v1p = (*v1)[dim];
-
-		/* insert vertex to the boxes it belongs to. */
-		if(v0p <= pos)
-			left_bounds.grow(*v0);
-
-		if(v0p >= pos)
-			right_bounds.grow(*v0);
-
-		if(v1p <= pos)
-			left_bounds.grow(*v1);
-
-		if(v1p >= pos)
-			right_bounds.grow(*v1);
+		/* curve split: the segment is contained in the convex hull of its
+		 * bezier control points, with the same tension as curvebounds() */
+		const Mesh::Curve& curve = mesh->curves[ref.prim_index()];
+		const int first = curve.first_key;
+		const int last = first + curve.num_keys - 1;
+		const int k = first + ref.prim_segment();
+		const float fc = 0.71f;
+
+		float3 p0 = mesh->curve_keys[max(k - 1, first)].co;
+		float3 p1 = mesh->curve_keys[k].co;
+		float3 p2 = mesh->curve_keys[k + 1].co;
+		float3 p3 = mesh->curve_keys[min(k + 2, last)].co;
+		float radius = max(mesh->curve_keys[k].radius, mesh->curve_keys[k + 1].radius);
+
+		float3 hull[4];
+		hull[0] = p1;
+		hull[1] = p1 + (p2 - p0)*(fc/3.0f);
+		hull[2] = p2 - (p3 - p1)*(fc/3.0f);
+		hull[3] = p2;
+
+		/* the curve width reaches radius over the plane, so clip the hull
+		 * further out and grow by the radius afterwards */
+		hull_clip_bounds(left_bounds, hull, 4, dim, pos + radius, 1.0f);
+		hull_clip_bounds(right_bounds, hull, 4, dim, pos - radius, -1.0f);
+
+		if(left_bounds.valid()) {
+			left_bounds.grow(left_bounds.min, radius);
+			left_bounds.grow(left_bounds.max, radius);
+		}
 
-		/* edge intersects the plane => insert intersection to both boxes. */
-		if((v0p < pos && v1p > pos) || (v0p > pos && v1p < pos)) {
-			float3 t = lerp(*v0, *v1, clamp((pos - v0p) / (v1p - v0p), 0.0f, 1.0f));
-			left_bounds.grow(t);
-			right_bounds.grow(t);
+		if(right_bounds.valid()) {
+			right_bounds.grow(right_bounds.min, radius);
+			right_bounds.grow(right_bounds.max, radius);
 		}
 	}
 
@@ -197,6 +197,37 @@ string Device::string_from_type(DeviceType type)
 	return "";
 }
 
+MemoryCategory Device::tex_memory_category(const char *name)
+{
+	/* prefixes of texture names in kernel_textures.h, the BVH also includes
+	 * the triangle data packed for intersection */
+	static const struct {
+		const char *prefix;
+		MemoryCategory category;
+	} categories[] = {
+		{"__bvh_", MEM_CATEGORY_BVH},
+		{"__tri_woop", MEM_CATEGORY_BVH},
+		{"__prim_", MEM_CATEGORY_BVH},
+		{"__object_node", MEM_CATEGORY_BVH},
+		{"__tri_", MEM_CATEGORY_TRIANGLES},
+		{"__curve", MEM_CATEGORY_CURVES},
+		{"__attributes_", MEM_CATEGORY_ATTRIBUTES},
+		{"__object", MEM_CATEGORY_OBJECTS},
+		{"__particles", MEM_CATEGORY_OBJECTS},
+		{"__tex_image", MEM_CATEGORY_IMAGES},
+		{"__svm_nodes", MEM_CATEGORY_SHADERS},
+		{"__shader_flag", MEM_CATEGORY_SHADERS},
+		{"__light", MEM_CATEGORY_LIGHTS},
+		{NULL, MEM_CATEGORY_OTHER}
+	};
+
+	for(int i = 0; categories[i].prefix; i++)
+		if(strncmp(name, categories[i].prefix, strlen(categories[i].prefix)) == 0)
+			return categories[i].category;
+
+	return MEM_CATEGORY_OTHER;
+}
+
 vector<DeviceType>& Device::available_types()
 {
 	static vector<DeviceType> types;
@@ -111,6 +111,9 @@ public:
 	/* open shading language, only for CPU device */
 	virtual void *osl_memory() { return NULL; }
 
+	/* texture cache for file images, only for CPU device */
+	virtual void *texture_cache_memory() { return NULL; }
+
 	/* load/compile kernels, must be called before adding tasks */ 
 	virtual bool load_kernels(bool experimental) { return true; }
 
@@ -139,6 +142,9 @@ public:
 	static string string_from_type(DeviceType type);
 	static vector<DeviceType>& available_types();
 	static vector<DeviceInfo>& available_devices();
+
+	/* memory statistics category of kernel texture */
+	static MemoryCategory tex_memory_category(const char *name);
 };
 
 CCL_NAMESPACE_END
@@ -28,6 +28,9 @@
 #include "osl_shader.h"
 #include "osl_globals.h"
 
+#include "kernel_texture_cache.h"
+#include "kernel_texture_cache_globals.h"
+
 #include "buffers.h"
 
 #include "util_debug.h"
@@ -48,12 +51,16 @@ public:
 #ifdef WITH_OSL
 	OSLGlobals osl_globals;
 #endif
+	TextureCacheGlobals texture_cache_globals;
 	
 	CPUDevice(Stats &stats) : Device(stats)
 	{
 #ifdef WITH_OSL
 		kernel_globals.osl = &osl_globals;
 #endif
+		kernel_globals.texture_cache = NULL;
+		kernel_globals.texture_cache_tdata = NULL;
+		kernel_globals.path_sort_batch = NULL;
 
 		/* do now to avoid thread issues */
 		system_cpu_support_sse2();
@@ -69,7 +76,7 @@ public:
 	{
 		mem.device_pointer = mem.data_pointer;
 
-		stats.mem_alloc(mem.memory_size());
+		stats.mem_alloc(mem.memory_size(), mem.stats_category, mem.stats_name);
 	}
 
 	void mem_copy_to(device_memory& mem)
@@ -91,7 +98,7 @@ public:
 	{
 		mem.device_pointer = 0;
 
-		stats.mem_free(mem.memory_size());
+		stats.mem_free(mem.memory_size(), mem.stats_category, mem.stats_name);
 	}
 
 	void const_copy_to(const char *name, void *host, size_t size)
@@ -101,17 +108,19 @@ public:
 
 	void tex_alloc(const char *name, device_memory& mem, bool interpolation, bool periodic)
 	{
+		mem.stats_category = tex_memory_category(name);
+
 		kernel_tex_copy(&kernel_globals, name, mem.data_pointer, mem.data_width, mem.data_height);
 		mem.device_pointer = mem.data_pointer;
 
-		stats.mem_alloc(mem.memory_size());
+		stats.mem_alloc(mem.memory_size(), mem.stats_category, mem.stats_name);
 	}
 
 	void tex_free(device_memory& mem)
 	{
 		mem.device_pointer = 0;
 
-		stats.mem_free(mem.memory_size());
+		stats.mem_free(mem.memory_size(), mem.stats_category, mem.stats_name);
 	}
 
 	void *osl_memory()
@@ -123,6 +132,11 @@ public:
 #endif
 	}
 
+	void *texture_cache_memory()
+	{
+		return &texture_cache_globals;
+	}
+
 	void thread_run(DeviceTask *task)
 	{
 		if(task->type == DeviceTask::PATH_TRACE)
@@ -142,6 +156,31 @@ public:
 		}
 	};
 
+	bool adaptive_sampling_converged(KernelGlobals *kg, RenderTile& tile)
+	{
+		return kernel_cpu_adaptive_stopping(kg, (float*)tile.buffer, tile.sample,
+			tile.x, tile.y, tile.w, tile.h, tile.offset, tile.stride);
+	}
+
+	void adaptive_sampling_finish(DeviceTask& task, KernelGlobals *kg, RenderTile& tile, int end_sample)
+	{
+		bool canceled = (task.get_cancel() || task_pool.canceled());
+
+		/* tile finished early because all pixels converged, skipped samples
+		 * still count towards the progress */
+		if(!canceled) {
+			while(tile.sample < end_sample) {
+				tile.sample++;
+
+				if(task.update_progress_sample)
+					task.update_progress_sample();
+			}
+		}
+
+		kernel_cpu_adaptive_post_adjust(kg, (float*)tile.buffer, tile.sample,
+			tile.x, tile.y, tile.w, tile.h, tile.offset, tile.stride);
+	}
+
 	void thread_path_trace(DeviceTask& task)
 	{
 		if(task_pool.canceled()) {
@@ -154,6 +193,7 @@ public:
 #ifdef WITH_OSL
 		OSLShader::thread_init(&kg, &kernel_globals, &osl_globals);
 #endif
+		TextureCache::thread_init(&kg, &texture_cache_globals);
 
 		RenderTile tile;
 		
@@ -171,16 +211,25 @@ public:
 							break;
 					}
 
-					for(int y = tile.y; y < tile.y + tile.h; y++) {
-						for(int x = tile.x; x < tile.x + tile.w; x++) {
-							kernel_cpu_sse3_path_trace(&kg, render_buffer, rng_state,
-								sample, x, y, tile.offset, tile.stride);
+					if(task.sorted_shading) {
+						kernel_cpu_sse3_path_trace_sorted(&kg, render_buffer, rng_state,
+							sample, tile.x, tile.y, tile.w, tile.h, tile.offset, tile.stride);
+					}
+					else {
+						for(int y = tile.y; y < tile.y + tile.h; y++) {
+							for(int x = tile.x; x < tile.x + tile.w; x++) {
+								kernel_cpu_sse3_path_trace(&kg, render_buffer, rng_state,
+									sample, x, y, tile.offset, tile.stride);
+							}
 						}
 					}
 
 					tile.sample = sample + 1;
 
 					task.update_progress(tile);
+
+					if(task.adaptive_sampling && adaptive_sampling_converged(&kg, tile))
+						break;
 				}
 			}
 			else if(system_cpu_support_sse2()) {
@@ -190,16 +239,25 @@ public:
 							break;
 					}
 
-					for(int y = tile.y; y < tile.y + tile.h; y++) {
-						for(int x = tile.x; x < tile.x + tile.w; x++) {
-							kernel_cpu_sse2_path_trace(&kg, render_buffer, rng_state,
-								sample, x, y, tile.offset, tile.stride);
+					if(task.sorted_shading) {
+						kernel_cpu_sse2_path_trace_sorted(&kg, render_buffer, rng_state,
+							sample, tile.x, tile.y, tile.w, tile.h, tile.offset, tile.stride);
+					}
+					else {
+						for(int y = tile.y; y < tile.y + tile.h; y++) {
+							for(int x = tile.x; x < tile.x + tile.w; x++) {
+								kernel_cpu_sse2_path_trace(&kg, render_buffer, rng_state,
+									sample, x, y, tile.offset, tile.stride);
+							}
 						}
 					}
 
 					tile.sample = sample + 1;
 
 					task.update_progress(tile);
+
+					if(task.adaptive_sampling && adaptive_sampling_converged(&kg, tile))
+						break;
 				}
 			}
 			else
@@ -211,19 +269,31 @@ public:
 							break;
 					}
 
-					for(int y = tile.y; y < tile.y + tile.h; y++) {
-						for(int x = tile.x; x < tile.x + tile.w; x++) {
-							kernel_cpu_path_trace(&kg, render_buffer, rng_state,
-								sample, x, y, tile.offset, tile.stride);
+					if(task.sorted_shading) {
+						kernel_cpu_path_trace_sorted(&kg, render_buffer, rng_state,
+							sample, tile.x, tile.y, tile.w, tile.h, tile.offset, tile.stride);
+					}
+					else {
+						for(int y = tile.y; y < tile.y + tile.h; y++) {
+							for(int x = tile.x; x < tile.x + tile.w; x++) {
+								kernel_cpu_path_trace(&kg, render_buffer, rng_state,
+									sample, x, y, tile.offset, tile.stride);
+							}
 						}
 					}
 
 					tile.sample = sample + 1;
 
 					task.update_progress(tile);
+
+					if(task.adaptive_sampling && adaptive_sampling_converged(&kg, tile))
+						break;
 				}
 			}
 
+			if(task.adaptive_sampling)
+				adaptive_sampling_finish(task, &kg, tile, end_sample);
+
 			task.release_tile(tile);
 
 			if(task_pool.canceled()) {
@@ -235,6 +305,8 @@ public:
 #ifdef WITH_OSL
 		OSLShader::thread_free(&kg);
 #endif
+		TextureCache::thread_free(&kg);
+		kernel_cpu_path_trace_sorted_free(&kg);
 	}
 
 	void thread_film_convert(DeviceTask& task)
@@ -296,6 +368,7 @@ public:
 #ifdef WITH_OSL
 		OSLShader::thread_init(&kg, &kernel_globals, &osl_globals);
 #endif
+		TextureCache::thread_init(&kg, &texture_cache_globals);
 
 #ifdef WITH_OPTIMIZED_KERNEL
 		if(system_cpu_support_sse3()) {
@@ -328,6 +401,7 @@ public:
 #ifdef WITH_OSL
 		OSLShader::thread_free(&kg);
 #endif
+		TextureCache::thread_free(&kg);
 	}
 
 	void task_add(DeviceTask& task)
@@ -370,7 +370,7 @@ public:
 		size_t size = mem.memory_size();
 		cuda_assert(cuMemAlloc(&device_pointer, size))
 		mem.device_pointer = (device_ptr)device_pointer;
-		stats.mem_alloc(size);
+		stats.mem_alloc(size, mem.stats_category, mem.stats_name);
 		cuda_pop_context();
 	}
 
@@ -417,7 +417,7 @@ public:
 
 			mem.device_pointer = 0;
 
-			stats.mem_free(mem.memory_size());
+			stats.mem_free(mem.memory_size(), mem.stats_category, mem.stats_name);
 		}
 	}
 
@@ -435,6 +435,8 @@ public:
 
 	void tex_alloc(const char *name, device_memory& mem, bool interpolation, bool periodic)
 	{
+		mem.stats_category = tex_memory_category(name);
+
 		/* determine format */
 		CUarray_format_enum format;
 		size_t dsize = datatype_size(mem.data_type);
@@ -500,7 +502,7 @@ public:
 
 				mem.device_pointer = (device_ptr)handle;
 
-				stats.mem_alloc(size);
+				stats.mem_alloc(size, mem.stats_category, mem.stats_name);
 			}
 			else {
 				cuda_pop_context();
@@ -566,7 +568,7 @@ public:
 				tex_interp_map.erase(tex_interp_map.find(mem.device_pointer));
 				mem.device_pointer = 0;
 
-				stats.mem_free(mem.memory_size());
+				stats.mem_free(mem.memory_size(), mem.stats_category, mem.stats_name);
 			}
 			else {
 				tex_interp_map.erase(tex_interp_map.find(mem.device_pointer));
@@ -818,7 +820,7 @@ public:
 				mem.device_pointer = pmem.cuTexId;
 				pixel_mem_map[mem.device_pointer] = pmem;
 
-				stats.mem_alloc(mem.memory_size());
+				stats.mem_alloc(mem.memory_size(), mem.stats_category, mem.stats_name);
 
 				return;
 			}
@@ -875,7 +877,7 @@ public:
 				pixel_mem_map.erase(pixel_mem_map.find(mem.device_pointer));
 				mem.device_pointer = 0;
 
-				stats.mem_free(mem.memory_size());
+				stats.mem_free(mem.memory_size(), mem.stats_category, mem.stats_name);
 
 				return;
 			}
@@ -29,6 +29,8 @@
  * to and from. */
 
 #include "util_debug.h"
+#include "util_stats.h"
+#include "util_string.h"
 #include "util_types.h"
 #include "util_vector.h"
 
@@ -149,6 +151,11 @@ template<> struct device_type_traits<float4> {
 	static const int num_elements = 4;
 };
 
+template<> struct device_type_traits<half> {
+	static const DataType data_type = TYPE_HALF;
+	static const int num_elements = 1;
+};
+
 template<> struct device_type_traits<half4> {
 	static const DataType data_type = TYPE_HALF;
 	static const int num_elements = 4;
@@ -172,6 +179,11 @@ public:
 	/* device pointer */
 	device_ptr device_pointer;
 
+	/* memory statistics, textures get their category from the texture name,
+	 * the name is used to break down image memory */
+	MemoryCategory stats_category;
+	string stats_name;
+
 protected:
 	device_memory() {}
 	virtual ~device_memory() { assert(!device_pointer); }
@@ -198,6 +210,7 @@ public:
 		assert(data_elements > 0);
 
 		device_pointer = 0;
+		stats_category = MEM_CATEGORY_OTHER;
 	}
 
 	virtual ~device_vector() {}
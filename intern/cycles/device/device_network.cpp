@@ -31,6 +31,10 @@ public:
 	tcp::socket socket;
 	device_ptr mem_counter;
 	DeviceTask the_task; /* todo: handle multiple tasks */
+	bool compress;
+
+	/* tile buffers whose contents the server sent along with the released tile */
+	set<device_ptr> pushed_buffers;
 
 	NetworkDevice(Stats &stats, const char *address)
 	: Device(stats), socket(io_service)
@@ -54,6 +58,11 @@ public:
 			throw boost::system::system_error(error);
 
 		mem_counter = 0;
+		compress = (getenv("CYCLES_NETWORK_COMPRESSION") != NULL);
+
+		RPCSend snd(socket, "compression");
+		snd.add(compress);
+		snd.write();
 	}
 
 	~NetworkDevice()
@@ -73,17 +82,47 @@ public:
 		snd.write();
 	}
 
+	network_hash_t buffer_hash(device_memory& mem)
+	{
+		size_t size = mem.memory_size();
+
+		if(size < NETWORK_CACHE_MIN_SIZE)
+			return 0;
+
+		return network_buffer_hash((void*)mem.data_pointer, size);
+	}
+
+	void send_buffer(RPCSend& snd, device_memory& mem, network_hash_t hash)
+	{
+		/* server replies if it has the contents in its cache already */
+		if(hash) {
+			RPCReceive rcv(socket);
+
+			if(rcv.name == "buffer_cached")
+				return;
+		}
+
+		snd.write_data((void*)mem.data_pointer, mem.memory_size(), compress);
+	}
+
 	void mem_copy_to(device_memory& mem)
 	{
 		RPCSend snd(socket, "mem_copy_to");
+		network_hash_t hash = buffer_hash(mem);
 
 		snd.add(mem);
+		snd.add(hash);
 		snd.write();
-		snd.write_buffer((void*)mem.data_pointer, mem.memory_size());
+
+		send_buffer(snd, mem, hash);
 	}
 
 	void mem_copy_from(device_memory& mem, int y, int w, int h, int elem)
 	{
+		/* already received with the tile */
+		if(pushed_buffers.erase(mem.device_pointer))
+			return;
+
 		RPCSend snd(socket, "mem_copy_from");
 
 		snd.add(mem);
@@ -94,7 +133,7 @@ public:
 		snd.write();
 
 		RPCReceive rcv(socket);
-		rcv.read_buffer((void*)mem.data_pointer, mem.memory_size());
+		rcv.read_data((void*)mem.data_pointer, mem.memory_size());
 	}
 
 	void mem_zero(device_memory& mem)
@@ -108,6 +147,8 @@ public:
 	void mem_free(device_memory& mem)
 	{
 		if(mem.device_pointer) {
+			pushed_buffers.erase(mem.device_pointer);
+
 			RPCSend snd(socket, "mem_free");
 
 			snd.add(mem);
@@ -134,6 +175,7 @@ public:
 		mem.device_pointer = ++mem_counter;
 
 		RPCSend snd(socket, "tex_alloc");
+		network_hash_t hash = buffer_hash(mem);
 
 		string name_string(name);
 
@@ -141,8 +183,10 @@ public:
 		snd.add(mem);
 		snd.add(interpolation);
 		snd.add(periodic);
+		snd.add(hash);
 		snd.write();
-		snd.write_buffer((void*)mem.data_pointer, mem.memory_size());
+
+		send_buffer(snd, mem, hash);
 	}
 
 	void tex_free(device_memory& mem)
@@ -183,8 +227,14 @@ public:
 				if(the_task.acquire_tile(this, tile)) { /* write return as bool */
 					the_tiles.push_back(tile);
 
+					/* tiles with their own buffers get the result sent along
+					 * when released, avoiding another round trip */
+					bool push_buffer = (tile.buffers->params.width == tile.w &&
+					                    tile.buffers->params.height == tile.h);
+
 					RPCSend snd(socket, "acquire_tile");
 					snd.add(tile);
+					snd.add(push_buffer);
 					snd.write();
 				}
 				else {
@@ -193,7 +243,10 @@ public:
 				}
 			}
 			else if(rcv.name == "release_tile") {
+				bool pushed;
+
 				rcv.read(tile);
+				rcv.read(pushed);
 
 				for(list<RenderTile>::iterator it = the_tiles.begin(); it != the_tiles.end(); it++) {
 					if(tile.x == it->x && tile.y == it->y && tile.start_sample == it->start_sample) {
@@ -205,10 +258,25 @@ public:
 
 				assert(tile.buffers != NULL);
 
-				the_task.release_tile(tile);
+				if(pushed) {
+					device_memory& mem = tile.buffers->buffer;
 
-				RPCSend snd(socket, "release_tile");
-				snd.write();
+					rcv.read_data((void*)mem.data_pointer, mem.memory_size());
+					pushed_buffers.insert(mem.device_pointer);
+
+					/* let the server continue rendering while the tile is
+					 * written, writing doesn't need any replies from it */
+					RPCSend snd(socket, "release_tile");
+					snd.write();
+
+					the_task.release_tile(tile);
+				}
+				else {
+					the_task.release_tile(tile);
+
+					RPCSend snd(socket, "release_tile");
+					snd.write();
+				}
 			}
 			else if(rcv.name == "task_wait_done")
 				break;
@@ -241,10 +309,75 @@ void device_network_info(vector<DeviceInfo>& devices)
 	devices.push_back(info);
 }
 
+/* Buffers received by the server, by hash of their contents. Least recently
+ * used buffers are removed when over the maximum size. */
+
+class NetworkBufferCache {
+public:
+	NetworkBufferCache(size_t max_size_)
+	: max_size(max_size_), total_size(0), time(0)
+	{
+	}
+
+	bool lookup(network_hash_t hash, void *buffer, size_t size)
+	{
+		map<network_hash_t, Entry>::iterator it = entries.find(hash);
+
+		if(it == entries.end() || it->second.data.size() != size)
+			return false;
+
+		if(size)
+			memcpy(buffer, &it->second.data[0], size);
+		it->second.last_used = ++time;
+
+		return true;
+	}
+
+	void insert(network_hash_t hash, void *buffer, size_t size)
+	{
+		if(size > max_size || entries.find(hash) != entries.end())
+			return;
+
+		while(total_size + size > max_size)
+			remove_least_recently_used();
+
+		Entry& entry = entries[hash];
+		entry.data.resize(size);
+		if(size)
+			memcpy(&entry.data[0], buffer, size);
+		entry.last_used = ++time;
+
+		total_size += size;
+	}
+
+protected:
+	void remove_least_recently_used()
+	{
+		map<network_hash_t, Entry>::iterator it, oldest = entries.begin();
+
+		for(it = entries.begin(); it != entries.end(); it++)
+			if(it->second.last_used < oldest->second.last_used)
+				oldest = it;
+
+		total_size -= oldest->second.data.size();
+		entries.erase(oldest);
+	}
+
+	struct Entry {
+		vector<uint8_t> data;
+		uint64_t last_used;
+	};
+
+	map<network_hash_t, Entry> entries;
+	size_t max_size;
+	size_t total_size;
+	uint64_t time;
+};
+
 class DeviceServer {
 public:
-	DeviceServer(Device *device_, tcp::socket& socket_)
-	: device(device_), socket(socket_)
+	DeviceServer(Device *device_, tcp::socket& socket_, NetworkBufferCache& cache_)
+	: device(device_), socket(socket_), cache(cache_), compress(false)
 	{
 	}
 
@@ -262,11 +395,33 @@ public:
 	}
 
 protected:
+	void receive_buffer(RPCReceive& rcv, network_hash_t hash, void *buffer, size_t size)
+	{
+		if(hash) {
+			if(cache.lookup(hash, buffer, size)) {
+				RPCSend snd(socket, "buffer_cached");
+				snd.write();
+				return;
+			}
+
+			RPCSend snd(socket, "buffer_missing");
+			snd.write();
+		}
+
+		rcv.read_data(buffer, size);
+
+		if(hash)
+			cache.insert(hash, buffer, size);
+	}
+
 	void process(RPCReceive& rcv)
 	{
 		// fprintf(stderr, "receive process %s\n", rcv.name.c_str());
 
-		if(rcv.name == "mem_alloc") {
+		if(rcv.name == "compression") {
+			rcv.read(compress);
+		}
+		else if(rcv.name == "mem_alloc") {
 			MemoryType type;
 			network_device_memory mem;
 			device_ptr remote_pointer;
@@ -292,13 +447,15 @@ protected:
 		}
 		else if(rcv.name == "mem_copy_to") {
 			network_device_memory mem;
+			network_hash_t hash;
 
 			rcv.read(mem);
+			rcv.read(hash);
 
 			device_ptr remote_pointer = mem.device_pointer;
 			mem.data_pointer = (device_ptr)&(mem_data[remote_pointer][0]);
 
-			rcv.read_buffer((uint8_t*)mem.data_pointer, mem.memory_size());
+			receive_buffer(rcv, hash, (uint8_t*)mem.data_pointer, mem.memory_size());
 
 			mem.device_pointer = ptr_map[remote_pointer];
 
@@ -322,7 +479,7 @@ protected:
 
 			RPCSend snd(socket);
 			snd.write();
-			snd.write_buffer((uint8_t*)mem.data_pointer, mem.memory_size());
+			snd.write_data((uint8_t*)mem.data_pointer, mem.memory_size(), compress);
 		}
 		else if(rcv.name == "mem_zero") {
 			network_device_memory mem;
@@ -345,6 +502,7 @@ protected:
 			ptr_map.erase(remote_pointer);
 			ptr_imap.erase(mem.device_pointer);
 			mem_data.erase(remote_pointer);
+			push_buffers.erase(mem.device_pointer);
 
 			device->mem_free(mem);
 		}
@@ -365,12 +523,14 @@ protected:
 			string name;
 			bool interpolation;
 			bool periodic;
+			network_hash_t hash;
 			device_ptr remote_pointer;
 
 			rcv.read(name);
 			rcv.read(mem);
 			rcv.read(interpolation);
 			rcv.read(periodic);
+			rcv.read(hash);
 
 			remote_pointer = mem.device_pointer;
 
@@ -381,7 +541,7 @@ protected:
 			else
 				mem.data_pointer = 0;
 
-			rcv.read_buffer((uint8_t*)mem.data_pointer, mem.memory_size());
+			receive_buffer(rcv, hash, (uint8_t*)mem.data_pointer, mem.memory_size());
 
 			device->tex_alloc(name.c_str(), mem, interpolation, periodic);
 
@@ -445,11 +605,17 @@ protected:
 			RPCReceive rcv(socket);
 
 			if(rcv.name == "acquire_tile") {
+				bool push_buffer;
+
 				rcv.read(tile);
+				rcv.read(push_buffer);
 
 				if(tile.buffer) tile.buffer = ptr_map[tile.buffer];
 				if(tile.rng_state) tile.rng_state = ptr_map[tile.rng_state];
 
+				if(push_buffer)
+					push_buffers.insert(tile.buffer);
+
 				result = true;
 				break;
 			}
@@ -476,13 +642,36 @@ protected:
 	{
 		thread_scoped_lock acquire_lock(acquire_mutex);
 
+		device_ptr buffer = tile.buffer;
+		bool push_buffer = (push_buffers.erase(buffer) != 0);
+
 		if(tile.buffer) tile.buffer = ptr_imap[tile.buffer];
 		if(tile.rng_state) tile.rng_state = ptr_imap[tile.rng_state];
 
 		RPCSend snd(socket, "release_tile");
 		snd.add(tile);
+		snd.add(push_buffer);
 		snd.write();
 
+		/* send the result with the tile, instead of waiting for the client to
+		 * request it */
+		if(push_buffer) {
+			vector<uint8_t>& data = mem_data[tile.buffer];
+			network_device_memory mem;
+
+			mem.data_type = TYPE_UCHAR;
+			mem.data_elements = 1;
+			mem.data_size = data.size();
+			mem.data_width = data.size();
+			mem.data_height = 0;
+			mem.data_pointer = (data.size())? (device_ptr)&data[0]: 0;
+			mem.device_pointer = buffer;
+
+			device->mem_copy_from(mem, 0, 1, 1, mem.memory_size());
+
+			snd.write_data((void*)mem.data_pointer, mem.memory_size(), compress);
+		}
+
 		while(1) {
 			RPCReceive rcv(socket);
 
@@ -501,12 +690,17 @@ protected:
 	/* properties */
 	Device *device;
 	tcp::socket& socket;
+	NetworkBufferCache& cache;
+	bool compress;
 
 	/* mapping of remote to local pointer */
 	map<device_ptr, device_ptr> ptr_map;
 	map<device_ptr, device_ptr> ptr_imap;
 	map<device_ptr, vector<uint8_t> > mem_data;
 
+	/* local pointers of tile buffers to send along with released tiles */
+	set<device_ptr> push_buffers;
+
 	thread_mutex acquire_mutex;
 
 	/* todo: free memory and device (osl) on network error */
@@ -518,6 +712,13 @@ void Device::server_run()
 		/* starts thread that responds to discovery requests */
 		ServerDiscovery discovery;
 
+		/* buffers are cached across connections, size in MB can be set with
+		 * the CYCLES_NETWORK_CACHE_SIZE environment variable */
+		const char *cache_size_str = getenv("CYCLES_NETWORK_CACHE_SIZE");
+		size_t cache_size = (cache_size_str)? atoi(cache_size_str): NETWORK_CACHE_DEFAULT_SIZE;
+
+		NetworkBufferCache cache(cache_size*1024*1024);
+
 		for(;;) {
 			/* accept connection */
 			boost::asio::io_service io_service;
@@ -529,7 +730,7 @@ void Device::server_run()
 			string remote_address = socket.remote_endpoint().address().to_string();
 			printf("Connected to remote client at: %s\n", remote_address.c_str());
 
-			DeviceServer server(this, socket);
+			DeviceServer server(this, socket, cache);
 			server.listen();
 
 			printf("Disconnected.\n");
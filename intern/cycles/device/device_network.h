@@ -29,11 +29,14 @@
 
 #include <iostream>
 
+#include <zlib.h>
+
 #include "buffers.h"
 
 #include "util_foreach.h"
 #include "util_list.h"
 #include "util_map.h"
+#include "util_set.h"
 #include "util_string.h"
 
 CCL_NAMESPACE_BEGIN
@@ -51,6 +54,46 @@ static const int DISCOVER_PORT = 5121;
 static const string DISCOVER_REQUEST_MSG = "REQUEST_RENDER_SERVER_IP";
 static const string DISCOVER_REPLY_MSG = "REPLY_RENDER_SERVER_IP";
 
+/* Buffer Transfer
+ *
+ * Buffers of at least NETWORK_CACHE_MIN_SIZE bytes are identified by a hash of
+ * their contents. Servers keep recently received buffers in a cache that
+ * persists across connections, so that rendering the next frame of an
+ * animation only transfers the arrays that changed. Buffer data may be zlib
+ * compressed, which is enabled on the client by setting the environment
+ * variable CYCLES_NETWORK_COMPRESSION. */
+
+#define NETWORK_CACHE_MIN_SIZE (64*1024)
+#define NETWORK_CACHE_DEFAULT_SIZE 1024 /* in MB */
+
+typedef uint64_t network_hash_t;
+
+static inline network_hash_t network_buffer_hash(const void *buffer, size_t size)
+{
+	/* FNV-1a over 64 bit words, with the remaining bytes hashed one by one */
+	const network_hash_t prime = 1099511628211ULL;
+	network_hash_t hash = 14695981039346656037ULL;
+
+	const uint8_t *data = (const uint8_t*)buffer;
+	size_t num_words = size/sizeof(uint64_t);
+
+	for(size_t i = 0; i < num_words; i++) {
+		uint64_t word;
+		memcpy(&word, data + i*sizeof(uint64_t), sizeof(uint64_t));
+
+		hash = (hash ^ word) * prime;
+		hash ^= hash >> 29;
+	}
+
+	for(size_t i = num_words*sizeof(uint64_t); i < size; i++)
+		hash = (hash ^ data[i]) * prime;
+
+	hash ^= (network_hash_t)size;
+
+	/* zero is reserved for buffers that are not cached */
+	return (hash)? hash: 1;
+}
+
 /* Serialization of device memory */
 
 class network_device_memory : public device_memory
@@ -104,7 +147,7 @@ public:
 	{
 		archive & tile.x & tile.y & tile.w & tile.h;
 		archive & tile.start_sample & tile.num_samples & tile.sample;
-		archive & tile.offset & tile.stride;
+		archive & tile.resolution & tile.offset & tile.stride;
 		archive & tile.buffer & tile.rng_state;
 	}
 
@@ -150,6 +193,34 @@ public:
 			cout << "Network send error: " << error.message() << "\n";
 	}
 
+	/* buffer data with a fixed size header holding the compressed size, or
+	 * zero if the data follows uncompressed */
+	void write_data(void *buffer, size_t size, bool compress)
+	{
+		vector<Bytef> compressed;
+		uLongf compressed_size = 0;
+
+		if(compress && size > 0) {
+			compressed.resize(compressBound(size));
+			compressed_size = compressed.size();
+
+			if(compress2(&compressed[0], &compressed_size, (const Bytef*)buffer, size, Z_BEST_SPEED) != Z_OK ||
+			   compressed_size >= size)
+				compressed_size = 0;
+		}
+
+		ostringstream header_stream;
+		header_stream << setw(16) << hex << (size_t)compressed_size;
+		string header_str = header_stream.str();
+
+		write_buffer((void*)header_str.c_str(), header_str.size());
+
+		if(compressed_size)
+			write_buffer(&compressed[0], compressed_size);
+		else
+			write_buffer(buffer, size);
+	}
+
 protected:
 	string name;
 	tcp::socket& socket;
@@ -229,13 +300,42 @@ public:
 			cout << "Network receive error: buffer size doesn't match expected size\n";
 	}
 
+	void read_data(void *buffer, size_t size)
+	{
+		vector<char> header(16);
+		read_buffer(&header[0], header.size());
+
+		string header_str(&header[0], header.size());
+		istringstream header_stream(header_str);
+		size_t compressed_size;
+
+		if(!(header_stream >> hex >> compressed_size)) {
+			cout << "Network receive error: can't decode data size from header\n";
+			return;
+		}
+
+		if(compressed_size == 0) {
+			read_buffer(buffer, size);
+			return;
+		}
+
+		vector<Bytef> compressed(compressed_size);
+		read_buffer(&compressed[0], compressed_size);
+
+		uLongf uncompressed_size = size;
+
+		if(uncompress((Bytef*)buffer, &uncompressed_size, &compressed[0], compressed_size) != Z_OK ||
+		   uncompressed_size != size)
+			cout << "Network receive error: can't decompress buffer\n";
+	}
+
 	void read(DeviceTask& task)
 	{
 		int type;
 
 		*archive & type & task.x & task.y & task.w & task.h;
 		*archive & task.rgba_byte & task.rgba_half & task.buffer & task.sample & task.num_samples;
-		*archive & task.resolution & task.offset & task.stride;
+		*archive & task.offset & task.stride;
 		*archive & task.shader_input & task.shader_output & task.shader_eval_type;
 		*archive & task.shader_x & task.shader_w;
 
@@ -247,7 +347,7 @@ public:
 		*archive & tile.x & tile.y & tile.w & tile.h;
 		*archive & tile.start_sample & tile.num_samples & tile.sample;
 		*archive & tile.resolution & tile.offset & tile.stride;
-		*archive & tile.buffer & tile.rng_state & tile.rgba_byte & tile.rgba_half;
+		*archive & tile.buffer & tile.rng_state;
 
 		tile.buffers = NULL;
 	}
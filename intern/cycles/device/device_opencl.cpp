@@ -824,7 +824,7 @@ public:
 
 		opencl_assert(ciErr);
 
-		stats.mem_alloc(size);
+		stats.mem_alloc(size, mem.stats_category, mem.stats_name);
 	}
 
 	void mem_copy_to(device_memory& mem)
@@ -859,7 +859,7 @@ public:
 			mem.device_pointer = 0;
 			opencl_assert(ciErr);
 
-			stats.mem_free(mem.memory_size());
+			stats.mem_free(mem.memory_size(), mem.stats_category, mem.stats_name);
 		}
 	}
 
@@ -884,6 +884,8 @@ public:
 
 	void tex_alloc(const char *name, device_memory& mem, bool interpolation, bool periodic)
 	{
+		mem.stats_category = tex_memory_category(name);
+
 		mem_alloc(mem, MEM_READ_ONLY);
 		mem_copy_to(mem);
 		assert(mem_map.find(name) == mem_map.end());
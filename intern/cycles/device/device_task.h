@@ -65,6 +65,8 @@ public:
 
 	bool need_finish_queue;
 	bool integrator_branched;
+	bool adaptive_sampling;
+	bool sorted_shading;
 protected:
 	double last_update_time;
 };
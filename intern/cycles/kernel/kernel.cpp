@@ -29,6 +29,15 @@ CCL_NAMESPACE_BEGIN
 
 /* Memory Copy */
 
+template<typename T> static void kernel_tex_image_copy(texture_image<T> *images, int num, int id, device_ptr mem, size_t width, size_t height)
+{
+	if(id >= 0 && id < num) {
+		images[id].data = (T*)mem;
+		images[id].width = width;
+		images[id].height = height;
+	}
+}
+
 void kernel_const_copy(KernelGlobals *kg, const char *name, void *host, size_t size)
 {
 	if(strcmp(name, "__data") == 0)
@@ -50,6 +59,23 @@ void kernel_tex_copy(KernelGlobals *kg, const char *name, device_ptr mem, size_t
 #define KERNEL_IMAGE_TEX(type, ttype, tname)
 #include "kernel_textures.h"
 
+	/* compact image types, before the prefixes of float4 and byte4 images */
+	else if(strstr(name, "__tex_image_half4")) {
+		int id = atoi(name + strlen("__tex_image_half4_"));
+		kernel_tex_image_copy(kg->texture_half4_images, TEX_NUM_HALF4_IMAGES_CPU, id - TEX_START_HALF4_CPU, mem, width, height);
+	}
+	else if(strstr(name, "__tex_image_float1")) {
+		int id = atoi(name + strlen("__tex_image_float1_"));
+		kernel_tex_image_copy(kg->texture_float1_images, TEX_NUM_FLOAT1_IMAGES_CPU, id - TEX_START_FLOAT1_CPU, mem, width, height);
+	}
+	else if(strstr(name, "__tex_image_byte1")) {
+		int id = atoi(name + strlen("__tex_image_byte1_"));
+		kernel_tex_image_copy(kg->texture_byte1_images, TEX_NUM_BYTE1_IMAGES_CPU, id - TEX_START_BYTE1_CPU, mem, width, height);
+	}
+	else if(strstr(name, "__tex_image_half1")) {
+		int id = atoi(name + strlen("__tex_image_half1_"));
+		kernel_tex_image_copy(kg->texture_half1_images, TEX_NUM_HALF1_IMAGES_CPU, id - TEX_START_HALF1_CPU, mem, width, height);
+	}
 	else if(strstr(name, "__tex_image_float")) {
 		texture_image_float4 *tex = NULL;
 		int id = atoi(name + strlen("__tex_image_float_"));
@@ -96,6 +122,39 @@ void kernel_cpu_path_trace(KernelGlobals *kg, float *buffer, unsigned int *rng_s
 		kernel_path_trace(kg, buffer, rng_state, sample, x, y, offset, stride);
 }
 
+void kernel_cpu_path_trace_sorted(KernelGlobals *kg, float *buffer, unsigned int *rng_state, int sample, int x, int y, int w, int h, int offset, int stride)
+{
+#ifdef __BRANCHED_PATH__
+	/* branched path splits into many paths per bounce, not batched */
+	if(kernel_data.integrator.branched) {
+		for(int py = y; py < y + h; py++)
+			for(int px = x; px < x + w; px++)
+				kernel_branched_path_trace(kg, buffer, rng_state, sample, px, py, offset, stride);
+	}
+	else
+#endif
+		kernel_path_trace_sorted(kg, buffer, rng_state, sample, x, y, w, h, offset, stride);
+}
+
+/* the batch is allocated with malloc by any of the kernel variants */
+void kernel_cpu_path_trace_sorted_free(KernelGlobals *kg)
+{
+	free(kg->path_sort_batch);
+	kg->path_sort_batch = NULL;
+}
+
+/* Adaptive Sampling */
+
+bool kernel_cpu_adaptive_stopping(KernelGlobals *kg, float *buffer, int sample, int x, int y, int w, int h, int offset, int stride)
+{
+	return kernel_adaptive_stopping(kg, buffer, sample, x, y, w, h, offset, stride);
+}
+
+void kernel_cpu_adaptive_post_adjust(KernelGlobals *kg, float *buffer, int sample, int x, int y, int w, int h, int offset, int stride)
+{
+	kernel_adaptive_post_adjust(kg, buffer, sample, x, y, w, h, offset, stride);
+}
+
 /* Film */
 
 void kernel_cpu_convert_to_byte(KernelGlobals *kg, uchar4 *rgba, float *buffer, float sample_scale, int x, int y, int offset, int stride)
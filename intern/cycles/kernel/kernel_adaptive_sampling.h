@@ -0,0 +1,181 @@
+/*
+ * Copyright 2011-2013 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+CCL_NAMESPACE_BEGIN
+
+/* Adaptive Sampling
+ *
+ * Every odd sample is accumulated a second time, weighted by two, in the
+ * auxiliary pass. The difference between this half buffer and the combined
+ * pass gives an estimate of the per pixel error, pixels below the noise
+ * threshold are marked converged in the w component and no longer sampled.
+ * The remaining samples of a tile then only go to the pixels that are still
+ * noisy, and tiles where all pixels converged are finished early. */
+
+__device_inline bool kernel_adaptive_pixel_converged(KernelGlobals *kg, __global float *buffer)
+{
+	if(!(kernel_data.film.pass_flag & PASS_ADAPTIVE_AUX_BUFFER))
+		return false;
+
+	return buffer[kernel_data.film.pass_adaptive_aux_buffer + 3] != 0.0f;
+}
+
+__device_inline void kernel_write_adaptive_sampling_passes(KernelGlobals *kg, __global float *buffer, int sample, float4 L)
+{
+	if(!(kernel_data.film.pass_flag & PASS_ADAPTIVE_AUX_BUFFER))
+		return;
+
+	__global float4 *aux = (__global float4*)(buffer + kernel_data.film.pass_adaptive_aux_buffer);
+
+	if(sample == 0)
+		*aux = make_float4(0.0f, 0.0f, 0.0f, 0.0f);
+	else if(sample & 1)
+		*aux = *aux + make_float4(2.0f*L.x, 2.0f*L.y, 2.0f*L.z, 0.0f);
+
+	kernel_write_pass_float(buffer + kernel_data.film.pass_sample_count, sample, 1.0f);
+}
+
+/* test if the pixel converged after sample samples were taken, using the error
+ * estimate from "A hierarchical automatic stopping condition for Monte Carlo
+ * global illumination", section 2.1 */
+__device bool kernel_adaptive_pixel_test(KernelGlobals *kg, __global float *buffer, int sample)
+{
+	float4 I = *((__global float4*)buffer);
+	float4 A = *((__global float4*)(buffer + kernel_data.film.pass_adaptive_aux_buffer));
+
+	/* small epsilon to avoid division by zero */
+	float error = (fabsf(I.x - A.x) + fabsf(I.y - A.y) + fabsf(I.z - A.z)) /
+	              (sample*0.0001f + sqrtf(fabsf(I.x + I.y + I.z)));
+
+	return (error < kernel_data.integrator.adaptive_threshold*(float)sample);
+}
+
+/* mark converged pixels in the tile, returns true if all pixels in the tile
+ * converged. pixels next to a pixel that did not converge are sampled further
+ * as well, so that sharp noise boundaries are avoided */
+__device bool kernel_adaptive_stopping(KernelGlobals *kg, __global float *buffer,
+	int sample, int tile_x, int tile_y, int tile_w, int tile_h, int offset, int stride)
+{
+	if(!(kernel_data.film.pass_flag & PASS_ADAPTIVE_AUX_BUFFER))
+		return false;
+	if(sample < kernel_data.integrator.adaptive_min_samples || (sample % ADAPTIVE_SAMPLING_STEP) != 0)
+		return false;
+
+	int pass_stride = kernel_data.film.pass_stride;
+	int aux_w = kernel_data.film.pass_adaptive_aux_buffer + 3;
+	bool all_converged = true;
+
+	/* per pixel test */
+	for(int y = tile_y; y < tile_y + tile_h; y++) {
+		for(int x = tile_x; x < tile_x + tile_w; x++) {
+			__global float *pixel = buffer + (offset + x + y*stride)*pass_stride;
+
+			if(pixel[aux_w] == 0.0f && kernel_adaptive_pixel_test(kg, pixel, sample))
+				pixel[aux_w] = 1.0f;
+		}
+	}
+
+	/* dilate unconverged pixels in x, then in y. neighbors are temporarily
+	 * marked with -1 so they don't spread any further themselves */
+	for(int y = tile_y; y < tile_y + tile_h; y++) {
+		for(int x = tile_x; x < tile_x + tile_w; x++) {
+			__global float *pixel = buffer + (offset + x + y*stride)*pass_stride;
+
+			if(pixel[aux_w] != 0.0f)
+				continue;
+
+			if(x > tile_x && pixel[aux_w - pass_stride] == 1.0f)
+				pixel[aux_w - pass_stride] = -1.0f;
+			if(x < tile_x + tile_w - 1 && pixel[aux_w + pass_stride] == 1.0f)
+				pixel[aux_w + pass_stride] = -1.0f;
+		}
+	}
+
+	for(int x = tile_x; x < tile_x + tile_w; x++) {
+		for(int y = tile_y; y < tile_y + tile_h; y++) {
+			__global float *pixel = buffer + (offset + x + y*stride)*pass_stride;
+
+			if(pixel[aux_w] != 0.0f)
+				continue;
+
+			if(y > tile_y && pixel[aux_w - stride*pass_stride] == 1.0f)
+				pixel[aux_w - stride*pass_stride] = -1.0f;
+			if(y < tile_y + tile_h - 1 && pixel[aux_w + stride*pass_stride] == 1.0f)
+				pixel[aux_w + stride*pass_stride] = -1.0f;
+		}
+	}
+
+	for(int y = tile_y; y < tile_y + tile_h; y++) {
+		for(int x = tile_x; x < tile_x + tile_w; x++) {
+			__global float *pixel = buffer + (offset + x + y*stride)*pass_stride;
+
+			if(pixel[aux_w] == -1.0f)
+				pixel[aux_w] = 0.0f;
+			if(pixel[aux_w] == 0.0f)
+				all_converged = false;
+		}
+	}
+
+	return all_converged;
+}
+
+/* pixels that stopped early have fewer samples than the rest of the tile,
+ * scale the accumulated passes as if they were rendered with all samples */
+__device void kernel_adaptive_post_adjust(KernelGlobals *kg, __global float *buffer,
+	int sample, int tile_x, int tile_y, int tile_w, int tile_h, int offset, int stride)
+{
+	int flag = kernel_data.film.pass_flag;
+
+	if(!(flag & PASS_ADAPTIVE_AUX_BUFFER))
+		return;
+
+	int pass_stride = kernel_data.film.pass_stride;
+	int aux = kernel_data.film.pass_adaptive_aux_buffer;
+	int sample_count = kernel_data.film.pass_sample_count;
+
+	for(int y = tile_y; y < tile_y + tile_h; y++) {
+		for(int x = tile_x; x < tile_x + tile_w; x++) {
+			__global float *pixel = buffer + (offset + x + y*stride)*pass_stride;
+			float pixel_samples = pixel[sample_count];
+
+			if(pixel_samples <= 0.0f || pixel_samples >= (float)sample)
+				continue;
+
+			float sample_multiplier = (float)sample/pixel_samples;
+
+			for(int i = 0; i < pass_stride; i++) {
+				/* passes written only once are not accumulated */
+				if((flag & PASS_DEPTH) && i == kernel_data.film.pass_depth)
+					continue;
+				if((flag & PASS_OBJECT_ID) && i == kernel_data.film.pass_object_id)
+					continue;
+				if((flag & PASS_MATERIAL_ID) && i == kernel_data.film.pass_material_id)
+					continue;
+				if(i >= aux && i < aux + 4)
+					continue;
+				if(i == sample_count)
+					continue;
+
+				pixel[i] *= sample_multiplier;
+			}
+
+			pixel[sample_count] = (float)sample;
+		}
+	}
+}
+
+CCL_NAMESPACE_END
+
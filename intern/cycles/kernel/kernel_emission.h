@@ -172,7 +172,17 @@ __device_noinline float3 indirect_primitive_emission(KernelGlobals *kg, ShaderDa
 #endif
 		/* multiple importance sampling, get triangle light pdf,
 		 * and compute weight with respect to BSDF pdf */
-		float pdf = triangle_light_pdf(kg, sd->Ng, sd->I, t);
+		float pdf;
+
+		if(light_tree_enabled(kg)) {
+			/* the tree probability depends on the point the ray came from */
+			float3 ray_P = sd->P + sd->I*t;
+			float area_pdf = light_tree_triangle_pdf(kg, sd->object, sd->prim, ray_P);
+			pdf = triangle_light_area_to_solid_angle_pdf(area_pdf, sd->Ng, sd->I, t);
+		}
+		else
+			pdf = triangle_light_pdf(kg, sd->Ng, sd->I, t);
+
 		float mis_weight = power_heuristic(bsdf_pdf, pdf);
 
 		return L*mis_weight;
@@ -186,7 +196,8 @@ __device_noinline float3 indirect_primitive_emission(KernelGlobals *kg, ShaderDa
 __device_noinline bool indirect_lamp_emission(KernelGlobals *kg, Ray *ray, int path_flag, float bsdf_pdf, float randt, float3 *emission, int bounce)
 {
 	LightSample ls;
-	int lamp = lamp_light_eval_sample(kg, randt);
+	float pick_pdf;
+	int lamp = lamp_light_eval_sample(kg, randt, ray->P, &pick_pdf);
 
 	if(lamp == ~0)
 		return false;
@@ -194,6 +205,9 @@ __device_noinline bool indirect_lamp_emission(KernelGlobals *kg, Ray *ray, int p
 	if(!lamp_light_eval(kg, lamp, ray->P, ray->D, ray->t, &ls))
 		return false;
 
+	if(light_tree_enabled(kg))
+		light_tree_lamp_adjust(kg, &ls, pick_pdf);
+
 #ifdef __PASSES__
 	/* use visibility flag to skip lights */
 	if(ls.shader & SHADER_EXCLUDE_ANY) {
@@ -211,7 +225,9 @@ __device_noinline bool indirect_lamp_emission(KernelGlobals *kg, Ray *ray, int p
 
 	if(!(path_flag & PATH_RAY_MIS_SKIP)) {
 		/* multiple importance sampling, get regular light pdf,
-		 * and compute weight with respect to BSDF pdf */
+		 * and compute weight with respect to BSDF pdf. the lamp was picked
+		 * here with the same probability as for light sampling from this
+		 * point, so it is left out of both pdfs */
 		float mis_weight = power_heuristic(bsdf_pdf, ls.pdf);
 		L *= mis_weight;
 	}
@@ -250,6 +266,12 @@ __device_noinline float3 indirect_background(KernelGlobals *kg, Ray *ray, int pa
 		/* multiple importance sampling, get background light pdf for ray
 		 * direction, and compute weight with respect to BSDF pdf */
 		float pdf = background_light_pdf(kg, ray->D);
+
+		/* light sampling picks the background from the light tree,
+		 * see light_tree_lamp_adjust */
+		if(light_tree_enabled(kg))
+			pdf *= kernel_data.integrator.light_tree_background_pdf*kernel_data.integrator.inv_pdf_lights;
+
 		float mis_weight = power_heuristic(bsdf_pdf, pdf);
 
 		return L*mis_weight;
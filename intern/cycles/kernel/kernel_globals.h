@@ -31,12 +31,20 @@ struct OSLThreadData;
 struct OSLShadingSystem;
 #endif
 
-#define MAX_BYTE_IMAGES   512
-#define MAX_FLOAT_IMAGES  5
+struct TextureCacheGlobals;
+struct TextureCacheThreadData;
+struct PathSortBatch;
+
+#define MAX_BYTE_IMAGES   TEX_NUM_BYTE4_IMAGES_CPU
+#define MAX_FLOAT_IMAGES  TEX_NUM_FLOAT4_IMAGES_CPU
 
 typedef struct KernelGlobals {
 	texture_image_uchar4 texture_byte_images[MAX_BYTE_IMAGES];
 	texture_image_float4 texture_float_images[MAX_FLOAT_IMAGES];
+	texture_image_half4 texture_half4_images[TEX_NUM_HALF4_IMAGES_CPU];
+	texture_image_float texture_float1_images[TEX_NUM_FLOAT1_IMAGES_CPU];
+	texture_image_uchar texture_byte1_images[TEX_NUM_BYTE1_IMAGES_CPU];
+	texture_image_half texture_half1_images[TEX_NUM_HALF1_IMAGES_CPU];
 
 #define KERNEL_TEX(type, ttype, name) ttype name;
 #define KERNEL_IMAGE_TEX(type, ttype, name)
@@ -52,8 +60,34 @@ typedef struct KernelGlobals {
 	OSLThreadData *osl_tdata;
 #endif
 
+	/* File images looked up through the texture cache rather than from the
+	 * image arrays above, NULL if not used. */
+	TextureCacheGlobals *texture_cache;
+	TextureCacheThreadData *texture_cache_tdata;
+
+	/* Per thread arrays for sorted path tracing, allocated on first use, too
+	 * large for the stack. */
+	PathSortBatch *path_sort_batch;
+
 } KernelGlobals;
 
+/* image slots are numbered consecutively over the arrays of each type */
+__device float4 kernel_tex_image_interp_cpu(KernelGlobals *kg, int id, float x, float y)
+{
+	if(id < TEX_START_BYTE4_CPU)
+		return kg->texture_float_images[id].interp(x, y);
+	else if(id < TEX_START_HALF4_CPU)
+		return kg->texture_byte_images[id - TEX_START_BYTE4_CPU].interp(x, y);
+	else if(id < TEX_START_FLOAT1_CPU)
+		return kg->texture_half4_images[id - TEX_START_HALF4_CPU].interp(x, y);
+	else if(id < TEX_START_BYTE1_CPU)
+		return kg->texture_float1_images[id - TEX_START_FLOAT1_CPU].interp(x, y);
+	else if(id < TEX_START_HALF1_CPU)
+		return kg->texture_byte1_images[id - TEX_START_BYTE1_CPU].interp(x, y);
+	else
+		return kg->texture_half1_images[id - TEX_START_HALF1_CPU].interp(x, y);
+}
+
 #endif
 
 /* For CUDA, constant memory textures must be globals, so we can't put them
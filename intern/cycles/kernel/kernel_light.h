@@ -457,10 +457,9 @@ __device void triangle_light_sample(KernelGlobals *kg, int prim, int object,
 	object_transform_light_sample(kg, ls, object, time);
 }
 
-__device float triangle_light_pdf(KernelGlobals *kg,
+__device float triangle_light_area_to_solid_angle_pdf(float pdf,
 	const float3 Ng, const float3 I, float t)
 {
-	float pdf = kernel_data.integrator.pdf_triangles;
 	float cos_pi = fabsf(dot(Ng, I));
 
 	if(cos_pi == 0.0f)
@@ -469,6 +468,12 @@ __device float triangle_light_pdf(KernelGlobals *kg,
 	return t*t*pdf/cos_pi;
 }
 
+__device float triangle_light_pdf(KernelGlobals *kg,
+	const float3 Ng, const float3 I, float t)
+{
+	return triangle_light_area_to_solid_angle_pdf(kernel_data.integrator.pdf_triangles, Ng, I, t);
+}
+
 /* Curve Light */
 
 #ifdef __HAIR__
@@ -515,14 +520,14 @@ __device void curve_segment_light_sample(KernelGlobals *kg, int prim, int object
 
 /* Light Distribution */
 
-__device int light_distribution_sample(KernelGlobals *kg, float randt)
+__device int light_distribution_sample_range(KernelGlobals *kg, float randt, int start, int num)
 {
 	/* this is basically std::upper_bound as used by pbrt, to find a point light or
 	 * triangle to emit from, proportional to area. a good improvement would be to
 	 * also sample proportional to power, though it's not so well defined with
 	 * OSL shaders. */
-	int first = 0;
-	int len = kernel_data.integrator.num_distribution + 1;
+	int first = start;
+	int len = num + 1;
 
 	while(len > 0) {
 		int half_len = len >> 1;
@@ -539,7 +544,251 @@ __device int light_distribution_sample(KernelGlobals *kg, float randt)
 
 	/* clamping should not be needed but float rounding errors seem to
 	 * make this fail on rare occasions */
-	return clamp(first-1, 0, kernel_data.integrator.num_distribution-1);
+	return clamp(first-1, start, start+num-1);
+}
+
+__device int light_distribution_sample(KernelGlobals *kg, float randt)
+{
+	return light_distribution_sample_range(kg, randt, 0, kernel_data.integrator.num_distribution);
+}
+
+/* Light Tree
+ *
+ * Hierarchy over the light distribution, picking emitters proportional to an
+ * estimate of their contribution at the shading point rather than only their
+ * area. Leaves are ranges of the distribution, either emissive triangles of one
+ * object or a single lamp. Distant and background lights have no position, they
+ * come after the tree and are picked with a fixed probability proportional to
+ * their estimated emission. */
+
+__device bool light_tree_enabled(KernelGlobals *kg)
+{
+	/* branched path samples lamps and mesh lights separately */
+	return kernel_data.integrator.use_light_tree && !kernel_data.integrator.branched;
+}
+
+__device float light_tree_node_importance(KernelGlobals *kg, int node, float3 P)
+{
+	float4 data0 = kernel_tex_fetch(__light_tree_nodes, node*LIGHT_TREE_NODE_SIZE + 0);
+	float4 data1 = kernel_tex_fetch(__light_tree_nodes, node*LIGHT_TREE_NODE_SIZE + 1);
+
+	float3 bmin = make_float3(data0.x, data0.y, data0.z);
+	float3 bmax = make_float3(data1.x, data1.y, data1.z);
+	float energy = data0.w;
+	float cos_theta_o = data1.w;
+
+	/* distance falloff from the bounds center, clamped to the bounds radius so
+	 * nodes containing the shading point are not infinitely important */
+	float3 D = P - 0.5f*(bmin + bmax);
+	float dist2 = len_squared(D);
+	float r2 = 0.25f*len_squared(bmax - bmin);
+	float importance = energy/max(max(dist2, r2), 1e-12f);
+
+	/* emitters facing away from the shading point, only when outside the bounds */
+	if(cos_theta_o > -1.0f && dist2 > r2) {
+		float4 data2 = kernel_tex_fetch(__light_tree_nodes, node*LIGHT_TREE_NODE_SIZE + 2);
+		float3 axis = make_float3(data2.x, data2.y, data2.z);
+
+		float dist = sqrtf(dist2);
+		float theta = safe_acosf(dot(axis, D)/dist);
+		float theta_o = safe_acosf(cos_theta_o);
+		float theta_u = safe_asinf(sqrtf(r2)/dist);
+		float theta_min = theta - theta_o - theta_u;
+
+		if(theta_min >= M_PI_2_F)
+			return 0.0f;
+		else if(theta_min > 0.0f)
+			importance *= cosf(theta_min);
+	}
+
+	return importance;
+}
+
+__device float light_tree_left_probability(KernelGlobals *kg, int left, int right, float3 P)
+{
+	float left_importance = light_tree_node_importance(kg, left, P);
+	float right_importance = light_tree_node_importance(kg, right, P);
+
+	if(left_importance + right_importance == 0.0f) {
+		/* all emitters face away, fall back to the emitted energy */
+		left_importance = kernel_tex_fetch(__light_tree_nodes, left*LIGHT_TREE_NODE_SIZE).w;
+		right_importance = kernel_tex_fetch(__light_tree_nodes, right*LIGHT_TREE_NODE_SIZE).w;
+
+		if(left_importance + right_importance == 0.0f)
+			return 0.5f;
+	}
+
+	return left_importance/(left_importance + right_importance);
+}
+
+/* probability of picking a distant or background light, the same at any point */
+__device float light_tree_inf_pdf(KernelGlobals *kg, int node)
+{
+	float share = kernel_tex_fetch(__light_tree_nodes, node*LIGHT_TREE_NODE_SIZE).w;
+	return (1.0f - kernel_data.integrator.light_tree_pdf)*share;
+}
+
+/* returns the index into the light distribution, with the probability of picking it in
+ * pick_pdf and the area of the leaf it was picked from, for triangles the area pdf is
+ * pick_pdf/leaf_area */
+__device int light_tree_sample(KernelGlobals *kg, float randt, float3 P, float *pick_pdf, float *leaf_area)
+{
+	float pdf_tree = kernel_data.integrator.light_tree_pdf;
+
+	if(randt >= pdf_tree) {
+		/* distant and background lights, few so a linear search is fine */
+		int num_inf = kernel_data.integrator.light_tree_num_inf;
+		int node = kernel_data.integrator.light_tree_inf_node;
+		float cdf = pdf_tree;
+
+		for(int i = 0; i < num_inf - 1; i++, node++) {
+			cdf += light_tree_inf_pdf(kg, node);
+
+			if(randt < cdf)
+				break;
+		}
+
+		*pick_pdf = light_tree_inf_pdf(kg, node);
+		*leaf_area = 1.0f;
+
+		return __float_as_int(kernel_tex_fetch(__light_tree_nodes, node*LIGHT_TREE_NODE_SIZE + 3).x);
+	}
+
+	/* descend into the child with the most expected contribution. randt is not
+	 * rescaled at each level, instead the interval [lo, hi) containing it is
+	 * narrowed, so deep trees do not accumulate rounding errors */
+	float pdf = pdf_tree;
+	float lo = 0.0f, hi = pdf_tree;
+	int node = 0;
+
+	while(true) {
+		int right = __float_as_int(kernel_tex_fetch(__light_tree_nodes, node*LIGHT_TREE_NODE_SIZE + 2).w);
+
+		if(right == -1)
+			break;
+
+		float left_pdf = light_tree_left_probability(kg, node + 1, right, P);
+		float split = lo + (hi - lo)*left_pdf;
+
+		if(randt < split) {
+			hi = split;
+			pdf *= left_pdf;
+			node = node + 1;
+		}
+		else {
+			lo = split;
+			pdf *= 1.0f - left_pdf;
+			node = right;
+		}
+	}
+
+	/* pick a triangle in the leaf proportional to area */
+	float4 data3 = kernel_tex_fetch(__light_tree_nodes, node*LIGHT_TREE_NODE_SIZE + 3);
+	int start = __float_as_int(data3.x);
+	int num = __float_as_int(data3.y);
+
+	*pick_pdf = pdf;
+	*leaf_area = data3.z;
+
+	if(num == 1)
+		return start;
+
+	float u = (hi > lo)? clamp((randt - lo)/(hi - lo), 0.0f, 1.0f): 0.5f;
+	float cdf_start = kernel_tex_fetch(__light_distribution, start).x;
+	float cdf_end = kernel_tex_fetch(__light_distribution, start + num).x;
+
+	return light_distribution_sample_range(kg, cdf_start + u*(cdf_end - cdf_start), start, num);
+}
+
+/* probability of picking a leaf node at P */
+__device float light_tree_node_pdf(KernelGlobals *kg, int target, float3 P)
+{
+	float pdf = kernel_data.integrator.light_tree_pdf;
+	int node = 0;
+
+	/* nodes are stored depth first, so the subtree of the right child starts at its index */
+	while(node != target) {
+		int right = __float_as_int(kernel_tex_fetch(__light_tree_nodes, node*LIGHT_TREE_NODE_SIZE + 2).w);
+		float left_pdf = light_tree_left_probability(kg, node + 1, right, P);
+
+		if(target >= right) {
+			pdf *= 1.0f - left_pdf;
+			node = right;
+		}
+		else {
+			pdf *= left_pdf;
+			node = node + 1;
+		}
+	}
+
+	return pdf;
+}
+
+/* area pdf of picking a triangle from P, for multiple importance sampling */
+__device float light_tree_triangle_pdf(KernelGlobals *kg, int object, int prim, float3 P)
+{
+	/* find the triangle, the distribution is sorted by object and primitive */
+	int first = 0;
+	int len = kernel_data.integrator.num_distribution - kernel_data.integrator.num_all_lights;
+
+	while(len > 0) {
+		int half_len = len >> 1;
+		int middle = first + half_len;
+		float4 l = kernel_tex_fetch(__light_distribution, middle);
+		int l_object = __float_as_int(l.w);
+		int l_prim = __float_as_int(l.y);
+
+		if(l_object < 0)
+			l_object = ~l_object;
+
+		if(l_object < object || (l_object == object && l_prim < prim)) {
+			first = middle + 1;
+			len = len - half_len - 1;
+		}
+		else {
+			len = half_len;
+		}
+	}
+
+	if(first == kernel_data.integrator.num_distribution - kernel_data.integrator.num_all_lights ||
+	   __float_as_int(kernel_tex_fetch(__light_distribution, first).y) != prim)
+		return 0.0f;
+
+	/* find the leaf containing it, leaves are sorted by their start in the distribution */
+	int leaf = 0;
+	len = kernel_data.integrator.light_tree_num_leaves;
+
+	while(len > 0) {
+		int half_len = len >> 1;
+		int middle = leaf + half_len;
+
+		if((int)kernel_tex_fetch(__light_tree_leaves, middle*2) <= first) {
+			leaf = middle + 1;
+			len = len - half_len - 1;
+		}
+		else {
+			len = half_len;
+		}
+	}
+
+	int node = kernel_tex_fetch(__light_tree_leaves, max(leaf - 1, 0)*2 + 1);
+	float area = kernel_tex_fetch(__light_tree_nodes, node*LIGHT_TREE_NODE_SIZE + 3).z;
+
+	if(area == 0.0f)
+		return 0.0f;
+
+	return light_tree_node_pdf(kg, node, P)/area;
+}
+
+/* lamps compensate for the probability of being picked in eval_fac, or in the pdf
+ * for background lights, replace the uniform probability by the one from the tree.
+ * pick_pdf of the background is light_tree_background_pdf, see indirect_background */
+__device void light_tree_lamp_adjust(KernelGlobals *kg, LightSample *ls, float pick_pdf)
+{
+	if(ls->type == LIGHT_BACKGROUND)
+		ls->pdf *= pick_pdf*kernel_data.integrator.inv_pdf_lights;
+	else
+		ls->eval_fac *= kernel_data.integrator.pdf_lights/pick_pdf;
 }
 
 /* Generic Light */
@@ -547,7 +796,20 @@ __device int light_distribution_sample(KernelGlobals *kg, float randt)
 __device void light_sample(KernelGlobals *kg, float randt, float randu, float randv, float time, float3 P, LightSample *ls)
 {
 	/* sample index */
-	int index = light_distribution_sample(kg, randt);
+	bool use_light_tree = light_tree_enabled(kg);
+	float pick_pdf = 1.0f, leaf_area = 1.0f;
+	int index;
+
+	if(use_light_tree) {
+		index = light_tree_sample(kg, randt, P, &pick_pdf, &leaf_area);
+
+		if(pick_pdf == 0.0f || leaf_area == 0.0f) {
+			ls->pdf = 0.0f;
+			return;
+		}
+	}
+	else
+		index = light_distribution_sample(kg, randt);
 
 	/* fetch light data */
 	float4 l = kernel_tex_fetch(__light_distribution, index);
@@ -568,12 +830,20 @@ __device void light_sample(KernelGlobals *kg, float randt, float randu, float ra
 
 		/* compute incoming direction, distance and pdf */
 		ls->D = normalize_len(ls->P - P, &ls->t);
-		ls->pdf = triangle_light_pdf(kg, ls->Ng, -ls->D, ls->t);
+
+		if(use_light_tree)
+			ls->pdf = triangle_light_area_to_solid_angle_pdf(pick_pdf/leaf_area, ls->Ng, -ls->D, ls->t);
+		else
+			ls->pdf = triangle_light_pdf(kg, ls->Ng, -ls->D, ls->t);
+
 		ls->shader |= __float_as_int(l.z) & (~SHADER_MASK);
 	}
 	else {
 		int lamp = -prim-1;
 		lamp_light_sample(kg, lamp, randu, randv, P, ls);
+
+		if(use_light_tree)
+			light_tree_lamp_adjust(kg, ls, pick_pdf);
 	}
 }
 
@@ -588,10 +858,22 @@ __device void light_select(KernelGlobals *kg, int index, float randu, float rand
 	lamp_light_sample(kg, index, randu, randv, P, ls);
 }
 
-__device int lamp_light_eval_sample(KernelGlobals *kg, float randt)
+__device int lamp_light_eval_sample(KernelGlobals *kg, float randt, float3 P, float *pick_pdf)
 {
 	/* sample index */
-	int index = light_distribution_sample(kg, randt);
+	int index;
+
+	if(light_tree_enabled(kg)) {
+		float leaf_area;
+		index = light_tree_sample(kg, randt, P, pick_pdf, &leaf_area);
+
+		if(*pick_pdf == 0.0f)
+			return ~0;
+	}
+	else {
+		index = light_distribution_sample(kg, randt);
+		*pick_pdf = kernel_data.integrator.pdf_lights;
+	}
 
 	/* fetch light data */
 	float4 l = kernel_tex_fetch(__light_distribution, index);
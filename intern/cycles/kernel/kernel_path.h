@@ -18,6 +18,10 @@
 #include "osl_shader.h"
 #endif
 
+#ifdef __KERNEL_CPU__
+#include "kernel_texture_cache.h"
+#endif
+
 #include "kernel_differential.h"
 #include "kernel_montecarlo.h"
 #include "kernel_projection.h"
@@ -34,6 +38,7 @@
 #include "kernel_light.h"
 #include "kernel_emission.h"
 #include "kernel_passes.h"
+#include "kernel_adaptive_sampling.h"
 #include "kernel_path_state.h"
 
 #ifdef __SUBSURFACE__
@@ -452,340 +457,391 @@ __device_inline bool kernel_path_integrate_lighting(KernelGlobals *kg, RNG *rng,
 
 #endif
 
-__device float4 kernel_path_integrate(KernelGlobals *kg, RNG *rng, int sample, Ray ray, __global float *buffer)
-{
-	/* initialize */
+/* Path integration is split into steps operating on PathIntegrateState, so that
+ * the same code can be used for tracing a single path at a time, and for the
+ * CPU integrator that intersects and shades batches of paths sorted by shader */
+
+typedef struct PathIntegrateState {
 	PathRadiance L;
-	float3 throughput = make_float3(1.0f, 1.0f, 1.0f);
-	float L_transparent = 0.0f;
+	float3 throughput;
+	float L_transparent;
 
-	path_radiance_init(&L, kernel_data.film.use_light_pass);
+	float min_ray_pdf;
+	float ray_pdf;
+	float ray_t;
 
-	float min_ray_pdf = FLT_MAX;
-	float ray_pdf = 0.0f;
-#ifdef __LAMP_MIS__
-	float ray_t = 0.0f;
-#endif
 	PathState state;
-	int rng_offset = PRNG_BASE_NUM;
+	int rng_offset;
+	int num_samples;
+
+	Ray ray;
+	Intersection isect;
+	bool hit;
+} PathIntegrateState;
+
+__device_inline void kernel_path_integrate_init(KernelGlobals *kg, PathIntegrateState *S, Ray *ray)
+{
+	S->throughput = make_float3(1.0f, 1.0f, 1.0f);
+	S->L_transparent = 0.0f;
+
+	path_radiance_init(&S->L, kernel_data.film.use_light_pass);
+
+	S->min_ray_pdf = FLT_MAX;
+	S->ray_pdf = 0.0f;
+	S->ray_t = 0.0f;
+	S->rng_offset = PRNG_BASE_NUM;
 #ifdef __CMJ__
-	int num_samples = kernel_data.integrator.aa_samples;
+	S->num_samples = kernel_data.integrator.aa_samples;
 #else
-	int num_samples = 0;
+	S->num_samples = 0;
 #endif
 
-	path_state_init(&state);
+	path_state_init(&S->state);
 
-	/* path iteration */
-	for(;; rng_offset += PRNG_BOUNCE_NUM) {
-		/* intersect scene */
-		Intersection isect;
-		uint visibility = path_state_ray_visibility(kg, &state);
-
-#ifdef __HAIR__
-		float difl = 0.0f, extmax = 0.0f;
-		uint lcg_state = 0;
+	S->ray = *ray;
+	S->hit = false;
+}
 
-		if(kernel_data.bvh.have_curves) {
-			if((kernel_data.cam.resolution == 1) && (state.flag & PATH_RAY_CAMERA)) {	
-				float3 pixdiff = ray.dD.dx + ray.dD.dy;
-				/*pixdiff = pixdiff - dot(pixdiff, ray.D)*ray.D;*/
-				difl = kernel_data.curve.minimum_width * len(pixdiff) * 0.5f;
-			}
+__device_inline void kernel_path_integrate_intersect(KernelGlobals *kg, RNG *rng, int sample, PathIntegrateState *S)
+{
+	/* intersect scene */
+	uint visibility = path_state_ray_visibility(kg, &S->state);
 
-			extmax = kernel_data.curve.maximum_width;
-			lcg_state = lcg_init(*rng + rng_offset + sample*0x51633e2d);
+#ifdef __HAIR__
+	float difl = 0.0f, extmax = 0.0f;
+	uint lcg_state = 0;
+
+	if(kernel_data.bvh.have_curves) {
+		if((kernel_data.cam.resolution == 1) && (S->state.flag & PATH_RAY_CAMERA)) {	
+			float3 pixdiff = S->ray.dD.dx + S->ray.dD.dy;
+			/*pixdiff = pixdiff - dot(pixdiff, ray.D)*ray.D;*/
+			difl = kernel_data.curve.minimum_width * len(pixdiff) * 0.5f;
 		}
 
-		bool hit = scene_intersect(kg, &ray, visibility, &isect, &lcg_state, difl, extmax);
+		extmax = kernel_data.curve.maximum_width;
+		lcg_state = lcg_init(*rng + S->rng_offset + sample*0x51633e2d);
+	}
+
+	S->hit = scene_intersect(kg, &S->ray, visibility, &S->isect, &lcg_state, difl, extmax);
 #else
-		bool hit = scene_intersect(kg, &ray, visibility, &isect);
+	S->hit = scene_intersect(kg, &S->ray, visibility, &S->isect);
 #endif
 
 #ifdef __LAMP_MIS__
-		if(kernel_data.integrator.use_lamp_mis && !(state.flag & PATH_RAY_CAMERA)) {
-			/* ray starting from previous non-transparent bounce */
-			Ray light_ray;
+	if(kernel_data.integrator.use_lamp_mis && !(S->state.flag & PATH_RAY_CAMERA)) {
+		/* ray starting from previous non-transparent bounce */
+		Ray light_ray;
 
-			light_ray.P = ray.P - ray_t*ray.D;
-			ray_t += isect.t;
-			light_ray.D = ray.D;
-			light_ray.t = ray_t;
-			light_ray.time = ray.time;
-			light_ray.dD = ray.dD;
-			light_ray.dP = ray.dP;
+		light_ray.P = S->ray.P - S->ray_t*S->ray.D;
+		S->ray_t += S->isect.t;
+		light_ray.D = S->ray.D;
+		light_ray.t = S->ray_t;
+		light_ray.time = S->ray.time;
+		light_ray.dD = S->ray.dD;
+		light_ray.dP = S->ray.dP;
 
-			/* intersect with lamp */
-			float light_t = path_rng_1D(kg, rng, sample, num_samples, rng_offset + PRNG_LIGHT);
-			float3 emission;
+		/* intersect with lamp */
+		float light_t = path_rng_1D(kg, rng, sample, S->num_samples, S->rng_offset + PRNG_LIGHT);
+		float3 emission;
 
-			if(indirect_lamp_emission(kg, &light_ray, state.flag, ray_pdf, light_t, &emission, state.bounce))
-				path_radiance_accum_emission(&L, throughput, emission, state.bounce);
-		}
+		if(indirect_lamp_emission(kg, &light_ray, S->state.flag, S->ray_pdf, light_t, &emission, S->state.bounce))
+			path_radiance_accum_emission(&S->L, S->throughput, emission, S->state.bounce);
+	}
 #endif
+}
 
-		if(!hit) {
-			/* eval background shader if nothing hit */
-			if(kernel_data.background.transparent && (state.flag & PATH_RAY_CAMERA)) {
-				L_transparent += average(throughput);
+/* shade the intersection found by kernel_path_integrate_intersect and set up
+ * the ray for the next bounce, returns false when the path is terminated */
+__device_inline bool kernel_path_integrate_shade(KernelGlobals *kg, RNG *rng, int sample, PathIntegrateState *S, __global float *buffer)
+{
+	PathRadiance *L = &S->L;
+	PathState *state = &S->state;
+	Ray *ray = &S->ray;
+	int num_samples = S->num_samples;
+	int rng_offset = S->rng_offset;
+
+	if(!S->hit) {
+		/* eval background shader if nothing hit */
+		if(kernel_data.background.transparent && (state->flag & PATH_RAY_CAMERA)) {
+			S->L_transparent += average(S->throughput);
 
 #ifdef __PASSES__
-				if(!(kernel_data.film.pass_flag & PASS_BACKGROUND))
+			if(!(kernel_data.film.pass_flag & PASS_BACKGROUND))
 #endif
-					break;
-			}
+				return false;
+		}
 
 #ifdef __BACKGROUND__
-			/* sample background shader */
-			float3 L_background = indirect_background(kg, &ray, state.flag, ray_pdf, state.bounce);
-			path_radiance_accum_background(&L, throughput, L_background, state.bounce);
+		/* sample background shader */
+		float3 L_background = indirect_background(kg, ray, state->flag, S->ray_pdf, state->bounce);
+		path_radiance_accum_background(L, S->throughput, L_background, state->bounce);
 #endif
 
-			break;
-		}
+		return false;
+	}
 
-		/* setup shading */
-		ShaderData sd;
-		shader_setup_from_ray(kg, &sd, &isect, &ray, state.bounce);
-		float rbsdf = path_rng_1D(kg, rng, sample, num_samples, rng_offset + PRNG_BSDF);
-		shader_eval_surface(kg, &sd, rbsdf, state.flag, SHADER_CONTEXT_MAIN);
+	/* setup shading */
+	ShaderData sd;
+	shader_setup_from_ray(kg, &sd, &S->isect, ray, state->bounce);
+	float rbsdf = path_rng_1D(kg, rng, sample, num_samples, rng_offset + PRNG_BSDF);
+	shader_eval_surface(kg, &sd, rbsdf, state->flag, SHADER_CONTEXT_MAIN);
 
-		/* holdout */
+	/* holdout */
 #ifdef __HOLDOUT__
-		if((sd.flag & (SD_HOLDOUT|SD_HOLDOUT_MASK)) && (state.flag & PATH_RAY_CAMERA)) {
-			if(kernel_data.background.transparent) {
-				float3 holdout_weight;
-				
-				if(sd.flag & SD_HOLDOUT_MASK)
-					holdout_weight = make_float3(1.0f, 1.0f, 1.0f);
-				else
-					holdout_weight = shader_holdout_eval(kg, &sd);
-
-				/* any throughput is ok, should all be identical here */
-				L_transparent += average(holdout_weight*throughput);
-			}
-
+	if((sd.flag & (SD_HOLDOUT|SD_HOLDOUT_MASK)) && (state->flag & PATH_RAY_CAMERA)) {
+		if(kernel_data.background.transparent) {
+			float3 holdout_weight;
+			
 			if(sd.flag & SD_HOLDOUT_MASK)
-				break;
+				holdout_weight = make_float3(1.0f, 1.0f, 1.0f);
+			else
+				holdout_weight = shader_holdout_eval(kg, &sd);
+
+			/* any throughput is ok, should all be identical here */
+			S->L_transparent += average(holdout_weight*S->throughput);
 		}
+
+		if(sd.flag & SD_HOLDOUT_MASK)
+			return false;
+	}
 #endif
 
-		/* holdout mask objects do not write data passes */
-		kernel_write_data_passes(kg, buffer, &L, &sd, sample, state.flag, throughput);
+	/* holdout mask objects do not write data passes */
+	kernel_write_data_passes(kg, buffer, L, &sd, sample, state->flag, S->throughput);
 
-		/* blurring of bsdf after bounces, for rays that have a small likelihood
-		 * of following this particular path (diffuse, rough glossy) */
-		if(kernel_data.integrator.filter_glossy != FLT_MAX) {
-			float blur_pdf = kernel_data.integrator.filter_glossy*min_ray_pdf;
+	/* blurring of bsdf after bounces, for rays that have a small likelihood
+	 * of following this particular path (diffuse, rough glossy) */
+	if(kernel_data.integrator.filter_glossy != FLT_MAX) {
+		float blur_pdf = kernel_data.integrator.filter_glossy*S->min_ray_pdf;
 
-			if(blur_pdf < 1.0f) {
-				float blur_roughness = sqrtf(1.0f - blur_pdf)*0.5f;
-				shader_bsdf_blur(kg, &sd, blur_roughness);
-			}
+		if(blur_pdf < 1.0f) {
+			float blur_roughness = sqrtf(1.0f - blur_pdf)*0.5f;
+			shader_bsdf_blur(kg, &sd, blur_roughness);
 		}
+	}
 
 #ifdef __EMISSION__
-		/* emission */
-		if(sd.flag & SD_EMISSION) {
-			/* todo: is isect.t wrong here for transparent surfaces? */
-			float3 emission = indirect_primitive_emission(kg, &sd, isect.t, state.flag, ray_pdf);
-			path_radiance_accum_emission(&L, throughput, emission, state.bounce);
-		}
+	/* emission */
+	if(sd.flag & SD_EMISSION) {
+		/* todo: is isect.t wrong here for transparent surfaces? */
+		float3 emission = indirect_primitive_emission(kg, &sd, S->isect.t, state->flag, S->ray_pdf);
+		path_radiance_accum_emission(L, S->throughput, emission, state->bounce);
+	}
 #endif
 
-		/* path termination. this is a strange place to put the termination, it's
-		 * mainly due to the mixed in MIS that we use. gives too many unneeded
-		 * shader evaluations, only need emission if we are going to terminate */
-		float probability = path_state_terminate_probability(kg, &state, throughput);
+	/* path termination. this is a strange place to put the termination, it's
+	 * mainly due to the mixed in MIS that we use. gives too many unneeded
+	 * shader evaluations, only need emission if we are going to terminate */
+	float probability = path_state_terminate_probability(kg, state, S->throughput);
 
-		if(probability == 0.0f) {
-			break;
-		}
-		else if(probability != 1.0f) {
-			float terminate = path_rng_1D(kg, rng, sample, num_samples, rng_offset + PRNG_TERMINATE);
+	if(probability == 0.0f) {
+		return false;
+	}
+	else if(probability != 1.0f) {
+		float terminate = path_rng_1D(kg, rng, sample, num_samples, rng_offset + PRNG_TERMINATE);
 
-			if(terminate >= probability)
-				break;
+		if(terminate >= probability)
+			return false;
 
-			throughput /= probability;
-		}
+		S->throughput /= probability;
+	}
 
 #ifdef __AO__
-		/* ambient occlusion */
-		if(kernel_data.integrator.use_ambient_occlusion || (sd.flag & SD_AO)) {
-			/* todo: solve correlation */
-			float bsdf_u, bsdf_v;
-			path_rng_2D(kg, rng, sample, num_samples, rng_offset + PRNG_BSDF_U, &bsdf_u, &bsdf_v);
+	/* ambient occlusion */
+	if(kernel_data.integrator.use_ambient_occlusion || (sd.flag & SD_AO)) {
+		/* todo: solve correlation */
+		float bsdf_u, bsdf_v;
+		path_rng_2D(kg, rng, sample, num_samples, rng_offset + PRNG_BSDF_U, &bsdf_u, &bsdf_v);
 
-			float ao_factor = kernel_data.background.ao_factor;
-			float3 ao_N;
-			float3 ao_bsdf = shader_bsdf_ao(kg, &sd, ao_factor, &ao_N);
-			float3 ao_D;
-			float ao_pdf;
-			float3 ao_alpha = shader_bsdf_alpha(kg, &sd);
+		float ao_factor = kernel_data.background.ao_factor;
+		float3 ao_N;
+		float3 ao_bsdf = shader_bsdf_ao(kg, &sd, ao_factor, &ao_N);
+		float3 ao_D;
+		float ao_pdf;
+		float3 ao_alpha = shader_bsdf_alpha(kg, &sd);
 
-			sample_cos_hemisphere(ao_N, bsdf_u, bsdf_v, &ao_D, &ao_pdf);
+		sample_cos_hemisphere(ao_N, bsdf_u, bsdf_v, &ao_D, &ao_pdf);
 
-			if(dot(sd.Ng, ao_D) > 0.0f && ao_pdf != 0.0f) {
-				Ray light_ray;
-				float3 ao_shadow;
+		if(dot(sd.Ng, ao_D) > 0.0f && ao_pdf != 0.0f) {
+			Ray light_ray;
+			float3 ao_shadow;
 
-				light_ray.P = ray_offset(sd.P, sd.Ng);
-				light_ray.D = ao_D;
-				light_ray.t = kernel_data.background.ao_distance;
+			light_ray.P = ray_offset(sd.P, sd.Ng);
+			light_ray.D = ao_D;
+			light_ray.t = kernel_data.background.ao_distance;
 #ifdef __OBJECT_MOTION__
-				light_ray.time = sd.time;
+			light_ray.time = sd.time;
 #endif
-				light_ray.dP = sd.dP;
-				light_ray.dD = differential3_zero();
+			light_ray.dP = sd.dP;
+			light_ray.dD = differential3_zero();
 
-				if(!shadow_blocked(kg, &state, &light_ray, &ao_shadow))
-					path_radiance_accum_ao(&L, throughput, ao_alpha, ao_bsdf, ao_shadow, state.bounce);
-			}
+			if(!shadow_blocked(kg, state, &light_ray, &ao_shadow))
+				path_radiance_accum_ao(L, S->throughput, ao_alpha, ao_bsdf, ao_shadow, state->bounce);
 		}
+	}
 #endif
 
 #ifdef __SUBSURFACE__
-		/* bssrdf scatter to a different location on the same object, replacing
-		 * the closures with a diffuse BSDF */
-		if(sd.flag & SD_BSSRDF) {
-			float bssrdf_probability;
-			ShaderClosure *sc = subsurface_scatter_pick_closure(kg, &sd, &bssrdf_probability);
-
-			/* modify throughput for picking bssrdf or bsdf */
-			throughput *= bssrdf_probability;
-
-			/* do bssrdf scatter step if we picked a bssrdf closure */
-			if(sc) {
-				uint lcg_state = lcg_init(*rng + rng_offset + sample*0x68bc21eb);
-
-				ShaderData bssrdf_sd[BSSRDF_MAX_HITS];
-				float bssrdf_u, bssrdf_v;
-				path_rng_2D(kg, rng, sample, num_samples, rng_offset + PRNG_BSDF_U, &bssrdf_u, &bssrdf_v);
-				int num_hits = subsurface_scatter_multi_step(kg, &sd, bssrdf_sd, state.flag, sc, &lcg_state, bssrdf_u, bssrdf_v, false);
-
-				/* compute lighting with the BSDF closure */
-				for(int hit = 0; hit < num_hits; hit++) {
-					float3 tp = throughput;
-					PathState hit_state = state;
-					Ray hit_ray = ray;
-					float hit_ray_t = ray_t;
-					float hit_ray_pdf = ray_pdf;
-					float hit_min_ray_pdf = min_ray_pdf;
-
-					hit_state.flag |= PATH_RAY_BSSRDF_ANCESTOR;
-					
-					if(kernel_path_integrate_lighting(kg, rng, sample, num_samples, &bssrdf_sd[hit],
-						&tp, &hit_min_ray_pdf, &hit_ray_pdf, &hit_state, rng_offset+PRNG_BOUNCE_NUM, &L, &hit_ray, &hit_ray_t)) {
-						kernel_path_indirect(kg, rng, sample, hit_ray, buffer,
-							tp, num_samples, num_samples,
-							hit_min_ray_pdf, hit_ray_pdf, hit_state, rng_offset+PRNG_BOUNCE_NUM*2, &L);
-
-						/* for render passes, sum and reset indirect light pass variables
-						 * for the next samples */
-						path_radiance_sum_indirect(&L);
-						path_radiance_reset_indirect(&L);
-					}
+	/* bssrdf scatter to a different location on the same object, replacing
+	 * the closures with a diffuse BSDF */
+	if(sd.flag & SD_BSSRDF) {
+		float bssrdf_probability;
+		ShaderClosure *sc = subsurface_scatter_pick_closure(kg, &sd, &bssrdf_probability);
+
+		/* modify throughput for picking bssrdf or bsdf */
+		S->throughput *= bssrdf_probability;
+
+		/* do bssrdf scatter step if we picked a bssrdf closure */
+		if(sc) {
+			uint lcg_state = lcg_init(*rng + rng_offset + sample*0x68bc21eb);
+
+			ShaderData bssrdf_sd[BSSRDF_MAX_HITS];
+			float bssrdf_u, bssrdf_v;
+			path_rng_2D(kg, rng, sample, num_samples, rng_offset + PRNG_BSDF_U, &bssrdf_u, &bssrdf_v);
+			int num_hits = subsurface_scatter_multi_step(kg, &sd, bssrdf_sd, state->flag, sc, &lcg_state, bssrdf_u, bssrdf_v, false);
+
+			/* compute lighting with the BSDF closure */
+			for(int hit = 0; hit < num_hits; hit++) {
+				float3 tp = S->throughput;
+				PathState hit_state = *state;
+				Ray hit_ray = *ray;
+				float hit_ray_t = S->ray_t;
+				float hit_ray_pdf = S->ray_pdf;
+				float hit_min_ray_pdf = S->min_ray_pdf;
+
+				hit_state.flag |= PATH_RAY_BSSRDF_ANCESTOR;
+				
+				if(kernel_path_integrate_lighting(kg, rng, sample, num_samples, &bssrdf_sd[hit],
+					&tp, &hit_min_ray_pdf, &hit_ray_pdf, &hit_state, rng_offset+PRNG_BOUNCE_NUM, L, &hit_ray, &hit_ray_t)) {
+					kernel_path_indirect(kg, rng, sample, hit_ray, buffer,
+						tp, num_samples, num_samples,
+						hit_min_ray_pdf, hit_ray_pdf, hit_state, rng_offset+PRNG_BOUNCE_NUM*2, L);
+
+					/* for render passes, sum and reset indirect light pass variables
+					 * for the next samples */
+					path_radiance_sum_indirect(L);
+					path_radiance_reset_indirect(L);
 				}
-				break;
 			}
+			return false;
 		}
+	}
 #endif
-		
-		/* The following code is the same as in kernel_path_integrate_lighting(),
-		   but for CUDA the function call is slower. */
+	
+	/* The following code is the same as in kernel_path_integrate_lighting(),
+	   but for CUDA the function call is slower. */
 #ifdef __EMISSION__
-		if(kernel_data.integrator.use_direct_light) {
-			/* sample illumination from lights to find path contribution */
-			if(sd.flag & SD_BSDF_HAS_EVAL) {
-				float light_t = path_rng_1D(kg, rng, sample, num_samples, rng_offset + PRNG_LIGHT);
+	if(kernel_data.integrator.use_direct_light) {
+		/* sample illumination from lights to find path contribution */
+		if(sd.flag & SD_BSDF_HAS_EVAL) {
+			float light_t = path_rng_1D(kg, rng, sample, num_samples, rng_offset + PRNG_LIGHT);
 #ifdef __MULTI_CLOSURE__
-				float light_o = 0.0f;
+			float light_o = 0.0f;
 #else
-				float light_o = path_rng_1D(kg, rng, sample, num_samples, rng_offset + PRNG_LIGHT_F);
+			float light_o = path_rng_1D(kg, rng, sample, num_samples, rng_offset + PRNG_LIGHT_F);
 #endif
-				float light_u, light_v;
-				path_rng_2D(kg, rng, sample, num_samples, rng_offset + PRNG_LIGHT_U, &light_u, &light_v);
+			float light_u, light_v;
+			path_rng_2D(kg, rng, sample, num_samples, rng_offset + PRNG_LIGHT_U, &light_u, &light_v);
 
-				Ray light_ray;
-				BsdfEval L_light;
-				bool is_lamp;
+			Ray light_ray;
+			BsdfEval L_light;
+			bool is_lamp;
 
 #ifdef __OBJECT_MOTION__
-				light_ray.time = sd.time;
+			light_ray.time = sd.time;
 #endif
 
-				if(direct_emission(kg, &sd, -1, light_t, light_o, light_u, light_v, &light_ray, &L_light, &is_lamp, state.bounce)) {
-					/* trace shadow ray */
-					float3 shadow;
+			if(direct_emission(kg, &sd, -1, light_t, light_o, light_u, light_v, &light_ray, &L_light, &is_lamp, state->bounce)) {
+				/* trace shadow ray */
+				float3 shadow;
 
-					if(!shadow_blocked(kg, &state, &light_ray, &shadow)) {
-						/* accumulate */
-						path_radiance_accum_light(&L, throughput, &L_light, shadow, 1.0f, state.bounce, is_lamp);
-					}
+				if(!shadow_blocked(kg, state, &light_ray, &shadow)) {
+					/* accumulate */
+					path_radiance_accum_light(L, S->throughput, &L_light, shadow, 1.0f, state->bounce, is_lamp);
 				}
 			}
 		}
+	}
 #endif
 
-		/* no BSDF? we can stop here */
-		if(!(sd.flag & SD_BSDF))
-			break;
+	/* no BSDF? we can stop here */
+	if(!(sd.flag & SD_BSDF))
+		return false;
 
-		/* sample BSDF */
-		float bsdf_pdf;
-		BsdfEval bsdf_eval;
-		float3 bsdf_omega_in;
-		differential3 bsdf_domega_in;
-		float bsdf_u, bsdf_v;
-		path_rng_2D(kg, rng, sample, num_samples, rng_offset + PRNG_BSDF_U, &bsdf_u, &bsdf_v);
-		int label;
+	/* sample BSDF */
+	float bsdf_pdf;
+	BsdfEval bsdf_eval;
+	float3 bsdf_omega_in;
+	differential3 bsdf_domega_in;
+	float bsdf_u, bsdf_v;
+	path_rng_2D(kg, rng, sample, num_samples, rng_offset + PRNG_BSDF_U, &bsdf_u, &bsdf_v);
+	int label;
 
-		label = shader_bsdf_sample(kg, &sd, bsdf_u, bsdf_v, &bsdf_eval,
-			&bsdf_omega_in, &bsdf_domega_in, &bsdf_pdf);
+	label = shader_bsdf_sample(kg, &sd, bsdf_u, bsdf_v, &bsdf_eval,
+		&bsdf_omega_in, &bsdf_domega_in, &bsdf_pdf);
 
-		if(bsdf_pdf == 0.0f || bsdf_eval_is_zero(&bsdf_eval))
-			break;
+	if(bsdf_pdf == 0.0f || bsdf_eval_is_zero(&bsdf_eval))
+		return false;
 
-		/* modify throughput */
-		path_radiance_bsdf_bounce(&L, &throughput, &bsdf_eval, bsdf_pdf, state.bounce, label);
+	/* modify throughput */
+	path_radiance_bsdf_bounce(L, &S->throughput, &bsdf_eval, bsdf_pdf, state->bounce, label);
 
-		/* set labels */
-		if(!(label & LABEL_TRANSPARENT)) {
-			ray_pdf = bsdf_pdf;
+	/* set labels */
+	if(!(label & LABEL_TRANSPARENT)) {
+		S->ray_pdf = bsdf_pdf;
 #ifdef __LAMP_MIS__
-			ray_t = 0.0f;
+		S->ray_t = 0.0f;
 #endif
-			min_ray_pdf = fminf(bsdf_pdf, min_ray_pdf);
-		}
+		S->min_ray_pdf = fminf(bsdf_pdf, S->min_ray_pdf);
+	}
 
-		/* update path state */
-		path_state_next(kg, &state, label);
+	/* update path state */
+	path_state_next(kg, state, label);
 
-		/* setup ray */
-		ray.P = ray_offset(sd.P, (label & LABEL_TRANSMIT)? -sd.Ng: sd.Ng);
-		ray.D = bsdf_omega_in;
+	/* setup ray */
+	ray->P = ray_offset(sd.P, (label & LABEL_TRANSMIT)? -sd.Ng: sd.Ng);
+	ray->D = bsdf_omega_in;
 
-		if(state.bounce == 0)
-			ray.t -= sd.ray_length; /* clipping works through transparent */
-		else
-			ray.t = FLT_MAX;
+	if(state->bounce == 0)
+		ray->t -= sd.ray_length; /* clipping works through transparent */
+	else
+		ray->t = FLT_MAX;
 
 #ifdef __RAY_DIFFERENTIALS__
-		ray.dP = sd.dP;
-		ray.dD = bsdf_domega_in;
+	ray->dP = sd.dP;
+	ray->dD = bsdf_domega_in;
 #endif
-	}
 
-	float3 L_sum = path_radiance_sum(kg, &L);
+	S->rng_offset += PRNG_BOUNCE_NUM;
+
+	return true;
+}
+
+__device_inline float4 kernel_path_integrate_finish(KernelGlobals *kg, int sample, PathIntegrateState *S, __global float *buffer)
+{
+	float3 L_sum = path_radiance_sum(kg, &S->L);
 
 #ifdef __CLAMP_SAMPLE__
-	path_radiance_clamp(&L, &L_sum, kernel_data.integrator.sample_clamp);
+	path_radiance_clamp(&S->L, &L_sum, kernel_data.integrator.sample_clamp);
 #endif
 
-	kernel_write_light_passes(kg, buffer, &L, sample);
+	kernel_write_light_passes(kg, buffer, &S->L, sample);
 
-	return make_float4(L_sum.x, L_sum.y, L_sum.z, 1.0f - L_transparent);
+	return make_float4(L_sum.x, L_sum.y, L_sum.z, 1.0f - S->L_transparent);
+}
+
+__device float4 kernel_path_integrate(KernelGlobals *kg, RNG *rng, int sample, Ray ray, __global float *buffer)
+{
+	PathIntegrateState S;
+
+	kernel_path_integrate_init(kg, &S, &ray);
+
+	/* path iteration */
+	do {
+		kernel_path_integrate_intersect(kg, rng, sample, &S);
+	} while(kernel_path_integrate_shade(kg, rng, sample, &S, buffer));
+
+	return kernel_path_integrate_finish(kg, sample, &S, buffer);
 }
 
 #ifdef __BRANCHED_PATH__
@@ -1206,6 +1262,10 @@ __device void kernel_path_trace(KernelGlobals *kg,
 	rng_state += index;
 	buffer += index*pass_stride;
 
+	/* skip pixels that already converged */
+	if(kernel_adaptive_pixel_converged(kg, buffer))
+		return;
+
 	/* initialize random numbers and ray */
 	RNG rng;
 	Ray ray;
@@ -1222,6 +1282,7 @@ __device void kernel_path_trace(KernelGlobals *kg,
 
 	/* accumulate result in output buffer */
 	kernel_write_pass_float4(buffer, sample, L);
+	kernel_write_adaptive_sampling_passes(kg, buffer, sample, L);
 
 	path_rng_end(kg, rng_state, rng);
 }
@@ -1238,6 +1299,10 @@ __device void kernel_branched_path_trace(KernelGlobals *kg,
 	rng_state += index;
 	buffer += index*pass_stride;
 
+	/* skip pixels that already converged */
+	if(kernel_adaptive_pixel_converged(kg, buffer))
+		return;
+
 	/* initialize random numbers and ray */
 	RNG rng;
 	Ray ray;
@@ -1254,10 +1319,194 @@ __device void kernel_branched_path_trace(KernelGlobals *kg,
 
 	/* accumulate result in output buffer */
 	kernel_write_pass_float4(buffer, sample, L);
+	kernel_write_adaptive_sampling_passes(kg, buffer, sample, L);
 
 	path_rng_end(kg, rng_state, rng);
 }
 #endif
 
-CCL_NAMESPACE_END
+#ifdef __KERNEL_CPU__
+
+/* Sorted Path Tracing
+ *
+ * Traces all pixels of a tile region for one sample as a batch: each bounce,
+ * the paths that are still active are intersected, sorted by the shader and
+ * object they hit, and then shaded in that order. Consecutive shader
+ * evaluations then mostly run the same SVM program on the same textures,
+ * which is more cache friendly than tracing one path at a time in scenes with
+ * many materials. The result is identical to kernel_path_trace. */
+
+#define PATH_SORT_BATCH_SIZE 256
+
+typedef struct PathSortItem {
+	int shader;
+	int object;
+	int index;
+} PathSortItem;
+
+/* arrays for one batch, kept in KernelGlobals since they take well over 100KB */
+typedef struct PathSortBatch {
+	PathIntegrateState S[PATH_SORT_BATCH_SIZE];
+	PathSortItem items[PATH_SORT_BATCH_SIZE];
+	RNG rng[PATH_SORT_BATCH_SIZE];
+	bool traced[PATH_SORT_BATCH_SIZE];
+	int2 pixels[PATH_SORT_BATCH_SIZE];
+} PathSortBatch;
+
+__device_inline void kernel_path_sort_key(KernelGlobals *kg, PathIntegrateState *S, PathSortItem *item)
+{
+	if(!S->hit) {
+		/* all misses evaluate the background shader */
+		item->shader = kernel_data.background.shader & SHADER_MASK;
+		item->object = ~0;
+		return;
+	}
+
+	Intersection *isect = &S->isect;
+	int prim = kernel_tex_fetch(__prim_index, isect->prim);
+	int shader;
+
+#ifdef __HAIR__
+	if(kernel_tex_fetch(__prim_segment, isect->prim) != ~0) {
+		float4 str = kernel_tex_fetch(__curves, prim);
+		shader = __float_as_int(str.z);
+	}
+	else
+#endif
+	{
+		float4 Ns = kernel_tex_fetch(__tri_normal, prim);
+		shader = __float_as_int(Ns.w);
+	}
+
+	item->shader = shader & SHADER_MASK;
+	item->object = (isect->object == ~0)? kernel_tex_fetch(__prim_object, isect->prim): isect->object;
+}
+
+__device_inline bool kernel_path_sort_less(const PathSortItem *a, const PathSortItem *b)
+{
+	if(a->shader != b->shader)
+		return a->shader < b->shader;
+	if(a->object != b->object)
+		return a->object < b->object;
+	return a->index < b->index;
+}
+
+__device void kernel_path_sort_items(PathSortItem *items, int num)
+{
+	/* insertion sort, batches are small and often already mostly sorted since
+	 * neighbouring pixels tend to hit the same material */
+	for(int i = 1; i < num; i++) {
+		PathSortItem item = items[i];
+		int j = i;
+
+		for(; j > 0 && kernel_path_sort_less(&item, &items[j-1]); j--)
+			items[j] = items[j-1];
+
+		items[j] = item;
+	}
+}
+
+__device void kernel_path_trace_sorted_batch(KernelGlobals *kg,
+	float *buffer, uint *rng_state, int sample,
+	PathSortBatch *batch, int num, int offset, int stride)
+{
+	PathIntegrateState *S = batch->S;
+	PathSortItem *items = batch->items;
+	RNG *rng = batch->rng;
+	bool *traced = batch->traced;
+	int2 *pixels = batch->pixels;
+	int pass_stride = kernel_data.film.pass_stride;
+	int num_active = 0;
+
+	/* setup camera rays */
+	for(int i = 0; i < num; i++) {
+		int index = offset + pixels[i].x + pixels[i].y*stride;
+		Ray ray;
+
+		kernel_path_trace_setup(kg, rng_state + index, sample, pixels[i].x, pixels[i].y, &rng[i], &ray);
+		kernel_path_integrate_init(kg, &S[i], &ray);
+
+		traced[i] = (ray.t != 0.0f);
+
+		if(traced[i])
+			items[num_active++].index = i;
+	}
+
+	/* bounce all active paths together */
+	while(num_active) {
+		for(int a = 0; a < num_active; a++) {
+			int i = items[a].index;
 
+			kernel_path_integrate_intersect(kg, &rng[i], sample, &S[i]);
+			kernel_path_sort_key(kg, &S[i], &items[a]);
+		}
+
+		kernel_path_sort_items(items, num_active);
+
+		int num_next = 0;
+
+		for(int a = 0; a < num_active; a++) {
+			int i = items[a].index;
+			int index = offset + pixels[i].x + pixels[i].y*stride;
+			float *pixel_buffer = buffer + index*pass_stride;
+
+			if(kernel_path_integrate_shade(kg, &rng[i], sample, &S[i], pixel_buffer))
+				items[num_next++].index = i;
+		}
+
+		num_active = num_next;
+	}
+
+	/* accumulate results in output buffer */
+	for(int i = 0; i < num; i++) {
+		int index = offset + pixels[i].x + pixels[i].y*stride;
+		float *pixel_buffer = buffer + index*pass_stride;
+		float4 L;
+
+		if(traced[i])
+			L = kernel_path_integrate_finish(kg, sample, &S[i], pixel_buffer);
+		else
+			L = make_float4(0.0f, 0.0f, 0.0f, 0.0f);
+
+		kernel_write_pass_float4(pixel_buffer, sample, L);
+		kernel_write_adaptive_sampling_passes(kg, pixel_buffer, sample, L);
+
+		path_rng_end(kg, rng_state + index, rng[i]);
+	}
+}
+
+__device void kernel_path_trace_sorted(KernelGlobals *kg,
+	float *buffer, uint *rng_state,
+	int sample, int sx, int sy, int sw, int sh, int offset, int stride)
+{
+	if(!kg->path_sort_batch)
+		kg->path_sort_batch = (PathSortBatch*)malloc(sizeof(PathSortBatch));
+
+	PathSortBatch *batch = kg->path_sort_batch;
+	int2 *pixels = batch->pixels;
+	int num = 0;
+
+	for(int y = sy; y < sy + sh; y++) {
+		for(int x = sx; x < sx + sw; x++) {
+			int index = offset + x + y*stride;
+
+			/* skip pixels that already converged */
+			if(kernel_adaptive_pixel_converged(kg, buffer + index*kernel_data.film.pass_stride))
+				continue;
+
+			pixels[num++] = make_int2(x, y);
+
+			if(num == PATH_SORT_BATCH_SIZE) {
+				kernel_path_trace_sorted_batch(kg, buffer, rng_state, sample, batch, num, offset, stride);
+				num = 0;
+			}
+		}
+	}
+
+	if(num)
+		kernel_path_trace_sorted_batch(kg, buffer, rng_state, sample, batch, num, offset, stride);
+}
+
+#endif
+
+CCL_NAMESPACE_END
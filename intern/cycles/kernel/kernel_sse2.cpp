@@ -48,6 +48,20 @@ void kernel_cpu_sse2_path_trace(KernelGlobals *kg, float *buffer, unsigned int *
 		kernel_path_trace(kg, buffer, rng_state, sample, x, y, offset, stride);
 }
 
+void kernel_cpu_sse2_path_trace_sorted(KernelGlobals *kg, float *buffer, unsigned int *rng_state, int sample, int x, int y, int w, int h, int offset, int stride)
+{
+#ifdef __BRANCHED_PATH__
+	/* branched path splits into many paths per bounce, not batched */
+	if(kernel_data.integrator.branched) {
+		for(int py = y; py < y + h; py++)
+			for(int px = x; px < x + w; px++)
+				kernel_branched_path_trace(kg, buffer, rng_state, sample, px, py, offset, stride);
+	}
+	else
+#endif
+		kernel_path_trace_sorted(kg, buffer, rng_state, sample, x, y, w, h, offset, stride);
+}
+
 /* Film */
 
 void kernel_cpu_sse2_convert_to_byte(KernelGlobals *kg, uchar4 *rgba, float *buffer, float sample_scale, int x, int y, int offset, int stride)
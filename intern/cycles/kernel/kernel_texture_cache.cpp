@@ -0,0 +1,98 @@
+/*
+ * Copyright 2011-2013 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include "kernel_compat_cpu.h"
+#include "kernel_types.h"
+#include "kernel_globals.h"
+
+#include "kernel_texture_cache.h"
+#include "kernel_texture_cache_globals.h"
+
+CCL_NAMESPACE_BEGIN
+
+/* Threads */
+
+void TextureCache::thread_init(KernelGlobals *kg, TextureCacheGlobals *tc_globals)
+{
+	/* no texture cache used? */
+	if(!tc_globals->use) {
+		kg->texture_cache = NULL;
+		kg->texture_cache_tdata = NULL;
+		return;
+	}
+
+	TextureCacheThreadData *tdata = new TextureCacheThreadData();
+	tdata->thread_info = tc_globals->ts->get_perthread_info();
+
+	kg->texture_cache = tc_globals;
+	kg->texture_cache_tdata = tdata;
+}
+
+void TextureCache::thread_free(KernelGlobals *kg)
+{
+	if(!kg->texture_cache)
+		return;
+
+	delete kg->texture_cache_tdata;
+
+	kg->texture_cache = NULL;
+	kg->texture_cache_tdata = NULL;
+}
+
+/* Lookup */
+
+bool TextureCache::lookup(KernelGlobals *kg, int id, float x, float y,
+	float dxdx, float dydx, float dxdy, float dydy, float4 *result)
+{
+	TextureCacheGlobals *tcg = kg->texture_cache;
+
+	if(id < 0 || id >= (int)tcg->images.size() || !tcg->images[id].handle)
+		return false;
+
+	TextureCacheGlobals::Image& img = tcg->images[id];
+	OIIO::TextureOpt options;
+	float rgba[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+
+	options.nchannels = img.channels;
+	options.swrap = OIIO::TextureOpt::WrapPeriodic;
+	options.twrap = OIIO::TextureOpt::WrapPeriodic;
+
+	/* images are stored with the first scanline at the top, while in memory
+	 * textures it's at the bottom */
+	bool status = tcg->ts->texture(img.handle, kg->texture_cache_tdata->thread_info,
+	                               options, x, 1.0f - y, dxdx, -dydx, dxdy, -dydy, rgba);
+
+	if(!status) {
+		/* same color as images that failed to load */
+		*result = make_float4(1.0f, 0.0f, 1.0f, 1.0f);
+		return true;
+	}
+
+	/* expand to RGBA the same way as images loaded in memory */
+	if(img.channels == 1)
+		*result = make_float4(rgba[0], rgba[0], rgba[0], 1.0f);
+	else if(img.channels == 2)
+		*result = make_float4(rgba[0], rgba[0], rgba[0], rgba[1]);
+	else if(img.channels == 3)
+		*result = make_float4(rgba[0], rgba[1], rgba[2], 1.0f);
+	else
+		*result = make_float4(rgba[0], rgba[1], rgba[2], rgba[3]);
+
+	return true;
+}
+
+CCL_NAMESPACE_END
+
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2011-2013 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#ifndef __KERNEL_TEXTURE_CACHE_H__
+#define __KERNEL_TEXTURE_CACHE_H__
+
+/* Texture Cache
+ *
+ * On the CPU, file images can be looked up through an OpenImageIO texture
+ * system instead of being loaded into memory entirely. Tiles of the mipmap
+ * levels are read on demand and evicted when the cache is over its memory
+ * limit. The images are registered externally by ImageManager before
+ * rendering starts.
+ *
+ * Before/after a thread starts rendering, thread_init/thread_free must be
+ * called, which will store the per thread texture system state in the
+ * thread's KernelGlobals.
+ */
+
+#include "kernel_types.h"
+
+CCL_NAMESPACE_BEGIN
+
+struct TextureCacheGlobals;
+
+class TextureCache {
+public:
+	/* per thread data */
+	static void thread_init(KernelGlobals *kg, TextureCacheGlobals *tc_globals);
+	static void thread_free(KernelGlobals *kg);
+
+	/* filtered lookup in image slot id, with coordinates and derivatives in the
+	 * same space as kernel_tex_image_interp. returns false if the image is not
+	 * in the cache and must be looked up in memory instead */
+	static bool lookup(KernelGlobals *kg, int id, float x, float y,
+		float dxdx, float dydx, float dxdy, float dydy, float4 *result);
+};
+
+CCL_NAMESPACE_END
+
+#endif /* __KERNEL_TEXTURE_CACHE_H__ */
+
@@ -30,6 +30,7 @@ CCL_NAMESPACE_BEGIN
 #define OBJECT_SIZE 		11
 #define OBJECT_VECTOR_SIZE	6
 #define LIGHT_SIZE			4
+#define LIGHT_TREE_NODE_SIZE	4
 #define FILTER_TABLE_SIZE	256
 #define RAMP_TABLE_SIZE		256
 #define PARTICLE_SIZE 		5
@@ -38,6 +39,8 @@ CCL_NAMESPACE_BEGIN
 #define BSSRDF_MIN_RADIUS			1e-8f
 #define BSSRDF_MAX_HITS				4
 
+#define ADAPTIVE_SAMPLING_STEP		4
+
 #define BB_DRAPPER				800.0f
 #define BB_MAX_TABLE_RANGE		12000.0f
 #define BB_TABLE_XPOWER			1.5f
@@ -46,6 +49,22 @@ CCL_NAMESPACE_BEGIN
 
 #define TEX_NUM_FLOAT_IMAGES	5
 
+/* on the CPU, images with a single channel or half float pixels are stored in
+ * compact types, in slots following the float4 and byte4 images */
+#define TEX_NUM_FLOAT4_IMAGES_CPU	5
+#define TEX_NUM_BYTE4_IMAGES_CPU	512
+#define TEX_NUM_HALF4_IMAGES_CPU	512
+#define TEX_NUM_FLOAT1_IMAGES_CPU	512
+#define TEX_NUM_BYTE1_IMAGES_CPU	512
+#define TEX_NUM_HALF1_IMAGES_CPU	512
+
+#define TEX_START_BYTE4_CPU		TEX_NUM_FLOAT4_IMAGES_CPU
+#define TEX_START_HALF4_CPU		(TEX_START_BYTE4_CPU + TEX_NUM_BYTE4_IMAGES_CPU)
+#define TEX_START_FLOAT1_CPU	(TEX_START_HALF4_CPU + TEX_NUM_HALF4_IMAGES_CPU)
+#define TEX_START_BYTE1_CPU		(TEX_START_FLOAT1_CPU + TEX_NUM_FLOAT1_IMAGES_CPU)
+#define TEX_START_HALF1_CPU		(TEX_START_BYTE1_CPU + TEX_NUM_BYTE1_IMAGES_CPU)
+#define TEX_NUM_IMAGES_CPU		(TEX_START_HALF1_CPU + TEX_NUM_HALF1_IMAGES_CPU)
+
 /* device capabilities */
 #ifdef __KERNEL_CPU__
 #define __KERNEL_SHADING__
@@ -268,7 +287,9 @@ typedef enum PassType {
 	PASS_MIST = 2097152,
 	PASS_SUBSURFACE_DIRECT = 4194304,
 	PASS_SUBSURFACE_INDIRECT = 8388608,
-	PASS_SUBSURFACE_COLOR = 16777216
+	PASS_SUBSURFACE_COLOR = 16777216,
+	PASS_ADAPTIVE_AUX_BUFFER = 33554432,
+	PASS_SAMPLE_COUNT = 67108864
 } PassType;
 
 #define PASS_ALL (~0)
@@ -693,12 +714,12 @@ typedef struct KernelFilm {
 	int pass_emission;
 	int pass_background;
 	int pass_ao;
-	int pass_pad1;
+	int pass_adaptive_aux_buffer;
 
 	int pass_shadow;
 	float pass_shadow_scale;
 	int filter_table_offset;
-	int pass_pad2;
+	int pass_sample_count;
 
 	int pass_mist;
 	float mist_start;
@@ -769,8 +790,17 @@ typedef struct KernelIntegrator {
 	/* sampler */
 	int sampling_pattern;
 
-	/* padding */
-	int pad;
+	/* light tree */
+	int use_light_tree;
+	int light_tree_num_leaves;
+	int light_tree_inf_node;
+	int light_tree_num_inf;
+	float light_tree_pdf;
+	float light_tree_background_pdf;
+
+	/* adaptive sampling */
+	float adaptive_threshold;
+	int adaptive_min_samples;
 } KernelIntegrator;
 
 typedef struct KernelBVH {
@@ -48,7 +48,7 @@ __device_inline float svm_image_texture_frac(float x, int *ix)
 	return x - (float)i;
 }
 
-__device float4 svm_image_texture(KernelGlobals *kg, int id, float x, float y, uint srgb, uint use_alpha)
+__device float4 svm_image_texture(KernelGlobals *kg, int id, float x, float y, float2 dx, float2 dy, uint srgb, uint use_alpha)
 {
 	/* first slots are used by float textures, which are not supported here */
 	if(id < TEX_NUM_FLOAT_IMAGES)
@@ -110,12 +110,24 @@ __device float4 svm_image_texture(KernelGlobals *kg, int id, float x, float y, u
 
 #else
 
-__device float4 svm_image_texture(KernelGlobals *kg, int id, float x, float y, uint srgb, uint use_alpha)
+__device_inline bool svm_image_texture_is_byte(int id)
+{
+#ifdef __KERNEL_CPU__
+	return (id >= TEX_START_BYTE4_CPU && id < TEX_START_HALF4_CPU) ||
+	       (id >= TEX_START_BYTE1_CPU && id < TEX_START_HALF1_CPU);
+#else
+	return (id >= TEX_NUM_FLOAT_IMAGES);
+#endif
+}
+
+__device float4 svm_image_texture(KernelGlobals *kg, int id, float x, float y, float2 dx, float2 dy, uint srgb, uint use_alpha)
 {
 	float4 r;
 
 #ifdef __KERNEL_CPU__
-	r = kernel_tex_image_interp(id, x, y);
+	/* file images may be in the texture cache instead of in memory */
+	if(!(kg->texture_cache && TextureCache::lookup(kg, id, x, y, dx.x, dx.y, dy.x, dy.y, &r)))
+		r = kernel_tex_image_interp(id, x, y);
 #else
 	/* not particularly proud of this massive switch, what are the
 	 * alternatives?
@@ -239,7 +251,7 @@ __device float4 svm_image_texture(KernelGlobals *kg, int id, float x, float y, u
 		r.y *= invw;
 		r.z *= invw;
 
-		if(id >= TEX_NUM_FLOAT_IMAGES) {
+		if(svm_image_texture_is_byte(id)) {
 			r.x = min(r.x, 1.0f);
 			r.y = min(r.y, 1.0f);
 			r.z = min(r.z, 1.0f);
@@ -257,6 +269,33 @@ __device float4 svm_image_texture(KernelGlobals *kg, int id, float x, float y, u
 
 #endif
 
+/* Derivatives of the texture coordinates, for filtered lookups in the texture
+ * cache. Only available when the coordinates are directly taken from a UV map
+ * attribute, which is passed by the compiler. */
+
+__device void svm_image_texture_derivatives(KernelGlobals *kg, ShaderData *sd, uint attr_id, float2 *dx, float2 *dy)
+{
+	*dx = make_float2(0.0f, 0.0f);
+	*dy = make_float2(0.0f, 0.0f);
+
+#if defined(__KERNEL_CPU__) && defined(__RAY_DIFFERENTIALS__)
+	if(!kg->texture_cache || attr_id == ATTR_STD_NONE)
+		return;
+
+	AttributeElement elem;
+	int offset = find_attribute(kg, sd, attr_id, &elem);
+
+	if(offset == ATTR_STD_NOT_FOUND)
+		return;
+
+	float3 duvdx, duvdy;
+	primitive_attribute_float3(kg, sd, elem, offset, &duvdx, &duvdy);
+
+	*dx = make_float2(duvdx.x, duvdx.y);
+	*dy = make_float2(duvdy.x, duvdy.y);
+#endif
+}
+
 __device void svm_node_tex_image(KernelGlobals *kg, ShaderData *sd, float *stack, uint4 node)
 {
 	uint id = node.y;
@@ -265,8 +304,11 @@ __device void svm_node_tex_image(KernelGlobals *kg, ShaderData *sd, float *stack
 	decode_node_uchar4(node.z, &co_offset, &out_offset, &alpha_offset, &srgb);
 
 	float3 co = stack_load_float3(stack, co_offset);
+	float2 dx, dy;
+	svm_image_texture_derivatives(kg, sd, node.w, &dx, &dy);
+
 	uint use_alpha = stack_valid(alpha_offset);
-	float4 f = svm_image_texture(kg, id, co.x, co.y, srgb, use_alpha);
+	float4 f = svm_image_texture(kg, id, co.x, co.y, dx, dy, srgb, use_alpha);
 
 	if(stack_valid(out_offset))
 		stack_store_float3(stack, out_offset, make_float3(f.x, f.y, f.z));
@@ -347,14 +389,15 @@ __device void svm_node_tex_image_box(KernelGlobals *kg, ShaderData *sd, float *s
 	uint id = node.y;
 
 	float4 f = make_float4(0.0f, 0.0f, 0.0f, 0.0f);
+	float2 d = make_float2(0.0f, 0.0f);
 	uint use_alpha = stack_valid(alpha_offset);
 
 	if(weight.x > 0.0f)
-		f += weight.x*svm_image_texture(kg, id, co.y, co.z, srgb, use_alpha);
+		f += weight.x*svm_image_texture(kg, id, co.y, co.z, d, d, srgb, use_alpha);
 	if(weight.y > 0.0f)
-		f += weight.y*svm_image_texture(kg, id, co.x, co.z, srgb, use_alpha);
+		f += weight.y*svm_image_texture(kg, id, co.x, co.z, d, d, srgb, use_alpha);
 	if(weight.z > 0.0f)
-		f += weight.z*svm_image_texture(kg, id, co.y, co.x, srgb, use_alpha);
+		f += weight.z*svm_image_texture(kg, id, co.y, co.x, d, d, srgb, use_alpha);
 
 	if(stack_valid(out_offset))
 		stack_store_float3(stack, out_offset, make_float3(f.x, f.y, f.z));
@@ -381,8 +424,9 @@ __device void svm_node_tex_environment(KernelGlobals *kg, ShaderData *sd, float
 	else
 		uv = direction_to_mirrorball(co);
 
+	float2 d = make_float2(0.0f, 0.0f);
 	uint use_alpha = stack_valid(alpha_offset);
-	float4 f = svm_image_texture(kg, id, uv.x, uv.y, srgb, use_alpha);
+	float4 f = svm_image_texture(kg, id, uv.x, uv.y, d, d, srgb, use_alpha);
 
 	if(stack_valid(out_offset))
 		stack_store_float3(stack, out_offset, make_float3(f.x, f.y, f.z));
@@ -99,7 +99,10 @@ RenderTile::RenderTile()
 
 RenderBuffers::RenderBuffers(Device *device_)
 {
-  device = device_;
+	device = device_;
+
+	buffer.stats_category = MEM_CATEGORY_RENDER_BUFFERS;
+	rng_state.stats_category = MEM_CATEGORY_RENDER_BUFFERS;
 }
 
 RenderBuffers::~RenderBuffers()
@@ -310,6 +313,9 @@ DisplayBuffer::DisplayBuffer(Device *device_, bool linear)
 	draw_height = 0;
 	transparent = true; /* todo: determine from background */
 	half_float = linear;
+
+	rgba_byte.stats_category = MEM_CATEGORY_RENDER_BUFFERS;
+	rgba_half.stats_category = MEM_CATEGORY_RENDER_BUFFERS;
 }
 
 DisplayBuffer::~DisplayBuffer()
@@ -128,6 +128,30 @@ void ShaderNode::attributes(AttributeRequestSet *attributes)
 	}
 }
 
+bool ShaderNode::equals_inputs(ShaderNode *other)
+{
+	/* same node type, and the same links or values for all inputs */
+	if(name != other->name || inputs.size() != other->inputs.size())
+		return false;
+
+	for(size_t i = 0; i < inputs.size(); i++) {
+		ShaderInput *input = inputs[i];
+		ShaderInput *other_input = other->inputs[i];
+
+		if(input->link != other_input->link)
+			return false;
+
+		if(!input->link) {
+			if(input->default_value != other_input->default_value)
+				return false;
+			if(input->value != other_input->value || input->value_string != other_input->value_string)
+				return false;
+		}
+	}
+
+	return true;
+}
+
 /* Graph */
 
 ShaderGraph::ShaderGraph()
@@ -464,14 +488,99 @@ void ShaderGraph::break_cycles(ShaderNode *node, vector<bool>& visited, vector<b
 	on_stack[node->id] = false;
 }
 
+void ShaderGraph::optimize(ShaderNode *node, set<ShaderNode*>& done, map<ustring, vector<ShaderNode*> >& unique)
+{
+	if(done.find(node) != done.end())
+		return;
+
+	done.insert(node);
+
+	/* optimize nodes connected to inputs first */
+	foreach(ShaderInput *input, node->inputs)
+		if(input->link)
+			optimize(input->link->parent, done, unique);
+
+	/* fold constants and bypass identity operations */
+	ShaderNode *output_node = output();
+	bool used = false;
+
+	foreach(ShaderOutput *output, node->outputs) {
+		if(output->links.empty())
+			continue;
+
+		vector<ShaderInput*> links(output->links);
+		float3 optimized_value = make_float3(0.0f, 0.0f, 0.0f);
+		ShaderInput *bypass = NULL;
+		bool folded = node->constant_fold(output, &optimized_value);
+
+		if(!folded) {
+			bypass = node->bypass_input(output);
+
+			/* passing through an unlinked input is a constant too */
+			if(bypass && bypass->constant()) {
+				optimized_value = bypass->value;
+				folded = true;
+			}
+		}
+
+		if(folded) {
+			foreach(ShaderInput *to, links) {
+				/* sockets that would get a texture coordinate or such when
+				 * unlinked must keep their link, and so must the output node,
+				 * an unlinked displacement input is not evaluated at all */
+				if(to->default_value == ShaderInput::NONE && to->parent != output_node) {
+					disconnect(to);
+					to->value = optimized_value;
+				}
+			}
+		}
+		else if(bypass && bypass->link) {
+			ShaderOutput *from = bypass->link;
+
+			foreach(ShaderInput *to, links) {
+				disconnect(to);
+				connect(from, to);
+			}
+		}
+
+		if(!output->links.empty())
+			used = true;
+	}
+
+	if(!used)
+		return;
+
+	/* merge with an equal node found before. inputs were optimized first, so
+	 * equal nodes are linked to the exact same outputs */
+	vector<ShaderNode*>& candidates = unique[node->name];
+
+	foreach(ShaderNode *other, candidates) {
+		if(node->equals(other)) {
+			for(size_t i = 0; i < node->outputs.size(); i++) {
+				vector<ShaderInput*> links(node->outputs[i]->links);
+
+				foreach(ShaderInput *to, links) {
+					disconnect(to);
+					connect(other->outputs[i], to);
+				}
+			}
+
+			return;
+		}
+	}
+
+	candidates.push_back(node);
+}
+
 void ShaderGraph::clean()
 {
 	/* remove proxy and unnecessary mix nodes */
 	remove_unneeded_nodes();
 
-	/* we do two things here: find cycles and break them, and remove unused
-	 * nodes that don't feed into the output. how cycles are broken is
-	 * undefined, they are invalid input, the important thing is to not crash */
+	/* we do a few things here: find cycles and break them, optimize the graph,
+	 * and remove unused nodes that don't feed into the output. how cycles are
+	 * broken is undefined, they are invalid input, the important thing is to
+	 * not crash */
 
 	vector<bool> visited(num_node_ids, false);
 	vector<bool> on_stack(num_node_ids, false);
@@ -479,6 +588,17 @@ void ShaderGraph::clean()
 	/* break cycles */
 	break_cycles(output(), visited, on_stack);
 
+	/* fold constants, bypass identity operations and merge duplicate nodes.
+	 * this leaves nodes disconnected, so find the used nodes again after */
+	set<ShaderNode*> done;
+	map<ustring, vector<ShaderNode*> > unique;
+
+	optimize(output(), done, unique);
+
+	visited.assign(num_node_ids, false);
+	on_stack.assign(num_node_ids, false);
+	break_cycles(output(), visited, on_stack);
+
 	/* disconnect unused nodes */
 	foreach(ShaderNode *node, nodes) {
 		if(!visited[node->id]) {
@@ -132,6 +132,9 @@ public:
 	void set(float f) { value = make_float3(f, 0, 0); }
 	void set(const ustring v) { value_string = v; }
 
+	/* unlinked, and not replaced by a texture coordinate or such later on */
+	bool constant() const { return !link && default_value == NONE; }
+
 	const char *name;
 	ShaderSocketType type;
 
@@ -192,6 +195,17 @@ public:
 	virtual bool has_converter_blackbody() { return false; }
 	virtual bool has_bssrdf_bump() { return false; }
 
+	/* graph optimization. if the value of an output socket does not depend on
+	 * shading data, constant_fold returns true and sets the value. if the
+	 * output is one of the inputs passed through unchanged, bypass_input
+	 * returns that input. equals returns true if the node computes the same as
+	 * another node, default is false as node parameters must be compared too */
+	virtual bool constant_fold(ShaderOutput *socket, float3 *optimized_value) { return false; }
+	virtual ShaderInput *bypass_input(ShaderOutput *socket) { return NULL; }
+	virtual bool equals(ShaderNode *other) { return false; }
+
+	bool equals_inputs(ShaderNode *other);
+
 	vector<ShaderInput*> inputs;
 	vector<ShaderOutput*> outputs;
 
@@ -253,6 +267,7 @@ protected:
 	void copy_nodes(set<ShaderNode*>& nodes, map<ShaderNode*, ShaderNode*>& nnodemap);
 
 	void break_cycles(ShaderNode *node, vector<bool>& visited, vector<bool>& on_stack);
+	void optimize(ShaderNode *node, set<ShaderNode*>& done, map<ustring, vector<ShaderNode*> >& unique);
 	void clean();
 	void bump_from_displacement();
 	void refine_bump_nodes();
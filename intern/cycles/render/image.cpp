@@ -18,6 +18,8 @@
 #include "image.h"
 #include "scene.h"
 
+#include "kernel_texture_cache_globals.h"
+
 #include "util_foreach.h"
 #include "util_image.h"
 #include "util_path.h"
@@ -29,24 +31,84 @@
 
 CCL_NAMESPACE_BEGIN
 
+/* Pixel Storage Types */
+
+template<typename T> struct ImageStorage {};
+
+template<> struct ImageStorage<uchar> {
+	static TypeDesc format() { return TypeDesc::UINT8; }
+	static uchar from_unit(float f) { return (uchar)(f*255.0f); }
+
+	static bool builtin_pixels(ImageManager *manager, const string& filename, void *data, uchar *pixels)
+	{
+		return manager->builtin_image_pixels_cb && manager->builtin_image_pixels_cb(filename, data, pixels);
+	}
+};
+
+template<> struct ImageStorage<float> {
+	static TypeDesc format() { return TypeDesc::FLOAT; }
+	static float from_unit(float f) { return f; }
+
+	static bool builtin_pixels(ImageManager *manager, const string& filename, void *data, float *pixels)
+	{
+		return manager->builtin_image_float_pixels_cb && manager->builtin_image_float_pixels_cb(filename, data, pixels);
+	}
+};
+
+template<> struct ImageStorage<half> {
+	static TypeDesc format() { return TypeDesc::HALF; }
+	/* only used for 0 and 1 */
+	static half from_unit(float f) { return (f == 0.0f)? 0: 0x3C00; }
+
+	/* builtin images are never stored as half float */
+	static bool builtin_pixels(ImageManager *manager, const string& filename, void *data, half *pixels)
+	{
+		return false;
+	}
+};
+
+static string image_texture_name(ImageDataType type, int slot)
+{
+	switch(type) {
+		case IMAGE_DATA_TYPE_FLOAT4: return string_printf("__tex_image_float_%03d", slot);
+		case IMAGE_DATA_TYPE_BYTE4: return string_printf("__tex_image_%03d", slot);
+		case IMAGE_DATA_TYPE_HALF4: return string_printf("__tex_image_half4_%03d", slot);
+		case IMAGE_DATA_TYPE_FLOAT: return string_printf("__tex_image_float1_%03d", slot);
+		case IMAGE_DATA_TYPE_BYTE: return string_printf("__tex_image_byte1_%03d", slot);
+		case IMAGE_DATA_TYPE_HALF: return string_printf("__tex_image_half1_%03d", slot);
+		default: break;
+	}
+
+	assert(0);
+	return "";
+}
+
+/* Image Manager */
+
 ImageManager::ImageManager()
 {
 	need_update = true;
 	pack_images = false;
 	osl_texture_system = NULL;
+	use_texture_cache = false;
+	texture_cache_size = 0;
 	animation_frame = 0;
 
-	tex_num_images = TEX_NUM_IMAGES;
-	tex_num_float_images = TEX_NUM_FLOAT_IMAGES;
-	tex_image_byte_start = TEX_IMAGE_BYTE_START;
+	for(int type = 0; type < IMAGE_DATA_NUM_TYPES; type++) {
+		tex_num_images[type] = 0;
+		tex_start_images[type] = 0;
+	}
+
+	tex_num_images[IMAGE_DATA_TYPE_FLOAT4] = TEX_NUM_FLOAT_IMAGES;
+	tex_num_images[IMAGE_DATA_TYPE_BYTE4] = TEX_NUM_IMAGES;
+	tex_start_images[IMAGE_DATA_TYPE_BYTE4] = TEX_IMAGE_BYTE_START;
 }
 
 ImageManager::~ImageManager()
 {
-	for(size_t slot = 0; slot < images.size(); slot++)
-		assert(!images[slot]);
-	for(size_t slot = 0; slot < float_images.size(); slot++)
-		assert(!float_images[slot]);
+	for(int type = 0; type < IMAGE_DATA_NUM_TYPES; type++)
+		for(size_t index = 0; index < images[type].size(); index++)
+			assert(!images[type][index]);
 }
 
 void ImageManager::set_pack_images(bool pack_images_)
@@ -59,11 +121,27 @@ void ImageManager::set_osl_texture_system(void *texture_system)
 	osl_texture_system = texture_system;
 }
 
+void ImageManager::set_texture_cache(bool use_texture_cache_, int texture_cache_size_)
+{
+	use_texture_cache = use_texture_cache_;
+	texture_cache_size = texture_cache_size_;
+}
+
 void ImageManager::set_extended_image_limits(void)
 {
-	tex_num_images = TEX_EXTENDED_NUM_IMAGES;
-	tex_num_float_images = TEX_EXTENDED_NUM_FLOAT_IMAGES;
-	tex_image_byte_start = TEX_EXTENDED_IMAGE_BYTE_START;
+	tex_num_images[IMAGE_DATA_TYPE_FLOAT4] = TEX_NUM_FLOAT4_IMAGES_CPU;
+	tex_num_images[IMAGE_DATA_TYPE_BYTE4] = TEX_NUM_BYTE4_IMAGES_CPU;
+	tex_num_images[IMAGE_DATA_TYPE_HALF4] = TEX_NUM_HALF4_IMAGES_CPU;
+	tex_num_images[IMAGE_DATA_TYPE_FLOAT] = TEX_NUM_FLOAT1_IMAGES_CPU;
+	tex_num_images[IMAGE_DATA_TYPE_BYTE] = TEX_NUM_BYTE1_IMAGES_CPU;
+	tex_num_images[IMAGE_DATA_TYPE_HALF] = TEX_NUM_HALF1_IMAGES_CPU;
+
+	tex_start_images[IMAGE_DATA_TYPE_FLOAT4] = 0;
+	tex_start_images[IMAGE_DATA_TYPE_BYTE4] = TEX_START_BYTE4_CPU;
+	tex_start_images[IMAGE_DATA_TYPE_HALF4] = TEX_START_HALF4_CPU;
+	tex_start_images[IMAGE_DATA_TYPE_FLOAT] = TEX_START_FLOAT1_CPU;
+	tex_start_images[IMAGE_DATA_TYPE_BYTE] = TEX_START_BYTE1_CPU;
+	tex_start_images[IMAGE_DATA_TYPE_HALF] = TEX_START_HALF1_CPU;
 }
 
 bool ImageManager::set_animation_frame_update(int frame)
@@ -71,33 +149,63 @@ bool ImageManager::set_animation_frame_update(int frame)
 	if(frame != animation_frame) {
 		animation_frame = frame;
 
-		for(size_t slot = 0; slot < images.size(); slot++)
-			if(images[slot] && images[slot]->animated)
-				return true;
-
-		for(size_t slot = 0; slot < float_images.size(); slot++)
-			if(float_images[slot] && float_images[slot]->animated)
-				return true;
+		for(int type = 0; type < IMAGE_DATA_NUM_TYPES; type++)
+			for(size_t index = 0; index < images[type].size(); index++)
+				if(images[type][index] && images[type][index]->animated)
+					return true;
 	}
 	
 	return false;
 }
 
-bool ImageManager::is_float_image(const string& filename, void *builtin_data, bool& is_linear)
+int ImageManager::type_index_to_slot(int index, ImageDataType type)
 {
-	bool is_float = false;
+	return tex_start_images[type] + index;
+}
+
+int ImageManager::slot_to_type_index(int slot, ImageDataType *type)
+{
+	for(int i = 0; i < IMAGE_DATA_NUM_TYPES; i++) {
+		if(slot >= tex_start_images[i] && slot < tex_start_images[i] + tex_num_images[i]) {
+			*type = (ImageDataType)i;
+			return slot - tex_start_images[i];
+		}
+	}
+
+	assert(0);
+	*type = IMAGE_DATA_TYPE_BYTE4;
+	return 0;
+}
+
+int ImageManager::num_slots()
+{
+	int num = 0;
+
+	for(int type = 0; type < IMAGE_DATA_NUM_TYPES; type++)
+		if(images[type].size())
+			num = max(num, type_index_to_slot(images[type].size(), (ImageDataType)type));
+
+	return num;
+}
+
+ImageDataType ImageManager::get_image_metadata(const string& filename, void *builtin_data, bool& is_linear)
+{
+	bool is_float = false, is_half = false;
+	int channels = 4;
 	is_linear = false;
 
 	if(builtin_data) {
 		if(builtin_image_info_cb) {
-			int width, height, channels;
+			int width, height;
 			builtin_image_info_cb(filename, builtin_data, is_float, width, height, channels);
 		}
 
-		if(is_float)
+		if(is_float) {
 			is_linear = true;
+			return IMAGE_DATA_TYPE_FLOAT4;
+		}
 
-		return is_float;
+		return IMAGE_DATA_TYPE_BYTE4;
 	}
 
 	ImageInput *in = ImageInput::create(filename);
@@ -120,6 +228,17 @@ bool ImageManager::is_float_image(const string& filename, void *builtin_data, bo
 				}
 			}
 
+			/* half float pixels are stored as they are, other formats with more
+			 * than one byte per channel are converted to float */
+			is_half = (spec.format == TypeDesc::HALF);
+
+			for(size_t channel = 0; channel < spec.channelformats.size(); channel++) {
+				if(spec.channelformats[channel] != TypeDesc::HALF)
+					is_half = false;
+			}
+
+			channels = spec.nchannels;
+
 			/* basic color space detection, not great but better than nothing
 			 * before we do OpenColorIO integration */
 			if(is_float) {
@@ -142,7 +261,20 @@ bool ImageManager::is_float_image(const string& filename, void *builtin_data, bo
 		delete in;
 	}
 
-	return is_float;
+	/* single channel images are stored without expanding to RGBA */
+	if(is_half)
+		return (channels == 1)? IMAGE_DATA_TYPE_HALF: IMAGE_DATA_TYPE_HALF4;
+	else if(is_float)
+		return (channels == 1)? IMAGE_DATA_TYPE_FLOAT: IMAGE_DATA_TYPE_FLOAT4;
+	else
+		return (channels == 1)? IMAGE_DATA_TYPE_BYTE: IMAGE_DATA_TYPE_BYTE4;
+}
+
+bool ImageManager::is_float_image(const string& filename, void *builtin_data, bool& is_linear)
+{
+	ImageDataType type = get_image_metadata(filename, builtin_data, is_linear);
+
+	return (type != IMAGE_DATA_TYPE_BYTE4 && type != IMAGE_DATA_TYPE_BYTE);
 }
 
 int ImageManager::add_image(const string& filename, void *builtin_data, bool animated, bool& is_float, bool& is_linear)
@@ -150,129 +282,85 @@ int ImageManager::add_image(const string& filename, void *builtin_data, bool ani
 	Image *img;
 	size_t slot;
 
-	/* load image info and find out if we need a float texture */
-	is_float = (pack_images)? false: is_float_image(filename, builtin_data, is_linear);
+	/* load image info and find out which storage type we need */
+	ImageDataType type = (pack_images)? IMAGE_DATA_TYPE_BYTE4: get_image_metadata(filename, builtin_data, is_linear);
 
-	if(is_float) {
-		/* find existing image */
-		for(slot = 0; slot < float_images.size(); slot++) {
-			if(float_images[slot] && float_images[slot]->filename == filename) {
-				float_images[slot]->users++;
-				return slot;
-			}
-		}
+	/* compact types are only available with extended image limits */
+	if(tex_num_images[type] == 0)
+		type = (type == IMAGE_DATA_TYPE_BYTE)? IMAGE_DATA_TYPE_BYTE4: IMAGE_DATA_TYPE_FLOAT4;
 
-		/* find free slot */
-		for(slot = 0; slot < float_images.size(); slot++) {
-			if(!float_images[slot])
-				break;
-		}
+	is_float = (type != IMAGE_DATA_TYPE_BYTE4 && type != IMAGE_DATA_TYPE_BYTE);
 
-		if(slot == float_images.size()) {
-			/* max images limit reached */
-			if(float_images.size() == TEX_NUM_FLOAT_IMAGES) {
-				printf("ImageManager::add_image: float image limit reached %d, skipping '%s'\n",
-				       tex_num_float_images, filename.c_str());
-				return -1;
-			}
+	vector<Image*>& type_images = images[type];
 
-			float_images.resize(float_images.size() + 1);
+	/* find existing image */
+	for(slot = 0; slot < type_images.size(); slot++) {
+		if(type_images[slot] && type_images[slot]->filename == filename) {
+			type_images[slot]->users++;
+			return type_index_to_slot(slot, type);
 		}
+	}
 
-		/* add new image */
-		img = new Image();
-		img->filename = filename;
-		img->builtin_data = builtin_data;
-		img->need_load = true;
-		img->animated = animated;
-		img->users = 1;
-
-		float_images[slot] = img;
+	/* find free slot */
+	for(slot = 0; slot < type_images.size(); slot++) {
+		if(!type_images[slot])
+			break;
 	}
-	else {
-		for(slot = 0; slot < images.size(); slot++) {
-			if(images[slot] && images[slot]->filename == filename) {
-				images[slot]->users++;
-				return slot+tex_image_byte_start;
-			}
-		}
 
-		/* find free slot */
-		for(slot = 0; slot < images.size(); slot++) {
-			if(!images[slot])
-				break;
+	if(slot == type_images.size()) {
+		/* max images limit reached */
+		if(type_images.size() == tex_num_images[type]) {
+			printf("ImageManager::add_image: %s image limit reached %d, skipping '%s'\n",
+			       (is_float)? "float": "byte", tex_num_images[type], filename.c_str());
+			return -1;
 		}
 
-		if(slot == images.size()) {
-			/* max images limit reached */
-			if(images.size() == tex_num_images) {
-				printf("ImageManager::add_image: byte image limit reached %d, skipping '%s'\n",
-				       tex_num_images, filename.c_str());
-				return -1;
-			}
-
-			images.resize(images.size() + 1);
-		}
+		type_images.resize(type_images.size() + 1);
+	}
 
-		/* add new image */
-		img = new Image();
-		img->filename = filename;
-		img->builtin_data = builtin_data;
-		img->need_load = true;
-		img->animated = animated;
-		img->users = 1;
+	/* add new image */
+	img = new Image();
+	img->filename = filename;
+	img->builtin_data = builtin_data;
+	img->need_load = true;
+	img->animated = animated;
+	img->users = 1;
 
-		images[slot] = img;
+	type_images[slot] = img;
 
-		slot += tex_image_byte_start;
-	}
 	need_update = true;
 
-	return slot;
+	return type_index_to_slot(slot, type);
 }
 
 void ImageManager::remove_image(const string& filename, void *builtin_data)
 {
-	size_t slot;
-
-	for(slot = 0; slot < images.size(); slot++) {
-		if(images[slot] && images[slot]->filename == filename && images[slot]->builtin_data == builtin_data) {
-			/* decrement user count */
-			images[slot]->users--;
-			assert(images[slot]->users >= 0);
-
-			/* don't remove immediately, rather do it all together later on. one of
-			 * the reasons for this is that on shader changes we add and remove nodes
-			 * that use them, but we do not want to reload the image all the time. */
-			if(images[slot]->users == 0)
-				need_update = true;
-
-			break;
-		}
-	}
+	for(int type = 0; type < IMAGE_DATA_NUM_TYPES; type++) {
+		for(size_t slot = 0; slot < images[type].size(); slot++) {
+			Image *img = images[type][slot];
 
-	if(slot == images.size()) {
-		/* see if it's in a float texture slot */
-		for(slot = 0; slot < float_images.size(); slot++) {
-			if(float_images[slot] && float_images[slot]->filename == filename && float_images[slot]->builtin_data == builtin_data) {
+			if(img && img->filename == filename && img->builtin_data == builtin_data) {
 				/* decrement user count */
-				float_images[slot]->users--;
-				assert(float_images[slot]->users >= 0);
+				img->users--;
+				assert(img->users >= 0);
 
 				/* don't remove immediately, rather do it all together later on. one of
 				 * the reasons for this is that on shader changes we add and remove nodes
 				 * that use them, but we do not want to reload the image all the time. */
-				if(float_images[slot]->users == 0)
+				if(img->users == 0)
 					need_update = true;
 
-				break;
+				return;
 			}
 		}
 	}
 }
 
-bool ImageManager::file_load_image(Image *img, device_vector<uchar4>& tex_img)
+template<typename StorageType, typename DeviceType>
+bool ImageManager::file_load_image(Image *img, device_vector<DeviceType>& tex_img)
 {
+	const int num_elements = sizeof(DeviceType)/sizeof(StorageType);
+
 	if(img->filename == "")
 		return false;
 
@@ -299,7 +387,7 @@ bool ImageManager::file_load_image(Image *img, device_vector<uchar4>& tex_img)
 	}
 	else {
 		/* load image using builtin images callbacks */
-		if(!builtin_image_info_cb || !builtin_image_pixels_cb)
+		if(!builtin_image_info_cb)
 			return false;
 
 		bool is_float;
@@ -307,7 +395,7 @@ bool ImageManager::file_load_image(Image *img, device_vector<uchar4>& tex_img)
 	}
 
 	/* we only handle certain number of components */
-	if(!(components >= 1 && components <= 4)) {
+	if(!(components >= 1 && components <= num_elements)) {
 		if(in) {
 			in->close();
 			delete in;
@@ -316,12 +404,12 @@ bool ImageManager::file_load_image(Image *img, device_vector<uchar4>& tex_img)
 		return false;
 	}
 
-	/* read RGBA pixels */
-	uchar *pixels = (uchar*)tex_img.resize(width, height);
-	int scanlinesize = width*components*sizeof(uchar);
+	/* read pixels */
+	StorageType *pixels = (StorageType*)tex_img.resize(width, height);
+	int scanlinesize = width*components*sizeof(StorageType);
 
 	if(in) {
-		in->read_image(TypeDesc::UINT8,
+		in->read_image(ImageStorage<StorageType>::format(),
 			(uchar*)pixels + (height-1)*scanlinesize,
 			AutoStride,
 			-scanlinesize,
@@ -330,126 +418,83 @@ bool ImageManager::file_load_image(Image *img, device_vector<uchar4>& tex_img)
 		in->close();
 		delete in;
 	}
-	else {
-		builtin_image_pixels_cb(img->filename, img->builtin_data, pixels);
+	else if(!ImageStorage<StorageType>::builtin_pixels(this, img->filename, img->builtin_data, pixels)) {
+		return false;
 	}
 
-	if(components == 2) {
-		for(int i = width*height-1; i >= 0; i--) {
-			pixels[i*4+3] = pixels[i*2+1];
-			pixels[i*4+2] = pixels[i*2+0];
-			pixels[i*4+1] = pixels[i*2+0];
-			pixels[i*4+0] = pixels[i*2+0];
+	/* expand to RGBA */
+	if(num_elements == 4) {
+		StorageType one = ImageStorage<StorageType>::from_unit(1.0f);
+
+		if(components == 2) {
+			for(int i = width*height-1; i >= 0; i--) {
+				pixels[i*4+3] = pixels[i*2+1];
+				pixels[i*4+2] = pixels[i*2+0];
+				pixels[i*4+1] = pixels[i*2+0];
+				pixels[i*4+0] = pixels[i*2+0];
+			}
 		}
-	}
-	else if(components == 3) {
-		for(int i = width*height-1; i >= 0; i--) {
-			pixels[i*4+3] = 255;
-			pixels[i*4+2] = pixels[i*3+2];
-			pixels[i*4+1] = pixels[i*3+1];
-			pixels[i*4+0] = pixels[i*3+0];
+		else if(components == 3) {
+			for(int i = width*height-1; i >= 0; i--) {
+				pixels[i*4+3] = one;
+				pixels[i*4+2] = pixels[i*3+2];
+				pixels[i*4+1] = pixels[i*3+1];
+				pixels[i*4+0] = pixels[i*3+0];
+			}
 		}
-	}
-	else if(components == 1) {
-		for(int i = width*height-1; i >= 0; i--) {
-			pixels[i*4+3] = 255;
-			pixels[i*4+2] = pixels[i];
-			pixels[i*4+1] = pixels[i];
-			pixels[i*4+0] = pixels[i];
+		else if(components == 1) {
+			for(int i = width*height-1; i >= 0; i--) {
+				pixels[i*4+3] = one;
+				pixels[i*4+2] = pixels[i];
+				pixels[i*4+1] = pixels[i];
+				pixels[i*4+0] = pixels[i];
+			}
 		}
 	}
 
 	return true;
 }
 
-bool ImageManager::file_load_float_image(Image *img, device_vector<float4>& tex_img)
+template<typename StorageType, typename DeviceType>
+void ImageManager::device_load_image_type(Device *device, Image *img, ImageDataType type, int slot, device_vector<DeviceType>& tex_img)
 {
-	if(img->filename == "")
-		return false;
-
-	ImageInput *in = NULL;
-	int width, height, components;
-
-	if(!img->builtin_data) {
-		/* load image from file through OIIO */
-		in = ImageInput::create(img->filename);
-
-		if(!in)
-			return false;
-
-		ImageSpec spec;
-
-		if(!in->open(img->filename, spec)) {
-			delete in;
-			return false;
-		}
-
-		/* we only handle certain number of components */
-		width = spec.width;
-		height = spec.height;
-		components = spec.nchannels;
+	if(tex_img.device_pointer) {
+		thread_scoped_lock device_lock(device_mutex);
+		device->tex_free(tex_img);
 	}
-	else {
-		/* load image using builtin images callbacks */
-		if(!builtin_image_info_cb || !builtin_image_float_pixels_cb)
-			return false;
 
-		bool is_float;
-		builtin_image_info_cb(img->filename, img->builtin_data, is_float, width, height, components);
-	}
+	if(!file_load_image<StorageType>(img, tex_img)) {
+		/* on failure to load, we set a 1x1 pixels pink image */
+		StorageType *pixels = (StorageType*)tex_img.resize(1, 1);
 
-	if(!(components >= 1 && components <= 4)) {
-		if(in) {
-			in->close();
-			delete in;
+		pixels[0] = ImageStorage<StorageType>::from_unit(TEX_IMAGE_MISSING_R);
+
+		if(sizeof(DeviceType) == 4*sizeof(StorageType)) {
+			pixels[1] = ImageStorage<StorageType>::from_unit(TEX_IMAGE_MISSING_G);
+			pixels[2] = ImageStorage<StorageType>::from_unit(TEX_IMAGE_MISSING_B);
+			pixels[3] = ImageStorage<StorageType>::from_unit(TEX_IMAGE_MISSING_A);
 		}
-		return false;
 	}
 
-	/* read RGBA pixels */
-	float *pixels = (float*)tex_img.resize(width, height);
-	int scanlinesize = width*components*sizeof(float);
+	string name = image_texture_name(type, slot);
 
-	if(in) {
-		in->read_image(TypeDesc::FLOAT,
-			(uchar*)pixels + (height-1)*scanlinesize,
-			AutoStride,
-			-scanlinesize,
-			AutoStride);
+	tex_img.stats_name = img->filename;
 
-		in->close();
-		delete in;
-	}
-	else {
-		builtin_image_float_pixels_cb(img->filename, img->builtin_data, pixels);
+	if(!pack_images) {
+		thread_scoped_lock device_lock(device_mutex);
+		device->tex_alloc(name.c_str(), tex_img, true, true);
 	}
+}
 
-	if(components == 2) {
-		for(int i = width*height-1; i >= 0; i--) {
-			pixels[i*4+3] = pixels[i*2+1];
-			pixels[i*4+2] = pixels[i*2+0];
-			pixels[i*4+1] = pixels[i*2+0];
-			pixels[i*4+0] = pixels[i*2+0];
-		}
-	}
-	else if(components == 3) {
-		for(int i = width*height-1; i >= 0; i--) {
-			pixels[i*4+3] = 1.0f;
-			pixels[i*4+2] = pixels[i*3+2];
-			pixels[i*4+1] = pixels[i*3+1];
-			pixels[i*4+0] = pixels[i*3+0];
-		}
-	}
-	else if(components == 1) {
-		for(int i = width*height-1; i >= 0; i--) {
-			pixels[i*4+3] = 1.0f;
-			pixels[i*4+2] = pixels[i];
-			pixels[i*4+1] = pixels[i];
-			pixels[i*4+0] = pixels[i];
-		}
+template<typename DeviceType>
+void ImageManager::device_free_image_type(Device *device, device_vector<DeviceType>& tex_img)
+{
+	if(tex_img.device_pointer) {
+		thread_scoped_lock device_lock(device_mutex);
+		device->tex_free(tex_img);
 	}
 
-	return true;
+	tex_img.clear();
 }
 
 void ImageManager::device_load_image(Device *device, DeviceScene *dscene, int slot, Progress *progress)
@@ -459,79 +504,44 @@ void ImageManager::device_load_image(Device *device, DeviceScene *dscene, int sl
 	if(osl_texture_system)
 		return;
 
-	Image *img;
-	bool is_float;
-
-	if(slot >= tex_image_byte_start) {
-		img = images[slot - tex_image_byte_start];
-		is_float = false;
-	}
-	else {
-		img = float_images[slot];
-		is_float = true;
-	}
-
-	if(is_float) {
-		string filename = path_filename(float_images[slot]->filename);
-		progress->set_status("Updating Images", "Loading " + filename);
+	ImageDataType type;
+	int index = slot_to_type_index(slot, &type);
+	Image *img = images[type][index];
 
-		device_vector<float4>& tex_img = dscene->tex_float_image[slot];
-
-		if(tex_img.device_pointer) {
-			thread_scoped_lock device_lock(device_mutex);
-			device->tex_free(tex_img);
-		}
+	TextureCacheGlobals *tcg = texture_cache_globals(device);
 
-		if(!file_load_float_image(img, tex_img)) {
-			/* on failure to load, we set a 1x1 pixels pink image */
-			float *pixels = (float*)tex_img.resize(1, 1);
+	if(tcg && !img->builtin_data) {
+		progress->set_status("Updating Images", "Opening " + path_filename(img->filename));
 
-			pixels[0] = TEX_IMAGE_MISSING_R;
-			pixels[1] = TEX_IMAGE_MISSING_G;
-			pixels[2] = TEX_IMAGE_MISSING_B;
-			pixels[3] = TEX_IMAGE_MISSING_A;
-		}
-
-		string name;
-
-		if(slot >= 10) name = string_printf("__tex_image_float_0%d", slot);
-		else name = string_printf("__tex_image_float_00%d", slot);
-
-		if(!pack_images) {
-			thread_scoped_lock device_lock(device_mutex);
-			device->tex_alloc(name.c_str(), tex_img, true, true);
+		if(texture_cache_load_image(tcg, img, slot)) {
+			img->need_load = false;
+			return;
 		}
 	}
-	else {
-		string filename = path_filename(images[slot - tex_image_byte_start]->filename);
-		progress->set_status("Updating Images", "Loading " + filename);
-
-		device_vector<uchar4>& tex_img = dscene->tex_image[slot - tex_image_byte_start];
-
-		if(tex_img.device_pointer) {
-			thread_scoped_lock device_lock(device_mutex);
-			device->tex_free(tex_img);
-		}
-
-		if(!file_load_image(img, tex_img)) {
-			/* on failure to load, we set a 1x1 pixels pink image */
-			uchar *pixels = (uchar*)tex_img.resize(1, 1);
-
-			pixels[0] = (TEX_IMAGE_MISSING_R * 255);
-			pixels[1] = (TEX_IMAGE_MISSING_G * 255);
-			pixels[2] = (TEX_IMAGE_MISSING_B * 255);
-			pixels[3] = (TEX_IMAGE_MISSING_A * 255);
-		}
-
-		string name;
 
-		if(slot >= 10) name = string_printf("__tex_image_0%d", slot);
-		else name = string_printf("__tex_image_00%d", slot);
+	progress->set_status("Updating Images", "Loading " + path_filename(img->filename));
 
-		if(!pack_images) {
-			thread_scoped_lock device_lock(device_mutex);
-			device->tex_alloc(name.c_str(), tex_img, true, true);
-		}
+	switch(type) {
+		case IMAGE_DATA_TYPE_FLOAT4:
+			device_load_image_type<float>(device, img, type, slot, dscene->tex_float_image[index]);
+			break;
+		case IMAGE_DATA_TYPE_BYTE4:
+			device_load_image_type<uchar>(device, img, type, slot, dscene->tex_image[index]);
+			break;
+		case IMAGE_DATA_TYPE_HALF4:
+			device_load_image_type<half>(device, img, type, slot, dscene->tex_half4_image[index]);
+			break;
+		case IMAGE_DATA_TYPE_FLOAT:
+			device_load_image_type<float>(device, img, type, slot, dscene->tex_float1_image[index]);
+			break;
+		case IMAGE_DATA_TYPE_BYTE:
+			device_load_image_type<uchar>(device, img, type, slot, dscene->tex_byte1_image[index]);
+			break;
+		case IMAGE_DATA_TYPE_HALF:
+			device_load_image_type<half>(device, img, type, slot, dscene->tex_half1_image[index]);
+			break;
+		default:
+			break;
 	}
 
 	img->need_load = false;
@@ -539,50 +549,48 @@ void ImageManager::device_load_image(Device *device, DeviceScene *dscene, int sl
 
 void ImageManager::device_free_image(Device *device, DeviceScene *dscene, int slot)
 {
-	Image *img;
-	bool is_float;
-
-	if(slot >= tex_image_byte_start) {
-		img = images[slot - tex_image_byte_start];
-		is_float = false;
-	}
-	else {
-		img = float_images[slot];
-		is_float = true;
-	}
+	ImageDataType type;
+	int index = slot_to_type_index(slot, &type);
+	Image *img = images[type][index];
 
 	if(img) {
+		TextureCacheGlobals *tcg = texture_cache_globals(device);
+
+		if(tcg)
+			texture_cache_free_image(tcg, slot);
+
 		if(osl_texture_system) {
 #ifdef WITH_OSL
-			ustring filename(images[slot]->filename);
+			ustring filename(img->filename);
 			((OSL::TextureSystem*)osl_texture_system)->invalidate(filename);
 #endif
 		}
-		else if(is_float) {
-			device_vector<float4>& tex_img = dscene->tex_float_image[slot];
-
-			if(tex_img.device_pointer) {
-				thread_scoped_lock device_lock(device_mutex);
-				device->tex_free(tex_img);
-			}
-
-			tex_img.clear();
-
-			delete float_images[slot];
-			float_images[slot] = NULL;
-		}
 		else {
-			device_vector<uchar4>& tex_img = dscene->tex_image[slot - tex_image_byte_start];
-
-			if(tex_img.device_pointer) {
-				thread_scoped_lock device_lock(device_mutex);
-				device->tex_free(tex_img);
+			switch(type) {
+				case IMAGE_DATA_TYPE_FLOAT4:
+					device_free_image_type(device, dscene->tex_float_image[index]);
+					break;
+				case IMAGE_DATA_TYPE_BYTE4:
+					device_free_image_type(device, dscene->tex_image[index]);
+					break;
+				case IMAGE_DATA_TYPE_HALF4:
+					device_free_image_type(device, dscene->tex_half4_image[index]);
+					break;
+				case IMAGE_DATA_TYPE_FLOAT:
+					device_free_image_type(device, dscene->tex_float1_image[index]);
+					break;
+				case IMAGE_DATA_TYPE_BYTE:
+					device_free_image_type(device, dscene->tex_byte1_image[index]);
+					break;
+				case IMAGE_DATA_TYPE_HALF:
+					device_free_image_type(device, dscene->tex_half1_image[index]);
+					break;
+				default:
+					break;
 			}
 
-			tex_img.clear();
-
-			delete images[slot - tex_image_byte_start];
-			images[slot - tex_image_byte_start] = NULL;
+			delete img;
+			images[type][index] = NULL;
 		}
 	}
 }
@@ -592,31 +600,27 @@ void ImageManager::device_update(Device *device, DeviceScene *dscene, Progress&
 	if(!need_update)
 		return;
 
-	TaskPool pool;
+	TextureCacheGlobals *tcg = texture_cache_globals(device);
 
-	for(size_t slot = 0; slot < images.size(); slot++) {
-		if(!images[slot])
-			continue;
+	if(tcg)
+		texture_cache_init(tcg);
 
-		if(images[slot]->users == 0) {
-			device_free_image(device, dscene, slot + tex_image_byte_start);
-		}
-		else if(images[slot]->need_load) {
-			if(!osl_texture_system) 
-				pool.push(function_bind(&ImageManager::device_load_image, this, device, dscene, slot + tex_image_byte_start, &progress));
-		}
-	}
+	TaskPool pool;
 
-	for(size_t slot = 0; slot < float_images.size(); slot++) {
-		if(!float_images[slot])
-			continue;
+	for(int type = 0; type < IMAGE_DATA_NUM_TYPES; type++) {
+		for(size_t index = 0; index < images[type].size(); index++) {
+			if(!images[type][index])
+				continue;
 
-		if(float_images[slot]->users == 0) {
-			device_free_image(device, dscene, slot);
-		}
-		else if(float_images[slot]->need_load) {
-			if(!osl_texture_system) 
-				pool.push(function_bind(&ImageManager::device_load_image, this, device, dscene, slot, &progress));
+			int slot = type_index_to_slot(index, (ImageDataType)type);
+
+			if(images[type][index]->users == 0) {
+				device_free_image(device, dscene, slot);
+			}
+			else if(images[type][index]->need_load) {
+				if(!osl_texture_system) 
+					pool.push(function_bind(&ImageManager::device_load_image, this, device, dscene, slot, &progress));
+			}
 		}
 	}
 
@@ -632,23 +636,24 @@ void ImageManager::device_pack_images(Device *device, DeviceScene *dscene, Progr
 {
 	/* for OpenCL, we pack all image textures inside a single big texture, and
 	 * will do our own interpolation in the kernel */
+	vector<Image*>& byte_images = images[IMAGE_DATA_TYPE_BYTE4];
 	size_t size = 0;
 
-	for(size_t slot = 0; slot < images.size(); slot++) {
-		if(!images[slot])
+	for(size_t slot = 0; slot < byte_images.size(); slot++) {
+		if(!byte_images[slot])
 			continue;
 
 		device_vector<uchar4>& tex_img = dscene->tex_image[slot];
 		size += tex_img.size();
 	}
 
-	uint4 *info = dscene->tex_image_packed_info.resize(images.size());
+	uint4 *info = dscene->tex_image_packed_info.resize(byte_images.size());
 	uchar4 *pixels = dscene->tex_image_packed.resize(size);
 
 	size_t offset = 0;
 
-	for(size_t slot = 0; slot < images.size(); slot++) {
-		if(!images[slot])
+	for(size_t slot = 0; slot < byte_images.size(); slot++) {
+		if(!byte_images[slot])
 			continue;
 
 		device_vector<uchar4>& tex_img = dscene->tex_image[slot];
@@ -665,12 +670,106 @@ void ImageManager::device_pack_images(Device *device, DeviceScene *dscene, Progr
 		device->tex_alloc("__tex_image_packed_info", dscene->tex_image_packed_info);
 }
 
+/* Texture Cache */
+
+TextureCacheGlobals *ImageManager::texture_cache_globals(Device *device)
+{
+	/* OSL does its own lookups through its texture system */
+	if(!use_texture_cache || osl_texture_system)
+		return NULL;
+
+	return (TextureCacheGlobals*)device->texture_cache_memory();
+}
+
+void ImageManager::texture_cache_init(TextureCacheGlobals *tcg)
+{
+	if(!tcg->ts) {
+		/* not shared with other renders, so the memory limit is for this one only */
+		tcg->ts = TextureSystem::create(false);
+
+		tcg->ts->attribute("automip", 1);
+		tcg->ts->attribute("autotile", 64);
+		tcg->ts->attribute("max_memory_MB", (float)texture_cache_size);
+	}
+
+	/* images are opened from multiple threads, so allocate all slots in advance */
+	tcg->images.resize(num_slots());
+	tcg->use = true;
+}
+
+bool ImageManager::texture_cache_load_image(TextureCacheGlobals *tcg, Image *img, int slot)
+{
+	if(img->filename == "")
+		return false;
+
+	/* use a tiled and mipmapped version converted with maketx if there is one,
+	 * other files are tiled and mipmapped by the texture system as needed */
+	string filename = img->filename;
+	size_t ext = filename.rfind('.');
+
+	if(ext != string::npos && filename.find_first_of("/\\", ext) == string::npos) {
+		string tx_filename = filename.substr(0, ext) + ".tx";
+
+		if(tx_filename != filename && path_exists(tx_filename))
+			filename = tx_filename;
+	}
+
+	ustring ufilename(filename);
+	TextureCacheGlobals::Image& tc_img = tcg->images[slot];
+
+	/* reloading, discard tiles of the previous file contents, the file name may
+	 * have changed so use the one the tiles were cached under */
+	if(tc_img.handle) {
+		tcg->ts->invalidate(tc_img.filename);
+		tc_img.handle = NULL;
+	}
+
+	/* on failure the image is loaded in memory like without the cache */
+	int channels = 0;
+
+	if(!tcg->ts->get_texture_info(ufilename, 0, ustring("channels"), TypeDesc::TypeInt, &channels))
+		return false;
+
+	if(!(channels >= 1 && channels <= 4))
+		return false;
+
+	tc_img.filename = ufilename;
+	tc_img.handle = tcg->ts->get_texture_handle(ufilename);
+	tc_img.channels = channels;
+
+	return (tc_img.handle != NULL);
+}
+
+void ImageManager::texture_cache_free_image(TextureCacheGlobals *tcg, int slot)
+{
+	if(slot >= (int)tcg->images.size() || !tcg->images[slot].handle)
+		return;
+
+	tcg->ts->invalidate(tcg->images[slot].filename);
+	tcg->images[slot] = TextureCacheGlobals::Image();
+}
+
+void ImageManager::texture_cache_free(TextureCacheGlobals *tcg)
+{
+	if(tcg->ts) {
+		TextureSystem::destroy(tcg->ts);
+		tcg->ts = NULL;
+	}
+
+	tcg->images.clear();
+	tcg->use = false;
+}
+
 void ImageManager::device_free(Device *device, DeviceScene *dscene)
 {
-	for(size_t slot = 0; slot < images.size(); slot++)
-		device_free_image(device, dscene, slot + tex_image_byte_start);
-	for(size_t slot = 0; slot < float_images.size(); slot++)
-		device_free_image(device, dscene, slot);
+	for(int type = 0; type < IMAGE_DATA_NUM_TYPES; type++)
+		for(size_t index = 0; index < images[type].size(); index++)
+			device_free_image(device, dscene, type_index_to_slot(index, (ImageDataType)type));
+
+	TextureCacheGlobals *tcg = texture_cache_globals(device);
+
+	if(tcg)
+		texture_cache_free(tcg);
 
 	device->tex_free(dscene->tex_image_packed);
 	device->tex_free(dscene->tex_image_packed_info);
@@ -678,8 +777,8 @@ void ImageManager::device_free(Device *device, DeviceScene *dscene)
 	dscene->tex_image_packed.clear();
 	dscene->tex_image_packed_info.clear();
 
-	images.clear();
-	float_images.clear();
+	for(int type = 0; type < IMAGE_DATA_NUM_TYPES; type++)
+		images[type].clear();
 }
 
 CCL_NAMESPACE_END
@@ -30,9 +30,9 @@ CCL_NAMESPACE_BEGIN
 #define TEX_NUM_IMAGES			95
 #define TEX_IMAGE_BYTE_START	TEX_NUM_FLOAT_IMAGES
 
-#define TEX_EXTENDED_NUM_FLOAT_IMAGES	5
-#define TEX_EXTENDED_NUM_IMAGES			512
-#define TEX_EXTENDED_IMAGE_BYTE_START	TEX_EXTENDED_NUM_FLOAT_IMAGES
+#define TEX_EXTENDED_NUM_FLOAT_IMAGES	TEX_NUM_FLOAT4_IMAGES_CPU
+#define TEX_EXTENDED_NUM_IMAGES			TEX_NUM_BYTE4_IMAGES_CPU
+#define TEX_EXTENDED_IMAGE_BYTE_START	TEX_START_BYTE4_CPU
 
 /* color to use when textures are not found */
 #define TEX_IMAGE_MISSING_R 1
@@ -43,6 +43,20 @@ CCL_NAMESPACE_BEGIN
 class Device;
 class DeviceScene;
 class Progress;
+struct TextureCacheGlobals;
+
+/* Storage of image pixels on the device. The compact types are only available
+ * with extended image limits. */
+enum ImageDataType {
+	IMAGE_DATA_TYPE_FLOAT4 = 0,
+	IMAGE_DATA_TYPE_BYTE4,
+	IMAGE_DATA_TYPE_HALF4,
+	IMAGE_DATA_TYPE_FLOAT,
+	IMAGE_DATA_TYPE_BYTE,
+	IMAGE_DATA_TYPE_HALF,
+
+	IMAGE_DATA_NUM_TYPES
+};
 
 class ImageManager {
 public:
@@ -57,6 +71,7 @@ public:
 	void device_free(Device *device, DeviceScene *dscene);
 
 	void set_osl_texture_system(void *texture_system);
+	void set_texture_cache(bool use_texture_cache_, int texture_cache_size_);
 	void set_pack_images(bool pack_images_);
 	void set_extended_image_limits(void);
 	bool set_animation_frame_update(int frame);
@@ -67,9 +82,9 @@ public:
 	boost::function<bool(const string &filename, void *data, unsigned char *pixels)> builtin_image_pixels_cb;
 	boost::function<bool(const string &filename, void *data, float *pixels)> builtin_image_float_pixels_cb;
 private:
-	int tex_num_images;
-	int tex_num_float_images;
-	int tex_image_byte_start;
+	/* number of slots and first slot for each data type */
+	int tex_num_images[IMAGE_DATA_NUM_TYPES];
+	int tex_start_images[IMAGE_DATA_NUM_TYPES];
 	thread_mutex device_mutex;
 	int animation_frame;
 
@@ -82,18 +97,38 @@ private:
 		int users;
 	};
 
-	vector<Image*> images;
-	vector<Image*> float_images;
+	vector<Image*> images[IMAGE_DATA_NUM_TYPES];
 	void *osl_texture_system;
 	bool pack_images;
 
-	bool file_load_image(Image *img, device_vector<uchar4>& tex_img);
-	bool file_load_float_image(Image *img, device_vector<float4>& tex_img);
+	/* file images are read on demand through the device texture cache, with
+	 * the memory limit in megabytes */
+	bool use_texture_cache;
+	int texture_cache_size;
+
+	ImageDataType get_image_metadata(const string& filename, void *builtin_data, bool& is_linear);
+	int type_index_to_slot(int index, ImageDataType type);
+	int slot_to_type_index(int slot, ImageDataType *type);
+	int num_slots();
+
+	template<typename StorageType, typename DeviceType>
+	bool file_load_image(Image *img, device_vector<DeviceType>& tex_img);
+
+	template<typename StorageType, typename DeviceType>
+	void device_load_image_type(Device *device, Image *img, ImageDataType type, int slot, device_vector<DeviceType>& tex_img);
+	template<typename DeviceType>
+	void device_free_image_type(Device *device, device_vector<DeviceType>& tex_img);
 
 	void device_load_image(Device *device, DeviceScene *dscene, int slot, Progress *progess);
 	void device_free_image(Device *device, DeviceScene *dscene, int slot);
 
 	void device_pack_images(Device *device, DeviceScene *dscene, Progress& progess);
+
+	TextureCacheGlobals *texture_cache_globals(Device *device);
+	void texture_cache_init(TextureCacheGlobals *tcg);
+	bool texture_cache_load_image(TextureCacheGlobals *tcg, Image *img, int slot);
+	void texture_cache_free_image(TextureCacheGlobals *tcg, int slot);
+	void texture_cache_free(TextureCacheGlobals *tcg);
 };
 
 CCL_NAMESPACE_END
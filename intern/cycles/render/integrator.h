@@ -66,6 +66,10 @@ public:
 
 	SamplingPattern sampling_pattern;
 
+	/* adaptive sampling, zero threshold disables it */
+	float adaptive_threshold;
+	int adaptive_min_samples;
+
 	bool need_update;
 
 	Integrator();
@@ -18,7 +18,9 @@
 #include "device.h"
 #include "integrator.h"
 #include "film.h"
+#include "graph.h"
 #include "light.h"
+#include "light_tree.h"
 #include "mesh.h"
 #include "object.h"
 #include "scene.h"
@@ -141,6 +143,34 @@ LightManager::~LightManager()
 {
 }
 
+/* rough estimate of the strength of a shader from the emission and background nodes
+ * in its graph, to weight emitters in the light tree. linked inputs are assumed to
+ * be around one, shaders without such nodes (OSL scripts) count as one */
+static float light_tree_shader_strength(Shader *shader)
+{
+	float strength = 0.0f;
+	bool found = false;
+
+	if(!shader->graph)
+		return 1.0f;
+
+	foreach(ShaderNode *node, shader->graph->nodes) {
+		if(node->name != ustring("emission") && node->name != ustring("background"))
+			continue;
+
+		ShaderInput *color_in = node->input("Color");
+		ShaderInput *strength_in = node->input("Strength");
+
+		float color = (color_in->link)? 1.0f: average(color_in->value);
+		float node_strength = (strength_in->link)? 1.0f: strength_in->value.x;
+
+		strength += fabsf(color*node_strength);
+		found = true;
+	}
+
+	return (found)? strength: 1.0f;
+}
+
 void LightManager::device_update_distribution(Device *device, DeviceScene *dscene, Scene *scene, Progress& progress)
 {
 	progress.set_status("Updating Lights", "Computing distribution");
@@ -196,6 +226,16 @@ void LightManager::device_update_distribution(Device *device, DeviceScene *dscen
 	float4 *distribution = dscene->light_distribution.resize(num_distribution + 1);
 	float totarea = 0.0f;
 
+	/* emitters for the light tree */
+	vector<LightTreeEmitter> emitters;
+	vector<int> inf_lights;
+	vector<float> inf_energy;
+	vector<bool> inf_background;
+	vector<float> shader_strength(scene->shaders.size());
+
+	for(size_t i = 0; i < scene->shaders.size(); i++)
+		shader_strength[i] = light_tree_shader_strength(scene->shaders[i]);
+
 	/* triangles */
 	size_t offset = 0;
 	int j = 0;
@@ -243,10 +283,28 @@ void LightManager::device_update_distribution(Device *device, DeviceScene *dscen
 				use_light_visibility = true;
 			}
 
+			int emitter_index = -1;
+
 			for(size_t i = 0; i < mesh->triangles.size(); i++) {
 				Shader *shader = scene->shaders[mesh->shader[i]];
 
 				if(shader->use_mis && shader->has_surface_emission) {
+					/* runs of consecutive triangles are light tree leaves */
+					if(emitter_index == -1 || emitters[emitter_index].dist_count == LIGHT_TREE_LEAF_TRIANGLES) {
+						LightTreeEmitter emitter;
+
+						emitter.bounds = BoundBox::empty;
+						emitter.energy = 0.0f;
+						emitter.area = 0.0f;
+						emitter.axis = make_float3(0.0f, 0.0f, 1.0f);
+						emitter.theta_o = M_PI_F;
+						emitter.dist_start = offset;
+						emitter.dist_count = 0;
+
+						emitter_index = emitters.size();
+						emitters.push_back(emitter);
+					}
+
 					distribution[offset].x = totarea;
 					distribution[offset].y = __int_as_float(i + mesh->tri_offset);
 					distribution[offset].z = __int_as_float(shader_id);
@@ -264,7 +322,16 @@ void LightManager::device_update_distribution(Device *device, DeviceScene *dscen
 						p3 = transform_point(&tfm, p3);
 					}
 
-					totarea += triangle_area(p1, p2, p3);
+					float area = triangle_area(p1, p2, p3);
+					totarea += area;
+
+					LightTreeEmitter& emitter = emitters[emitter_index];
+					emitter.bounds.grow(p1);
+					emitter.bounds.grow(p2);
+					emitter.bounds.grow(p3);
+					emitter.energy += area*shader_strength[mesh->shader[i]];
+					emitter.area += area;
+					emitter.dist_count++;
 				}
 			}
 
@@ -327,6 +394,48 @@ void LightManager::device_update_distribution(Device *device, DeviceScene *dscen
 			use_lamp_mis = true;
 		if(light->type == LIGHT_BACKGROUND)
 			num_background_lights++;
+
+		/* lamps with a position are light tree leaves, lamp strength is already
+		 * the emitted power so it is not multiplied by the lamp area */
+		float strength = shader_strength[light->shader];
+
+		if(light->type == LIGHT_DISTANT || light->type == LIGHT_BACKGROUND) {
+			/* irradiance, the background emits from the whole hemisphere */
+			inf_lights.push_back(offset);
+			inf_energy.push_back((light->type == LIGHT_BACKGROUND)? M_PI_F*strength: strength);
+			inf_background.push_back(light->type == LIGHT_BACKGROUND);
+		}
+		else {
+			LightTreeEmitter emitter;
+
+			emitter.bounds = BoundBox::empty;
+			emitter.energy = strength;
+			emitter.area = 1.0f;
+			emitter.axis = make_float3(0.0f, 0.0f, 1.0f);
+			emitter.theta_o = M_PI_F;
+			emitter.dist_start = offset;
+			emitter.dist_count = 1;
+
+			if(light->type == LIGHT_AREA) {
+				float3 axisu = light->axisu*(light->sizeu*light->size*0.5f);
+				float3 axisv = light->axisv*(light->sizev*light->size*0.5f);
+
+				emitter.bounds.grow(light->co - axisu - axisv);
+				emitter.bounds.grow(light->co - axisu + axisv);
+				emitter.bounds.grow(light->co + axisu - axisv);
+				emitter.bounds.grow(light->co + axisu + axisv);
+
+				/* area lights emit from one side only */
+				if(len(light->dir) > 0.0f) {
+					emitter.axis = normalize(light->dir);
+					emitter.theta_o = 0.0f;
+				}
+			}
+			else
+				emitter.bounds.grow(light->co, light->size);
+
+			emitters.push_back(emitter);
+		}
 	}
 
 	/* normalize cumulative distribution functions */
@@ -376,6 +485,72 @@ void LightManager::device_update_distribution(Device *device, DeviceScene *dscen
 
 		kintegrator->use_lamp_mis = use_lamp_mis;
 
+		/* light tree, only worth it with multiple emitters that have a position */
+		kintegrator->use_light_tree = false;
+
+		if(emitters.size() > 1) {
+			progress.set_status("Updating Lights", "Building light tree");
+
+			vector<float4> nodes;
+			vector<uint> leaves;
+
+			LightTreeBuilder builder(emitters);
+			builder.build(nodes, leaves);
+
+			/* share of the distant and background lights, comparing their irradiance
+			 * with that of the tree at the distance of its bounds radius. clamped so
+			 * neither side is starved where the estimate is off */
+			float tree_energy = nodes[0].w;
+			float tree_radius = 0.5f*len(float4_to_float3(nodes[1]) - float4_to_float3(nodes[0]));
+			float tree_irradiance = tree_energy/(4.0f*M_PI_F*max(tree_radius*tree_radius, 1e-4f));
+			float total_inf_energy = 0.0f;
+			float pdf_tree = 1.0f;
+
+			foreach(float energy, inf_energy)
+				total_inf_energy += energy;
+
+			if(inf_lights.size()) {
+				if(tree_irradiance + total_inf_energy > 0.0f)
+					pdf_tree = clamp(tree_irradiance/(tree_irradiance + total_inf_energy), 0.1f, 0.9f);
+				else
+					pdf_tree = 0.5f;
+			}
+
+			/* distant and background lights go after the tree, storing the probability
+			 * of picking them among each other */
+			int inf_node = nodes.size()/LIGHT_TREE_NODE_SIZE;
+			float background_pdf = 0.0f;
+
+			for(size_t i = 0; i < inf_lights.size(); i++) {
+				float share = (total_inf_energy > 0.0f)? inf_energy[i]/total_inf_energy: 1.0f/inf_lights.size();
+				int dist_index = inf_lights[i];
+
+				if(inf_background[i])
+					background_pdf += (1.0f - pdf_tree)*share;
+
+				nodes.push_back(make_float4(0.0f, 0.0f, 0.0f, share));
+				nodes.push_back(make_float4(0.0f, 0.0f, 0.0f, -1.0f));
+				nodes.push_back(make_float4(0.0f, 0.0f, 1.0f, __int_as_float(-1)));
+				nodes.push_back(make_float4(__int_as_float(dist_index), __int_as_float(1), 1.0f, 0.0f));
+			}
+
+			float4 *tree_nodes = dscene->light_tree_nodes.resize(nodes.size());
+			uint *tree_leaves = dscene->light_tree_leaves.resize(leaves.size());
+
+			memcpy(tree_nodes, &nodes[0], sizeof(float4)*nodes.size());
+			memcpy(tree_leaves, &leaves[0], sizeof(uint)*leaves.size());
+
+			kintegrator->use_light_tree = true;
+			kintegrator->light_tree_num_leaves = leaves.size()/2;
+			kintegrator->light_tree_inf_node = inf_node;
+			kintegrator->light_tree_num_inf = inf_lights.size();
+			kintegrator->light_tree_pdf = pdf_tree;
+			kintegrator->light_tree_background_pdf = background_pdf;
+
+			device->tex_alloc("__light_tree_nodes", dscene->light_tree_nodes);
+			device->tex_alloc("__light_tree_leaves", dscene->light_tree_leaves);
+		}
+
 		/* bit of an ugly hack to compensate for emitting triangles influencing
 		 * amount of samples we get for this pass */
 		kfilm->pass_shadow_scale = 1.0f;
@@ -398,6 +573,7 @@ void LightManager::device_update_distribution(Device *device, DeviceScene *dscen
 		kintegrator->pdf_lights = 0.0f;
 		kintegrator->inv_pdf_lights = 0.0f;
 		kintegrator->use_lamp_mis = false;
+		kintegrator->use_light_tree = false;
 		kfilm->pass_shadow_scale = 1.0f;
 	}
 }
@@ -668,11 +844,15 @@ void LightManager::device_free(Device *device, DeviceScene *dscene)
 	device->tex_free(dscene->light_data);
 	device->tex_free(dscene->light_background_marginal_cdf);
 	device->tex_free(dscene->light_background_conditional_cdf);
+	device->tex_free(dscene->light_tree_nodes);
+	device->tex_free(dscene->light_tree_leaves);
 
 	dscene->light_distribution.clear();
 	dscene->light_data.clear();
 	dscene->light_background_marginal_cdf.clear();
 	dscene->light_background_conditional_cdf.clear();
+	dscene->light_tree_nodes.clear();
+	dscene->light_tree_leaves.clear();
 }
 
 void LightManager::tag_update(Scene *scene)
@@ -0,0 +1,169 @@
+/*
+ * Copyright 2011-2013 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include "kernel_types.h"
+
+#include "light_tree.h"
+
+#include "util_algorithm.h"
+#include "util_math.h"
+
+CCL_NAMESPACE_BEGIN
+
+struct LightTreeEmitterCompare {
+	int dim;
+
+	LightTreeEmitterCompare(int dim_)
+	: dim(dim_)
+	{
+	}
+
+	bool operator()(const LightTreeEmitter& a, const LightTreeEmitter& b) const
+	{
+		return a.bounds.center2()[dim] < b.bounds.center2()[dim];
+	}
+};
+
+/* smallest cone containing two cones, theta_o of pi means all directions */
+static void light_tree_cone_union(float3& axis, float& theta_o, float3 axis_b, float theta_o_b)
+{
+	if(theta_o_b > theta_o) {
+		swap(axis, axis_b);
+		swap(theta_o, theta_o_b);
+	}
+
+	if(theta_o >= M_PI_F)
+		return;
+
+	float theta_d = safe_acosf(dot(axis, axis_b));
+
+	/* b is inside a */
+	if(min(theta_d + theta_o_b, M_PI_F) <= theta_o)
+		return;
+
+	float theta_new = 0.5f*(theta_o + theta_d + theta_o_b);
+
+	if(theta_new >= M_PI_F) {
+		theta_o = M_PI_F;
+		return;
+	}
+
+	/* rotate axis towards b so the new cone touches both */
+	float3 ortho = axis_b - axis*dot(axis, axis_b);
+	float ortho_len = len(ortho);
+
+	if(ortho_len == 0.0f) {
+		theta_o = M_PI_F;
+		return;
+	}
+
+	float theta_r = theta_new - theta_o;
+
+	axis = normalize(axis*cosf(theta_r) + (ortho/ortho_len)*sinf(theta_r));
+	theta_o = theta_new;
+}
+
+LightTreeBuilder::LightTreeBuilder(vector<LightTreeEmitter>& emitters_)
+: emitters(emitters_)
+{
+}
+
+void LightTreeBuilder::build(vector<float4>& nodes, vector<uint>& leaves)
+{
+	vector<pair<uint, uint> > leaf_nodes;
+
+	nodes.clear();
+	leaves.clear();
+
+	if(emitters.size() == 0)
+		return;
+
+	nodes.reserve((2*emitters.size() - 1)*LIGHT_TREE_NODE_SIZE);
+	leaf_nodes.reserve(emitters.size());
+
+	recurse(0, emitters.size(), nodes, leaf_nodes);
+
+	/* sorted by distribution start, so the kernel can find the leaf of a triangle */
+	sort(leaf_nodes.begin(), leaf_nodes.end());
+
+	leaves.resize(leaf_nodes.size()*2);
+
+	for(size_t i = 0; i < leaf_nodes.size(); i++) {
+		leaves[i*2 + 0] = leaf_nodes[i].first;
+		leaves[i*2 + 1] = leaf_nodes[i].second;
+	}
+}
+
+LightTreeBuilder::NodeBounds LightTreeBuilder::recurse(int start, int end, vector<float4>& nodes, vector<pair<uint, uint> >& leaves)
+{
+	int index = nodes.size()/LIGHT_TREE_NODE_SIZE;
+	int right = -1;
+	int dist_start = 0, dist_count = 0;
+	float area = 0.0f;
+	NodeBounds node;
+
+	nodes.resize(nodes.size() + LIGHT_TREE_NODE_SIZE);
+
+	if(end - start == 1) {
+		const LightTreeEmitter& emitter = emitters[start];
+
+		node.bounds = emitter.bounds;
+		node.energy = emitter.energy;
+		node.axis = emitter.axis;
+		node.theta_o = emitter.theta_o;
+
+		dist_start = emitter.dist_start;
+		dist_count = emitter.dist_count;
+		area = emitter.area;
+
+		leaves.push_back(pair<uint, uint>(dist_start, index));
+	}
+	else {
+		/* split at the median of the emitter centers along the largest axis */
+		BoundBox centers = BoundBox::empty;
+
+		for(int i = start; i < end; i++)
+			centers.grow(emitters[i].bounds.center2());
+
+		float3 size = centers.size();
+		int dim = (size.x > size.y)? ((size.x > size.z)? 0: 2): ((size.y > size.z)? 1: 2);
+		int mid = (start + end)/2;
+
+		std::nth_element(emitters.begin() + start, emitters.begin() + mid, emitters.begin() + end,
+			LightTreeEmitterCompare(dim));
+
+		/* depth first, the left child directly follows its parent */
+		node = recurse(start, mid, nodes, leaves);
+		right = nodes.size()/LIGHT_TREE_NODE_SIZE;
+		NodeBounds right_node = recurse(mid, end, nodes, leaves);
+
+		node.bounds.grow(right_node.bounds);
+		node.energy += right_node.energy;
+		light_tree_cone_union(node.axis, node.theta_o, right_node.axis, right_node.theta_o);
+	}
+
+	float cos_theta_o = (node.theta_o >= M_PI_F)? -1.0f: cosf(node.theta_o);
+	float4 *data = &nodes[index*LIGHT_TREE_NODE_SIZE];
+
+	data[0] = make_float4(node.bounds.min.x, node.bounds.min.y, node.bounds.min.z, node.energy);
+	data[1] = make_float4(node.bounds.max.x, node.bounds.max.y, node.bounds.max.z, cos_theta_o);
+	data[2] = make_float4(node.axis.x, node.axis.y, node.axis.z, __int_as_float(right));
+	data[3] = make_float4(__int_as_float(dist_start), __int_as_float(dist_count), area, 0.0f);
+
+	return node;
+}
+
+CCL_NAMESPACE_END
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2011-2013 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#ifndef __LIGHT_TREE_H__
+#define __LIGHT_TREE_H__
+
+#include "util_boundbox.h"
+#include "util_map.h"
+#include "util_types.h"
+#include "util_vector.h"
+
+CCL_NAMESPACE_BEGIN
+
+/* Light Tree
+ *
+ * Hierarchy over the emitters in the light distribution, used by the kernel to
+ * pick emitters proportional to their emitted energy, distance and orientation
+ * relative to the shading point. Each emitter is a range of the light distribution. */
+
+/* maximum number of consecutive emissive triangles of an object in one leaf */
+#define LIGHT_TREE_LEAF_TRIANGLES 16
+
+struct LightTreeEmitter {
+	BoundBox bounds;
+	/* estimated emission times area, area only used to pick triangles in the leaf */
+	float energy;
+	float area;
+
+	/* emission directions are within theta_o of axis, pi if not oriented */
+	float3 axis;
+	float theta_o;
+
+	int dist_start;
+	int dist_count;
+};
+
+class LightTreeBuilder {
+public:
+	LightTreeBuilder(vector<LightTreeEmitter>& emitters);
+
+	/* nodes are packed depth first with LIGHT_TREE_NODE_SIZE float4 each, leaves
+	 * receives (distribution start, node) pairs sorted by distribution start */
+	void build(vector<float4>& nodes, vector<uint>& leaves);
+
+protected:
+	struct NodeBounds {
+		BoundBox bounds;
+		float energy;
+		float3 axis;
+		float theta_o;
+	};
+
+	NodeBounds recurse(int start, int end, vector<float4>& nodes, vector<pair<uint, uint> >& leaves);
+
+	vector<LightTreeEmitter>& emitters;
+};
+
+CCL_NAMESPACE_END
+
+#endif /* __LIGHT_TREE_H__ */
+
@@ -20,6 +20,8 @@
 #include "osl.h"
 #include "sky_model.h"
 
+#include "svm_math_util.h"
+
 #include "util_foreach.h"
 #include "util_transform.h"
 
@@ -157,6 +159,21 @@ void TextureMapping::compile(OSLCompiler &compiler)
 	}
 }
 
+bool TextureMapping::equals(const TextureMapping& other) const
+{
+	return translation == other.translation &&
+	       rotation == other.rotation &&
+	       scale == other.scale &&
+	       min == other.min &&
+	       max == other.max &&
+	       use_minmax == other.use_minmax &&
+	       type == other.type &&
+	       x_mapping == other.x_mapping &&
+	       y_mapping == other.y_mapping &&
+	       z_mapping == other.z_mapping &&
+	       projection == other.projection;
+}
+
 /* Image Texture */
 
 static ShaderEnum color_space_init()
@@ -217,6 +234,26 @@ ShaderNode *ImageTextureNode::clone() const
 	return node;
 }
 
+uint ImageTextureNode::uv_attribute(SVMCompiler& compiler)
+{
+	/* UV map the coordinates are taken from unmodified, so the kernel can use
+	 * its derivatives for filtering */
+	ShaderOutput *link = input("Vector")->link;
+
+	if(!link || !tex_mapping.skip())
+		return ATTR_STD_NONE;
+
+	if(link->parent->name == ustring("texture_coordinate") && link == link->parent->output("UV")) {
+		if(!((TextureCoordinateNode*)link->parent)->from_dupli)
+			return compiler.attribute(ATTR_STD_UV);
+	}
+	else if(link->parent->name == ustring("attribute")) {
+		return compiler.attribute(((AttributeNode*)link->parent)->attribute);
+	}
+
+	return ATTR_STD_NONE;
+}
+
 void ImageTextureNode::compile(SVMCompiler& compiler)
 {
 	ShaderInput *vector_in = input("Vector");
@@ -253,7 +290,8 @@ void ImageTextureNode::compile(SVMCompiler& compiler)
 					vector_offset,
 					color_out->stack_offset,
 					alpha_out->stack_offset,
-					srgb));
+					srgb),
+				uv_attribute(compiler));
 		}
 		else {
 			compiler.add_node(NODE_TEX_IMAGE_BOX,
@@ -303,6 +341,21 @@ void ImageTextureNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_image_texture");
 }
 
+bool ImageTextureNode::equals(ShaderNode *other)
+{
+	if(!equals_inputs(other))
+		return false;
+
+	ImageTextureNode *node = static_cast<ImageTextureNode*>(other);
+	return tex_mapping.equals(node->tex_mapping) &&
+	       filename == node->filename &&
+	       builtin_data == node->builtin_data &&
+	       color_space == node->color_space &&
+	       projection == node->projection &&
+	       projection_blend == node->projection_blend &&
+	       animated == node->animated;
+}
+
 /* Environment Texture */
 
 static ShaderEnum env_projection_init()
@@ -426,6 +479,20 @@ void EnvironmentTextureNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_environment_texture");
 }
 
+bool EnvironmentTextureNode::equals(ShaderNode *other)
+{
+	if(!equals_inputs(other))
+		return false;
+
+	EnvironmentTextureNode *node = static_cast<EnvironmentTextureNode*>(other);
+	return tex_mapping.equals(node->tex_mapping) &&
+	       filename == node->filename &&
+	       builtin_data == node->builtin_data &&
+	       color_space == node->color_space &&
+	       projection == node->projection &&
+	       animated == node->animated;
+}
+
 /* Sky Texture */
 
 static float2 sky_spherical_coordinates(float3 dir)
@@ -696,6 +763,16 @@ void GradientTextureNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_gradient_texture");
 }
 
+bool GradientTextureNode::equals(ShaderNode *other)
+{
+	if(!equals_inputs(other))
+		return false;
+
+	GradientTextureNode *node = static_cast<GradientTextureNode*>(other);
+	return tex_mapping.equals(node->tex_mapping) &&
+	       type == node->type;
+}
+
 /* Noise Texture */
 
 NoiseTextureNode::NoiseTextureNode()
@@ -755,6 +832,15 @@ void NoiseTextureNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_noise_texture");
 }
 
+bool NoiseTextureNode::equals(ShaderNode *other)
+{
+	if(!equals_inputs(other))
+		return false;
+
+	NoiseTextureNode *node = static_cast<NoiseTextureNode*>(other);
+	return tex_mapping.equals(node->tex_mapping);
+}
+
 /* Voronoi Texture */
 
 static ShaderEnum voronoi_coloring_init()
@@ -818,6 +904,16 @@ void VoronoiTextureNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_voronoi_texture");
 }
 
+bool VoronoiTextureNode::equals(ShaderNode *other)
+{
+	if(!equals_inputs(other))
+		return false;
+
+	VoronoiTextureNode *node = static_cast<VoronoiTextureNode*>(other);
+	return tex_mapping.equals(node->tex_mapping) &&
+	       coloring == node->coloring;
+}
+
 /* Musgrave Texture */
 
 static ShaderEnum musgrave_type_init()
@@ -908,6 +1004,16 @@ void MusgraveTextureNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_musgrave_texture");
 }
 
+bool MusgraveTextureNode::equals(ShaderNode *other)
+{
+	if(!equals_inputs(other))
+		return false;
+
+	MusgraveTextureNode *node = static_cast<MusgraveTextureNode*>(other);
+	return tex_mapping.equals(node->tex_mapping) &&
+	       type == node->type;
+}
+
 /* Wave Texture */
 
 static ShaderEnum wave_type_init()
@@ -988,6 +1094,16 @@ void WaveTextureNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_wave_texture");
 }
 
+bool WaveTextureNode::equals(ShaderNode *other)
+{
+	if(!equals_inputs(other))
+		return false;
+
+	WaveTextureNode *node = static_cast<WaveTextureNode*>(other);
+	return tex_mapping.equals(node->tex_mapping) &&
+	       type == node->type;
+}
+
 /* Magic Texture */
 
 MagicTextureNode::MagicTextureNode()
@@ -1046,6 +1162,16 @@ void MagicTextureNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_magic_texture");
 }
 
+bool MagicTextureNode::equals(ShaderNode *other)
+{
+	if(!equals_inputs(other))
+		return false;
+
+	MagicTextureNode *node = static_cast<MagicTextureNode*>(other);
+	return tex_mapping.equals(node->tex_mapping) &&
+	       depth == node->depth;
+}
+
 /* Checker Texture */
 
 CheckerTextureNode::CheckerTextureNode()
@@ -1103,6 +1229,15 @@ void CheckerTextureNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_checker_texture");
 }
 
+bool CheckerTextureNode::equals(ShaderNode *other)
+{
+	if(!equals_inputs(other))
+		return false;
+
+	CheckerTextureNode *node = static_cast<CheckerTextureNode*>(other);
+	return tex_mapping.equals(node->tex_mapping);
+}
+
 /* Brick Texture */
 
 BrickTextureNode::BrickTextureNode()
@@ -1197,6 +1332,19 @@ void BrickTextureNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_brick_texture");
 }
 
+bool BrickTextureNode::equals(ShaderNode *other)
+{
+	if(!equals_inputs(other))
+		return false;
+
+	BrickTextureNode *node = static_cast<BrickTextureNode*>(other);
+	return tex_mapping.equals(node->tex_mapping) &&
+	       offset == node->offset &&
+	       squash == node->squash &&
+	       offset_frequency == node->offset_frequency &&
+	       squash_frequency == node->squash_frequency;
+}
+
 /* Normal */
 
 NormalNode::NormalNode()
@@ -1263,6 +1411,24 @@ void MappingNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_mapping");
 }
 
+ShaderInput *MappingNode::bypass_input(ShaderOutput *socket)
+{
+	/* identity transform, normal mapping still normalizes the vector */
+	if(tex_mapping.skip() && tex_mapping.type != TextureMapping::NORMAL)
+		return input("Vector");
+
+	return NULL;
+}
+
+bool MappingNode::equals(ShaderNode *other)
+{
+	if(!equals_inputs(other))
+		return false;
+
+	MappingNode *node = static_cast<MappingNode*>(other);
+	return tex_mapping.equals(node->tex_mapping);
+}
+
 /* Convert */
 
 ConvertNode::ConvertNode(ShaderSocketType from_, ShaderSocketType to_, bool autoconvert)
@@ -1395,6 +1561,44 @@ void ConvertNode::compile(OSLCompiler& compiler)
 		assert(0);
 }
 
+bool ConvertNode::constant_fold(ShaderOutput *socket, float3 *optimized_value)
+{
+	ShaderInput *in = inputs[0];
+
+	/* int and string values are not folded */
+	if(!in->constant() || from == SHADER_SOCKET_INT || from == SHADER_SOCKET_STRING ||
+	   to == SHADER_SOCKET_INT || to == SHADER_SOCKET_STRING)
+		return false;
+
+	if(from == SHADER_SOCKET_FLOAT) {
+		/* float to float3 */
+		*optimized_value = make_float3(in->value.x, in->value.x, in->value.x);
+	}
+	else if(to == SHADER_SOCKET_FLOAT) {
+		if(from == SHADER_SOCKET_COLOR)
+			/* color to float */
+			optimized_value->x = linear_rgb_to_gray(in->value);
+		else
+			/* vector/point/normal to float */
+			optimized_value->x = (in->value.x + in->value.y + in->value.z)*(1.0f/3.0f);
+	}
+	else {
+		/* float3 to float3 */
+		*optimized_value = in->value;
+	}
+
+	return true;
+}
+
+bool ConvertNode::equals(ShaderNode *other)
+{
+	if(!equals_inputs(other))
+		return false;
+
+	ConvertNode *node = static_cast<ConvertNode*>(other);
+	return from == node->from && to == node->to;
+}
+
 /* Proxy */
 
 ProxyNode::ProxyNode(ShaderSocketType type_)
@@ -2131,6 +2335,11 @@ void GeometryNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_geometry");
 }
 
+bool GeometryNode::equals(ShaderNode *other)
+{
+	return equals_inputs(other);
+}
+
 /* TextureCoordinate */
 
 TextureCoordinateNode::TextureCoordinateNode()
@@ -2264,6 +2473,15 @@ void TextureCoordinateNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_texture_coordinate");
 }
 
+bool TextureCoordinateNode::equals(ShaderNode *other)
+{
+	if(!equals_inputs(other))
+		return false;
+
+	TextureCoordinateNode *node = static_cast<TextureCoordinateNode*>(other);
+	return from_dupli == node->from_dupli;
+}
+
 /* Light Path */
 
 LightPathNode::LightPathNode()
@@ -2627,6 +2845,17 @@ void ValueNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_value");
 }
 
+bool ValueNode::constant_fold(ShaderOutput *socket, float3 *optimized_value)
+{
+	*optimized_value = make_float3(value, 0.0f, 0.0f);
+	return true;
+}
+
+bool ValueNode::equals(ShaderNode *other)
+{
+	return equals_inputs(other) && value == static_cast<ValueNode*>(other)->value;
+}
+
 /* Color */
 
 ColorNode::ColorNode()
@@ -2655,6 +2884,17 @@ void ColorNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_value");
 }
 
+bool ColorNode::constant_fold(ShaderOutput *socket, float3 *optimized_value)
+{
+	*optimized_value = value;
+	return true;
+}
+
+bool ColorNode::equals(ShaderNode *other)
+{
+	return equals_inputs(other) && value == static_cast<ColorNode*>(other)->value;
+}
+
 /* Add Closure */
 
 AddClosureNode::AddClosureNode()
@@ -2759,6 +2999,36 @@ void InvertNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_invert");
 }
 
+bool InvertNode::constant_fold(ShaderOutput *socket, float3 *optimized_value)
+{
+	ShaderInput *fac_in = input("Fac");
+	ShaderInput *color_in = input("Color");
+
+	if(!fac_in->constant() || !color_in->constant())
+		return false;
+
+	float fac = fac_in->value.x;
+	float3 color = color_in->value;
+
+	*optimized_value = fac*(make_float3(1.0f, 1.0f, 1.0f) - color) + (1.0f - fac)*color;
+	return true;
+}
+
+ShaderInput *InvertNode::bypass_input(ShaderOutput *socket)
+{
+	ShaderInput *fac_in = input("Fac");
+
+	if(fac_in->constant() && fac_in->value.x == 0.0f)
+		return input("Color");
+
+	return NULL;
+}
+
+bool InvertNode::equals(ShaderNode *other)
+{
+	return equals_inputs(other);
+}
+
 /* Mix */
 
 MixNode::MixNode()
@@ -2830,6 +3100,75 @@ void MixNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_mix");
 }
 
+bool MixNode::constant_fold(ShaderOutput *socket, float3 *optimized_value)
+{
+	ShaderInput *fac_in = input("Fac");
+	ShaderInput *color1_in = input("Color1");
+	ShaderInput *color2_in = input("Color2");
+
+	/* only blend is evaluated here, other types go through bypass_input */
+	if(type != ustring("Mix"))
+		return false;
+	if(!fac_in->constant() || !color1_in->constant() || !color2_in->constant())
+		return false;
+
+	float t = clamp(fac_in->value.x, 0.0f, 1.0f);
+	float3 color = interp(color1_in->value, color2_in->value, t);
+
+	if(use_clamp) {
+		color.x = clamp(color.x, 0.0f, 1.0f);
+		color.y = clamp(color.y, 0.0f, 1.0f);
+		color.z = clamp(color.z, 0.0f, 1.0f);
+	}
+
+	*optimized_value = color;
+	return true;
+}
+
+ShaderInput *MixNode::bypass_input(ShaderOutput *socket)
+{
+	ShaderInput *fac_in = input("Fac");
+	ShaderInput *color1_in = input("Color1");
+	ShaderInput *color2_in = input("Color2");
+
+	if(use_clamp)
+		return NULL;
+
+	/* these types give the first color for a zero factor */
+	bool zero_fac_identity = (type == ustring("Mix") || type == ustring("Add") ||
+	                          type == ustring("Multiply") || type == ustring("Subtract"));
+
+	if(fac_in->constant()) {
+		float t = clamp(fac_in->value.x, 0.0f, 1.0f);
+
+		if(t == 0.0f && zero_fac_identity)
+			return color1_in;
+		if(t == 1.0f && type == ustring("Mix"))
+			return color2_in;
+	}
+
+	/* adding or subtracting zero, multiplying by one */
+	if(color2_in->constant()) {
+		float3 color2 = color2_in->value;
+
+		if((type == ustring("Add") || type == ustring("Subtract")) && color2 == make_float3(0.0f, 0.0f, 0.0f))
+			return color1_in;
+		if(type == ustring("Multiply") && color2 == make_float3(1.0f, 1.0f, 1.0f))
+			return color1_in;
+	}
+
+	return NULL;
+}
+
+bool MixNode::equals(ShaderNode *other)
+{
+	if(!equals_inputs(other))
+		return false;
+
+	MixNode *node = static_cast<MixNode*>(other);
+	return type == node->type && use_clamp == node->use_clamp;
+}
+
 /* Combine RGB */
 CombineRGBNode::CombineRGBNode()
 : ShaderNode("combine_rgb")
@@ -2864,6 +3203,24 @@ void CombineRGBNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_combine_rgb");
 }
 
+bool CombineRGBNode::constant_fold(ShaderOutput *socket, float3 *optimized_value)
+{
+	ShaderInput *red_in = input("R");
+	ShaderInput *green_in = input("G");
+	ShaderInput *blue_in = input("B");
+
+	if(!red_in->constant() || !green_in->constant() || !blue_in->constant())
+		return false;
+
+	*optimized_value = make_float3(red_in->value.x, green_in->value.x, blue_in->value.x);
+	return true;
+}
+
+bool CombineRGBNode::equals(ShaderNode *other)
+{
+	return equals_inputs(other);
+}
+
 /* Combine HSV */
 CombineHSVNode::CombineHSVNode()
 : ShaderNode("combine_hsv")
@@ -2895,6 +3252,11 @@ void CombineHSVNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_combine_hsv");
 }
 
+bool CombineHSVNode::equals(ShaderNode *other)
+{
+	return equals_inputs(other);
+}
+
 /* Gamma */
 GammaNode::GammaNode()
 : ShaderNode("gamma")
@@ -2922,6 +3284,11 @@ void GammaNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_gamma");
 }
 
+bool GammaNode::equals(ShaderNode *other)
+{
+	return equals_inputs(other);
+}
+
 /* Bright Contrast */
 BrightContrastNode::BrightContrastNode()
 : ShaderNode("brightness")
@@ -2954,6 +3321,11 @@ void BrightContrastNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_brightness");
 }
 
+bool BrightContrastNode::equals(ShaderNode *other)
+{
+	return equals_inputs(other);
+}
+
 /* Separate RGB */
 SeparateRGBNode::SeparateRGBNode()
 : ShaderNode("separate_rgb")
@@ -2988,6 +3360,28 @@ void SeparateRGBNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_separate_rgb");
 }
 
+bool SeparateRGBNode::constant_fold(ShaderOutput *socket, float3 *optimized_value)
+{
+	ShaderInput *color_in = input("Image");
+
+	if(!color_in->constant())
+		return false;
+
+	for(int channel = 0; channel < 3; channel++) {
+		if(outputs[channel] == socket) {
+			*optimized_value = make_float3(color_in->value[channel], 0.0f, 0.0f);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool SeparateRGBNode::equals(ShaderNode *other)
+{
+	return equals_inputs(other);
+}
+
 /* Separate HSV */
 SeparateHSVNode::SeparateHSVNode()
 : ShaderNode("separate_hsv")
@@ -3020,6 +3414,11 @@ void SeparateHSVNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_separate_hsv");
 }
 
+bool SeparateHSVNode::equals(ShaderNode *other)
+{
+	return equals_inputs(other);
+}
+
 /* Hue Saturation Value */
 HSVNode::HSVNode()
 : ShaderNode("hsv")
@@ -3057,6 +3456,11 @@ void HSVNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_hsv");
 }
 
+bool HSVNode::equals(ShaderNode *other)
+{
+	return equals_inputs(other);
+}
+
 /* Attribute */
 
 AttributeNode::AttributeNode()
@@ -3127,6 +3531,15 @@ void AttributeNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_attribute");
 }
 
+bool AttributeNode::equals(ShaderNode *other)
+{
+	if(!equals_inputs(other))
+		return false;
+
+	AttributeNode *node = static_cast<AttributeNode*>(other);
+	return attribute == node->attribute;
+}
+
 /* Camera */
 
 CameraNode::CameraNode()
@@ -3394,6 +3807,62 @@ void MathNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_math");
 }
 
+bool MathNode::constant_fold(ShaderOutput *socket, float3 *optimized_value)
+{
+	ShaderInput *value1_in = input("Value1");
+	ShaderInput *value2_in = input("Value2");
+
+	if(!value1_in->constant() || !value2_in->constant())
+		return false;
+
+	float value = svm_math((NodeMath)type_enum[type], value1_in->value.x, value2_in->value.x);
+
+	if(use_clamp)
+		value = clamp(value, 0.0f, 1.0f);
+
+	*optimized_value = make_float3(value, 0.0f, 0.0f);
+	return true;
+}
+
+ShaderInput *MathNode::bypass_input(ShaderOutput *socket)
+{
+	ShaderInput *value1_in = input("Value1");
+	ShaderInput *value2_in = input("Value2");
+
+	if(use_clamp)
+		return NULL;
+
+	/* adding or subtracting zero, multiplying or dividing by one, power of one */
+	if(value2_in->constant()) {
+		float value2 = value2_in->value.x;
+
+		if((type == ustring("Add") || type == ustring("Subtract")) && value2 == 0.0f)
+			return value1_in;
+		if((type == ustring("Multiply") || type == ustring("Divide") || type == ustring("Power")) && value2 == 1.0f)
+			return value1_in;
+	}
+
+	if(value1_in->constant()) {
+		float value1 = value1_in->value.x;
+
+		if(type == ustring("Add") && value1 == 0.0f)
+			return value2_in;
+		if(type == ustring("Multiply") && value1 == 1.0f)
+			return value2_in;
+	}
+
+	return NULL;
+}
+
+bool MathNode::equals(ShaderNode *other)
+{
+	if(!equals_inputs(other))
+		return false;
+
+	MathNode *node = static_cast<MathNode*>(other);
+	return type == node->type && use_clamp == node->use_clamp;
+}
+
 /* VectorMath */
 
 VectorMathNode::VectorMathNode()
@@ -3445,6 +3914,35 @@ void VectorMathNode::compile(OSLCompiler& compiler)
 	compiler.add(this, "node_vector_math");
 }
 
+bool VectorMathNode::constant_fold(ShaderOutput *socket, float3 *optimized_value)
+{
+	ShaderInput *vector1_in = input("Vector1");
+	ShaderInput *vector2_in = input("Vector2");
+
+	if(!vector1_in->constant() || !vector2_in->constant())
+		return false;
+
+	float value;
+	float3 vector;
+
+	svm_vector_math(&value, &vector, (NodeVectorMath)type_enum[type], vector1_in->value, vector2_in->value);
+
+	if(socket == output("Value"))
+		*optimized_value = make_float3(value, 0.0f, 0.0f);
+	else
+		*optimized_value = vector;
+
+	return true;
+}
+
+bool VectorMathNode::equals(ShaderNode *other)
+{
+	if(!equals_inputs(other))
+		return false;
+
+	return type == static_cast<VectorMathNode*>(other)->type;
+}
+
 /* VectorTransform */
 
 VectorTransformNode::VectorTransformNode()
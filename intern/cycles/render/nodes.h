@@ -35,6 +35,7 @@ public:
 	bool skip();
 	void compile(SVMCompiler& compiler, int offset_in, int offset_out);
 	void compile(OSLCompiler &compiler);
+	bool equals(const TextureMapping& other) const;
 
 	float3 translation;
 	float3 rotation;
@@ -64,6 +65,7 @@ public:
 class ImageTextureNode : public TextureNode {
 public:
 	SHADER_NODE_NO_CLONE_CLASS(ImageTextureNode)
+	bool equals(ShaderNode *other);
 	~ImageTextureNode();
 	ShaderNode *clone() const;
 
@@ -80,11 +82,14 @@ public:
 
 	static ShaderEnum color_space_enum;
 	static ShaderEnum projection_enum;
+
+	uint uv_attribute(SVMCompiler& compiler);
 };
 
 class EnvironmentTextureNode : public TextureNode {
 public:
 	SHADER_NODE_NO_CLONE_CLASS(EnvironmentTextureNode)
+	bool equals(ShaderNode *other);
 	~EnvironmentTextureNode();
 	ShaderNode *clone() const;
 
@@ -122,6 +127,7 @@ public:
 class GradientTextureNode : public TextureNode {
 public:
 	SHADER_NODE_CLASS(GradientTextureNode)
+	bool equals(ShaderNode *other);
 
 	ustring type;
 	static ShaderEnum type_enum;
@@ -130,11 +136,13 @@ public:
 class NoiseTextureNode : public TextureNode {
 public:
 	SHADER_NODE_CLASS(NoiseTextureNode)
+	bool equals(ShaderNode *other);
 };
 
 class VoronoiTextureNode : public TextureNode {
 public:
 	SHADER_NODE_CLASS(VoronoiTextureNode)
+	bool equals(ShaderNode *other);
 
 	ustring coloring;
 
@@ -144,6 +152,7 @@ public:
 class MusgraveTextureNode : public TextureNode {
 public:
 	SHADER_NODE_CLASS(MusgraveTextureNode)
+	bool equals(ShaderNode *other);
 
 	ustring type;
 
@@ -153,6 +162,7 @@ public:
 class WaveTextureNode : public TextureNode {
 public:
 	SHADER_NODE_CLASS(WaveTextureNode)
+	bool equals(ShaderNode *other);
 
 	ustring type;
 	static ShaderEnum type_enum;
@@ -161,6 +171,7 @@ public:
 class MagicTextureNode : public TextureNode {
 public:
 	SHADER_NODE_CLASS(MagicTextureNode)
+	bool equals(ShaderNode *other);
 
 	int depth;
 };
@@ -168,11 +179,13 @@ public:
 class CheckerTextureNode : public TextureNode {
 public:
 	SHADER_NODE_CLASS(CheckerTextureNode)
+	bool equals(ShaderNode *other);
 };
 
 class BrickTextureNode : public TextureNode {
 public:
 	SHADER_NODE_CLASS(BrickTextureNode)
+	bool equals(ShaderNode *other);
 	
 	float offset, squash;
 	int offset_frequency, squash_frequency;
@@ -181,6 +194,8 @@ public:
 class MappingNode : public ShaderNode {
 public:
 	SHADER_NODE_CLASS(MappingNode)
+	ShaderInput *bypass_input(ShaderOutput *socket);
+	bool equals(ShaderNode *other);
 
 	TextureMapping tex_mapping;
 };
@@ -189,6 +204,8 @@ class ConvertNode : public ShaderNode {
 public:
 	ConvertNode(ShaderSocketType from, ShaderSocketType to, bool autoconvert = false);
 	SHADER_NODE_BASE_CLASS(ConvertNode)
+	bool constant_fold(ShaderOutput *socket, float3 *optimized_value);
+	bool equals(ShaderNode *other);
 
 	ShaderSocketType from, to;
 };
@@ -336,12 +353,14 @@ public:
 class GeometryNode : public ShaderNode {
 public:
 	SHADER_NODE_CLASS(GeometryNode)
+	bool equals(ShaderNode *other);
 	void attributes(AttributeRequestSet *attributes);
 };
 
 class TextureCoordinateNode : public ShaderNode {
 public:
 	SHADER_NODE_CLASS(TextureCoordinateNode)
+	bool equals(ShaderNode *other);
 	void attributes(AttributeRequestSet *attributes);
 	
 	bool from_dupli;
@@ -378,6 +397,8 @@ public:
 class ValueNode : public ShaderNode {
 public:
 	SHADER_NODE_CLASS(ValueNode)
+	bool constant_fold(ShaderOutput *socket, float3 *optimized_value);
+	bool equals(ShaderNode *other);
 
 	float value;
 };
@@ -385,6 +406,8 @@ public:
 class ColorNode : public ShaderNode {
 public:
 	SHADER_NODE_CLASS(ColorNode)
+	bool constant_fold(ShaderOutput *socket, float3 *optimized_value);
+	bool equals(ShaderNode *other);
 
 	float3 value;
 };
@@ -407,11 +430,17 @@ public:
 class InvertNode : public ShaderNode {
 public:
 	SHADER_NODE_CLASS(InvertNode)
+	bool constant_fold(ShaderOutput *socket, float3 *optimized_value);
+	ShaderInput *bypass_input(ShaderOutput *socket);
+	bool equals(ShaderNode *other);
 };
 
 class MixNode : public ShaderNode {
 public:
 	SHADER_NODE_CLASS(MixNode)
+	bool constant_fold(ShaderOutput *socket, float3 *optimized_value);
+	ShaderInput *bypass_input(ShaderOutput *socket);
+	bool equals(ShaderNode *other);
 
 	bool use_clamp;
 
@@ -422,41 +451,51 @@ public:
 class CombineRGBNode : public ShaderNode {
 public:
 	SHADER_NODE_CLASS(CombineRGBNode)
+	bool constant_fold(ShaderOutput *socket, float3 *optimized_value);
+	bool equals(ShaderNode *other);
 };
 
 class CombineHSVNode : public ShaderNode {
 public:
 	SHADER_NODE_CLASS(CombineHSVNode)
+	bool equals(ShaderNode *other);
 };
 
 class GammaNode : public ShaderNode {
 public:
 	SHADER_NODE_CLASS(GammaNode)
+	bool equals(ShaderNode *other);
 };
 
 class BrightContrastNode : public ShaderNode {
 public:
 	SHADER_NODE_CLASS(BrightContrastNode)
+	bool equals(ShaderNode *other);
 };
 
 class SeparateRGBNode : public ShaderNode {
 public:
 	SHADER_NODE_CLASS(SeparateRGBNode)
+	bool constant_fold(ShaderOutput *socket, float3 *optimized_value);
+	bool equals(ShaderNode *other);
 };
 
 class SeparateHSVNode : public ShaderNode {
 public:
 	SHADER_NODE_CLASS(SeparateHSVNode)
+	bool equals(ShaderNode *other);
 };
 
 class HSVNode : public ShaderNode {
 public:
 	SHADER_NODE_CLASS(HSVNode)
+	bool equals(ShaderNode *other);
 };
 
 class AttributeNode : public ShaderNode {
 public:
 	SHADER_NODE_CLASS(AttributeNode)
+	bool equals(ShaderNode *other);
 	void attributes(AttributeRequestSet *attributes);
 
 	ustring attribute;
@@ -499,6 +538,9 @@ public:
 class MathNode : public ShaderNode {
 public:
 	SHADER_NODE_CLASS(MathNode)
+	bool constant_fold(ShaderOutput *socket, float3 *optimized_value);
+	ShaderInput *bypass_input(ShaderOutput *socket);
+	bool equals(ShaderNode *other);
 
 	bool use_clamp;
 
@@ -516,6 +558,8 @@ public:
 class VectorMathNode : public ShaderNode {
 public:
 	SHADER_NODE_CLASS(VectorMathNode)
+	bool constant_fold(ShaderOutput *socket, float3 *optimized_value);
+	bool equals(ShaderNode *other);
 
 	ustring type;
 	static ShaderEnum type_enum;
@@ -88,6 +88,8 @@ public:
 	device_vector<float4> light_data;
 	device_vector<float2> light_background_marginal_cdf;
 	device_vector<float2> light_background_conditional_cdf;
+	device_vector<float4> light_tree_nodes;
+	device_vector<uint> light_tree_leaves;
 
 	/* particles */
 	device_vector<float4> particles;
@@ -106,6 +108,10 @@ public:
 	/* images */
 	device_vector<uchar4> tex_image[TEX_EXTENDED_NUM_IMAGES];
 	device_vector<float4> tex_float_image[TEX_EXTENDED_NUM_FLOAT_IMAGES];
+	device_vector<half4> tex_half4_image[TEX_NUM_HALF4_IMAGES_CPU];
+	device_vector<float> tex_float1_image[TEX_NUM_FLOAT1_IMAGES_CPU];
+	device_vector<uchar> tex_byte1_image[TEX_NUM_BYTE1_IMAGES_CPU];
+	device_vector<half> tex_half1_image[TEX_NUM_HALF1_IMAGES_CPU];
 
 	/* opencl images */
 	device_vector<uchar4> tex_image_packed;
@@ -124,6 +130,8 @@ public:
 	bool use_bvh_spatial_split;
 	bool use_qbvh;
 	bool persistent_data;
+	bool use_texture_cache;
+	int texture_cache_size;
 
 	SceneParams()
 	{
@@ -137,6 +145,8 @@ public:
 		use_qbvh = false;
 #endif
 		persistent_data = false;
+		use_texture_cache = false;
+		texture_cache_size = 4096;
 	}
 
 	bool modified(const SceneParams& params)
@@ -145,7 +155,9 @@ public:
 		&& use_bvh_cache == params.use_bvh_cache
 		&& use_bvh_spatial_split == params.use_bvh_spatial_split
 		&& use_qbvh == params.use_qbvh
-		&& persistent_data == params.persistent_data); }
+		&& persistent_data == params.persistent_data
+		&& use_texture_cache == params.use_texture_cache
+		&& texture_cache_size == params.texture_cache_size); }
 };
 
 /* Scene */
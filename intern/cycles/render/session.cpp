@@ -50,6 +50,12 @@ Session::Session(const SessionParams& params_)
 
 	device = Device::create(params.device, stats, params.background);
 
+	/* CPU threads all acquire tiles, other devices take one tile at a time */
+	if(params.device.type == DEVICE_CPU)
+		tile_manager.set_num_workers(TaskScheduler::num_threads());
+	else
+		tile_manager.set_num_workers(max(params.device.multi_devices.size(), 1));
+
 	if(params.background) {
 		buffers = NULL;
 		display = NULL;
@@ -830,6 +836,8 @@ void Session::path_trace()
 	task.update_progress_sample = function_bind(&Session::update_progress_sample, this);
 	task.need_finish_queue = params.progressive_refine;
 	task.integrator_branched = scene->integrator->method == Integrator::BRANCHED_PATH;
+	task.adaptive_sampling = params.adaptive_sampling;
+	task.sorted_shading = params.sorted_shading;
 
 	device->task_add(task);
 }
@@ -52,6 +52,8 @@ public:
 	TileOrder tile_order;
 	int start_resolution;
 	int threads;
+	bool adaptive_sampling;
+	bool sorted_shading;
 
 	bool display_buffer_linear;
 
@@ -73,6 +75,8 @@ public:
 		tile_size = make_int2(64, 64);
 		start_resolution = INT_MAX;
 		threads = 0;
+		adaptive_sampling = false;
+		sorted_shading = false;
 
 		display_buffer_linear = false;
 
@@ -96,6 +100,8 @@ public:
 		&& tile_size == params.tile_size
 		&& start_resolution == params.start_resolution
 		&& threads == params.threads
+		&& adaptive_sampling == params.adaptive_sampling
+		&& sorted_shading == params.sorted_shading
 		&& display_buffer_linear == params.display_buffer_linear
 		&& cancel_timeout == params.cancel_timeout
 		&& reset_timeout == params.reset_timeout
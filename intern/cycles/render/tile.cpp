@@ -29,6 +29,7 @@ TileManager::TileManager(bool progressive_, int num_samples_, int2 tile_size_, i
 	tile_order = tile_order_;
 	start_resolution = start_resolution_;
 	num_devices = num_devices_;
+	num_workers = 1;
 	preserve_tile_device = preserve_tile_device_;
 	background = background_;
 
@@ -62,6 +63,7 @@ void TileManager::reset(BufferParams& params_, int num_samples_)
 	state.sample = -1;
 	state.num_tiles = 0;
 	state.num_rendered_tiles = 0;
+	state.num_finished_workers = 0;
 	state.num_samples = 0;
 	state.resolution_divider = divider;
 	state.tiles.clear();
@@ -154,6 +156,7 @@ void TileManager::set_tiles()
 		gen_tiles_sliced();
 
 	state.num_tiles = state.tiles.size();
+	state.num_finished_workers = 0;
 
 	state.buffer.width = image_w;
 	state.buffer.height = image_h;
@@ -230,6 +233,55 @@ list<Tile>::iterator TileManager::next_background_tile(int device, TileOrder til
 	return best;
 }
 
+void TileManager::split_tile(list<Tile>::iterator tile_it)
+{
+	/* workers that already found no tile left have stopped, only the ones still
+	 * rendering will come back for a piece */
+	int num_active = num_workers - state.num_finished_workers;
+	int num_pending = 0;
+
+	for(list<Tile>::iterator iter = state.tiles.begin(); iter != state.tiles.end(); iter++)
+		if(iter->rendering == false && iter != tile_it)
+			num_pending++;
+
+	if(num_pending + 1 >= num_active)
+		return;
+
+	/* split into strips along the longest side, one for every worker without a tile */
+	bool split_x = (tile_it->w >= tile_it->h);
+	int size = (split_x)? tile_it->w: tile_it->h;
+	int num = min(num_active - num_pending, size/TILE_MIN_SPLIT_SIZE);
+
+	if(num <= 1)
+		return;
+
+	Tile tile = *tile_it;
+
+	for(int i = 0; i < num; i++) {
+		int start = (size/num)*i;
+		int length = (i == num-1)? size - start: size/num;
+
+		Tile piece = tile;
+
+		if(split_x) {
+			piece.x = tile.x + start;
+			piece.w = length;
+		}
+		else {
+			piece.y = tile.y + start;
+			piece.h = length;
+		}
+
+		if(i == 0) {
+			*tile_it = piece;
+		}
+		else {
+			piece.index = state.num_tiles++;
+			state.tiles.push_back(piece);
+		}
+	}
+}
+
 bool TileManager::next_tile(Tile& tile, int device)
 {
 	list<Tile>::iterator tile_it;
@@ -239,6 +291,11 @@ bool TileManager::next_tile(Tile& tile, int device)
 	else
 		tile_it = next_viewport_tile(device);
 
+	/* tile buffers are allocated per tile index when tiles are preserved for
+	 * devices, so only split tiles for final render without progressive refine */
+	if(tile_it != state.tiles.end() && background && !preserve_tile_device)
+		split_tile(tile_it);
+
 	if(tile_it != state.tiles.end()) {
 		tile_it->rendering = true;
 		tile = *tile_it;
@@ -247,6 +304,8 @@ bool TileManager::next_tile(Tile& tile, int device)
 		return true;
 	}
 
+	state.num_finished_workers++;
+
 	return false;
 }
 
@@ -40,6 +40,9 @@ public:
 	: index(index_), x(x_), y(y_), w(w_), h(h_), device(device_), rendering(false) {}
 };
 
+/* Tiles are not split further than this size */
+#define TILE_MIN_SPLIT_SIZE 8
+
 /* Tile order */
 
 /* Note: this should match enum_tile_order in properties.py */
@@ -64,6 +67,8 @@ public:
 		int resolution_divider;
 		int num_tiles;
 		int num_rendered_tiles;
+		/* workers that found no tile left, they do not ask again in this pass */
+		int num_finished_workers;
 		list<Tile> tiles;
 	} state;
 
@@ -80,6 +85,7 @@ public:
 	bool done();
 	
 	void set_tile_order(TileOrder tile_order_) { tile_order = tile_order_; }
+	void set_num_workers(int num_workers_) { num_workers = num_workers_; }
 protected:
 
 	void set_tiles();
@@ -90,6 +96,9 @@ protected:
 	int start_resolution;
 	int num_devices;
 
+	/* number of threads acquiring tiles in parallel */
+	int num_workers;
+
 	/* in some cases it is important that the same tile will be returned for the same
 	 * device it was originally generated for (i.e. viewport rendering when buffer is
 	 * allocating once for tile and then always used by it)
@@ -120,6 +129,11 @@ protected:
 
 	/* returns first unhandled tile for viewport render */
 	list<Tile>::iterator next_viewport_tile(int device);
+
+	/* when there are fewer tiles left than workers still asking for tiles, splits
+	 * a tile before it is handed out so that workers which would otherwise be idle
+	 * at the end of the frame get a share of the remaining work */
+	void split_tile(list<Tile>::iterator tile_it);
 };
 
 CCL_NAMESPACE_END
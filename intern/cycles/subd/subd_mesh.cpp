@@ -36,8 +36,12 @@
 #include "subd_split.h"
 #include "subd_vert.h"
 
+#include "attribute.h"
+#include "mesh.h"
+
 #include "util_debug.h"
 #include "util_foreach.h"
+#include "util_task.h"
 
 CCL_NAMESPACE_BEGIN
 
@@ -285,12 +289,48 @@ void SubdMesh::link_boundary_edge(SubdEdge *edge)
 		edge->vert->edge = edge;
 }
 
-void SubdMesh::tessellate(DiagSplit *split, bool linear, Mesh *mesh, int shader, bool smooth)
+/* Tessellation
+ *
+ * Faces are split and diced into separate meshes in parallel, each task with
+ * its own builder and splitter, after which the meshes are appended in face
+ * order, so the result is the same as tessellating serially. */
+
+static void mesh_append(Mesh *mesh, Mesh *part)
+{
+	int vert_offset = mesh->verts.size();
+	int tri_offset = mesh->triangles.size();
+	int num_verts = part->verts.size();
+	int num_tris = part->triangles.size();
+
+	if(num_verts == 0)
+		return;
+
+	mesh->reserve(vert_offset + num_verts, tri_offset + num_tris,
+		mesh->curves.size(), mesh->curve_keys.size());
+
+	memcpy(&mesh->verts[vert_offset], &part->verts[0], sizeof(float3)*num_verts);
+
+	for(int i = 0; i < num_tris; i++) {
+		Mesh::Triangle& t = part->triangles[i];
+
+		mesh->set_triangle(tri_offset + i,
+			t.v[0] + vert_offset, t.v[1] + vert_offset, t.v[2] + vert_offset,
+			part->shader[i], part->smooth[i]);
+	}
+
+	Attribute *part_vN = part->attributes.find(ATTR_STD_VERTEX_NORMAL);
+
+	if(part_vN) {
+		Attribute *attr_vN = mesh->attributes.add(ATTR_STD_VERTEX_NORMAL);
+		memcpy(attr_vN->data_float3() + vert_offset, part_vN->data_float3(), sizeof(float3)*num_verts);
+	}
+}
+
+void SubdMesh::tessellate_faces(DiagSplit *split, bool linear, Mesh *mesh, int shader, bool smooth, int start, int end)
 {
 	SubdBuilder *builder = SubdBuilder::create(linear);
-	int num_faces = faces.size();
-		        
-	for(int f = 0; f < num_faces; f++) {
+
+	for(int f = start; f < end; f++) {
 		SubdFace *face = faces[f];
 		Patch *patch = builder->run(face);
 
@@ -305,5 +345,181 @@ void SubdMesh::tessellate(DiagSplit *split, bool linear, Mesh *mesh, int shader,
 	delete builder;
 }
 
+void SubdMesh::tessellate(DiagSplit *split, bool linear, Mesh *mesh, int shader, bool smooth)
+{
+	int num_faces = faces.size();
+	int num_threads = TaskScheduler::num_threads();
+	int task_faces = max(num_faces/(num_threads*4), SUBD_TASK_MIN_FACES);
+	int num_tasks = (num_faces + task_faces - 1)/task_faces;
+
+	if(num_tasks <= 1) {
+		tessellate_faces(split, linear, mesh, shader, smooth, 0, num_faces);
+		return;
+	}
+
+	vector<DiagSplit> splits(num_tasks, *split);
+	vector<Mesh*> parts(num_tasks);
+	TaskPool pool;
+
+	for(int i = 0; i < num_tasks; i++) {
+		int start = i*task_faces;
+		int end = min(start + task_faces, num_faces);
+
+		parts[i] = new Mesh();
+
+		pool.push(function_bind(&SubdMesh::tessellate_faces, this,
+			&splits[i], linear, parts[i], shader, smooth, start, end));
+	}
+
+	pool.wait_work();
+
+	for(int i = 0; i < num_tasks; i++) {
+		mesh_append(mesh, parts[i]);
+		delete parts[i];
+	}
+}
+
+/* Tessellation Cache */
+
+SubdCache::SubdCache()
+{
+}
+
+SubdCache::~SubdCache()
+{
+	map<void*, Entry*>::iterator it;
+
+	for(it = entries.begin(); it != entries.end(); it++)
+		delete it->second;
+}
+
+SubdCache::Entry::~Entry()
+{
+	delete result;
+}
+
+static void subd_control_mesh(SubdMesh *sdmesh, vector<float3>& verts, vector<int>& faces)
+{
+	verts.clear();
+	faces.clear();
+
+	foreach(SubdVert *vert, sdmesh->verts)
+		verts.push_back(vert->co);
+
+	foreach(SubdFace *face, sdmesh->faces) {
+		faces.push_back(face->num_edges());
+
+		for(SubdFace::EdgeIterator it(face->edges()); !it.isDone(); it.advance())
+			faces.push_back(it.current()->from()->id);
+	}
+}
+
+static float subd_raster_size(SubdMesh *sdmesh, DiagSplit *split)
+{
+	if(!split->camera)
+		return 0.0f;
+
+	BoundBox bounds = BoundBox::empty;
+
+	foreach(SubdVert *vert, sdmesh->verts)
+		bounds.grow(vert->co);
+
+	if(!bounds.valid())
+		return 0.0f;
+
+	/* sum of the projected lengths of the bounding box edges, as an estimate
+	 * of how many micropolygons the mesh will be diced into */
+	float3 P[8];
+	float size = 0.0f;
+
+	for(int i = 0; i < 8; i++) {
+		float3 co = make_float3((i & 1)? bounds.max.x: bounds.min.x,
+		                        (i & 2)? bounds.max.y: bounds.min.y,
+		                        (i & 4)? bounds.max.z: bounds.min.z);
+		P[i] = split->project(co);
+		P[i].z = 0.0f;
+	}
+
+	for(int i = 0; i < 8; i++)
+		for(int axis = 1; axis < 8; axis <<= 1)
+			if(!(i & axis))
+				size += len(P[i] - P[i | axis]);
+
+	return size;
+}
+
+void SubdCache::tessellate(void *key, SubdMesh *sdmesh, DiagSplit *split, bool linear,
+	Mesh *mesh, int shader, bool smooth)
+{
+	Entry *entry;
+	map<void*, Entry*>::iterator it = entries.find(key);
+
+	if(it == entries.end()) {
+		entry = new Entry();
+		entries[key] = entry;
+	}
+	else
+		entry = it->second;
+
+	entry->used = true;
+
+	/* compare parameters and control mesh with the cached tessellation */
+	vector<float3> verts;
+	vector<int> faces;
+	float raster_size = subd_raster_size(sdmesh, split);
+
+	subd_control_mesh(sdmesh, verts, faces);
+
+	bool valid = entry->result &&
+		entry->linear == linear &&
+		entry->shader == shader &&
+		entry->smooth == smooth &&
+		entry->dicing_rate == split->dicing_rate &&
+		entry->use_camera == (split->camera != NULL) &&
+		entry->verts.size() == verts.size() &&
+		entry->faces.size() == faces.size();
+
+	if(valid && verts.size())
+		valid = memcmp(&entry->verts[0], &verts[0], sizeof(float3)*verts.size()) == 0;
+	if(valid && faces.size())
+		valid = memcmp(&entry->faces[0], &faces[0], sizeof(int)*faces.size()) == 0;
+	if(valid && split->camera)
+		valid = fabsf(raster_size - entry->raster_size) <= entry->raster_size*SUBD_CACHE_RASTER_TOLERANCE;
+
+	if(!valid) {
+		delete entry->result;
+		entry->result = new Mesh();
+
+		sdmesh->tessellate(split, linear, entry->result, shader, smooth);
+
+		entry->verts.swap(verts);
+		entry->faces.swap(faces);
+		entry->linear = linear;
+		entry->shader = shader;
+		entry->smooth = smooth;
+		entry->dicing_rate = split->dicing_rate;
+		entry->use_camera = (split->camera != NULL);
+		entry->raster_size = raster_size;
+	}
+
+	mesh_append(mesh, entry->result);
+}
+
+void SubdCache::clear_unused()
+{
+	map<void*, Entry*>::iterator it = entries.begin();
+
+	while(it != entries.end()) {
+		if(it->second->used) {
+			it->second->used = false;
+			it++;
+		}
+		else {
+			delete it->second;
+			entries.erase(it++);
+		}
+	}
+}
+
 CCL_NAMESPACE_END
 
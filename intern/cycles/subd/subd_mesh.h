@@ -42,6 +42,12 @@ class SubdEdge;
 class DiagSplit;
 class Mesh;
 
+/* minimum number of faces tessellated by a single task */
+#define SUBD_TASK_MIN_FACES 256
+
+/* relative change in projected size before a cached tessellation is diced again */
+#define SUBD_CACHE_RASTER_TOLERANCE 0.25f
+
 /* Subd Mesh, half edge based for dynamic mesh manipulation */
 
 class SubdMesh
@@ -70,6 +76,8 @@ protected:
 	SubdEdge *add_edge(int i, int j);
 	SubdEdge *find_edge(int i, int j);
 	void link_boundary_edge(SubdEdge *edge);
+	void tessellate_faces(DiagSplit *split, bool linear,
+		Mesh *mesh, int shader, bool smooth, int start, int end);
 	
 	struct Key {
 		Key() {}
@@ -84,6 +92,46 @@ protected:
 	map<Key, SubdEdge *> edge_map;
 };
 
+/* Subd Cache
+ *
+ * Keeps tessellated meshes between syncs, so that a control mesh that did not
+ * change is not diced again, unless the camera moved enough to change its size
+ * on screen. Entries are identified by a key chosen by the caller. */
+
+class SubdCache
+{
+public:
+	SubdCache();
+	~SubdCache();
+
+	void tessellate(void *key, SubdMesh *sdmesh, DiagSplit *split, bool linear,
+		Mesh *mesh, int shader, bool smooth);
+
+	/* free entries not used since the previous call */
+	void clear_unused();
+
+protected:
+	struct Entry {
+		Entry() : result(NULL), used(false) {}
+		~Entry();
+
+		vector<float3> verts;
+		vector<int> faces;
+
+		bool linear;
+		int shader;
+		bool smooth;
+		float dicing_rate;
+		bool use_camera;
+		float raster_size;
+
+		Mesh *result;
+		bool used;
+	};
+
+	map<void*, Entry*> entries;
+};
+
 CCL_NAMESPACE_END
 
 #endif /* __SUBD_MESH_H__ */
@@ -35,6 +35,7 @@ DiagSplit::DiagSplit()
 	split_threshold = 1;
 	dicing_rate = 0.1f;
 	camera = NULL;
+	objecttoworld = transform_identity();
 }
 
 void DiagSplit::dispatch(QuadDice::SubPatch& sub, QuadDice::EdgeFactors& ef)
@@ -49,39 +50,88 @@ void DiagSplit::dispatch(TriangleDice::SubPatch& sub, TriangleDice::EdgeFactors&
 	edgefactors_triangle.push_back(ef);
 }
 
-float3 DiagSplit::project(Patch *patch, float2 uv)
+float3 DiagSplit::project(float3 P, bool *in_view)
+{
+	if(camera) {
+		/* points behind the camera are moved onto the near plane and reported
+		 * as not in view, so that they don't get subdivided endlessly */
+		bool visible = true;
+
+		P = transform_point(&objecttoworld, P);
+		P = transform_point(&camera->worldtocamera, P);
+
+		if(camera->type == CAMERA_PERSPECTIVE && P.z < camera->nearclip) {
+			P.z = camera->nearclip;
+			visible = false;
+		}
+
+		P = transform_perspective(&camera->cameratoraster, P);
+
+		float mx = DSPLIT_VIEW_MARGIN*camera->width;
+		float my = DSPLIT_VIEW_MARGIN*camera->height;
+
+		if(P.x < -mx || P.x > camera->width + mx || P.y < -my || P.y > camera->height + my)
+			visible = false;
+
+		if(in_view)
+			*in_view = visible;
+	}
+	else if(in_view)
+		*in_view = true;
+
+	return P;
+}
+
+float3 DiagSplit::project(Patch *patch, float2 uv, bool *in_view)
 {
 	float3 P;
 
 	patch->eval(&P, NULL, NULL, uv.x, uv.y);
-	if(camera)
-		P = transform_perspective(&camera->worldtoraster, P);
 
-	return P;
+	return project(P, in_view);
 }
 
 int DiagSplit::T(Patch *patch, float2 Pstart, float2 Pend)
 {
 	float3 Plast = make_float3(0.0f, 0.0f, 0.0f);
-	float Lsum = 0.0f;
-	float Lmax = 0.0f;
+	float3 Plast_object = make_float3(0.0f, 0.0f, 0.0f);
+	float Lsum = 0.0f, Lsum_object = 0.0f;
+	float Lmax = 0.0f, Lmax_object = 0.0f;
+	bool in_view = true;
 
 	for(int i = 0; i < test_steps; i++) {
 		float t = i/(float)(test_steps-1);
+		float2 uv = Pstart + t*(Pend - Pstart);
+		float3 P_object;
+		bool visible;
 
-		float3 P = project(patch, Pstart + t*(Pend - Pstart));
+		patch->eval(&P_object, NULL, NULL, uv.x, uv.y);
+		float3 P = project(P_object, &visible);
+		in_view = in_view && visible;
 
 		if(i > 0) {
 			float L = len(P - Plast);
 			Lsum += L;
 			Lmax = max(L, Lmax);
+
+			float L_object = len(P_object - Plast_object);
+			Lsum_object += L_object;
+			Lmax_object = max(L_object, Lmax_object);
 		}
 
 		Plast = P;
+		Plast_object = P_object;
+	}
+
+	/* edges outside of the view have no meaningful raster size, dice them
+	 * with the dicing rate in object space instead */
+	if(!in_view) {
+		Lsum = Lsum_object;
+		Lmax = Lmax_object;
 	}
 
-	int tmin = (int)ceil(Lsum/dicing_rate);
-	int tmax = (int)ceil((test_steps-1)*Lmax/dicing_rate); // XXX paper says N instead of N-1, seems wrong?
+	int tmin = (int)min(ceilf(Lsum/dicing_rate), (float)DSPLIT_MAX_T);
+	int tmax = (int)min(ceilf((test_steps-1)*Lmax/dicing_rate), (float)DSPLIT_MAX_T); // XXX paper says N instead of N-1, seems wrong?
 
 	if(tmax - tmin > split_threshold)
 		return DSPLIT_NON_UNIFORM;
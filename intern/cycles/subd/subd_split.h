@@ -24,6 +24,7 @@
 
 #include "subd_dice.h"
 
+#include "util_transform.h"
 #include "util_types.h"
 #include "util_vector.h"
 
@@ -34,6 +35,14 @@ class Patch;
 
 #define DSPLIT_NON_UNIFORM -1
 
+/* maximum tessellation factor of an edge, bounds the number of micropolygons
+ * of patches that are very close to the camera */
+#define DSPLIT_MAX_T 256
+
+/* patches further than this many frame sizes outside the raster, or behind the
+ * camera, are diced in object space */
+#define DSPLIT_VIEW_MARGIN 1.0f
+
 class DiagSplit {
 public:
 	vector<QuadDice::SubPatch> subpatches_quad;
@@ -44,11 +53,15 @@ public:
 	int test_steps;
 	int split_threshold;
 	float dicing_rate;
+
+	/* with a camera, dicing rate is in pixels instead of object space */
 	Camera *camera;
+	Transform objecttoworld;
 
 	DiagSplit();
 
-	float3 project(Patch *patch, float2 uv);
+	float3 project(float3 P, bool *in_view = NULL);
+	float3 project(Patch *patch, float2 uv, bool *in_view = NULL);
 	int T(Patch *patch, float2 Pstart, float2 Pend);
 	void partition_edge(Patch *patch, float2 *P, int *t0, int *t1,
 		float2 Pstart, float2 Pend, int t);
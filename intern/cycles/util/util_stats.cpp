@@ -0,0 +1,194 @@
+/*
+ * Copyright 2011-2013 Blender Foundation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License
+ */
+
+#include "util_foreach.h"
+#include "util_stats.h"
+
+CCL_NAMESPACE_BEGIN
+
+static const char *mem_category_names[MEM_NUM_CATEGORIES] = {
+	"bvh",
+	"triangles",
+	"curves",
+	"attributes",
+	"objects",
+	"images",
+	"shaders",
+	"lights",
+	"render_buffers",
+	"other"
+};
+
+const char *mem_category_name(MemoryCategory category)
+{
+	return mem_category_names[category];
+}
+
+Stats::Stats()
+: mem_used(0), mem_peak(0)
+{
+	for(int i = 0; i < MEM_NUM_CATEGORIES; i++) {
+		category_used[i] = 0;
+		category_peak[i] = 0;
+	}
+}
+
+Stats::Stats(const Stats& other)
+{
+	thread_scoped_lock lock(other.mutex);
+	copy_from(other);
+}
+
+Stats& Stats::operator=(const Stats& other)
+{
+	if(this != &other) {
+		Stats tmp = other.get_copy();
+		thread_scoped_lock lock(mutex);
+		copy_from(tmp);
+	}
+
+	return *this;
+}
+
+void Stats::copy_from(const Stats& other)
+{
+	mem_used = other.mem_used;
+	mem_peak = other.mem_peak;
+
+	for(int i = 0; i < MEM_NUM_CATEGORIES; i++) {
+		category_used[i] = other.category_used[i];
+		category_peak[i] = other.category_peak[i];
+	}
+
+	image_used = other.image_used;
+}
+
+Stats Stats::get_copy() const
+{
+	/* the copy constructor takes the lock */
+	return Stats(*this);
+}
+
+void Stats::mem_alloc(size_t size, MemoryCategory category, const string& name)
+{
+	thread_scoped_lock lock(mutex);
+
+	mem_used += size;
+	if(mem_used > mem_peak)
+		mem_peak = mem_used;
+
+	category_used[category] += size;
+	if(category_used[category] > category_peak[category])
+		category_peak[category] = category_used[category];
+
+	if(category == MEM_CATEGORY_IMAGES && name != "")
+		image_used[name] += size;
+}
+
+void Stats::mem_free(size_t size, MemoryCategory category, const string& name)
+{
+	thread_scoped_lock lock(mutex);
+
+	mem_used -= size;
+	category_used[category] -= size;
+
+	if(category == MEM_CATEGORY_IMAGES && name != "") {
+		map<string, size_t>::iterator it = image_used.find(name);
+
+		if(it != image_used.end()) {
+			it->second -= size;
+
+			if(it->second == 0)
+				image_used.erase(it);
+		}
+	}
+}
+
+void Stats::reset_peak()
+{
+	thread_scoped_lock lock(mutex);
+
+	mem_peak = mem_used;
+
+	for(int i = 0; i < MEM_NUM_CATEGORIES; i++)
+		category_peak[i] = category_used[i];
+}
+
+MemoryCategory Stats::mem_largest_category() const
+{
+	thread_scoped_lock lock(mutex);
+	int largest = 0;
+
+	for(int i = 1; i < MEM_NUM_CATEGORIES; i++)
+		if(category_used[i] > category_used[largest])
+			largest = i;
+
+	return (MemoryCategory)largest;
+}
+
+string json_escape(const string& str)
+{
+	string result;
+
+	foreach(char c, str) {
+		if(c == '"' || c == '\\') {
+			result += '\\';
+			result += c;
+		}
+		else if((unsigned char)c < 0x20)
+			result += string_printf("\\u%04x", (int)(unsigned char)c);
+		else
+			result += c;
+	}
+
+	return result;
+}
+
+string Stats::mem_json(const string& indent) const
+{
+	thread_scoped_lock lock(mutex);
+	string json = "{\n";
+
+	json += string_printf("%s\t\"used\": %llu,\n", indent.c_str(), (unsigned long long)mem_used);
+	json += string_printf("%s\t\"peak\": %llu,\n", indent.c_str(), (unsigned long long)mem_peak);
+	json += indent + "\t\"categories\": {\n";
+
+	for(int i = 0; i < MEM_NUM_CATEGORIES; i++) {
+		json += string_printf("%s\t\t\"%s\": {\"used\": %llu, \"peak\": %llu}%s\n",
+			indent.c_str(), mem_category_names[i],
+			(unsigned long long)category_used[i], (unsigned long long)category_peak[i],
+			(i == MEM_NUM_CATEGORIES-1)? "": ",");
+	}
+
+	json += indent + "\t},\n";
+	json += indent + "\t\"images\": {\n";
+
+	map<string, size_t>::const_iterator it;
+	size_t i = 0;
+
+	for(it = image_used.begin(); it != image_used.end(); it++, i++) {
+		json += string_printf("%s\t\t\"%s\": %llu%s\n",
+			indent.c_str(), json_escape(it->first).c_str(), (unsigned long long)it->second,
+			(i == image_used.size()-1)? "": ",");
+	}
+
+	json += indent + "\t}\n";
+	json += indent + "}";
+
+	return json;
+}
+
+CCL_NAMESPACE_END
@@ -17,24 +17,76 @@
 #ifndef __UTIL_STATS_H__
 #define __UTIL_STATS_H__
 
+#include "util_map.h"
+#include "util_string.h"
+#include "util_thread.h"
+
 CCL_NAMESPACE_BEGIN
 
+/* Memory Categories
+ *
+ * Device memory is accounted per category, kernel textures get their category
+ * from their name, other memory from the owner of the device vector. */
+
+enum MemoryCategory {
+	MEM_CATEGORY_BVH = 0,
+	MEM_CATEGORY_TRIANGLES,
+	MEM_CATEGORY_CURVES,
+	MEM_CATEGORY_ATTRIBUTES,
+	MEM_CATEGORY_OBJECTS,
+	MEM_CATEGORY_IMAGES,
+	MEM_CATEGORY_SHADERS,
+	MEM_CATEGORY_LIGHTS,
+	MEM_CATEGORY_RENDER_BUFFERS,
+	MEM_CATEGORY_OTHER,
+
+	MEM_NUM_CATEGORIES
+};
+
+const char *mem_category_name(MemoryCategory category);
+
+/* escape string for use inside a quoted JSON string */
+string json_escape(const string& str);
+
+/* Devices allocate from the session thread while the interface reads the
+ * statistics, so all access goes through the mutex. Readers outside of the
+ * session thread should take a copy with get_copy() and only read that. */
+
 class Stats {
 public:
-	Stats() : mem_used(0), mem_peak(0) {}
+	Stats();
+	Stats(const Stats& other);
+	Stats& operator=(const Stats& other);
+
+	/* consistent copy of the statistics */
+	Stats get_copy() const;
+
+	/* name is optional, and used to break down the images category */
+	void mem_alloc(size_t size, MemoryCategory category = MEM_CATEGORY_OTHER, const string& name = "");
+	void mem_free(size_t size, MemoryCategory category = MEM_CATEGORY_OTHER, const string& name = "");
+
+	/* restart peak tracking from current usage */
+	void reset_peak();
 
-	void mem_alloc(size_t size) {
-		mem_used += size;
-		if(mem_used > mem_peak)
-			mem_peak = mem_used;
-	}
+	/* usage and peaks as JSON object, lines indented with indent */
+	string mem_json(const string& indent = "") const;
 
-	void mem_free(size_t size) {
-		mem_used -= size;
-	}
+	/* category currently using the most memory */
+	MemoryCategory mem_largest_category() const;
 
 	size_t mem_used;
 	size_t mem_peak;
+
+	size_t category_used[MEM_NUM_CATEGORIES];
+	size_t category_peak[MEM_NUM_CATEGORIES];
+
+	/* usage per named item, for images this is the filename */
+	map<string, size_t> image_used;
+
+protected:
+	void copy_from(const Stats& other);
+
+	mutable thread_mutex mutex;
 };
 
 CCL_NAMESPACE_END
@@ -14,6 +14,7 @@
  * limitations under the License
  */
 
+#include "util_math.h"
 #include "util_system.h"
 #include "util_types.h"
 
@@ -25,7 +26,13 @@
 #elif defined(__APPLE__)
 #include <sys/sysctl.h>
 #include <sys/types.h>
+#include <pthread.h>
+#elif defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #else
+#include <pthread.h>
 #include <unistd.h>
 #endif
 
@@ -209,5 +216,26 @@ bool system_cpu_support_sse3()
 
 #endif
 
+void system_thread_lower_priority()
+{
+#ifdef _WIN32
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+#elif defined(__linux__)
+	/* nice values apply to individual threads on linux */
+	id_t tid = (id_t)syscall(SYS_gettid);
+	int nice = getpriority(PRIO_PROCESS, tid);
+
+	setpriority(PRIO_PROCESS, tid, min(nice + 5, 19));
+#else
+	struct sched_param param;
+	int policy;
+
+	if(pthread_getschedparam(pthread_self(), &policy, &param) == 0) {
+		param.sched_priority = max(param.sched_priority - 8, sched_get_priority_min(policy));
+		pthread_setschedparam(pthread_self(), policy, &param);
+	}
+#endif
+}
+
 CCL_NAMESPACE_END
 
@@ -27,6 +27,10 @@ int system_cpu_bits();
 bool system_cpu_support_sse2();
 bool system_cpu_support_sse3();
 
+/* lower the scheduling priority of the calling thread, this can not be undone
+ * without privileges on all platforms */
+void system_thread_lower_priority();
+
 CCL_NAMESPACE_END
 
 #endif /* __UTIL_SYSTEM_H__ */
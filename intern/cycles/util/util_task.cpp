@@ -169,6 +169,7 @@ thread_mutex TaskScheduler::mutex;
 int TaskScheduler::users = 0;
 vector<thread*> TaskScheduler::threads;
 bool TaskScheduler::do_exit = false;
+bool TaskScheduler::low_priority = false;
 
 list<TaskScheduler::Entry> TaskScheduler::queue;
 thread_mutex TaskScheduler::queue_mutex;
@@ -243,6 +244,9 @@ void TaskScheduler::thread_run(int thread_id)
 
 	/* todo: test affinity/denormal mask */
 
+	if(low_priority)
+		system_thread_lower_priority();
+
 	/* keep popping off tasks */
 	while(thread_wait_pop(entry)) {
 		/* run task */
@@ -98,6 +98,11 @@ public:
 	/* test if any session is using the scheduler */
 	static bool active() { return users != 0; }
 
+	/* run worker threads at lowered OS priority, so that interactive work of
+	 * the host application preempts rendering. used for threads launched by
+	 * the next init() that starts the scheduler */
+	static void set_low_priority(bool low_priority_) { low_priority = low_priority_; }
+
 protected:
 	friend class TaskPool;
 
@@ -110,6 +115,7 @@ protected:
 	static int users;
 	static vector<thread*> threads;
 	static bool do_exit;
+	static bool low_priority;
 
 	static list<Entry> queue;
 	static thread_mutex queue_mutex;
@@ -552,6 +552,28 @@ template<size_t i0, size_t i1, size_t i2, size_t i3> __device_inline const __m12
 typedef unsigned short half;
 struct half4 { half x, y, z, w; };
 
+#ifndef __KERNEL_CUDA__
+
+__device_inline float half_to_float(half h)
+{
+	/* denormals are flushed to zero */
+	union { uint i; float f; } out;
+	uint sign = (uint)(h & 0x8000) << 16;
+	uint exponent = (h >> 10) & 0x1F;
+	uint mantissa = h & 0x3FF;
+
+	if(exponent == 0)
+		out.i = sign;
+	else if(exponent == 0x1F)
+		out.i = sign | 0x7F800000 | (mantissa << 13);
+	else
+		out.i = sign | ((exponent + 112) << 23) | (mantissa << 13);
+
+	return out.f;
+}
+
+#endif
+
 #ifdef __KERNEL_CUDA__
 
 __device_inline void float4_store_half(half *h, const float4 *f, float scale)
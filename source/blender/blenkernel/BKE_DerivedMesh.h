@@ -676,6 +676,8 @@ float (*editbmesh_get_vertex_cos(struct BMEditMesh *em, int *numVerts_r))[3];
 int editbmesh_modifier_is_enabled(struct Scene *scene, struct ModifierData *md, DerivedMesh *dm);
 void makeDerivedMesh(struct Scene *scene, struct Object *ob, struct BMEditMesh *em, 
                      CustomDataMask dataMask, int build_shapekey_layers);
+void mesh_modifier_stack_cache_init(void);
+void mesh_free_modifier_stack_cache(struct Object *ob);
 
 /** returns an array of deform matrices for crazyspace correction, and the
  * number of modifiers left */
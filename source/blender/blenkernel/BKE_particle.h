@@ -39,6 +39,7 @@
 
 struct ParticleSystemModifierData;
 struct ParticleSystem;
+struct SPHGrid;
 struct ParticleKey;
 struct ParticleSettings;
 struct HairKey;
@@ -91,6 +92,7 @@ typedef struct ParticleSimulationData {
 
 typedef struct SPHData {
 	ParticleSystem *psys[10];
+	struct SPHGrid *grid[10];  /* neighbor lookup for each of psys, see psys_sph_init */
 	ParticleData *pa;
 	float mass;
 	struct EdgeHash *eh;
@@ -311,6 +313,7 @@ int psys_get_particle_state(struct ParticleSimulationData *sim, int p, struct Pa
 
 void psys_sph_init(struct ParticleSimulationData *sim, struct SPHData *sphdata);
 void psys_sph_finalise(struct SPHData *sphdata);
+void psys_sph_grid_free(struct SPHGrid *grid);
 void psys_sph_density(struct BVHTree *tree, struct SPHData *data, float co[3], float vars[2]);
 
 /* for anim.c */
@@ -42,6 +42,8 @@
 #include "DNA_armature_types.h"
 #include "DNA_object_types.h"
 #include "DNA_scene_types.h" // N_T
+#include "DNA_sdna_types.h"
+#include "DNA_genfile.h"
 
 #include "BLI_blenlib.h"
 #include "BLI_math.h"
@@ -75,6 +77,8 @@ static DerivedMesh *navmesh_dm_createNavMeshForVisualization(DerivedMesh *dm);
 
 #include "BLI_sys_types.h" /* for intptr_t support */
 
+#include "atomic_ops.h"
+
 #include "GL/glew.h"
 
 #include "GPU_buffers.h"
@@ -1412,6 +1416,397 @@ static void dm_ensure_display_normals(DerivedMesh *dm)
 		CDDM_calc_normals_mapping_ex(dm, (dm->dirty & DM_DIRTY_NORMALS) ? false : true);
 	}
 }
+/* -------------------------------------------------------------------- */
+/* Modifier Stack Cache
+ *
+ * Keeps a copy of the stack result after the last constructive modifier of
+ * an unchanged stack prefix, so tweaking a modifier further down the stack
+ * only re-evaluates from the first changed modifier.
+ *
+ * Every prefix of the stack gets a cumulative key made of the input mesh
+ * contents, the object's vertex groups, the requested data masks and the
+ * settings of each modifier. Only modifiers that depend on nothing but
+ * their own settings and their input mesh can be part of a cached prefix:
+ * time dependent modifiers, modifiers which reference other data-blocks
+ * (objects, textures...) and virtual modifiers end the cacheable range. */
+
+/* upper limit for the memory used by all cached results together */
+#define MODIFIER_STACK_CACHE_MEM_LIMIT ((uint64_t)256 * 1024 * 1024)
+
+typedef struct ModifierStackCache {
+	DerivedMesh *dm;  /* copy of the stack result after the modifier at 'index' */
+	int index;        /* position of the cached result in the evaluated stack */
+	int totkey;
+	uint64_t *keys;   /* cumulative keys of the cacheable stack prefixes of the last evaluation */
+	uint64_t mem;     /* memory used by 'dm', counted against MODIFIER_STACK_CACHE_MEM_LIMIT */
+} ModifierStackCache;
+
+/* most byte ranges of settings a modifier struct may have, types with more are not cached */
+#define MODIFIER_STACK_CACHE_MAX_RANGES 32
+
+/* the parts of a modifier type's struct that make up its settings: everything after the
+ * generic header except pointers, which are runtime data (caches, bindings) or references
+ * that can change while the settings stay the same */
+typedef struct ModifierSettingsRanges {
+	bool valid;
+	int totrange;
+	int range[MODIFIER_STACK_CACHE_MAX_RANGES][2];  /* byte offset and length */
+} ModifierSettingsRanges;
+
+static ModifierSettingsRanges modifier_stack_cache_settings[NUM_MODIFIER_TYPES];
+
+static uint64_t modifier_stack_cache_mem = 0;
+
+BLI_INLINE uint64_t modifier_stack_cache_hash_int(uint64_t h, uint64_t k)
+{
+	/* 64 bit FNV-1a style mixing of a whole word */
+	h ^= k;
+	h *= 0x100000001b3ULL;
+	return h ^ (h >> 29);
+}
+
+static uint64_t modifier_stack_cache_hash_data(uint64_t h, const void *data, size_t size)
+{
+	const unsigned char *p = data;
+	const unsigned char *p_end = p + size;
+
+	if (data == NULL)
+		return modifier_stack_cache_hash_int(h, 0);
+
+	for (; p + sizeof(uint64_t) <= p_end; p += sizeof(uint64_t)) {
+		uint64_t k;
+		memcpy(&k, p, sizeof(k));
+		h = modifier_stack_cache_hash_int(h, k);
+	}
+	for (; p < p_end; p++) {
+		h = modifier_stack_cache_hash_int(h, *p);
+	}
+
+	return modifier_stack_cache_hash_int(h, size);
+}
+
+static uint64_t modifier_stack_cache_hash_customdata(uint64_t h, const CustomData *data, int totelem)
+{
+	int i;
+
+	h = modifier_stack_cache_hash_int(h, (uint64_t)totelem);
+
+	for (i = 0; i < data->totlayer; i++) {
+		const CustomDataLayer *layer = &data->layers[i];
+
+		h = modifier_stack_cache_hash_int(h, (uint64_t)layer->type);
+		h = modifier_stack_cache_hash_int(h, (uint64_t)layer->active);
+		h = modifier_stack_cache_hash_int(h, (uint64_t)layer->active_rnd);
+		h = modifier_stack_cache_hash_data(h, layer->name, strlen(layer->name));
+
+		if (layer->type == CD_MDEFORMVERT) {
+			/* weights are stored outside of the layer and edited in-place by weight paint */
+			const MDeformVert *dvert = layer->data;
+			int j;
+
+			for (j = 0; j < totelem; j++, dvert++) {
+				h = modifier_stack_cache_hash_data(h, dvert->dw, sizeof(*dvert->dw) * dvert->totweight);
+			}
+		}
+		else {
+			h = modifier_stack_cache_hash_data(h, layer->data, (size_t)CustomData_sizeof(layer->type) * totelem);
+		}
+	}
+
+	return h;
+}
+
+static void modifier_stack_cache_settings_init(ModifierSettingsRanges *settings, SDNA *sdna,
+                                               ModifierTypeInfo *mti)
+{
+	const int size = mti->structSize;
+	const int structnr = DNA_struct_find_nr(sdna, mti->structName);
+	char *mask;
+	int i;
+
+	settings->valid = false;
+	settings->totrange = 0;
+
+	if (structnr == -1 || sdna->typelens[sdna->structs[structnr][0]] != size)
+		return;
+
+	mask = MEM_callocN((size_t)size, __func__);
+	DNA_struct_pointer_mask(sdna, structnr, mask);
+
+	settings->valid = true;
+
+	for (i = (int)sizeof(ModifierData); i < size; i++) {
+		int start;
+
+		if (mask[i])
+			continue;
+
+		if (settings->totrange == MODIFIER_STACK_CACHE_MAX_RANGES) {
+			settings->valid = false;
+			break;
+		}
+
+		for (start = i; i < size && !mask[i]; i++) {
+			/* pass */
+		}
+
+		settings->range[settings->totrange][0] = start;
+		settings->range[settings->totrange][1] = i - start;
+		settings->totrange++;
+	}
+
+	MEM_freeN(mask);
+}
+
+/* find the settings of every modifier type in DNA, called once on startup */
+void mesh_modifier_stack_cache_init(void)
+{
+	SDNA *sdna = DNA_sdna_from_data(DNAstr, DNAlen, false);
+	int type;
+
+	for (type = 0; type < NUM_MODIFIER_TYPES; type++) {
+		ModifierTypeInfo *mti = modifierType_getInfo(type);
+
+		if (mti)
+			modifier_stack_cache_settings_init(&modifier_stack_cache_settings[type], sdna, mti);
+		else
+			modifier_stack_cache_settings[type].valid = false;
+	}
+
+	DNA_sdna_free(sdna);
+}
+
+static uint64_t modifier_stack_cache_hash_settings(uint64_t h, ModifierData *md)
+{
+	const ModifierSettingsRanges *settings = &modifier_stack_cache_settings[md->type];
+	int i;
+
+	for (i = 0; i < settings->totrange; i++) {
+		h = modifier_stack_cache_hash_data(h, (char *)md + settings->range[i][0], (size_t)settings->range[i][1]);
+	}
+
+	return h;
+}
+
+static void modifier_stack_cache_id_walk(void *userData, Object *UNUSED(ob), ID **idpoin)
+{
+	if (*idpoin) {
+		*((bool *)userData) = true;
+	}
+}
+
+static void modifier_stack_cache_object_walk(void *userData, Object *UNUSED(ob), Object **obpoin)
+{
+	if (*obpoin) {
+		*((bool *)userData) = true;
+	}
+}
+
+/* can the result of this modifier be reused as long as its settings and input do not change? */
+static bool modifier_stack_cache_supports(Object *ob, ModifierData *md)
+{
+	ModifierTypeInfo *mti = modifierType_getInfo(md->type);
+	bool has_id_links = false;
+
+	/* virtual modifiers (armature or shape key deform from the parent/key) */
+	if (BLI_findindex(&ob->modifiers, md) == -1)
+		return false;
+	if (!modifier_stack_cache_settings[md->type].valid)
+		return false;
+	if (mti->type == eModifierTypeType_DeformOrConstruct)
+		return false;
+	if (mti->flags & (eModifierTypeFlag_UsesPointCache | eModifierTypeFlag_RequiresOriginalData))
+		return false;
+	if (mti->dependsOnTime && mti->dependsOnTime(md))
+		return false;
+
+	if (mti->foreachIDLink)
+		mti->foreachIDLink(md, ob, modifier_stack_cache_id_walk, &has_id_links);
+	else if (mti->foreachObjectLink)
+		mti->foreachObjectLink(md, ob, modifier_stack_cache_object_walk, &has_id_links);
+
+	return !has_id_links;
+}
+
+/**
+ * Calculate the cumulative keys of the cacheable prefixes of the stack starting at \a firstmd.
+ * Returns the number of keys written to \a r_keys (allocated), which may be zero.
+ */
+static int modifier_stack_cache_keys(Scene *scene, Object *ob, ModifierData *firstmd, CDMaskLink *datamasks,
+                                     CustomDataMask dataMask, int required_mode, uint64_t **r_keys)
+{
+	Mesh *me = ob->data;
+	ModifierData *md;
+	CDMaskLink *curr;
+	bDeformGroup *dg;
+	uint64_t *keys;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	int totkey = 0;
+
+	for (md = firstmd; md; md = md->next) {
+		if (modifier_isEnabled(scene, md, required_mode) && !modifier_stack_cache_supports(ob, md))
+			break;
+		totkey++;
+	}
+
+	*r_keys = NULL;
+	if (totkey == 0)
+		return 0;
+
+	/* input mesh */
+	h = modifier_stack_cache_hash_int(h, (uint64_t)(intptr_t)me);
+	h = modifier_stack_cache_hash_int(h, (uint64_t)me->cd_flag);
+	h = modifier_stack_cache_hash_int(h, dataMask);
+	h = modifier_stack_cache_hash_customdata(h, &me->vdata, me->totvert);
+	h = modifier_stack_cache_hash_customdata(h, &me->edata, me->totedge);
+	h = modifier_stack_cache_hash_customdata(h, &me->ldata, me->totloop);
+	h = modifier_stack_cache_hash_customdata(h, &me->pdata, me->totpoly);
+	h = modifier_stack_cache_hash_int(h, (uint64_t)me->totface);
+
+	/* modifiers reference vertex groups by name */
+	for (dg = ob->defbase.first; dg; dg = dg->next) {
+		h = modifier_stack_cache_hash_data(h, dg->name, strlen(dg->name));
+	}
+
+	keys = MEM_mallocN(sizeof(*keys) * totkey, __func__);
+
+	for (md = firstmd, curr = datamasks, totkey = 0; md; md = md->next, curr = curr->next) {
+		if (modifier_isEnabled(scene, md, required_mode) && !modifier_stack_cache_supports(ob, md))
+			break;
+
+		/* skip the generic header (list pointers, name, UI flags), only the settings matter */
+		h = modifier_stack_cache_hash_int(h, (uint64_t)md->type);
+		h = modifier_stack_cache_hash_int(h, (uint64_t)md->mode);
+		h = modifier_stack_cache_hash_int(h, curr->mask);
+		h = modifier_stack_cache_hash_settings(h, md);
+		keys[totkey++] = h;
+	}
+
+	*r_keys = keys;
+	return totkey;
+}
+
+static void modifier_stack_cache_clear_result(ModifierStackCache *cache)
+{
+	if (cache->dm) {
+		cache->dm->needsFree = 1;
+		cache->dm->release(cache->dm);
+		cache->dm = NULL;
+		atomic_sub_uint64(&modifier_stack_cache_mem, cache->mem);
+		cache->mem = 0;
+	}
+	cache->index = -1;
+}
+
+static uint64_t modifier_stack_cache_customdata_mem(const CustomData *data, int totelem)
+{
+	/* the base element arrays are not counted here, CDDM_copy duplicates them separately */
+	const CustomDataMask mask = CD_MASK_DERIVEDMESH &
+	                            ~(CD_MASK_MVERT | CD_MASK_MEDGE | CD_MASK_MFACE | CD_MASK_MLOOP | CD_MASK_MPOLY);
+	uint64_t mem = 0;
+	int i;
+
+	for (i = 0; i < data->totlayer; i++) {
+		if (mask & CD_TYPE_AS_MASK(data->layers[i].type))
+			mem += (uint64_t)CustomData_sizeof(data->layers[i].type) * (uint64_t)totelem;
+	}
+
+	return mem;
+}
+
+/* memory used by CDDM_copy(dm), estimated without making the copy */
+static uint64_t modifier_stack_cache_dm_mem(DerivedMesh *dm)
+{
+	return modifier_stack_cache_customdata_mem(&dm->vertData, dm->numVertData) +
+	       modifier_stack_cache_customdata_mem(&dm->edgeData, dm->numEdgeData) +
+	       modifier_stack_cache_customdata_mem(&dm->faceData, dm->numTessFaceData) +
+	       modifier_stack_cache_customdata_mem(&dm->loopData, dm->numLoopData) +
+	       modifier_stack_cache_customdata_mem(&dm->polyData, dm->numPolyData) +
+	       sizeof(MVert) * (uint64_t)dm->numVertData +
+	       sizeof(MEdge) * (uint64_t)dm->numEdgeData +
+	       sizeof(MFace) * (uint64_t)dm->numTessFaceData +
+	       sizeof(MLoop) * (uint64_t)dm->numLoopData +
+	       sizeof(MPoly) * (uint64_t)dm->numPolyData;
+}
+
+/* store a copy of \a dm as the result of the stack up to \a index */
+static void modifier_stack_cache_store(ModifierStackCache *cache, DerivedMesh *dm, int index)
+{
+	DerivedMesh *cachedm;
+	uint64_t mem;
+
+	modifier_stack_cache_clear_result(cache);
+
+	/* soft limit, concurrent object updates may overshoot it slightly */
+	mem = modifier_stack_cache_dm_mem(dm);
+	if (modifier_stack_cache_mem + mem > MODIFIER_STACK_CACHE_MEM_LIMIT)
+		return;
+
+	cachedm = CDDM_copy(dm);
+
+	atomic_add_uint64(&modifier_stack_cache_mem, mem);
+	cachedm->needsFree = 0;
+	cache->dm = cachedm;
+	cache->mem = mem;
+	cache->index = index;
+}
+
+/**
+ * Position of the last constructive modifier within the first \a totkey modifiers of the stack,
+ * which is not the last enabled modifier (caching the final result would hand out a plain copy
+ * instead of the modifier's own DerivedMesh type). Returns -1 when there is none.
+ */
+static int modifier_stack_cache_checkpoint(Scene *scene, ModifierData *firstmd, int required_mode, int totkey)
+{
+	ModifierData *md;
+	int i, checkpoint = -1, candidate = -1;
+
+	for (md = firstmd, i = 0; md; md = md->next, i++) {
+		ModifierTypeInfo *mti = modifierType_getInfo(md->type);
+
+		if (!modifier_isEnabled(scene, md, required_mode))
+			continue;
+
+		/* an enabled modifier follows the candidate */
+		checkpoint = candidate;
+
+		if (i >= totkey)
+			break;
+
+		if (mti->type != eModifierTypeType_OnlyDeform)
+			candidate = i;
+	}
+
+	return checkpoint;
+}
+
+static bool modifier_stack_cache_has_errors(ModifierData *firstmd, ModifierData *lastmd)
+{
+	ModifierData *md;
+
+	for (md = firstmd; md; md = md->next) {
+		if (md->error)
+			return true;
+		if (md == lastmd)
+			break;
+	}
+
+	return false;
+}
+
+void mesh_free_modifier_stack_cache(Object *ob)
+{
+	ModifierStackCache *cache = ob->modifier_stack_cache;
+
+	if (cache) {
+		modifier_stack_cache_clear_result(cache);
+		if (cache->keys)
+			MEM_freeN(cache->keys);
+		MEM_freeN(cache);
+		ob->modifier_stack_cache = NULL;
+	}
+}
+
 /* new value for useDeform -1  (hack for the gameengine):
  * - apply only the modifier stack of the object, skipping the virtual modifiers,
  * - don't apply the key
@@ -1452,6 +1847,13 @@ static void mesh_calc_modifiers(Scene *scene, Object *ob, float (*inputVertexCos
 
 	VirtualModifierData virtualModifierData;
 
+	/* modifier stack cache, only for the regular viewport evaluation */
+	bool use_stack_cache = (useCache && !useRenderParams && useDeform > 0 && !needMapping &&
+	                        !inputVertexCos && index == -1 && !build_shapekey_layers &&
+	                        !sculpt_mode && !do_init_wmcol);
+	ModifierStackCache *stack_cache = NULL;
+	int stack_index = 0, stack_store_index = -1;
+
 	ModifierApplyFlag app_flags = useRenderParams ? MOD_APPLY_RENDER : 0;
 	ModifierApplyFlag deform_app_flags = app_flags;
 	if (useCache)
@@ -1497,6 +1899,13 @@ static void mesh_calc_modifiers(Scene *scene, Object *ob, float (*inputVertexCos
 	datamasks = modifiers_calcDataMasks(scene, ob, md, dataMask, required_mode, previewmd, previewmask);
 	curr = datamasks;
 
+	/* orco layers are built in parallel to the stack, the cached result can't provide them */
+	if (previewmd || (datamasks && (datamasks->mask & (CD_MASK_ORCO | CD_MASK_CLOTH_ORCO))))
+		use_stack_cache = false;
+
+	if (useCache && !use_stack_cache)
+		mesh_free_modifier_stack_cache(ob);
+
 	if (deform_r) *deform_r = NULL;
 	*final_r = NULL;
 
@@ -1505,7 +1914,7 @@ static void mesh_calc_modifiers(Scene *scene, Object *ob, float (*inputVertexCos
 			deformedVerts = inputVertexCos;
 		
 		/* Apply all leading deforming modifiers */
-		for (; md; md = md->next, curr = curr->next) {
+		for (; md; md = md->next, curr = curr->next, stack_index++) {
 			ModifierTypeInfo *mti = modifierType_getInfo(md->type);
 
 			md->scene = scene;
@@ -1559,7 +1968,57 @@ static void mesh_calc_modifiers(Scene *scene, Object *ob, float (*inputVertexCos
 	orcodm = NULL;
 	clothorcodm = NULL;
 
-	for (; md; md = md->next, curr = curr->next) {
+	if (use_stack_cache) {
+		uint64_t *keys;
+		int totkey, first_dirty, limit;
+
+		if (ob->modifier_stack_cache == NULL) {
+			ob->modifier_stack_cache = MEM_callocN(sizeof(ModifierStackCache), "ModifierStackCache");
+			ob->modifier_stack_cache->index = -1;
+		}
+		stack_cache = ob->modifier_stack_cache;
+
+		totkey = modifier_stack_cache_keys(scene, ob, firstmd, datamasks, dataMask, required_mode, &keys);
+
+		for (first_dirty = 0; first_dirty < totkey && first_dirty < stack_cache->totkey; first_dirty++) {
+			if (keys[first_dirty] != stack_cache->keys[first_dirty])
+				break;
+		}
+
+		if (stack_cache->dm && stack_cache->index < first_dirty) {
+			/* the stack is unchanged up to the cached result, continue from there */
+			if (deformedVerts) {
+				MEM_freeN(deformedVerts);
+				deformedVerts = NULL;
+			}
+
+			dm = CDDM_copy(stack_cache->dm);
+
+			for (md = firstmd, curr = datamasks, stack_index = 0;
+			     stack_index <= stack_cache->index;
+			     md = md->next, curr = curr->next, stack_index++)
+			{
+				/* pass */
+			}
+		}
+		else {
+			modifier_stack_cache_clear_result(stack_cache);
+		}
+
+		/* cache the result of the last unchanged constructive modifier, when everything
+		 * changed (or on first evaluation) assume later modifiers will be edited */
+		limit = (first_dirty == 0) ? totkey : first_dirty;
+		stack_store_index = modifier_stack_cache_checkpoint(scene, firstmd, required_mode, limit);
+		if (stack_store_index == stack_cache->index)
+			stack_store_index = -1;
+
+		if (stack_cache->keys)
+			MEM_freeN(stack_cache->keys);
+		stack_cache->keys = keys;
+		stack_cache->totkey = totkey;
+	}
+
+	for (; md; md = md->next, curr = curr->next, stack_index++) {
 		ModifierTypeInfo *mti = modifierType_getInfo(md->type);
 
 		md->scene = scene;
@@ -1732,6 +2191,10 @@ static void mesh_calc_modifiers(Scene *scene, Object *ob, float (*inputVertexCos
 
 					deformedVerts = NULL;
 				}
+
+				/* keep the result of the unchanged part of the stack for the next evaluation */
+				if (stack_index == stack_store_index && !modifier_stack_cache_has_errors(firstmd, md))
+					modifier_stack_cache_store(stack_cache, dm, stack_index);
 			}
 
 			/* create an orco derivedmesh in parallel */
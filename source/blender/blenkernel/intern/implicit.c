@@ -226,9 +226,10 @@ DO_INLINE void zero_lfvector(float (*to)[3], unsigned int verts)
 /* multiply long vector with scalar*/
 DO_INLINE void mul_lfvectorS(float (*to)[3], float (*fLongVector)[3], float scalar, unsigned int verts)
 {
-	unsigned int i = 0;
+	int i;
 
-	for (i = 0; i < verts; i++) {
+#pragma omp parallel for private(i) if (verts > CLOTH_OPENMP_LIMIT)
+	for (i = 0; i < (int)verts; i++) {
 		mul_fvector_S(to[i], fLongVector[i], scalar);
 	}
 }
@@ -242,26 +243,50 @@ DO_INLINE void submul_lfvectorS(float (*to)[3], float (*fLongVector)[3], float s
 	}
 }
 /* dot product for big vector */
+#define CLOTH_DOT_CHUNK 1024
 DO_INLINE float dot_lfvector(float (*fLongVectorA)[3], float (*fLongVectorB)[3], unsigned int verts)
 {
-	long i = 0;
-	float temp = 0.0;
-// XXX brecht, disabled this for now (first schedule line was already disabled),
-// due to non-commutative nature of floating point ops this makes the sim give
-// different results each time you run it!
-// schedule(guided, 2)
-//#pragma omp parallel for reduction(+: temp) if (verts > CLOTH_OPENMP_LIMIT)
-	for (i = 0; i < (long)verts; i++) {
-		temp += dot_v3v3(fLongVectorA[i], fLongVectorB[i]);
+	/* An OpenMP reduction makes the sim give different results each time you run it,
+	 * due to the non-commutative nature of floating point ops. Instead fixed size chunks
+	 * are summed in parallel and the partial sums are added up in order, so the result
+	 * doesn't depend on the number of threads. */
+	double partial_stack[64], *partial = partial_stack;
+	double temp = 0.0;
+	int totchunk = (int)((verts + CLOTH_DOT_CHUNK - 1) / CLOTH_DOT_CHUNK);
+	int chunk;
+
+	if (totchunk > (int)(sizeof(partial_stack) / sizeof(*partial_stack)))
+		partial = MEM_mallocN(sizeof(*partial) * totchunk, "cloth_implicit_dot");
+
+#pragma omp parallel for private(chunk) if (verts > CLOTH_OPENMP_LIMIT)
+	for (chunk = 0; chunk < totchunk; chunk++) {
+		unsigned int i = (unsigned int)chunk * CLOTH_DOT_CHUNK;
+		unsigned int end = MIN2(i + CLOTH_DOT_CHUNK, verts);
+		double sum = 0.0;
+
+		for (; i < end; i++) {
+			sum += dot_v3v3(fLongVectorA[i], fLongVectorB[i]);
+		}
+		partial[chunk] = sum;
 	}
-	return temp;
+
+	for (chunk = 0; chunk < totchunk; chunk++) {
+		temp += partial[chunk];
+	}
+
+	if (partial != partial_stack)
+		MEM_freeN(partial);
+
+	return (float)temp;
 }
+#undef CLOTH_DOT_CHUNK
 /* A = B + C  --> for big vector */
 DO_INLINE void add_lfvector_lfvector(float (*to)[3], float (*fLongVectorA)[3], float (*fLongVectorB)[3], unsigned int verts)
 {
-	unsigned int i = 0;
+	int i;
 
-	for (i = 0; i < verts; i++) {
+#pragma omp parallel for private(i) if (verts > CLOTH_OPENMP_LIMIT)
+	for (i = 0; i < (int)verts; i++) {
 		VECADD(to[i], fLongVectorA[i], fLongVectorB[i]);
 	}
 
@@ -269,9 +294,10 @@ DO_INLINE void add_lfvector_lfvector(float (*to)[3], float (*fLongVectorA)[3], f
 /* A = B + C * float --> for big vector */
 DO_INLINE void add_lfvector_lfvectorS(float (*to)[3], float (*fLongVectorA)[3], float (*fLongVectorB)[3], float bS, unsigned int verts)
 {
-	unsigned int i = 0;
+	int i;
 
-	for (i = 0; i < verts; i++) {
+#pragma omp parallel for private(i) if (verts > CLOTH_OPENMP_LIMIT)
+	for (i = 0; i < (int)verts; i++) {
 		VECADDS(to[i], fLongVectorA[i], fLongVectorB[i], bS);
 
 	}
@@ -279,17 +305,20 @@ DO_INLINE void add_lfvector_lfvectorS(float (*to)[3], float (*fLongVectorA)[3],
 /* A = B * float + C * float --> for big vector */
 DO_INLINE void add_lfvectorS_lfvectorS(float (*to)[3], float (*fLongVectorA)[3], float aS, float (*fLongVectorB)[3], float bS, unsigned int verts)
 {
-	unsigned int i = 0;
+	int i;
 
-	for (i = 0; i < verts; i++) {
+#pragma omp parallel for private(i) if (verts > CLOTH_OPENMP_LIMIT)
+	for (i = 0; i < (int)verts; i++) {
 		VECADDSS(to[i], fLongVectorA[i], aS, fLongVectorB[i], bS);
 	}
 }
 /* A = B - C * float --> for big vector */
 DO_INLINE void sub_lfvector_lfvectorS(float (*to)[3], float (*fLongVectorA)[3], float (*fLongVectorB)[3], float bS, unsigned int verts)
 {
-	unsigned int i = 0;
-	for (i = 0; i < verts; i++) {
+	int i;
+
+#pragma omp parallel for private(i) if (verts > CLOTH_OPENMP_LIMIT)
+	for (i = 0; i < (int)verts; i++) {
 		VECSUBS(to[i], fLongVectorA[i], fLongVectorB[i], bS);
 	}
 
@@ -297,9 +326,10 @@ DO_INLINE void sub_lfvector_lfvectorS(float (*to)[3], float (*fLongVectorA)[3],
 /* A = B - C --> for big vector */
 DO_INLINE void sub_lfvector_lfvector(float (*to)[3], float (*fLongVectorA)[3], float (*fLongVectorB)[3], unsigned int verts)
 {
-	unsigned int i = 0;
+	int i;
 
-	for (i = 0; i < verts; i++) {
+#pragma omp parallel for private(i) if (verts > CLOTH_OPENMP_LIMIT)
+	for (i = 0; i < (int)verts; i++) {
 		sub_v3_v3v3(to[i], fLongVectorA[i], fLongVectorB[i]);
 	}
 
@@ -577,36 +607,81 @@ DO_INLINE void mul_bfmatrix_S(fmatrix3x3 *matrix, float scalar)
 	}
 }
 
+/* Compressed row layout of the big matrices: for every vertex (row) the off-diagonal
+ * blocks touching it and the vertex on their other end. The big matrices only store
+ * each symmetric spring block once, this lets a row be computed without scattering
+ * into other rows, so rows can be processed in parallel. All big matrices of a cloth
+ * share the same layout (see implicit_init), one row index serves all of them. */
+typedef struct BlockRowIndex {
+	unsigned int *row_start;  /* vcount + 1 offsets into block and column */
+	unsigned int *block;      /* index of the off-diagonal block in the big matrix */
+	unsigned int *column;     /* vertex coupled to the row vertex by the block */
+} BlockRowIndex;
+
+static void create_block_row_index(BlockRowIndex *rows, fmatrix3x3 *matrix)
+{
+	unsigned int vcount = matrix[0].vcount, scount = matrix[0].scount;
+	unsigned int *fill;
+	unsigned int i;
+
+	rows->row_start = MEM_callocN(sizeof(unsigned int) * (vcount + 1), "cloth_implicit_row_start");
+	rows->block = MEM_mallocN(sizeof(unsigned int) * (2 * scount + 1), "cloth_implicit_row_block");
+	rows->column = MEM_mallocN(sizeof(unsigned int) * (2 * scount + 1), "cloth_implicit_row_column");
+
+	/* count the blocks of each row, every block appears in the rows of both its vertices */
+	for (i = vcount; i < vcount + scount; i++) {
+		rows->row_start[matrix[i].r + 1]++;
+		rows->row_start[matrix[i].c + 1]++;
+	}
+	for (i = 0; i < vcount; i++) {
+		rows->row_start[i + 1] += rows->row_start[i];
+	}
+
+	fill = MEM_dupallocN(rows->row_start);
+	for (i = vcount; i < vcount + scount; i++) {
+		unsigned int r = matrix[i].r, c = matrix[i].c;
+
+		rows->block[fill[r]] = i;
+		rows->column[fill[r]++] = c;
+		rows->block[fill[c]] = i;
+		rows->column[fill[c]++] = r;
+	}
+	MEM_freeN(fill);
+}
+
+static void free_block_row_index(BlockRowIndex *rows)
+{
+	if (rows->row_start) {
+		MEM_freeN(rows->row_start);
+		MEM_freeN(rows->block);
+		MEM_freeN(rows->column);
+		rows->row_start = rows->block = rows->column = NULL;
+	}
+}
+
 /* SPARSE SYMMETRIC multiply big matrix with long vector*/
 /* STATUS: verified */
-DO_INLINE void mul_bfmatrix_lfvector( float (*to)[3], fmatrix3x3 *from, lfVector *fLongVector)
+DO_INLINE void mul_bfmatrix_lfvector( float (*to)[3], fmatrix3x3 *from, BlockRowIndex *rows, lfVector *fLongVector)
 {
-	unsigned int i = 0;
-	unsigned int vcount = from[0].vcount;
-	lfVector *temp = create_lfvector(vcount);
-	
-	zero_lfvector(to, vcount);
+	int vcount = (int)from[0].vcount;
+	int i;
 
-#pragma omp parallel sections private(i) if (vcount > CLOTH_OPENMP_LIMIT)
-	{
-#pragma omp section
-		{
-			for (i = from[0].vcount; i < from[0].vcount+from[0].scount; i++) {
-				muladd_fmatrix_fvector(to[from[i].c], from[i].m, fLongVector[from[i].r]);
-			}
-		}
-#pragma omp section
-		{
-			for (i = 0; i < from[0].vcount+from[0].scount; i++) {
-				muladd_fmatrix_fvector(temp[from[i].r], from[i].m, fLongVector[from[i].c]);
-			}
+#pragma omp parallel for private(i) if (vcount > CLOTH_OPENMP_LIMIT)
+	for (i = 0; i < vcount; i++) {
+		const unsigned int row_end = rows->row_start[i + 1];
+		unsigned int j;
+		float r[3];
+
+		mul_fmatrix_fvector(r, from[i].m, fLongVector[i]);
+
+		/* the blocks and vectors are gathered through the row index, so this loop
+		 * does not vectorize, the gain is from computing rows in parallel */
+		for (j = rows->row_start[i]; j < row_end; j++) {
+			muladd_fmatrix_fvector(r, from[rows->block[j]].m, fLongVector[rows->column[j]]);
 		}
+
+		copy_v3_v3(to[i], r);
 	}
-	add_lfvector_lfvector(to, to, temp, from[0].vcount);
-	
-	del_lfvector(temp);
-	
-	
 }
 
 /* SPARSE SYMMETRIC multiply big matrix with long vector (for diagonal preconditioner) */
@@ -706,6 +781,7 @@ DO_INLINE void subadd_bfmatrixS_bfmatrixS( fmatrix3x3 *to, fmatrix3x3 *from, flo
 typedef struct Implicit_Data  {
 	lfVector *X, *V, *Xnew, *Vnew, *olddV, *F, *B, *dV, *z;
 	fmatrix3x3 *A, *dFdV, *dFdX, *S, *P, *Pinv, *bigI, *M; 
+	BlockRowIndex rows;
 } Implicit_Data;
 
 /* Init constraint matrix */
@@ -803,6 +879,8 @@ int implicit_init(Object *UNUSED(ob), ClothModifierData *clmd)
 	
 	initdiag_bfmatrix(id->bigI, I);
 
+	create_block_row_index(&id->rows, id->A);
+
 	for (i = 0; i < cloth->numverts; i++) {
 		copy_v3_v3(id->X[i], verts[i].x);
 	}
@@ -839,6 +917,8 @@ int	implicit_free(ClothModifierData *clmd)
 			del_lfvector(id->dV);
 			del_lfvector(id->z);
 
+			free_block_row_index(&id->rows);
+
 			MEM_freeN(id);
 		}
 	}
@@ -893,39 +973,72 @@ DO_INLINE void filter(lfVector *V, fmatrix3x3 *S)
 	}
 }
 
-static int  cg_filtered(lfVector *ldV, fmatrix3x3 *lA, lfVector *lB, lfVector *z, fmatrix3x3 *S)
+// block diagonalizer
+DO_INLINE void BuildPPinv(fmatrix3x3 *lA, fmatrix3x3 *P, fmatrix3x3 *Pinv)
+{
+	int i;
+	
+	// Take only the diagonal blocks of A
+#pragma omp parallel for private(i) if (lA[0].vcount > CLOTH_OPENMP_LIMIT)
+	for (i = 0; i < (int)lA[0].vcount; i++) {
+		// block diagonalizer
+		cp_fmatrix(P[i].m, lA[i].m);
+
+		/* singular blocks don't precondition */
+		if (det_fmatrix(P[i].m) != 0.0f)
+			inverse_fmatrix(Pinv[i].m, P[i].m);
+		else
+			cp_fmatrix(Pinv[i].m, I);
+	}
+}
+
+/* block diagonal (Jacobi) preconditioner, one 3x3 block per vertex */
+DO_INLINE void mul_bfmatrix_diag_lfvector(float (*to)[3], fmatrix3x3 *Pinv, lfVector *fLongVector)
+{
+	int i;
+
+#pragma omp parallel for private(i) if (Pinv[0].vcount > CLOTH_OPENMP_LIMIT)
+	for (i = 0; i < (int)Pinv[0].vcount; i++) {
+		mul_fmatrix_fvector(to[i], Pinv[i].m, fLongVector[i]);
+	}
+}
+
+/* Solves for unknown X in equation AX=B, preconditioned with the inverted diagonal blocks of A.
+ * The constraint filter S is applied to keep pinned vertices out of the solution. */
+static int  cg_filtered(lfVector *ldV, fmatrix3x3 *lA, BlockRowIndex *rows, lfVector *lB, lfVector *z, fmatrix3x3 *S, fmatrix3x3 *P, fmatrix3x3 *Pinv)
 {
-	// Solves for unknown X in equation AX=B
 	unsigned int conjgrad_loopcount=0, conjgrad_looplimit=100;
-	float conjgrad_epsilon=0.0001f /* , conjgrad_lasterror=0 */ /* UNUSED */;
-	lfVector *q, *d, *tmp, *r; 
+	float conjgrad_epsilon=0.0001f;
+	lfVector *q, *d, *h, *r; 
 	float s, starget, a, s_prev;
 	unsigned int numverts = lA[0].vcount;
 	q = create_lfvector(numverts);
 	d = create_lfvector(numverts);
-	tmp = create_lfvector(numverts);
+	h = create_lfvector(numverts);
 	r = create_lfvector(numverts);
 
-	// zero_lfvector(ldV, CLOTHPARTICLES);
+	BuildPPinv(lA, P, Pinv);
+
 	filter(ldV, S);
 
 	add_lfvector_lfvector(ldV, ldV, z, numverts);
 
-	// r = B - Mul(tmp, A, X);    // just use B if X known to be zero
-	cp_lfvector(r, lB, numverts);
-	mul_bfmatrix_lfvector(tmp, lA, ldV);
-	sub_lfvector_lfvector(r, r, tmp, numverts);
+	// r = B - Mul(tmp, A, X);
+	mul_bfmatrix_lfvector(q, lA, rows, ldV);
+	sub_lfvector_lfvector(r, lB, q, numverts);
 
 	filter(r, S);
 
-	cp_lfvector(d, r, numverts);
+	// d = P^-1 r
+	mul_bfmatrix_diag_lfvector(d, Pinv, r);
+	filter(d, S);
 
-	s = dot_lfvector(r, r, numverts);
+	s = dot_lfvector(r, d, numverts);
 	starget = s * sqrtf(conjgrad_epsilon);
 
 	while (s>starget && conjgrad_loopcount < conjgrad_looplimit) {
 		// Mul(q, A, d); // q = A*d;
-		mul_bfmatrix_lfvector(q, lA, d);
+		mul_bfmatrix_lfvector(q, lA, rows, d);
 
 		filter(q, S);
 
@@ -937,41 +1050,30 @@ static int  cg_filtered(lfVector *ldV, fmatrix3x3 *lA, lfVector *lB, lfVector *z
 		// r = r - q*a;
 		sub_lfvector_lfvectorS(r, r, q, a, numverts);
 
+		// h = P^-1 r
+		mul_bfmatrix_diag_lfvector(h, Pinv, r);
+		filter(h, S);
+
 		s_prev = s;
-		s = dot_lfvector(r, r, numverts);
+		s = dot_lfvector(r, h, numverts);
 
-		//d = r+d*(s/s_prev);
-		add_lfvector_lfvectorS(d, r, d, (s/s_prev), numverts);
+		//d = h+d*(s/s_prev);
+		add_lfvector_lfvectorS(d, h, d, (s/s_prev), numverts);
 
 		filter(d, S);
 
 		conjgrad_loopcount++;
 	}
-	/* conjgrad_lasterror = s; */ /* UNUSED */
 
 	del_lfvector(q);
 	del_lfvector(d);
-	del_lfvector(tmp);
+	del_lfvector(h);
 	del_lfvector(r);
 	// printf("W/O conjgrad_loopcount: %d\n", conjgrad_loopcount);
 
 	return conjgrad_loopcount<conjgrad_looplimit;  // true means we reached desired accuracy in given time - ie stable
 }
 
-// block diagonalizer
-DO_INLINE void BuildPPinv(fmatrix3x3 *lA, fmatrix3x3 *P, fmatrix3x3 *Pinv)
-{
-	unsigned int i = 0;
-	
-	// Take only the diagonal blocks of A
-// #pragma omp parallel for private(i) if (lA[0].vcount > CLOTH_OPENMP_LIMIT)
-	for (i = 0; i<lA[0].vcount; i++) {
-		// block diagonalizer
-		cp_fmatrix(P[i].m, lA[i].m);
-		inverse_fmatrix(Pinv[i].m, P[i].m);
-		
-	}
-}
 #if 0
 /*
 // version 1.3
@@ -1684,7 +1786,7 @@ static void cloth_calc_force(ClothModifierData *clmd, float UNUSED(frame), lfVec
 	// printf("\n");
 }
 
-static void simulate_implicit_euler(lfVector *Vnew, lfVector *UNUSED(lX), lfVector *lV, lfVector *lF, fmatrix3x3 *dFdV, fmatrix3x3 *dFdX, float dt, fmatrix3x3 *A, lfVector *B, lfVector *dV, fmatrix3x3 *S, lfVector *z, lfVector *olddV, fmatrix3x3 *UNUSED(P), fmatrix3x3 *UNUSED(Pinv), fmatrix3x3 *M, fmatrix3x3 *UNUSED(bigI))
+static void simulate_implicit_euler(lfVector *Vnew, lfVector *UNUSED(lX), lfVector *lV, lfVector *lF, fmatrix3x3 *dFdV, fmatrix3x3 *dFdX, float dt, fmatrix3x3 *A, lfVector *B, lfVector *dV, fmatrix3x3 *S, lfVector *z, lfVector *olddV, fmatrix3x3 *P, fmatrix3x3 *Pinv, fmatrix3x3 *M, fmatrix3x3 *UNUSED(bigI), BlockRowIndex *rows)
 {
 	unsigned int numverts = dFdV[0].vcount;
 
@@ -1695,13 +1797,13 @@ static void simulate_implicit_euler(lfVector *Vnew, lfVector *UNUSED(lX), lfVect
 	
 	subadd_bfmatrixS_bfmatrixS(A, dFdV, dt, dFdX, (dt*dt));
 
-	mul_bfmatrix_lfvector(dFdXmV, dFdX, lV);
+	mul_bfmatrix_lfvector(dFdXmV, dFdX, rows, lV);
 
 	add_lfvectorS_lfvectorS(B, lF, dt, dFdXmV, (dt*dt), numverts);
 
 	// itstart();
 
-	cg_filtered(dV, A, B, z, S); /* conjugate gradient algorithm to solve Ax=b */
+	cg_filtered(dV, A, rows, B, z, S, P, Pinv); /* conjugate gradient algorithm to solve Ax=b */
 	// cg_filtered_pre(dV, A, B, z, S, P, Pinv, bigI);
 
 	// itend();
@@ -1829,7 +1931,7 @@ int implicit_solver(Object *ob, float frame, ClothModifierData *clmd, ListBase *
 		cloth_calc_force(clmd, frame, id->F, id->X, id->V, id->dFdV, id->dFdX, effectors, step, id->M);
 		
 		// calculate new velocity
-		simulate_implicit_euler(id->Vnew, id->X, id->V, id->F, id->dFdV, id->dFdX, dt, id->A, id->B, id->dV, id->S, id->z, id->olddV, id->P, id->Pinv, id->M, id->bigI);
+		simulate_implicit_euler(id->Vnew, id->X, id->V, id->F, id->dFdV, id->dFdX, dt, id->A, id->B, id->dV, id->S, id->z, id->olddV, id->P, id->Pinv, id->M, id->bigI, &id->rows);
 		
 		// advance positions
 		add_lfvector_lfvectorS(id->Xnew, id->X, id->Vnew, dt, numverts);
@@ -1903,7 +2005,7 @@ int implicit_solver(Object *ob, float frame, ClothModifierData *clmd, ListBase *
 				// calculate 
 				cloth_calc_force(clmd, frame, id->F, id->X, id->V, id->dFdV, id->dFdX, effectors, step+dt, id->M);
 				
-				simulate_implicit_euler(id->Vnew, id->X, id->V, id->F, id->dFdV, id->dFdX, dt / 2.0f, id->A, id->B, id->dV, id->S, id->z, id->olddV, id->P, id->Pinv, id->M, id->bigI);
+				simulate_implicit_euler(id->Vnew, id->X, id->V, id->F, id->dFdV, id->dFdX, dt / 2.0f, id->A, id->B, id->dV, id->S, id->z, id->olddV, id->P, id->Pinv, id->M, id->bigI, &id->rows);
 			}
 		}
 		else {
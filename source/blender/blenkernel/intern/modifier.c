@@ -100,6 +100,8 @@ void BKE_modifier_init(void)
 	virtualModifierCommonData.cmd.modifier.mode |= eModifierMode_Virtual;
 	virtualModifierCommonData.lmd.modifier.mode |= eModifierMode_Virtual;
 	virtualModifierCommonData.smd.modifier.mode |= eModifierMode_Virtual;
+
+	mesh_modifier_stack_cache_init();
 }
 
 ModifierTypeInfo *modifierType_getInfo(ModifierType type)
@@ -321,6 +321,7 @@ void BKE_object_free(Object *ob)
 	int a;
 	
 	BKE_object_free_derived_caches(ob);
+	mesh_free_modifier_stack_cache(ob);
 	
 	/* disconnect specific data, but not for lib data (might be indirect data, can get relinked) */
 	if (ob->data) {
@@ -1115,6 +1116,7 @@ static ParticleSystem *copy_particlesystem(ParticleSystem *psys)
 	psysn->frand = NULL;
 	psysn->pdd = NULL;
 	psysn->effectors = NULL;
+	psysn->sphgrid = NULL;
 	
 	psysn->pathcachebufs.first = psysn->pathcachebufs.last = NULL;
 	psysn->childcachebufs.first = psysn->childcachebufs.last = NULL;
@@ -1335,6 +1337,7 @@ Object *BKE_object_copy_ex(Main *bmain, Object *ob, int copy_caches)
 	
 	obn->derivedDeform = NULL;
 	obn->derivedFinal = NULL;
+	obn->modifier_stack_cache = NULL;
 
 	obn->gpulamp.first = obn->gpulamp.last = NULL;
 	obn->pc_ids.first = obn->pc_ids.last = NULL;
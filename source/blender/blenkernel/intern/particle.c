@@ -571,7 +571,8 @@ void psys_free(Object *ob, ParticleSystem *psys)
 		
 		BLI_freelistN(&psys->targets);
 
-		BLI_bvhtree_free(psys->bvhtree);
+		if (psys->sphgrid)
+			psys_sph_grid_free(psys->sphgrid);
 		BLI_kdtree_free(psys->tree);
  
 		if (psys->fluid_springs)
@@ -2394,9 +2395,10 @@ void psys_find_parents(ParticleSimulationData *sim)
 {
 	ParticleSettings *part = sim->psys->part;
 	KDTree *tree;
+	KDTreeNearest *nearest;
 	ChildParticle *cpa;
 	int p, totparent, totchild = sim->psys->totchild;
-	float co[3], orco[3];
+	float co[3], orco[3], (*child_orco)[3];
 	int from = PART_FROM_FACE;
 	totparent = (int)(totchild * part->parents * 0.3f);
 
@@ -2412,9 +2414,26 @@ void psys_find_parents(ParticleSimulationData *sim)
 
 	BLI_kdtree_balance(tree);
 
-	for (; p < totchild; p++, cpa++) {
-		psys_particle_on_emitter(sim->psmd, from, cpa->num, DMCACHE_ISCHILD, cpa->fuv, cpa->foffset, co, 0, 0, 0, orco, 0);
-		cpa->parent = BLI_kdtree_find_nearest(tree, orco, NULL, NULL);
+	if (totchild > totparent) {
+		const int totquery = totchild - totparent;
+		int i;
+
+		child_orco = MEM_mallocN(sizeof(*child_orco) * totquery, "child_orco");
+		nearest = MEM_mallocN(sizeof(*nearest) * totquery, "child_nearest");
+
+		for (i = 0; p < totchild; p++, cpa++, i++) {
+			psys_particle_on_emitter(sim->psmd, from, cpa->num, DMCACHE_ISCHILD, cpa->fuv, cpa->foffset, co, 0, 0, 0, child_orco[i], 0);
+		}
+
+		/* search all parents at once, this is threaded for many children */
+		BLI_kdtree_find_nearest_n_batch(tree, (const float (*)[3])child_orco, NULL, (unsigned int)totquery, nearest, 1, NULL);
+
+		for (i = 0, cpa = sim->psys->child + totparent; i < totquery; i++, cpa++) {
+			cpa->parent = (totparent > 0) ? nearest[i].index : -1;
+		}
+
+		MEM_freeN(child_orco);
+		MEM_freeN(nearest);
 	}
 
 	BLI_kdtree_free(tree);
@@ -2194,34 +2194,6 @@ void psys_get_pointcache_start_end(Scene *scene, ParticleSystem *psys, int *sfra
 /************************************************/
 /*			Effectors							*/
 /************************************************/
-static void psys_update_particle_bvhtree(ParticleSystem *psys, float cfra)
-{
-	if (psys) {
-		PARTICLE_P;
-		int totpart = 0;
-
-		if (!psys->bvhtree || psys->bvhtree_frame != cfra) {
-			LOOP_SHOWN_PARTICLES {
-				totpart++;
-			}
-			
-			BLI_bvhtree_free(psys->bvhtree);
-			psys->bvhtree = BLI_bvhtree_new(totpart, 0.0, 4, 6);
-
-			LOOP_SHOWN_PARTICLES {
-				if (pa->alive == PARS_ALIVE) {
-					if (pa->state.time == cfra)
-						BLI_bvhtree_insert(psys->bvhtree, p, pa->prev_state.co, 1);
-					else
-						BLI_bvhtree_insert(psys->bvhtree, p, pa->state.co, 1);
-				}
-			}
-			BLI_bvhtree_balance(psys->bvhtree);
-
-			psys->bvhtree_frame = cfra;
-		}
-	}
-}
 void psys_update_particle_tree(ParticleSystem *psys, float cfra)
 {
 	if (psys) {
@@ -2519,8 +2491,170 @@ typedef struct SPHRangeData {
 	int use_size;
 } SPHRangeData;
 
-static void sph_evaluate_func(BVHTree *tree, ParticleSystem **psys, float co[3], SPHRangeData *pfr, float interaction_radius, BVHTree_RangeQuery callback)
+/* Spatial hash of the particle positions at the start of a step, used for the SPH
+ * neighbor lookups. Space is divided in cubic cells of the interaction radius, each
+ * cell is hashed into a bucket and the points are sorted by bucket, so a range query
+ * only visits the points stored in the cells overlapping the query sphere. */
+typedef struct SPHGridPoint {
+	float co[3];
+	int cell[3];
+	int index;  /* particle index in the particle system */
+} SPHGridPoint;
+
+typedef struct SPHGrid {
+	float cell_size, inv_cell_size;
+	unsigned int bucket_mask;
+	int *bucket_start;      /* bucket_mask + 2 offsets into points */
+	SPHGridPoint *points;   /* sorted by bucket */
+	int totpoint;
+} SPHGrid;
+
+BLI_INLINE unsigned int sph_grid_bucket(const SPHGrid *grid, const int cell[3])
+{
+	return (((unsigned int)cell[0] * 73856093u) ^
+	        ((unsigned int)cell[1] * 19349663u) ^
+	        ((unsigned int)cell[2] * 83492791u)) & grid->bucket_mask;
+}
+
+BLI_INLINE void sph_grid_cell(const SPHGrid *grid, const float co[3], int r_cell[3])
+{
+	r_cell[0] = (int)floorf(co[0] * grid->inv_cell_size);
+	r_cell[1] = (int)floorf(co[1] * grid->inv_cell_size);
+	r_cell[2] = (int)floorf(co[2] * grid->inv_cell_size);
+}
+
+static SPHGrid *sph_grid_build(ParticleSystem *psys, float cell_size, float cfra)
+{
+	SPHGrid *grid = MEM_callocN(sizeof(SPHGrid), "SPHGrid");
+	SPHGridPoint *points;
+	unsigned int *buckets, totbucket;
+	int *fill;
+	PARTICLE_P;
+	int i, totpoint = 0;
+
+	LOOP_SHOWN_PARTICLES {
+		if (pa->alive == PARS_ALIVE)
+			totpoint++;
+	}
+
+	/* at least two buckets per point keeps the chains short */
+	for (totbucket = 1; totbucket < 2 * (unsigned int)totpoint; totbucket <<= 1) {
+		/* pass */
+	}
+
+	grid->cell_size = cell_size;
+	grid->inv_cell_size = 1.0f / max_ff(cell_size, FLT_EPSILON);
+	grid->bucket_mask = totbucket - 1;
+	grid->bucket_start = MEM_callocN(sizeof(int) * (totbucket + 1), "SPHGrid bucket_start");
+	grid->points = MEM_mallocN(sizeof(SPHGridPoint) * max_ii(totpoint, 1), "SPHGrid points");
+	grid->totpoint = totpoint;
+
+	points = MEM_mallocN(sizeof(SPHGridPoint) * max_ii(totpoint, 1), "SPHGrid unsorted points");
+	buckets = MEM_mallocN(sizeof(unsigned int) * max_ii(totpoint, 1), "SPHGrid point buckets");
+
+	i = 0;
+	LOOP_SHOWN_PARTICLES {
+		if (pa->alive == PARS_ALIVE) {
+			/* particles already moved to this frame by another system use their previous position */
+			copy_v3_v3(points[i].co, (pa->state.time == cfra) ? pa->prev_state.co : pa->state.co);
+			points[i].index = p;
+			i++;
+		}
+	}
+
+#pragma omp parallel for private(i) if (totpoint > 10000)
+	for (i = 0; i < totpoint; i++) {
+		sph_grid_cell(grid, points[i].co, points[i].cell);
+		buckets[i] = sph_grid_bucket(grid, points[i].cell);
+	}
+
+	/* counting sort by bucket, points of a cell end up next to each other in memory */
+	for (i = 0; i < totpoint; i++) {
+		grid->bucket_start[buckets[i] + 1]++;
+	}
+	for (i = 0; i < (int)totbucket; i++) {
+		grid->bucket_start[i + 1] += grid->bucket_start[i];
+	}
+
+	fill = MEM_dupallocN(grid->bucket_start);
+	for (i = 0; i < totpoint; i++) {
+		grid->points[fill[buckets[i]]++] = points[i];
+	}
+
+	MEM_freeN(fill);
+	MEM_freeN(buckets);
+	MEM_freeN(points);
+
+	return grid;
+}
+
+void psys_sph_grid_free(SPHGrid *grid)
 {
+	MEM_freeN(grid->bucket_start);
+	MEM_freeN(grid->points);
+	MEM_freeN(grid);
+}
+
+/* build the grid once per frame, before the particles are initialized for the step,
+ * other fluid systems coupled to this one reuse it. a coupled system with a larger
+ * interaction radius rebuilds it with larger cells, so its queries stay within the
+ * neighboring cells */
+static void psys_update_particle_sph_grid(ParticleSystem *psys, float cell_size, float cfra)
+{
+	if (psys) {
+		if (!psys->sphgrid || psys->bvhtree_frame != cfra || psys->sphgrid->cell_size < cell_size) {
+			if (psys->sphgrid)
+				psys_sph_grid_free(psys->sphgrid);
+
+			psys->sphgrid = sph_grid_build(psys, cell_size, cfra);
+			psys->bvhtree_frame = cfra;
+		}
+	}
+}
+
+/* same as BLI_bvhtree_range_query, calls back for every point closer than radius */
+static void sph_grid_range_query(const SPHGrid *grid, const float co[3], float radius, BVHTree_RangeQuery callback, void *userdata)
+{
+	const float radius_sq = radius * radius;
+	float co_min[3], co_max[3];
+	int cell_min[3], cell_max[3], cell[3];
+
+	if (grid->totpoint == 0)
+		return;
+
+	copy_v3_v3(co_min, co);
+	copy_v3_v3(co_max, co);
+	add_v3_fl(co_min, -radius);
+	add_v3_fl(co_max, radius);
+	sph_grid_cell(grid, co_min, cell_min);
+	sph_grid_cell(grid, co_max, cell_max);
+
+	for (cell[2] = cell_min[2]; cell[2] <= cell_max[2]; cell[2]++) {
+		for (cell[1] = cell_min[1]; cell[1] <= cell_max[1]; cell[1]++) {
+			for (cell[0] = cell_min[0]; cell[0] <= cell_max[0]; cell[0]++) {
+				const unsigned int bucket = sph_grid_bucket(grid, cell);
+				const SPHGridPoint *pt = grid->points + grid->bucket_start[bucket];
+				const SPHGridPoint *pt_end = grid->points + grid->bucket_start[bucket + 1];
+
+				for (; pt < pt_end; pt++) {
+					float dist_sq;
+
+					/* buckets are shared by cells with the same hash */
+					if (pt->cell[0] != cell[0] || pt->cell[1] != cell[1] || pt->cell[2] != cell[2])
+						continue;
+
+					dist_sq = len_squared_v3v3(co, pt->co);
+					if (dist_sq < radius_sq)
+						callback(userdata, pt->index, dist_sq);
+				}
+			}
+		}
+	}
+}
+
+static void sph_evaluate_func(BVHTree *tree, SPHData *sphdata, float co[3], SPHRangeData *pfr, float interaction_radius, BVHTree_RangeQuery callback)
+{
+	ParticleSystem **psys = sphdata->psys;
 	int i;
 
 	pfr->tot_neighbors = 0;
@@ -2534,8 +2668,8 @@ static void sph_evaluate_func(BVHTree *tree, ParticleSystem **psys, float co[3],
 			BLI_bvhtree_range_query(tree, co, interaction_radius, callback, pfr);
 			break;
 		}
-		else {
-			BLI_bvhtree_range_query(psys[i]->bvhtree, co, interaction_radius, callback, pfr);
+		else if (sphdata->grid[i]) {
+			sph_grid_range_query(sphdata->grid[i], co, interaction_radius, callback, pfr);
 		}
 	}
 }
@@ -2646,7 +2780,7 @@ static void sph_force_cb(void *sphdata_v, ParticleKey *state, float *force, floa
 	pfr.pa = pa;
 	pfr.mass = sphdata->mass;
 
-	sph_evaluate_func( NULL, psys, state->co, &pfr, interaction_radius, sph_density_accum_cb);
+	sph_evaluate_func(NULL, sphdata, state->co, &pfr, interaction_radius, sph_density_accum_cb);
 
 	density = data[0];
 	near_density = data[1];
@@ -2836,7 +2970,7 @@ static void sphclassical_force_cb(void *sphdata_v, ParticleKey *state, float *fo
 	pfr.h = h;
 	pfr.pa = pa;
 
-	sph_evaluate_func(NULL, psys, state->co, &pfr, interaction_radius, sphclassical_neighbour_accum_cb);
+	sph_evaluate_func(NULL, sphdata, state->co, &pfr, interaction_radius, sphclassical_neighbour_accum_cb);
 	pressure =  stiffness * (pow7(pa->sphdensity / rest_density) - 1.0f);
 
 	/* multiply by mass so that we return a force, not accel */
@@ -2914,7 +3048,7 @@ static void sphclassical_calc_dens(ParticleData *pa, float UNUSED(dfra), SPHData
 	pfr.pa = pa;
 	pfr.mass = sphdata->mass;
 
-	sph_evaluate_func( NULL, psys, pa->state.co, &pfr, interaction_radius, sphclassical_density_accum_cb);
+	sph_evaluate_func(NULL, sphdata, pa->state.co, &pfr, interaction_radius, sphclassical_density_accum_cb);
 	pa->sphdensity = MIN2(MAX2(data[0], fluid->rest_density * 0.9f), fluid->rest_density * 1.1f);
 }
 
@@ -2928,6 +3062,10 @@ void psys_sph_init(ParticleSimulationData *sim, SPHData *sphdata)
 	for (i=1, pt=sim->psys->targets.first; i<10; i++, pt=(pt?pt->next:NULL))
 		sphdata->psys[i] = pt ? psys_get_target_system(sim->ob, pt) : NULL;
 
+	/* grids are built in dynamics_step, see psys_update_particle_sph_grid */
+	for (i = 0; i < 10; i++)
+		sphdata->grid[i] = sphdata->psys[i] ? sphdata->psys[i]->sphgrid : NULL;
+
 	if (psys_uses_gravity(sim))
 		sphdata->gravity = sim->scene->physics_settings.gravity;
 	else
@@ -2955,10 +3093,16 @@ void psys_sph_init(ParticleSimulationData *sim, SPHData *sphdata)
 
 void psys_sph_finalise(SPHData *sphdata)
 {
+	int i;
+
 	if (sphdata->eh) {
 		BLI_edgehash_free(sphdata->eh, NULL);
 		sphdata->eh = NULL;
 	}
+
+	/* grids are owned by the particle systems */
+	for (i = 0; i < 10; i++)
+		sphdata->grid[i] = NULL;
 }
 /* Sample the density field at a point in space. */
 void psys_sph_density(BVHTree *tree, SPHData *sphdata, float co[3], float vars[2])
@@ -2975,7 +3119,7 @@ void psys_sph_density(BVHTree *tree, SPHData *sphdata, float co[3], float vars[2
 	pfr.h = interaction_radius * sphdata->hfac;
 	pfr.mass = sphdata->mass;
 
-	sph_evaluate_func(tree, psys, co, &pfr, interaction_radius, sphdata->density_cb);
+	sph_evaluate_func(tree, sphdata, co, &pfr, interaction_radius, sphdata->density_cb);
 
 	vars[0] = pfr.data[0];
 	vars[1] = pfr.data[1];
@@ -4284,11 +4428,15 @@ static void dynamics_step(ParticleSimulationData *sim, float cfra)
 		case PART_PHYS_FLUID:
 		{
 			ParticleTarget *pt = psys->targets.first;
-			psys_update_particle_bvhtree(psys, cfra);
-			
-			for (; pt; pt=pt->next) {  /* Updating others systems particle tree for fluid-fluid interaction */
+			SPHFluidSettings *fluid = part->fluid;
+			/* neighbors are searched within the interaction radius, see sph_force_cb */
+			float cell_size = fluid->radius * ((fluid->flag & SPH_FAC_RADIUS) ? 4.0f * part->size : 1.0f);
+
+			psys_update_particle_sph_grid(psys, cell_size, cfra);
+
+			for (; pt; pt=pt->next) {  /* Updating others systems particle grid for fluid-fluid interaction */
 				if (pt->ob)
-					psys_update_particle_bvhtree(BLI_findlink(&pt->ob->particlesystem, pt->psys-1), cfra);
+					psys_update_particle_sph_grid(BLI_findlink(&pt->ob->particlesystem, pt->psys-1), cell_size, cfra);
 			}
 			break;
 		}
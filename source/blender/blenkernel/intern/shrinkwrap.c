@@ -37,6 +37,8 @@
 #include <time.h>
 #include <assert.h>
 
+#include "MEM_guardedalloc.h"
+
 #include "DNA_object_types.h"
 #include "DNA_modifier_types.h"
 #include "DNA_meshdata_types.h"
@@ -112,6 +114,65 @@ static void space_transform_invert_normal(const SpaceTransform *data, float no[3
 	normalize_v3(no); /* TODO: could we just determine de scale value from the matrix? */
 }
 
+/*
+ * Gather the vertices with a non-zero weight in target space, for batched tree queries.
+ * Returns the number of queries, r_index and r_weight map them back to the vertices.
+ */
+static int shrinkwrap_gather_queries(ShrinkwrapCalcData *calc, float (**r_co)[3], int **r_index, float **r_weight)
+{
+	float (*query_co)[3] = MEM_mallocN(sizeof(*query_co) * calc->numVerts, "shrinkwrap query co");
+	int *query_index = MEM_mallocN(sizeof(*query_index) * calc->numVerts, "shrinkwrap query index");
+	float *query_weight = MEM_mallocN(sizeof(*query_weight) * calc->numVerts, "shrinkwrap query weight");
+	int i, totquery = 0;
+
+	for (i = 0; i < calc->numVerts; ++i) {
+		const float weight = defvert_array_find_weight_safe(calc->dvert, i, calc->vgroup);
+		if (weight == 0.0f) {
+			continue;
+		}
+
+		/* Convert the vertex to tree coordinates */
+		if (calc->vert) {
+			copy_v3_v3(query_co[totquery], calc->vert[i].co);
+		}
+		else {
+			copy_v3_v3(query_co[totquery], calc->vertexCos[i]);
+		}
+		space_transform_apply(&calc->local2target, query_co[totquery]);
+
+		query_index[totquery] = i;
+		query_weight[totquery] = weight;
+		totquery++;
+	}
+
+	*r_co = query_co;
+	*r_index = query_index;
+	*r_weight = query_weight;
+
+	return totquery;
+}
+
+/*
+ * Run a nearest point search for all affected vertices at once, the batched search orders
+ * the queries spatially and uses the hit of neighboring vertices to prune the search tree.
+ */
+static BVHTreeNearest *shrinkwrap_find_nearest_batch(BVHTreeFromMesh *treeData, const float (*query_co)[3],
+                                                     int totquery)
+{
+	BVHTreeNearest *nearest = MEM_mallocN(sizeof(*nearest) * max_ii(totquery, 1), "shrinkwrap nearest");
+	int i;
+
+	for (i = 0; i < totquery; i++) {
+		nearest[i].index = -1;
+		nearest[i].dist = FLT_MAX;
+	}
+
+	BLI_bvhtree_find_nearest_batch(treeData->tree, query_co, nearest, totquery,
+	                               treeData->nearest_callback, treeData);
+
+	return nearest;
+}
+
 /*
  * Shrinkwrap to the nearest vertex
  *
@@ -120,10 +181,13 @@ static void space_transform_invert_normal(const SpaceTransform *data, float no[3
  */
 static void shrinkwrap_calc_nearest_vertex(ShrinkwrapCalcData *calc)
 {
-	int i;
+	int i, totquery;
 
 	BVHTreeFromMesh treeData = NULL_BVHTreeFromMesh;
-	BVHTreeNearest nearest  = NULL_BVHTreeNearest;
+	BVHTreeNearest *nearest;
+	float (*query_co)[3];
+	int *query_index;
+	float *query_weight;
 
 
 	TIMEIT_BENCH(bvhtree_from_mesh_verts(&treeData, calc->target, 0.0, 2, 6), bvhtree_verts);
@@ -132,64 +196,84 @@ static void shrinkwrap_calc_nearest_vertex(ShrinkwrapCalcData *calc)
 		return;
 	}
 
-	/* Setup nearest */
-	nearest.index = -1;
-	nearest.dist = FLT_MAX;
+	totquery = shrinkwrap_gather_queries(calc, &query_co, &query_index, &query_weight);
+	nearest = shrinkwrap_find_nearest_batch(&treeData, (const float (*)[3])query_co, totquery);
+
 #ifndef __APPLE__
-#pragma omp parallel for default(none) private(i) firstprivate(nearest) shared(treeData, calc) schedule(static)
+#pragma omp parallel for default(none) private(i) shared(calc, nearest, query_index, query_weight, totquery) \
+	schedule(static)
 #endif
-	for (i = 0; i < calc->numVerts; ++i) {
-		float *co = calc->vertexCos[i];
+	for (i = 0; i < totquery; ++i) {
+		float *co = calc->vertexCos[query_index[i]];
+		float weight = query_weight[i];
 		float tmp_co[3];
-		float weight = defvert_array_find_weight_safe(calc->dvert, i, calc->vgroup);
-		if (weight == 0.0f) {
-			continue;
-		}
-
-
-		/* Convert the vertex to tree coordinates */
-		if (calc->vert) {
-			copy_v3_v3(tmp_co, calc->vert[i].co);
-		}
-		else {
-			copy_v3_v3(tmp_co, co);
-		}
-		space_transform_apply(&calc->local2target, tmp_co);
-
-		/* Use local proximity heuristics (to reduce the nearest search)
-		 *
-		 * If we already had an hit before.. we assume this vertex is going to have a close hit to that other vertex
-		 * so we can initiate the "nearest.dist" with the expected value to that last hit.
-		 * This will lead in prunning of the search tree. */
-		if (nearest.index != -1)
-			nearest.dist = len_squared_v3v3(tmp_co, nearest.co);
-		else
-			nearest.dist = FLT_MAX;
-
-		BLI_bvhtree_find_nearest(treeData.tree, tmp_co, &nearest, treeData.nearest_callback, &treeData);
-
 
 		/* Found the nearest vertex */
-		if (nearest.index != -1) {
+		if (nearest[i].index != -1) {
 			/* Adjusting the vertex weight,
 			 * so that after interpolating it keeps a certain distance from the nearest position */
-			if (nearest.dist > FLT_EPSILON) {
-				const float dist = sqrtf(nearest.dist);
+			if (nearest[i].dist > FLT_EPSILON) {
+				const float dist = sqrtf(nearest[i].dist);
 				weight *= (dist - calc->keepDist) / dist;
 			}
 
 			/* Convert the coordinates back to mesh coordinates */
-			copy_v3_v3(tmp_co, nearest.co);
+			copy_v3_v3(tmp_co, nearest[i].co);
 			space_transform_invert(&calc->local2target, tmp_co);
 
 			interp_v3_v3v3(co, co, tmp_co, weight);  /* linear interpolation */
 		}
 	}
 
+	MEM_freeN(nearest);
+	MEM_freeN(query_co);
+	MEM_freeN(query_index);
+	MEM_freeN(query_weight);
+
 	free_bvhtree_from_mesh(&treeData);
 }
 
 
+/*
+ * Validates a ray cast hit in target space and updates "hit" with it, converted back to
+ * local space, if it is closer. Returns TRUE if "hit" was updated.
+ * Options are the same as for BKE_shrinkwrap_project_normal.
+ */
+static int shrinkwrap_project_normal_hit(char options, const float dir[3], const SpaceTransform *transf,
+                                         BVHTreeRayHit *hit_tmp, BVHTreeRayHit *hit)
+{
+	if (hit_tmp->index != -1) {
+		/* invert the normal first so face culling works on rotated objects */
+		if (transf) {
+			space_transform_invert_normal(transf, hit_tmp->no);
+		}
+
+		if (options & (MOD_SHRINKWRAP_CULL_TARGET_FRONTFACE | MOD_SHRINKWRAP_CULL_TARGET_BACKFACE)) {
+			/* apply backface */
+			const float dot = dot_v3v3(dir, hit_tmp->no);
+			if (((options & MOD_SHRINKWRAP_CULL_TARGET_FRONTFACE) && dot <= 0.0f) ||
+			    ((options & MOD_SHRINKWRAP_CULL_TARGET_BACKFACE)  && dot >= 0.0f))
+			{
+				return FALSE; /* Ignore hit */
+			}
+		}
+
+		/* a batched ray cast doesn't know about hits in other directions */
+		if (hit_tmp->dist > hit->dist) {
+			return FALSE;
+		}
+
+		if (transf) {
+			/* Inverting space transform (TODO make coeherent with the initial dist readjust) */
+			space_transform_invert(transf, hit_tmp->co);
+		}
+
+		memcpy(hit, hit_tmp, sizeof(*hit_tmp));
+		return TRUE;
+	}
+	return FALSE;
+}
+
 /*
  * This function raycast a single vertex and updates the hit if the "hit" is considered valid.
  * Returns TRUE if "hit" was updated.
@@ -238,38 +322,134 @@ int BKE_shrinkwrap_project_normal(char options, const float vert[3],
 
 	BLI_bvhtree_ray_cast(tree, co, no, 0.0f, &hit_tmp, callback, userdata);
 
-	if (hit_tmp.index != -1) {
-		/* invert the normal first so face culling works on rotated objects */
+	if (shrinkwrap_project_normal_hit(options, dir, transf, &hit_tmp, hit)) {
+#ifdef USE_DIST_CORRECT
 		if (transf) {
-			space_transform_invert_normal(transf, hit_tmp.no);
+			hit->dist = len_v3v3(vert, hit->co);
 		}
+#endif
+		return TRUE;
+	}
+	return FALSE;
+}
 
-		if (options & (MOD_SHRINKWRAP_CULL_TARGET_FRONTFACE | MOD_SHRINKWRAP_CULL_TARGET_BACKFACE)) {
-			/* apply backface */
-			const float dot = dot_v3v3(dir, hit_tmp.no);
-			if (((options & MOD_SHRINKWRAP_CULL_TARGET_FRONTFACE) && dot <= 0.0f) ||
-			    ((options & MOD_SHRINKWRAP_CULL_TARGET_BACKFACE)  && dot >= 0.0f))
-			{
-				return FALSE; /* Ignore hit */
-			}
+/* vertex position and projection direction in local space */
+static void shrinkwrap_projection_ray(ShrinkwrapCalcData *calc, int i, const float proj_axis[3],
+                                      float r_co[3], float r_no[3])
+{
+	if (calc->vert && calc->smd->projAxis == MOD_SHRINKWRAP_PROJECT_OVER_NORMAL) {
+		/* calc->vert contains verts from derivedMesh  */
+		/* this coordinated are deformed by vertexCos only for normal projection (to get correct normals) */
+		/* for other cases calc->varts contains undeformed coordinates and vertexCos should be used */
+		copy_v3_v3(r_co, calc->vert[i].co);
+		normal_short_to_float_v3(r_no, calc->vert[i].no);
+	}
+	else {
+		copy_v3_v3(r_co, calc->vertexCos[i]);
+		copy_v3_v3(r_no, proj_axis);
+	}
+}
+
+/*
+ * Normal projection without an auxiliary target, all rays are cast at once so the batched
+ * ray cast can order them spatially and run them on the task scheduler.
+ * Rays for both directions are cast up to the full distance, the closest valid hit is used.
+ */
+static void shrinkwrap_calc_normal_projection_batch(ShrinkwrapCalcData *calc, BVHTreeFromMesh *treeData,
+                                                    const float proj_axis[3])
+{
+	const char use_normal = calc->smd->shrinkOpts;
+	const float proj_limit_squared = calc->smd->projLimit * calc->smd->projLimit;
+	const int use_pos = (use_normal & MOD_SHRINKWRAP_PROJECT_ALLOW_POS_DIR) != 0;
+	const int totdir = use_pos + ((use_normal & MOD_SHRINKWRAP_PROJECT_ALLOW_NEG_DIR) != 0);
+	const int alloc_verts = max_ii(calc->numVerts, 1);
+	BVHTreeRay *rays = MEM_mallocN(sizeof(*rays) * totdir * alloc_verts, "shrinkwrap rays");
+	BVHTreeRayHit *hits = MEM_mallocN(sizeof(*hits) * totdir * alloc_verts, "shrinkwrap ray hits");
+	float (*query_no)[3] = MEM_mallocN(sizeof(*query_no) * alloc_verts, "shrinkwrap query no");
+	int *query_index = MEM_mallocN(sizeof(*query_index) * alloc_verts, "shrinkwrap query index");
+	float *query_weight = MEM_mallocN(sizeof(*query_weight) * alloc_verts, "shrinkwrap query weight");
+	int i, totquery = 0;
+
+	for (i = 0; i < calc->numVerts; ++i) {
+		const float weight = defvert_array_find_weight_safe(calc->dvert, i, calc->vgroup);
+		float tmp_co[3];
+		int d;
+
+		if (weight == 0.0f) {
+			continue;
 		}
 
-		if (transf) {
-			/* Inverting space transform (TODO make coeherent with the initial dist readjust) */
-			space_transform_invert(transf, hit_tmp.co);
-#ifdef USE_DIST_CORRECT
-			hit_tmp.dist = len_v3v3(vert, hit_tmp.co);
+		shrinkwrap_projection_ray(calc, i, proj_axis, tmp_co, query_no[totquery]);
+		space_transform_apply(&calc->local2target, tmp_co);
+
+		for (d = 0; d < totdir; d++) {
+			BVHTreeRay *ray = &rays[totquery * totdir + d];
+			BVHTreeRayHit *hit = &hits[totquery * totdir + d];
+
+			copy_v3_v3(ray->origin, tmp_co);
+			if (d == 0 && use_pos)
+				copy_v3_v3(ray->direction, query_no[totquery]);
+			else
+				negate_v3_v3(ray->direction, query_no[totquery]);
+			space_transform_apply_normal(&calc->local2target, ray->direction);
+			ray->radius = 0.0f;
+
+			hit->index = -1;
+			hit->dist = 10000.0f; /* TODO: we should use FLT_MAX here, but sweepsphere code isn't prepared for that */
+		}
+
+		query_index[totquery] = i;
+		query_weight[totquery] = weight;
+		totquery++;
+	}
+
+	BLI_bvhtree_ray_cast_batch(treeData->tree, rays, hits, totquery * totdir,
+	                           treeData->raycast_callback, treeData);
+
+#ifndef __APPLE__
+#pragma omp parallel for private(i) schedule(static)
 #endif
+	for (i = 0; i < totquery; ++i) {
+		float *co = calc->vertexCos[query_index[i]];
+		const float *no = query_no[i];
+		BVHTreeRayHit hit;
+		int d;
+
+		hit.index = -1;
+		hit.dist = 10000.0f;
+
+		for (d = 0; d < totdir; d++) {
+			float dir[3];
+
+			if (d == 0 && use_pos)
+				copy_v3_v3(dir, no);
+			else
+				negate_v3_v3(dir, no);
+
+			shrinkwrap_project_normal_hit(calc->smd->shrinkOpts, dir, &calc->local2target,
+			                              &hits[i * totdir + d], &hit);
 		}
 
-		BLI_assert(hit_tmp.dist <= hit->dist);
+		/* don't set the initial dist (which is more efficient),
+		 * because its calculated in the targets space, we want the dist in our own space */
+		if (proj_limit_squared != 0.0f) {
+			if (len_squared_v3v3(hit.co, co) > proj_limit_squared) {
+				hit.index = -1;
+			}
+		}
 
-		memcpy(hit, &hit_tmp, sizeof(hit_tmp));
-		return TRUE;
+		if (hit.index != -1) {
+			madd_v3_v3v3fl(hit.co, hit.co, no, calc->keepDist);
+			interp_v3_v3v3(co, co, hit.co, query_weight[i]);
+		}
 	}
-	return FALSE;
-}
 
+	MEM_freeN(rays);
+	MEM_freeN(hits);
+	MEM_freeN(query_no);
+	MEM_freeN(query_index);
+	MEM_freeN(query_weight);
+}
 
 static void shrinkwrap_calc_normal_projection(ShrinkwrapCalcData *calc)
 {
@@ -326,9 +506,10 @@ static void shrinkwrap_calc_normal_projection(ShrinkwrapCalcData *calc)
 	}
 
 	/* After sucessufuly build the trees, start projection vertexs */
-	if (bvhtree_from_mesh_faces(&treeData, calc->target, 0.0, 4, 6) &&
-	    (auxMesh == NULL || bvhtree_from_mesh_faces(&auxData, auxMesh, 0.0, 4, 6)))
-	{
+	if (bvhtree_from_mesh_faces(&treeData, calc->target, 0.0, 4, 6) && auxMesh == NULL) {
+		shrinkwrap_calc_normal_projection_batch(calc, &treeData, proj_axis);
+	}
+	else if (treeData.tree && auxMesh && bvhtree_from_mesh_faces(&auxData, auxMesh, 0.0, 4, 6)) {
 
 #ifndef __APPLE__
 #pragma omp parallel for private(i, hit) schedule(static)
@@ -342,24 +523,7 @@ static void shrinkwrap_calc_normal_projection(ShrinkwrapCalcData *calc)
 				continue;
 			}
 
-			if (calc->vert) {
-				/* calc->vert contains verts from derivedMesh  */
-				/* this coordinated are deformed by vertexCos only for normal projection (to get correct normals) */
-				/* for other cases calc->varts contains undeformed coordinates and vertexCos should be used */
-				if (calc->smd->projAxis == MOD_SHRINKWRAP_PROJECT_OVER_NORMAL) {
-					copy_v3_v3(tmp_co, calc->vert[i].co);
-					normal_short_to_float_v3(tmp_no, calc->vert[i].no);
-				}
-				else {
-					copy_v3_v3(tmp_co, co);
-					copy_v3_v3(tmp_no, proj_axis);
-				}
-			}
-			else {
-				copy_v3_v3(tmp_co, co);
-				copy_v3_v3(tmp_no, proj_axis);
-			}
-
+			shrinkwrap_projection_ray(calc, i, proj_axis, tmp_co, tmp_no);
 
 			hit.index = -1;
 			hit.dist = 10000.0f; /* TODO: we should use FLT_MAX here, but sweepsphere code isn't prepared for that */
@@ -422,10 +586,13 @@ static void shrinkwrap_calc_normal_projection(ShrinkwrapCalcData *calc)
  */
 static void shrinkwrap_calc_nearest_surface_point(ShrinkwrapCalcData *calc)
 {
-	int i;
+	int i, totquery;
 
 	BVHTreeFromMesh treeData = NULL_BVHTreeFromMesh;
-	BVHTreeNearest nearest  = NULL_BVHTreeNearest;
+	BVHTreeNearest *nearest;
+	float (*query_co)[3];
+	int *query_index;
+	float *query_weight;
 
 	/* Create a bvh-tree of the given target */
 	bvhtree_from_mesh_faces(&treeData, calc->target, 0.0, 2, 6);
@@ -434,67 +601,48 @@ static void shrinkwrap_calc_nearest_surface_point(ShrinkwrapCalcData *calc)
 		return;
 	}
 
-	/* Setup nearest */
-	nearest.index = -1;
-	nearest.dist = FLT_MAX;
+	/* Find the nearest surface points */
+	totquery = shrinkwrap_gather_queries(calc, &query_co, &query_index, &query_weight);
+	nearest = shrinkwrap_find_nearest_batch(&treeData, (const float (*)[3])query_co, totquery);
 
-
-	/* Find the nearest vertex */
 #ifndef __APPLE__
-#pragma omp parallel for default(none) private(i) firstprivate(nearest) shared(calc, treeData) schedule(static)
+#pragma omp parallel for default(none) private(i) shared(calc, nearest, query_co, query_index, query_weight, totquery) \
+	schedule(static)
 #endif
-	for (i = 0; i < calc->numVerts; ++i) {
-		float *co = calc->vertexCos[i];
-		float tmp_co[3];
-		float weight = defvert_array_find_weight_safe(calc->dvert, i, calc->vgroup);
-		if (weight == 0.0f) continue;
-
-		/* Convert the vertex to tree coordinates */
-		if (calc->vert) {
-			copy_v3_v3(tmp_co, calc->vert[i].co);
-		}
-		else {
-			copy_v3_v3(tmp_co, co);
-		}
-		space_transform_apply(&calc->local2target, tmp_co);
-
-		/* Use local proximity heuristics (to reduce the nearest search)
-		 *
-		 * If we already had an hit before.. we assume this vertex is going to have a close hit to that other vertex
-		 * so we can initiate the "nearest.dist" with the expected value to that last hit.
-		 * This will lead in prunning of the search tree. */
-		if (nearest.index != -1)
-			nearest.dist = len_squared_v3v3(tmp_co, nearest.co);
-		else
-			nearest.dist = FLT_MAX;
-
-		BLI_bvhtree_find_nearest(treeData.tree, tmp_co, &nearest, treeData.nearest_callback, &treeData);
+	for (i = 0; i < totquery; ++i) {
+		float *co = calc->vertexCos[query_index[i]];
+		float *tmp_co = query_co[i];
 
 		/* Found the nearest vertex */
-		if (nearest.index != -1) {
+		if (nearest[i].index != -1) {
 			if (calc->smd->shrinkOpts & MOD_SHRINKWRAP_KEEP_ABOVE_SURFACE) {
 				/* Make the vertex stay on the front side of the face */
-				madd_v3_v3v3fl(tmp_co, nearest.co, nearest.no, calc->keepDist);
+				madd_v3_v3v3fl(tmp_co, nearest[i].co, nearest[i].no, calc->keepDist);
 			}
 			else {
 				/* Adjusting the vertex weight,
 				 * so that after interpolating it keeps a certain distance from the nearest position */
-				float dist = sasqrt(nearest.dist);
+				float dist = sasqrt(nearest[i].dist);
 				if (dist > FLT_EPSILON) {
 					/* linear interpolation */
-					interp_v3_v3v3(tmp_co, tmp_co, nearest.co, (dist - calc->keepDist) / dist);
+					interp_v3_v3v3(tmp_co, tmp_co, nearest[i].co, (dist - calc->keepDist) / dist);
 				}
 				else {
-					copy_v3_v3(tmp_co, nearest.co);
+					copy_v3_v3(tmp_co, nearest[i].co);
 				}
 			}
 
 			/* Convert the coordinates back to mesh coordinates */
 			space_transform_invert(&calc->local2target, tmp_co);
-			interp_v3_v3v3(co, co, tmp_co, weight);  /* linear interpolation */
+			interp_v3_v3v3(co, co, tmp_co, query_weight[i]);  /* linear interpolation */
 		}
 	}
 
+	MEM_freeN(nearest);
+	MEM_freeN(query_co);
+	MEM_freeN(query_index);
+	MEM_freeN(query_weight);
+
 	free_bvhtree_from_mesh(&treeData);
 }
 
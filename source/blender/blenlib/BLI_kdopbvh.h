@@ -107,6 +107,16 @@ int BLI_bvhtree_find_nearest(BVHTree *tree, const float co[3], BVHTreeNearest *n
 int BLI_bvhtree_ray_cast(BVHTree *tree, const float co[3], const float dir[3], float radius, BVHTreeRayHit *hit,
                          BVHTree_RayCastCallback callback, void *userdata);
 
+/* batched versions of the queries above, results are written to nearest[i] / hits[i] which
+ * must be initialized by the caller like for a single query. When called from the main thread
+ * queries are spatially sorted and run on the task scheduler, so callbacks must be thread safe.
+ * For nearest queries the hit of a neighboring query may be used as initial candidate, callbacks
+ * must accept any point returned for a primitive as valid for all queries */
+void BLI_bvhtree_find_nearest_batch(BVHTree *tree, const float (*co)[3], BVHTreeNearest *nearest, int totquery,
+                                    BVHTree_NearestPointCallback callback, void *userdata);
+void BLI_bvhtree_ray_cast_batch(BVHTree *tree, const BVHTreeRay *rays, BVHTreeRayHit *hits, int totray,
+                                BVHTree_RayCastCallback callback, void *userdata);
+
 float BLI_bvhtree_bb_raycast(const float bv[6], const float light_start[3], const float light_end[3], float pos[3]);
 
 /* range query */
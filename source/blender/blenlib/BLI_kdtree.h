@@ -57,4 +57,8 @@ int BLI_kdtree_range_search(KDTree *tree, const float co[3], const float nor[3],
                             KDTreeNearest **r_nearest,
                             float range) ATTR_NONNULL(1, 2, 4) ATTR_WARN_UNUSED_RESULT;
 
+void BLI_kdtree_find_nearest_n_batch(KDTree *tree, const float (*co)[3], const float (*nor)[3],
+                                     unsigned int totquery, KDTreeNearest *r_nearest, unsigned int n,
+                                     int *r_found) ATTR_NONNULL(1, 2, 5);
+
 #endif  /* __BLI_KDTREE_H__ */
@@ -36,6 +36,8 @@
 #include "BLI_utildefines.h"
 #include "BLI_kdopbvh.h"
 #include "BLI_math.h"
+#include "BLI_task.h"
+#include "BLI_threads.h"
 #include "BLI_strict_flags.h"
 
 #ifdef _OPENMP
@@ -1637,3 +1639,246 @@ int BLI_bvhtree_range_query(BVHTree *tree, const float co[3], float radius, BVHT
 
 	return data.hits;
 }
+
+/* -------------------------------------------------------------------- */
+/* Batched queries
+ *
+ * Many callers (shrinkwrap, proximity, transfer tools) run one query per vertex of a
+ * large mesh. Doing these one by one gives poor cache behavior since consecutive
+ * vertices are often far apart in the tree, so queries are first ordered along a
+ * Morton curve and then split into chunks that are run on the task scheduler.
+ * Within a chunk the result of the previous query seeds the next one, which gives
+ * a tight initial search distance for the nearest point search.
+ *
+ * Callbacks are called from multiple threads and must not write shared data. */
+
+#define BVH_BATCH_CHUNK_SIZE 256
+
+typedef struct BVHBatchData {
+	BVHTree *tree;
+	const int *order;
+	int totquery;
+
+	/* nearest */
+	const float (*co)[3];
+	BVHTreeNearest *nearest;
+	BVHTree_NearestPointCallback nearest_callback;
+
+	/* ray cast */
+	const BVHTreeRay *rays;
+	BVHTreeRayHit *hits;
+	BVHTree_RayCastCallback ray_callback;
+
+	void *userdata;
+} BVHBatchData;
+
+/* spread the lower 10 bits of x so there are two zero bits between each */
+static unsigned int bvh_morton_spread(unsigned int x)
+{
+	x &= 0x000003ffu;
+	x = (x | (x << 16)) & 0x030000ffu;
+	x = (x | (x << 8))  & 0x0300f00fu;
+	x = (x | (x << 4))  & 0x030c30c3u;
+	x = (x | (x << 2))  & 0x09249249u;
+	return x;
+}
+
+/* returns an array of query indices ordered along a Morton curve through the
+ * bounds of the given points, points are read with a stride in bytes */
+static int *bvh_batch_spatial_order(const char *co_first, size_t stride, int totquery)
+{
+	unsigned int *keys = MEM_mallocN(sizeof(*keys) * (size_t)totquery * 2, "bvh batch keys");
+	int *order = MEM_mallocN(sizeof(*order) * (size_t)totquery * 2, "bvh batch order");
+	unsigned int *keys_tmp = keys + totquery;
+	int *order_tmp = order + totquery;
+	unsigned int *count = MEM_mallocN(sizeof(*count) * 0x10000, "bvh batch count");
+	float min[3], max[3], scale[3];
+	int i, j, pass;
+
+	INIT_MINMAX(min, max);
+	for (i = 0; i < totquery; i++) {
+		minmax_v3v3_v3(min, max, (const float *)(co_first + stride * (size_t)i));
+	}
+
+	for (j = 0; j < 3; j++) {
+		const float size = max[j] - min[j];
+		scale[j] = (size > FLT_EPSILON) ? 1023.0f / size : 0.0f;
+	}
+
+	for (i = 0; i < totquery; i++) {
+		const float *co = (const float *)(co_first + stride * (size_t)i);
+		unsigned int q[3];
+
+		for (j = 0; j < 3; j++) {
+			float f = (co[j] - min[j]) * scale[j];
+			CLAMP(f, 0.0f, 1023.0f);
+			q[j] = (unsigned int)f;
+		}
+
+		keys[i] = bvh_morton_spread(q[0]) | (bvh_morton_spread(q[1]) << 1) | (bvh_morton_spread(q[2]) << 2);
+		order[i] = i;
+	}
+
+	/* two pass radix sort on 16 bits, stable so equal keys keep their original order */
+	for (pass = 0; pass < 2; pass++) {
+		const unsigned int shift = (unsigned int)pass * 16u;
+		unsigned int sum = 0;
+
+		memset(count, 0, sizeof(*count) * 0x10000);
+		for (i = 0; i < totquery; i++) {
+			count[(keys[i] >> shift) & 0xffffu]++;
+		}
+		for (i = 0; i < 0x10000; i++) {
+			const unsigned int c = count[i];
+			count[i] = sum;
+			sum += c;
+		}
+		for (i = 0; i < totquery; i++) {
+			const unsigned int dst = count[(keys[i] >> shift) & 0xffffu]++;
+			keys_tmp[dst] = keys[i];
+			order_tmp[dst] = order[i];
+		}
+
+		SWAP(unsigned int *, keys, keys_tmp);
+		SWAP(int *, order, order_tmp);
+	}
+
+	/* after an even number of passes the result is back in the first half */
+	MEM_freeN(count);
+	MEM_freeN(keys);
+
+	return order;
+}
+
+static void bvh_batch_find_nearest_range(const BVHBatchData *data, int start, int end)
+{
+	const BVHTreeNearest *prev = NULL;
+	int i;
+
+	for (i = start; i < end; i++) {
+		const int q = data->order ? data->order[i] : i;
+		const float *co = data->co[q];
+		BVHTreeNearest *nearest = &data->nearest[q];
+
+		/* the previous query is close by, its hit is a valid candidate for this one */
+		if (prev && prev->index != -1) {
+			const float dist = len_squared_v3v3(co, prev->co);
+
+			if (dist < nearest->dist) {
+				nearest->index = prev->index;
+				nearest->flags = prev->flags;
+				nearest->dist = dist;
+				copy_v3_v3(nearest->co, prev->co);
+				copy_v3_v3(nearest->no, prev->no);
+			}
+		}
+
+		BLI_bvhtree_find_nearest(data->tree, co, nearest, data->nearest_callback, data->userdata);
+		prev = nearest;
+	}
+}
+
+static void bvh_batch_ray_cast_range(const BVHBatchData *data, int start, int end)
+{
+	int i;
+
+	for (i = start; i < end; i++) {
+		const int q = data->order ? data->order[i] : i;
+		const BVHTreeRay *ray = &data->rays[q];
+
+		BLI_bvhtree_ray_cast(data->tree, ray->origin, ray->direction, ray->radius, &data->hits[q],
+		                     data->ray_callback, data->userdata);
+	}
+}
+
+static void bvh_batch_range(const BVHBatchData *data, int start, int end)
+{
+	if (data->nearest)
+		bvh_batch_find_nearest_range(data, start, end);
+	else
+		bvh_batch_ray_cast_range(data, start, end);
+}
+
+static void bvh_batch_task(TaskPool *pool, void *taskdata, int UNUSED(threadid))
+{
+	const BVHBatchData *data = BLI_task_pool_userdata(pool);
+	const int start = GET_INT_FROM_POINTER(taskdata);
+	const int end = min_ii(start + BVH_BATCH_CHUNK_SIZE, data->totquery);
+
+	bvh_batch_range(data, start, end);
+}
+
+static void bvh_batch_run(BVHBatchData *data, const char *co_first, size_t stride)
+{
+	TaskScheduler *scheduler;
+	TaskPool *pool;
+	int *order;
+	int start;
+
+	data->order = NULL;
+
+	/* small batches are not worth sorting and threading. the scheduler is only used from
+	 * the main thread, other threads may be running tasks of the scheduler themselves or
+	 * do their own threading (e.g. modifiers evaluated for rendering) */
+	if (data->totquery <= BVH_BATCH_CHUNK_SIZE * 2 || !BLI_thread_is_main()) {
+		bvh_batch_range(data, 0, data->totquery);
+		return;
+	}
+
+	scheduler = BLI_task_scheduler_get();
+
+	if (BLI_task_scheduler_num_threads(scheduler) < 2) {
+		bvh_batch_range(data, 0, data->totquery);
+		return;
+	}
+
+	order = bvh_batch_spatial_order(co_first, stride, data->totquery);
+	data->order = order;
+
+	pool = BLI_task_pool_create(scheduler, data);
+
+	for (start = 0; start < data->totquery; start += BVH_BATCH_CHUNK_SIZE) {
+		BLI_task_pool_push(pool, bvh_batch_task, SET_INT_IN_POINTER(start), false, TASK_PRIORITY_LOW);
+	}
+
+	BLI_task_pool_work_and_wait(pool);
+	BLI_task_pool_free(pool);
+
+	MEM_freeN(order);
+}
+
+void BLI_bvhtree_find_nearest_batch(BVHTree *tree, const float (*co)[3], BVHTreeNearest *nearest, int totquery,
+                                    BVHTree_NearestPointCallback callback, void *userdata)
+{
+	BVHBatchData data = {NULL};
+
+	if (totquery <= 0)
+		return;
+
+	data.tree = tree;
+	data.totquery = totquery;
+	data.co = co;
+	data.nearest = nearest;
+	data.nearest_callback = callback;
+	data.userdata = userdata;
+
+	bvh_batch_run(&data, (const char *)co[0], sizeof(*co));
+}
+
+void BLI_bvhtree_ray_cast_batch(BVHTree *tree, const BVHTreeRay *rays, BVHTreeRayHit *hits, int totray,
+                                BVHTree_RayCastCallback callback, void *userdata)
+{
+	BVHBatchData data = {NULL};
+
+	if (totray <= 0)
+		return;
+
+	data.tree = tree;
+	data.totquery = totray;
+	data.rays = rays;
+	data.hits = hits;
+	data.ray_callback = callback;
+	data.userdata = userdata;
+
+	bvh_batch_run(&data, (const char *)rays[0].origin, sizeof(*rays));
+}
@@ -30,12 +30,16 @@
 #include "BLI_math.h"
 #include "BLI_kdtree.h"
 #include "BLI_utildefines.h"
+#include "BLI_task.h"
+#include "BLI_threads.h"
 #include "BLI_strict_flags.h"
 
 
+/* Nodes link to their children by index into the node array, which keeps a node at 28 bytes
+ * so more of the tree fits in cache. Normals are not stored, only the query normal is used. */
 typedef struct KDTreeNode {
-	struct KDTreeNode *left, *right;
-	float co[3], nor[3];
+	unsigned int left, right;
+	float co[3];
 	int index;
 	unsigned int d;  /* range is only (0-2) */
 } KDTreeNode;
@@ -43,13 +47,21 @@ typedef struct KDTreeNode {
 struct KDTree {
 	KDTreeNode *nodes;
 	unsigned int totnode;
-	KDTreeNode *root;
+	unsigned int root;
+#ifndef NDEBUG
+	unsigned int maxsize;
+#endif
 };
 
 #define KD_STACK_INIT 100      /* initial size for array (on the stack) */
 #define KD_NEAR_ALLOC_INC 100  /* alloc increment for collecting nearest */
 #define KD_FOUND_ALLOC_INC 50  /* alloc increment for collecting nearest */
 
+#define KD_NODE_UNSET ((unsigned int)-1)
+
+#define KD_BALANCE_THREADED_MIN 10000  /* minimum number of points to balance in threads */
+#define KD_BATCH_CHUNK_SIZE 1024       /* queries per task for batched searches */
+
 /**
  * Creates or free a kdtree
  */
@@ -60,7 +72,11 @@ KDTree *BLI_kdtree_new(unsigned int maxsize)
 	tree = MEM_mallocN(sizeof(KDTree), "KDTree");
 	tree->nodes = MEM_mallocN(sizeof(KDTreeNode) * maxsize, "KDTreeNode");
 	tree->totnode = 0;
-	tree->root = NULL;
+	tree->root = KD_NODE_UNSET;
+
+#ifndef NDEBUG
+	tree->maxsize = maxsize;
+#endif
 
 	return tree;
 }
@@ -76,35 +92,33 @@ void BLI_kdtree_free(KDTree *tree)
 /**
  * Construction: first insert points, then call balance. Normal is optional.
  */
-void BLI_kdtree_insert(KDTree *tree, int index, const float co[3], const float nor[3])
+void BLI_kdtree_insert(KDTree *tree, int index, const float co[3], const float UNUSED(nor[3]))
 {
 	KDTreeNode *node = &tree->nodes[tree->totnode++];
 
+	BLI_assert(tree->totnode <= tree->maxsize);
+
 	/* note, array isn't calloc'd,
 	 * need to initialize all struct members */
 
-	node->left = node->right = NULL;
+	node->left = node->right = KD_NODE_UNSET;
 	copy_v3_v3(node->co, co);
-	if (nor)
-		copy_v3_v3(node->nor, nor);
-	else
-		zero_v3(node->nor);
-
 	node->index = index;
 	node->d = 0;
 }
 
-static KDTreeNode *kdtree_balance(KDTreeNode *nodes, unsigned int totnode, unsigned int axis)
+/* the root of a balanced range of nodes is always its median */
+BLI_INLINE unsigned int kdtree_balance_root(unsigned int totnode, unsigned int ofs)
+{
+	return (totnode == 0) ? KD_NODE_UNSET : ofs + totnode / 2;
+}
+
+/* partition nodes around the median along axis, returns the median */
+static unsigned int kdtree_partition(KDTreeNode *nodes, unsigned int totnode, unsigned int axis)
 {
-	KDTreeNode *node;
 	float co;
 	unsigned int left, right, median, i, j;
 
-	if (totnode <= 0)
-		return NULL;
-	else if (totnode == 1)
-		return nodes;
-	
 	/* quicksort style sorting around median */
 	left = 0;
 	right = totnode - 1;
@@ -132,21 +146,114 @@ static KDTreeNode *kdtree_balance(KDTreeNode *nodes, unsigned int totnode, unsig
 			left = i + 1;
 	}
 
+	return median;
+}
+
+/* balance a range of nodes starting at ofs in the tree node array, returns the root */
+static unsigned int kdtree_balance(KDTreeNode *nodes, unsigned int totnode, unsigned int axis, unsigned int ofs)
+{
+	KDTreeNode *node;
+	unsigned int median;
+
+	if (totnode <= 0)
+		return KD_NODE_UNSET;
+	else if (totnode == 1)
+		return ofs;
+
+	median = kdtree_partition(nodes, totnode, axis);
+
 	/* set node and sort subnodes */
 	node = &nodes[median];
 	node->d = axis;
-	node->left = kdtree_balance(nodes, median, (axis + 1) % 3);
-	node->right = kdtree_balance(nodes + median + 1, (totnode - (median + 1)), (axis + 1) % 3);
+	node->left = kdtree_balance(nodes, median, (axis + 1) % 3, ofs);
+	node->right = kdtree_balance(nodes + median + 1, (totnode - (median + 1)), (axis + 1) % 3, ofs + median + 1);
+
+	return ofs + median;
+}
+
+typedef struct KDBalanceJob {
+	unsigned int ofs, totnode, axis;
+} KDBalanceJob;
+
+/* balance the top levels of the tree, leaving the subtrees below depth as jobs */
+static unsigned int kdtree_balance_split(KDTreeNode *nodes, unsigned int totnode, unsigned int axis,
+                                         unsigned int ofs, unsigned int depth,
+                                         KDBalanceJob *jobs, unsigned int *r_totjob)
+{
+	KDTreeNode *node;
+	unsigned int median;
+
+	if (depth == 0 || totnode <= 1) {
+		if (totnode > 1) {
+			KDBalanceJob *job = &jobs[(*r_totjob)++];
+			job->ofs = ofs;
+			job->totnode = totnode;
+			job->axis = axis;
+		}
+		return kdtree_balance_root(totnode, ofs);
+	}
+
+	median = kdtree_partition(nodes, totnode, axis);
+
+	node = &nodes[median];
+	node->d = axis;
+	node->left = kdtree_balance_split(nodes, median, (axis + 1) % 3, ofs, depth - 1,
+	                                  jobs, r_totjob);
+	node->right = kdtree_balance_split(nodes + median + 1, (totnode - (median + 1)), (axis + 1) % 3,
+	                                   ofs + median + 1, depth - 1, jobs, r_totjob);
+
+	return ofs + median;
+}
 
-	return node;
+static void kdtree_balance_task(TaskPool *pool, void *taskdata, int UNUSED(threadid))
+{
+	KDTree *tree = BLI_task_pool_userdata(pool);
+	KDBalanceJob *job = taskdata;
+
+	kdtree_balance(tree->nodes + job->ofs, job->totnode, job->axis, job->ofs);
 }
 
 void BLI_kdtree_balance(KDTree *tree)
 {
-	tree->root = kdtree_balance(tree->nodes, tree->totnode, 0);
+	TaskScheduler *scheduler;
+	TaskPool *pool;
+	KDBalanceJob *jobs;
+	unsigned int depth = 0, totjob = 0, num_threads, i;
+
+	/* the scheduler is only used from the main thread, see bvh_batch_run */
+	if (tree->totnode < KD_BALANCE_THREADED_MIN || !BLI_thread_is_main()) {
+		tree->root = kdtree_balance(tree->nodes, tree->totnode, 0, 0);
+		return;
+	}
+
+	scheduler = BLI_task_scheduler_get();
+	num_threads = (unsigned int)BLI_task_scheduler_num_threads(scheduler);
+
+	if (num_threads < 2) {
+		tree->root = kdtree_balance(tree->nodes, tree->totnode, 0, 0);
+		return;
+	}
+
+	/* partition the top levels on this thread until there are enough subtrees to
+	 * keep all threads busy, the subtrees only touch their own range of nodes */
+	while ((1u << depth) < num_threads * 4)
+		depth++;
+
+	jobs = MEM_mallocN(sizeof(*jobs) * (1u << depth), "KDTree.balance_jobs");
+	tree->root = kdtree_balance_split(tree->nodes, tree->totnode, 0, 0, depth, jobs, &totjob);
+
+	pool = BLI_task_pool_create(scheduler, tree);
+
+	for (i = 0; i < totjob; i++)
+		BLI_task_pool_push(pool, kdtree_balance_task, &jobs[i], false, TASK_PRIORITY_LOW);
+
+	BLI_task_pool_work_and_wait(pool);
+	BLI_task_pool_free(pool);
+
+	MEM_freeN(jobs);
 }
 
-static float squared_distance(const float v2[3], const float v1[3], const float UNUSED(n1[3]), const float n2[3])
+static float squared_distance(const float v2[3], const float v1[3], const float n2[3])
 {
 	float d[3], dist;
 
@@ -166,11 +273,11 @@ static float squared_distance(const float v2[3], const float v1[3], const float
 	return dist;
 }
 
-static KDTreeNode **realloc_nodes(KDTreeNode **stack, unsigned int *totstack, const bool is_alloc)
+static unsigned int *realloc_nodes(unsigned int *stack, unsigned int *totstack, const bool is_alloc)
 {
-	KDTreeNode **stack_new = MEM_mallocN((*totstack + KD_NEAR_ALLOC_INC) * sizeof(KDTreeNode *), "KDTree.treestack");
-	memcpy(stack_new, stack, *totstack * sizeof(KDTreeNode *));
-	// memset(stack_new + *totstack, 0, sizeof(KDTreeNode *) * KD_NEAR_ALLOC_INC);
+	unsigned int *stack_new = MEM_mallocN((*totstack + KD_NEAR_ALLOC_INC) * sizeof(unsigned int), "KDTree.treestack");
+	memcpy(stack_new, stack, *totstack * sizeof(unsigned int));
+	// memset(stack_new + *totstack, 0, sizeof(unsigned int) * KD_NEAR_ALLOC_INC);
 	if (is_alloc)
 		MEM_freeN(stack);
 	*totstack += KD_NEAR_ALLOC_INC;
@@ -183,36 +290,37 @@ static KDTreeNode **realloc_nodes(KDTreeNode **stack, unsigned int *totstack, co
 int BLI_kdtree_find_nearest(KDTree *tree, const float co[3], const float nor[3],
                             KDTreeNearest *r_nearest)
 {
-	KDTreeNode *root, *node, *min_node;
-	KDTreeNode **stack, *defaultstack[KD_STACK_INIT];
+	const KDTreeNode *nodes = tree->nodes;
+	const KDTreeNode *root, *node, *min_node;
+	unsigned int *stack, defaultstack[KD_STACK_INIT];
 	float min_dist, cur_dist;
 	unsigned int totstack, cur = 0;
 
-	if (!tree->root)
+	if (tree->root == KD_NODE_UNSET)
 		return -1;
 
 	stack = defaultstack;
 	totstack = KD_STACK_INIT;
 
-	root = tree->root;
+	root = &nodes[tree->root];
 	min_node = root;
-	min_dist = squared_distance(root->co, co, root->nor, nor);
+	min_dist = squared_distance(root->co, co, nor);
 
 	if (co[root->d] < root->co[root->d]) {
-		if (root->right)
+		if (root->right != KD_NODE_UNSET)
 			stack[cur++] = root->right;
-		if (root->left)
+		if (root->left != KD_NODE_UNSET)
 			stack[cur++] = root->left;
 	}
 	else {
-		if (root->left)
+		if (root->left != KD_NODE_UNSET)
 			stack[cur++] = root->left;
-		if (root->right)
+		if (root->right != KD_NODE_UNSET)
 			stack[cur++] = root->right;
 	}
 	
 	while (cur--) {
-		node = stack[cur];
+		node = &nodes[stack[cur]];
 
 		cur_dist = node->co[node->d] - co[node->d];
 
@@ -220,30 +328,30 @@ int BLI_kdtree_find_nearest(KDTree *tree, const float co[3], const float nor[3],
 			cur_dist = -cur_dist * cur_dist;
 
 			if (-cur_dist < min_dist) {
-				cur_dist = squared_distance(node->co, co, node->nor, nor);
+				cur_dist = squared_distance(node->co, co, nor);
 				if (cur_dist < min_dist) {
 					min_dist = cur_dist;
 					min_node = node;
 				}
-				if (node->left)
+				if (node->left != KD_NODE_UNSET)
 					stack[cur++] = node->left;
 			}
-			if (node->right)
+			if (node->right != KD_NODE_UNSET)
 				stack[cur++] = node->right;
 		}
 		else {
 			cur_dist = cur_dist * cur_dist;
 
 			if (cur_dist < min_dist) {
-				cur_dist = squared_distance(node->co, co, node->nor, nor);
+				cur_dist = squared_distance(node->co, co, nor);
 				if (cur_dist < min_dist) {
 					min_dist = cur_dist;
 					min_node = node;
 				}
-				if (node->right)
+				if (node->right != KD_NODE_UNSET)
 					stack[cur++] = node->right;
 			}
-			if (node->left)
+			if (node->left != KD_NODE_UNSET)
 				stack[cur++] = node->left;
 		}
 		if (UNLIKELY(cur + 3 > totstack)) {
@@ -292,38 +400,39 @@ int BLI_kdtree_find_nearest_n(KDTree *tree, const float co[3], const float nor[3
                               KDTreeNearest r_nearest[],
                               unsigned int n)
 {
-	KDTreeNode *root, *node = NULL;
-	KDTreeNode **stack, *defaultstack[KD_STACK_INIT];
+	const KDTreeNode *nodes = tree->nodes;
+	const KDTreeNode *root, *node = NULL;
+	unsigned int *stack, defaultstack[KD_STACK_INIT];
 	float cur_dist;
 	unsigned int totstack, cur = 0;
 	unsigned int i, found = 0;
 
-	if (!tree->root || n == 0)
+	if (tree->root == KD_NODE_UNSET || n == 0)
 		return 0;
 
 	stack = defaultstack;
 	totstack = KD_STACK_INIT;
 
-	root = tree->root;
+	root = &nodes[tree->root];
 
-	cur_dist = squared_distance(root->co, co, root->nor, nor);
+	cur_dist = squared_distance(root->co, co, nor);
 	add_nearest(r_nearest, &found, n, root->index, cur_dist, root->co);
 	
 	if (co[root->d] < root->co[root->d]) {
-		if (root->right)
+		if (root->right != KD_NODE_UNSET)
 			stack[cur++] = root->right;
-		if (root->left)
+		if (root->left != KD_NODE_UNSET)
 			stack[cur++] = root->left;
 	}
 	else {
-		if (root->left)
+		if (root->left != KD_NODE_UNSET)
 			stack[cur++] = root->left;
-		if (root->right)
+		if (root->right != KD_NODE_UNSET)
 			stack[cur++] = root->right;
 	}
 
 	while (cur--) {
-		node = stack[cur];
+		node = &nodes[stack[cur]];
 
 		cur_dist = node->co[node->d] - co[node->d];
 
@@ -331,29 +440,29 @@ int BLI_kdtree_find_nearest_n(KDTree *tree, const float co[3], const float nor[3
 			cur_dist = -cur_dist * cur_dist;
 
 			if (found < n || -cur_dist < r_nearest[found - 1].dist) {
-				cur_dist = squared_distance(node->co, co, node->nor, nor);
+				cur_dist = squared_distance(node->co, co, nor);
 
 				if (found < n || cur_dist < r_nearest[found - 1].dist)
 					add_nearest(r_nearest, &found, n, node->index, cur_dist, node->co);
 
-				if (node->left)
+				if (node->left != KD_NODE_UNSET)
 					stack[cur++] = node->left;
 			}
-			if (node->right)
+			if (node->right != KD_NODE_UNSET)
 				stack[cur++] = node->right;
 		}
 		else {
 			cur_dist = cur_dist * cur_dist;
 
 			if (found < n || cur_dist < r_nearest[found - 1].dist) {
-				cur_dist = squared_distance(node->co, co, node->nor, nor);
+				cur_dist = squared_distance(node->co, co, nor);
 				if (found < n || cur_dist < r_nearest[found - 1].dist)
 					add_nearest(r_nearest, &found, n, node->index, cur_dist, node->co);
 
-				if (node->right)
+				if (node->right != KD_NODE_UNSET)
 					stack[cur++] = node->right;
 			}
-			if (node->left)
+			if (node->left != KD_NODE_UNSET)
 				stack[cur++] = node->left;
 		}
 		if (UNLIKELY(cur + 3 > totstack)) {
@@ -382,12 +491,12 @@ static int range_compare(const void *a, const void *b)
 	else
 		return 0;
 }
-static void add_in_range(KDTreeNearest **ptn, unsigned int found, unsigned int *totfoundstack, int index, float dist, float *co)
+static void add_in_range(KDTreeNearest **ptn, unsigned int found, unsigned int *totfoundstack, int index, float dist, const float *co)
 {
 	KDTreeNearest *to;
 
 	if (found >= *totfoundstack) {
-		KDTreeNearest *temp = MEM_mallocN((*totfoundstack + KD_FOUND_ALLOC_INC) * sizeof(KDTreeNode), "KDTree.treefoundstack");
+		KDTreeNearest *temp = MEM_mallocN((*totfoundstack + KD_FOUND_ALLOC_INC) * sizeof(KDTreeNearest), "KDTree.treefoundstack");
 		memcpy(temp, *ptn, *totfoundstack * sizeof(KDTreeNearest));
 		if (*ptn)
 			MEM_freeN(*ptn);
@@ -410,58 +519,59 @@ static void add_in_range(KDTreeNearest **ptn, unsigned int found, unsigned int *
 int BLI_kdtree_range_search(KDTree *tree, const float co[3], const float nor[3],
                             KDTreeNearest **r_nearest, float range)
 {
-	KDTreeNode *root, *node = NULL;
-	KDTreeNode **stack, *defaultstack[KD_STACK_INIT];
+	const KDTreeNode *nodes = tree->nodes;
+	const KDTreeNode *root, *node = NULL;
+	unsigned int *stack, defaultstack[KD_STACK_INIT];
 	KDTreeNearest *foundstack = NULL;
 	float range2 = range * range, dist2;
 	unsigned int totstack, cur = 0, found = 0, totfoundstack = 0;
 
-	if (!tree || !tree->root)
+	if (!tree || tree->root == KD_NODE_UNSET)
 		return 0;
 
 	stack = defaultstack;
 	totstack = KD_STACK_INIT;
 
-	root = tree->root;
+	root = &nodes[tree->root];
 
 	if (co[root->d] + range < root->co[root->d]) {
-		if (root->left)
+		if (root->left != KD_NODE_UNSET)
 			stack[cur++] = root->left;
 	}
 	else if (co[root->d] - range > root->co[root->d]) {
-		if (root->right)
+		if (root->right != KD_NODE_UNSET)
 			stack[cur++] = root->right;
 	}
 	else {
-		dist2 = squared_distance(root->co, co, root->nor, nor);
+		dist2 = squared_distance(root->co, co, nor);
 		if (dist2 <= range2)
 			add_in_range(&foundstack, found++, &totfoundstack, root->index, dist2, root->co);
 
-		if (root->left)
+		if (root->left != KD_NODE_UNSET)
 			stack[cur++] = root->left;
-		if (root->right)
+		if (root->right != KD_NODE_UNSET)
 			stack[cur++] = root->right;
 	}
 
 	while (cur--) {
-		node = stack[cur];
+		node = &nodes[stack[cur]];
 
 		if (co[node->d] + range < node->co[node->d]) {
-			if (node->left)
+			if (node->left != KD_NODE_UNSET)
 				stack[cur++] = node->left;
 		}
 		else if (co[node->d] - range > node->co[node->d]) {
-			if (node->right)
+			if (node->right != KD_NODE_UNSET)
 				stack[cur++] = node->right;
 		}
 		else {
-			dist2 = squared_distance(node->co, co, node->nor, nor);
+			dist2 = squared_distance(node->co, co, nor);
 			if (dist2 <= range2)
 				add_in_range(&foundstack, found++, &totfoundstack, node->index, dist2, node->co);
 
-			if (node->left)
+			if (node->left != KD_NODE_UNSET)
 				stack[cur++] = node->left;
-			if (node->right)
+			if (node->right != KD_NODE_UNSET)
 				stack[cur++] = node->right;
 		}
 
@@ -480,3 +590,93 @@ int BLI_kdtree_range_search(KDTree *tree, const float co[3], const float nor[3],
 
 	return (int)found;
 }
+
+/* -------------------------------------------------------------------- */
+/* Batched queries, split in chunks that run on the task scheduler */
+
+typedef struct KDBatchData {
+	KDTree *tree;
+	const float (*co)[3];
+	const float (*nor)[3];
+	unsigned int totquery;
+
+	KDTreeNearest *nearest;
+	unsigned int n;
+
+	int *r_found;
+} KDBatchData;
+
+static void kdtree_batch_range(const KDBatchData *data, unsigned int start, unsigned int end)
+{
+	unsigned int i;
+
+	for (i = start; i < end; i++) {
+		const float *nor = data->nor ? data->nor[i] : NULL;
+		int found = BLI_kdtree_find_nearest_n(data->tree, data->co[i], nor, &data->nearest[i * data->n], data->n);
+
+		if (data->r_found)
+			data->r_found[i] = found;
+	}
+}
+
+static void kdtree_batch_task(TaskPool *pool, void *taskdata, int UNUSED(threadid))
+{
+	const KDBatchData *data = BLI_task_pool_userdata(pool);
+	const unsigned int start = (unsigned int)GET_INT_FROM_POINTER(taskdata);
+	const unsigned int end = start + KD_BATCH_CHUNK_SIZE;
+
+	kdtree_batch_range(data, start, MIN2(end, data->totquery));
+}
+
+static void kdtree_batch_run(const KDBatchData *data)
+{
+	TaskScheduler *scheduler;
+	TaskPool *pool;
+	unsigned int start;
+
+	/* small batches are not worth threading, and the scheduler is only used from
+	 * the main thread, see bvh_batch_run */
+	if (data->totquery <= KD_BATCH_CHUNK_SIZE * 2 || !BLI_thread_is_main()) {
+		kdtree_batch_range(data, 0, data->totquery);
+		return;
+	}
+
+	scheduler = BLI_task_scheduler_get();
+
+	if (BLI_task_scheduler_num_threads(scheduler) < 2) {
+		kdtree_batch_range(data, 0, data->totquery);
+		return;
+	}
+
+	pool = BLI_task_pool_create(scheduler, (void *)data);
+
+	for (start = 0; start < data->totquery; start += KD_BATCH_CHUNK_SIZE)
+		BLI_task_pool_push(pool, kdtree_batch_task, SET_INT_IN_POINTER(start), false, TASK_PRIORITY_LOW);
+
+	BLI_task_pool_work_and_wait(pool);
+	BLI_task_pool_free(pool);
+}
+
+/**
+ * Find the n nearest points for many query points at once, using multiple threads.
+ * Normals are optional.
+ *
+ * \param r_nearest  An array sized at least \a totquery * \a n, results for query i start at i * n.
+ * \param r_found  Optional array sized \a totquery, receives the number of points found per query.
+ */
+void BLI_kdtree_find_nearest_n_batch(KDTree *tree, const float (*co)[3], const float (*nor)[3],
+                                     unsigned int totquery, KDTreeNearest *r_nearest, unsigned int n,
+                                     int *r_found)
+{
+	KDBatchData data = {NULL};
+
+	data.tree = tree;
+	data.co = co;
+	data.nor = nor;
+	data.totquery = totquery;
+	data.nearest = r_nearest;
+	data.n = n;
+	data.r_found = r_found;
+
+	kdtree_batch_run(&data);
+}
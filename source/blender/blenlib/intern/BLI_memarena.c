@@ -176,3 +176,32 @@ void BLI_memarena_clear(MemArena *ma)
 #endif
 
 }
+
+/**
+ * Move all memory allocated by \a ma_src into \a ma_dst and free \a ma_src.
+ * Pointers returned by either arena remain valid until \a ma_dst is freed,
+ * useful for building data in separate arenas from multiple threads.
+ */
+void BLI_memarena_merge(MemArena *ma_dst, MemArena *ma_src)
+{
+	if (ma_src->bufs) {
+		if (ma_dst->bufs) {
+			LinkNode *link_src_last = ma_src->bufs;
+
+			while (link_src_last->next)
+				link_src_last = link_src_last->next;
+
+			/* keep the buffer of the destination in use first in the list,
+			 * BLI_memarena_clear relies on that */
+			link_src_last->next = ma_dst->bufs->next;
+			ma_dst->bufs->next = ma_src->bufs;
+		}
+		else {
+			ma_dst->bufs = ma_src->bufs;
+			ma_dst->curbuf = ma_src->curbuf;
+			ma_dst->cursize = ma_src->cursize;
+		}
+	}
+
+	MEM_freeN(ma_src);
+}
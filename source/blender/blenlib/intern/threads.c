@@ -121,6 +121,7 @@ static pthread_mutex_t _opengl_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t _nodes_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t _movieclip_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t _colormanage_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t _task_scheduler_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_t mainid;
 static int thread_levels = 0;  /* threads can be invoked inside threads */
 static int num_threads_override = 0;
@@ -163,6 +164,13 @@ void BLI_threadapi_exit(void)
 
 TaskScheduler *BLI_task_scheduler_get(void)
 {
+	TaskScheduler *scheduler;
+
+	/* render threads may ask for the scheduler at the same time
+	 * as the main thread, only create it once and never read the
+	 * pointer outside of the lock */
+	pthread_mutex_lock(&_task_scheduler_lock);
+
 	if (task_scheduler == NULL) {
 		int tot_thread = BLI_system_thread_count();
 
@@ -172,7 +180,11 @@ TaskScheduler *BLI_task_scheduler_get(void)
 		task_scheduler = BLI_task_scheduler_create(tot_thread);
 	}
 
-	return task_scheduler;
+	scheduler = task_scheduler;
+
+	pthread_mutex_unlock(&_task_scheduler_lock);
+
+	return scheduler;
 }
 
 /* tot = 0 only initializes malloc mutex in a safe way (see sequence.c)
@@ -3902,7 +3902,7 @@ static void direct_link_particlesystems(FileData *fd, ListBase *particles)
 		}
 		
 		psys->tree = NULL;
-		psys->bvhtree = NULL;
+		psys->sphgrid = NULL;
 	}
 	return;
 }
@@ -5035,6 +5035,7 @@ static void direct_link_object(FileData *fd, Object *ob)
 	ob->bb = NULL;
 	ob->derivedDeform = NULL;
 	ob->derivedFinal = NULL;
+	ob->modifier_stack_cache = NULL;
 	ob->gpulamp.first= ob->gpulamp.last = NULL;
 	link_list(fd, &ob->pc_ids);
 
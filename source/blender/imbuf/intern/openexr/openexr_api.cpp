@@ -772,6 +772,13 @@ void IMB_exr_write_channels(void *handle)
 }
 
 void IMB_exr_read_channels(void *handle)
+{
+	IMB_exr_read_channels_ex(handle, 0);
+}
+
+/* skip_unset: channels in the file without a rect set are left out on
+ * purpose by the caller, don't warn about them */
+void IMB_exr_read_channels_ex(void *handle, int skip_unset)
 {
 	ExrHandle *data = (ExrHandle *)handle;
 	FrameBuffer frameBuffer;
@@ -791,7 +798,7 @@ void IMB_exr_read_channels(void *handle)
 				frameBuffer.insert(echan->name, Slice(Imf::FLOAT,  (char *)(echan->rect + echan->xstride * (data->height - 1) * data->width),
 				                                      echan->xstride * sizeof(float), -echan->ystride * sizeof(float)));
 		}
-		else
+		else if (!skip_unset)
 			printf("warning, channel with no rect set %s\n", echan->name);
 	}
 
@@ -57,6 +57,7 @@ void    IMB_exrtile_begin_write(void *handle, const char *filename, int mipmap,
 void    IMB_exr_set_channel(void *handle, const char *layname, const char *passname, int xstride, int ystride, float *rect);
 
 void    IMB_exr_read_channels(void *handle);
+void    IMB_exr_read_channels_ex(void *handle, int skip_unset);
 void    IMB_exr_write_channels(void *handle);
 void    IMB_exrtile_write_channels(void *handle, int partx, int party, int level);
 void    IMB_exrtile_clear_channels(void *handle);
@@ -43,6 +43,7 @@ void    IMB_exrtile_begin_write     (void *handle, const char *filename, int mip
 void    IMB_exr_set_channel         (void *handle, const char *layname, const char *channame, int xstride, int ystride, float *rect) { (void)handle; (void)layname; (void)channame; (void)xstride; (void)ystride; (void)rect; }
 
 void    IMB_exr_read_channels       (void *handle) { (void)handle; }
+void    IMB_exr_read_channels_ex    (void *handle, int skip_unset) { (void)handle; (void)skip_unset; }
 void    IMB_exr_write_channels      (void *handle) { (void)handle; }
 void    IMB_exrtile_write_channels  (void *handle, int partx, int party, int level) { (void)handle; (void)partx; (void)party; (void)level; }
 void    IMB_exrtile_clear_channels  (void *handle) { (void)handle; }
@@ -64,6 +64,7 @@ struct SDNA *DNA_sdna_from_data(const void *data, const int datalen, bool do_end
 void DNA_sdna_free(struct SDNA *sdna);
 
 int DNA_struct_find_nr(struct SDNA *sdna, const char *str);
+void DNA_struct_pointer_mask(struct SDNA *sdna, int structnr, char *r_mask);
 void DNA_struct_switch_endian(struct SDNA *oldsdna, int oldSDNAnr, char *data);
 char *DNA_struct_get_compareflags(struct SDNA *sdna, struct SDNA *newsdna);
 void *DNA_struct_reconstruct(struct SDNA *newsdna, struct SDNA *oldsdna, char *compflags, int oldSDNAnr, int blocks, void *data);
@@ -305,7 +305,7 @@ typedef struct ParticleSystem {
 	int tot_fluidsprings, alloc_fluidsprings;
 
 	struct KDTree *tree;								/* used for interactions with self and other systems */
-	struct BVHTree *bvhtree;								/* used for interactions with self and other systems */
+	struct SPHGrid *sphgrid;								/* fluid neighbor lookups, built at bvhtree_frame (runtime) */
 
 	struct ParticleDrawData *pdd;
 
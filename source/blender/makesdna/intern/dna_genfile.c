@@ -339,6 +339,43 @@ int DNA_struct_find_nr(SDNA *sdna, const char *str)
 #endif
 }
 
+/**
+ * Sets the bytes of \a r_mask that hold pointer members of struct \a structnr to 1,
+ * including pointers in nested structs, other bytes are left untouched.
+ * \a r_mask must be at least as large as the struct.
+ */
+void DNA_struct_pointer_mask(SDNA *sdna, int structnr, char *r_mask)
+{
+	const short *sp = sdna->structs[structnr];
+	const int nr = sp[1];
+	int a, offset = 0;
+
+	sp += 2;
+
+	for (a = 0; a < nr; a++, sp += 2) {
+		const int len = elementsize(sdna, sp[0], sp[1]);
+
+		if (ispointer(sdna->names[sp[1]])) {
+			memset(r_mask + offset, 1, len);
+		}
+		else {
+			const int nested_nr = DNA_struct_find_nr(sdna, sdna->types[sp[0]]);
+
+			if (nested_nr != -1) {
+				const int nested_len = sdna->typelens[sp[0]];
+				int b;
+
+				/* arrays of structs */
+				for (b = 0; b + nested_len <= len; b += nested_len) {
+					DNA_struct_pointer_mask(sdna, nested_nr, r_mask + offset + b);
+				}
+			}
+		}
+
+		offset += len;
+	}
+}
+
 /* ************************* END DIV ********************** */
 
 /* ************************* READ DNA ********************** */
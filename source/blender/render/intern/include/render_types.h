@@ -62,6 +62,7 @@ struct ObjectInstanceRen;
 struct RayObject;
 struct RayFace;
 struct RenderEngine;
+struct TaskScheduler;
 struct ReportList;
 struct Main;
 struct ImagePool;
@@ -193,6 +194,10 @@ struct Render
 	unsigned int lay;
 	
 	ListBase parts;
+
+	/* only used when the render has a different number of threads than the
+	 * global task scheduler, see render_task_scheduler_get */
+	struct TaskScheduler *task_scheduler;
 	
 	/* render engine */
 	struct RenderEngine *engine;
@@ -227,9 +232,13 @@ struct Render
 	
 	struct GHash *orco_hash;
 
+	/* first ObjectRen per mesh shared by objects, only during conversion */
+	struct GHash *shared_data_hash;
+
 	struct GHash *sss_hash;
-	ListBase *sss_points;
-	struct Material *sss_mat;
+	ListBase *sss_points;	/* points for each material in sss_mats, during the preprocessing pass */
+	struct Material **sss_mats;
+	int sss_totmat;
 
 	ListBase customdata_names;
 
@@ -329,6 +338,10 @@ typedef struct ObjectRen {
 
 	float obmat[4][4];	/* only used in convertblender.c, for instancing */
 
+	/* post-processing deferred until all objects are converted, only used in convertblender.c */
+	short finalize, autosmooth_angle;
+	float autosmooth_mat[4][4];
+
 	/* used on makeraytree */
 	struct RayObject *raytree;
 	struct RayFace *rayfaces;
@@ -601,10 +614,6 @@ typedef struct LampRen {
 	struct RayObject *last_hit[BLENDER_MAX_THREADS];
 	
 	struct MTex *mtex[MAX_MTEX];
-
-	/* threading */
-	int thread_assigned;
-	int thread_ready;
 } LampRen;
 
 /* **************** defines ********************* */
@@ -651,6 +660,13 @@ typedef struct LampRen {
 /* objectren->flag */
 #define R_INSTANCEABLE		1
 
+/* objectren->finalize */
+#define R_FINALIZE_OBJECT		1
+#define R_FINALIZE_AUTOSMOOTH	2
+#define R_FINALIZE_NORMALS		4
+#define R_FINALIZE_TANGENT		8
+#define R_FINALIZE_NMAP_TANGENT	16
+
 /* objectinstance->flag */
 #define R_DUPLI_TRANSFORMED	1
 #define R_ENV_TRANSFORMED	2
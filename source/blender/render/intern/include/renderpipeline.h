@@ -36,9 +36,11 @@
 struct Render;
 struct RenderLayer;
 struct RenderResult;
+struct TaskScheduler;
 
 struct RenderLayer *render_get_active_layer(struct Render *re, struct RenderResult *rr);
 float panorama_pixel_rot(struct Render *re);
+struct TaskScheduler *render_task_scheduler_get(struct Render *re);
 
 #endif /* __RENDERPIPELINE_H__ */
 
@@ -36,6 +36,7 @@
 /* Generic multiple scattering API */
 
 struct ScatterSettings;
+struct TaskScheduler;
 typedef struct ScatterSettings ScatterSettings;
 
 struct ScatterTree;
@@ -47,7 +48,7 @@ void scatter_settings_free(ScatterSettings *ss);
 
 ScatterTree *scatter_tree_new(ScatterSettings *ss[3], float scale, float error,
                               float (*co)[3], float (*color)[3], float *area, int totpoint);
-void scatter_tree_build(ScatterTree *tree);
+void scatter_tree_build(ScatterTree *tree, struct TaskScheduler *scheduler);
 void scatter_tree_sample(ScatterTree *tree, const float co[3], float color[3]);
 void scatter_tree_free(ScatterTree *tree);
 
@@ -58,7 +59,7 @@ struct Material;
 struct VlakRen;
 
 void make_sss_tree(struct Render *re);
-void sss_add_points(Render *re, float (*co)[3], float (*color)[3], float *area, int totpoint);
+void sss_add_points(Render *re, int mat_index, float (*co)[3], float (*color)[3], float *area, int totpoint);
 void free_sss(struct Render *re);
 
 int sample_sss(struct Render *re, struct Material *mat, const float co[3], float color[3]);
@@ -35,6 +35,7 @@
 #include "MEM_guardedalloc.h"
 
 #include "BLI_math.h"
+#include "BLI_task.h"
 #include "BLI_utildefines.h"
 
 #include "DNA_material_types.h"
@@ -525,6 +526,14 @@ int RE_rayobjectcontrol_test_break(RayObjectControl *control)
 	return 0;
 }
 
+TaskScheduler *RE_rayobjectcontrol_task_scheduler(RayObjectControl *control)
+{
+	if (control && control->task_scheduler)
+		return control->task_scheduler;
+
+	return BLI_task_scheduler_get();
+}
+
 void RE_rayobject_set_control(RayObject *r, void *data, RE_rayobjectcontrol_test_break_callback test_break)
 {
 	if (RE_rayobject_isRayAPI(r)) {
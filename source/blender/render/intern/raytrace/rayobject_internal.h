@@ -51,6 +51,7 @@ typedef int (*RE_rayobjectcontrol_test_break_callback)(void *data);
 typedef struct RayObjectControl {
 	void *data;
 	RE_rayobjectcontrol_test_break_callback test_break;
+	struct TaskScheduler *task_scheduler;
 } RayObjectControl;
 
 /* Returns true if for some reason a heavy processing function should stop
@@ -59,6 +60,10 @@ typedef struct RayObjectControl {
 
 int RE_rayobjectcontrol_test_break(RayObjectControl *c);
 
+/* Scheduler to use for threaded tree building, the global one if not set */
+
+struct TaskScheduler *RE_rayobjectcontrol_task_scheduler(RayObjectControl *c);
+
 /* RayObject
  *
  *  A ray object is everything where we can cast rays like:
@@ -40,6 +40,8 @@
 #include "MEM_guardedalloc.h"
 
 #include "BLI_math.h"
+#include "BLI_task.h"
+#include "BLI_threads.h"
 #include "BLI_utildefines.h"
 
 static bool selected_node(RTBuilder::Object *node)
@@ -153,8 +155,42 @@ static void object_sort(Item *begin, Item *end, int axis)
 	assert(false);
 }
 
+/* below this size sorting is fast enough to not be worth using threads */
+#define RTBUILD_SORT_TASK_MIN_SIZE 4096
+
+typedef struct RTBuildSortData {
+	RTBuilder *b;
+	RayObjectControl *ctrl;
+} RTBuildSortData;
+
+static void rtbuild_sort_task(TaskPool *pool, void *taskdata, int UNUSED(threadid))
+{
+	RTBuildSortData *data = (RTBuildSortData *)BLI_task_pool_userdata(pool);
+	RTBuilder *b = data->b;
+	int axis = GET_INT_FROM_POINTER(taskdata);
+
+	if (RE_rayobjectcontrol_test_break(data->ctrl))
+		return;
+
+	object_sort(b->sorted_begin[axis], b->sorted_end[axis], axis);
+}
+
 void rtbuild_done(RTBuilder *b, RayObjectControl *ctrl)
 {
+	if (rtbuild_size(b) >= RTBUILD_SORT_TASK_MIN_SIZE) {
+		/* axes are sorted independently */
+		RTBuildSortData data = {b, ctrl};
+		TaskPool *task_pool = BLI_task_pool_create(RE_rayobjectcontrol_task_scheduler(ctrl), &data);
+
+		for (int i = 0; i < 3; i++)
+			if (b->sorted_begin[i])
+				BLI_task_pool_push(task_pool, rtbuild_sort_task, SET_INT_IN_POINTER(i), false, TASK_PRIORITY_HIGH);
+
+		BLI_task_pool_work_and_wait(task_pool);
+		BLI_task_pool_free(task_pool);
+		return;
+	}
+
 	for (int i = 0; i < 3; i++) {
 		if (b->sorted_begin[i]) {
 			if (RE_rayobjectcontrol_test_break(ctrl)) break;
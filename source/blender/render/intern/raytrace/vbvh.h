@@ -32,8 +32,14 @@
 
 #include <assert.h>
 #include <algorithm>
+#include <vector>
+
+#include "MEM_guardedalloc.h"
 
 #include "BLI_memarena.h"
+#include "BLI_task.h"
+#include "BLI_threads.h"
+#include "BLI_utildefines.h"
 
 #include "rayobject_rtbuild.h"
 
@@ -104,27 +110,45 @@ static void append_sibling(Node *node, Node *sibling)
 
 /*
  * Builds a binary VBVH from a rtbuild
+ *
+ * Subtrees with at least RTBUILD_TASK_MIN_SIZE primitives are built as tasks,
+ * each in its own memory arena that is merged into the tree arena when all
+ * tasks are done.
  */
+#define RTBUILD_TASK_MIN_SIZE 4096
+
 template<class Node>
 struct BuildBinaryVBVH {
 	MemArena *arena;
 	RayObjectControl *control;
+	TaskPool *task_pool;
+	std::vector<MemArena *> task_arenas;
+	volatile int stop;  /* set by any task, read by all of them */
+
+	struct BuildTask {
+		RTBuilder builder;
+		Node *node;
+	};
 
 	void test_break()
 	{
-		if (RE_rayobjectcontrol_test_break(control))
+		if (stop || RE_rayobjectcontrol_test_break(control)) {
+			stop = 1;
 			throw "Stop";
+		}
 	}
 
 	BuildBinaryVBVH(MemArena *a, RayObjectControl *c)
 	{
 		arena = a;
 		control = c;
+		task_pool = NULL;
+		stop = 0;
 	}
 
-	Node *create_node()
+	Node *create_node(MemArena *node_arena)
 	{
-		Node *node = (Node *)BLI_memarena_alloc(arena, sizeof(Node) );
+		Node *node = (Node *)BLI_memarena_alloc(node_arena, sizeof(Node) );
 		assert(RE_rayobject_isAligned(node));
 
 		node->sibling = NULL;
@@ -140,53 +164,124 @@ struct BuildBinaryVBVH {
 	
 	Node *transform(RTBuilder *builder)
 	{
+		Node *root = NULL;
+
+		if (rtbuild_size(builder) >= RTBUILD_TASK_MIN_SIZE)
+			task_pool = BLI_task_pool_create(RE_rayobjectcontrol_task_scheduler(control), this);
+
 		try
 		{
-			return _transform(builder);
-			
+			root = _transform(builder, arena);
 		} catch (...)
 		{
+			stop = 1;
 		}
-		return NULL;
+
+		if (task_pool) {
+			BLI_task_pool_work_and_wait(task_pool);
+			BLI_task_pool_free(task_pool);
+			task_pool = NULL;
+
+			for (size_t i = 0; i < task_arenas.size(); i++)
+				BLI_memarena_merge(arena, task_arenas[i]);
+			task_arenas.clear();
+		}
+
+		return (stop) ? NULL : root;
 	}
-	
-	Node *_transform(RTBuilder *builder)
+
+	static void build_task_run(TaskPool *pool, void *taskdata, int UNUSED(threadid))
 	{
-		int size = rtbuild_size(builder);
+		BuildBinaryVBVH *build = (BuildBinaryVBVH *)BLI_task_pool_userdata(pool);
+		BuildTask *task = (BuildTask *)taskdata;
+		MemArena *task_arena;
 
-		if (size == 0) {
-			return NULL;
+		if (build->stop)
+			return;
+
+		task_arena = BLI_memarena_new(BLI_MEMARENA_STD_BUFSIZE, "vbvh task arena");
+		BLI_memarena_use_malloc(task_arena);
+
+		try
+		{
+			build->_transform_node(&task->builder, task->node, task_arena);
+		} catch (...)
+		{
+			build->stop = 1;
 		}
-		else if (size == 1) {
-			Node *node = create_node();
+
+		BLI_mutex_lock(BLI_task_pool_user_mutex(pool));
+		build->task_arenas.push_back(task_arena);
+		BLI_mutex_unlock(BLI_task_pool_user_mutex(pool));
+	}
+
+	Node *_transform(RTBuilder *builder, MemArena *node_arena)
+	{
+		if (rtbuild_size(builder) == 0)
+			return NULL;
+
+		Node *node = create_node(node_arena);
+		_transform_node(builder, node, node_arena);
+		return node;
+	}
+
+	void _transform_node(RTBuilder *builder, Node *node, MemArena *node_arena)
+	{
+		int size = rtbuild_size(builder);
+
+		if (size == 1) {
 			INIT_MINMAX(node->bb, node->bb + 3);
 			rtbuild_merge_bb(builder, node->bb, node->bb + 3);
 			node->child = (Node *) rtbuild_get_primitive(builder, 0);
-			return node;
 		}
 		else {
 			test_break();
-			
-			Node *node = create_node();
 
 			Node **child = &node->child;
+			bool use_tasks = false;
 
 			int nc = rtbuild_split(builder);
 			INIT_MINMAX(node->bb, node->bb + 3);
 
 			assert(nc == 2);
+
+			/* bounds of children built as tasks are not known until the
+			 * tasks are done, compute them before the tasks reorder primitives */
+			if (task_pool) {
+				for (int i = 0; i < nc; i++)
+					if (builder->child_offset[i + 1] - builder->child_offset[i] >= RTBUILD_TASK_MIN_SIZE)
+						use_tasks = true;
+
+				if (use_tasks)
+					rtbuild_merge_bb(builder, node->bb, node->bb + 3);
+			}
+
 			for (int i = 0; i < nc; i++) {
 				RTBuilder tmp;
 				rtbuild_get_child(builder, i, &tmp);
-				
-				*child = _transform(&tmp);
-				DO_MIN((*child)->bb, node->bb);
-				DO_MAX((*child)->bb + 3, node->bb + 3);
+
+				if (use_tasks && rtbuild_size(&tmp) >= RTBUILD_TASK_MIN_SIZE) {
+					BuildTask *task = (BuildTask *)MEM_mallocN(sizeof(BuildTask), "BuildBinaryVBVH.BuildTask");
+
+					task->builder = tmp;
+					task->node = create_node(node_arena);
+					*child = task->node;
+
+					BLI_task_pool_push(task_pool, build_task_run, task, true, TASK_PRIORITY_HIGH);
+				}
+				else {
+					*child = _transform(&tmp, node_arena);
+
+					if (!use_tasks) {
+						DO_MIN((*child)->bb, node->bb);
+						DO_MAX((*child)->bb + 3, node->bb + 3);
+					}
+				}
+
 				child = &((*child)->sibling);
 			}
 
 			*child = NULL;
-			return node;
 		}
 	}
 };
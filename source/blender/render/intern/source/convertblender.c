@@ -42,6 +42,7 @@
 #include "BLI_memarena.h"
 #include "BLI_ghash.h"
 #include "BLI_linklist.h"
+#include "BLI_task.h"
 #ifdef WITH_FREESTYLE
 #  include "BLI_edgehash.h"
 #endif
@@ -3712,21 +3713,33 @@ static void init_render_mesh(Render *re, ObjectRen *obr, int timeoffset)
 			calc_edge_stress(re, obr, me);
 
 		if (test_for_displace(re, ob ) ) {
-			recalc_normals= 1;
+			/* displacement evaluates textures, keep it out of the threads */
 			calc_vertexnormals(re, obr, 0, 0);
 			if (do_autosmooth)
 				do_displacement(re, obr, mat, imat);
 			else
 				do_displacement(re, obr, NULL, NULL);
-		}
 
-		if (do_autosmooth) {
-			recalc_normals= 1;
-			autosmooth(re, obr, mat, me->smoothresh);
-		}
+			if (do_autosmooth)
+				autosmooth(re, obr, mat, me->smoothresh);
 
-		if (recalc_normals!=0 || need_tangent!=0)
 			calc_vertexnormals(re, obr, need_tangent, need_nmap_tangent);
+		}
+		else {
+			/* done by finalize_render_objects */
+			if (do_autosmooth) {
+				recalc_normals= 1;
+				obr->finalize |= R_FINALIZE_AUTOSMOOTH;
+				obr->autosmooth_angle= me->smoothresh;
+				copy_m4_m4(obr->autosmooth_mat, mat);
+			}
+
+			if (recalc_normals!=0 || need_tangent!=0) {
+				obr->finalize |= R_FINALIZE_NORMALS;
+				if (need_tangent) obr->finalize |= R_FINALIZE_TANGENT;
+				if (need_nmap_tangent) obr->finalize |= R_FINALIZE_NMAP_TANGENT;
+			}
+		}
 	}
 
 	dm->release(dm);
@@ -4220,7 +4233,7 @@ void init_render_world(Render *re)
 /* ------------------------------------------------------------------------- */
 
 /* prevent phong interpolation for giving ray shadow errors (terminator problem) */
-static void set_phong_threshold(ObjectRen *obr)
+static float phong_threshold(ObjectRen *obr)
 {
 //	VertRen *ver;
 	VlakRen *vlr;
@@ -4263,8 +4276,10 @@ static void set_phong_threshold(ObjectRen *obr)
 	
 	if (tot) {
 		thresh/= (float)tot;
-		obr->ob->smoothresh= cosf(0.5f*(float)M_PI-saacos(thresh));
+		return cosf(0.5f*(float)M_PI-saacos(thresh));
 	}
+
+	return 0.0f;
 }
 
 /* per face check if all samples should be taken.
@@ -4505,83 +4520,156 @@ static void check_non_flat_quads(ObjectRen *obr)
 	}
 }
 
-static void finalize_render_object(Render *re, ObjectRen *obr, int timeoffset)
+/* only touches data of the object itself, so it can run in parallel with other
+ * objects. returns the phong threshold for the object */
+static float finalize_render_object(Render *re, ObjectRen *obr)
 {
 	Object *ob= obr->ob;
 	VertRen *ver= NULL;
 	StrandRen *strand= NULL;
 	StrandBound *sbound= NULL;
-	float min[3], max[3], smin[3], smax[3];
+	float min[3], max[3], smin[3], smax[3], smoothresh= 0.0f;
 	int a, b;
 
-	if (obr->totvert || obr->totvlak || obr->tothalo || obr->totstrand) {
-		/* the exception below is because displace code now is in init_render_mesh call, 
-		 * I will look at means to have autosmooth enabled for all object types
-		 * and have it as general postprocess, like displace */
-		if (ob->type!=OB_MESH && test_for_displace(re, ob))
-			do_displacement(re, obr, NULL, NULL);
+	/* phong normal interpolation can cause error in tracing
+	 * (terminator problem) */
+	if ((re->r.mode & R_RAYTRACE) && (re->r.mode & R_SHADOW))
+		smoothresh= phong_threshold(obr);
 	
-		if (!timeoffset) {
-			/* phong normal interpolation can cause error in tracing
-			 * (terminator problem) */
-			ob->smoothresh= 0.0;
-			if ((re->r.mode & R_RAYTRACE) && (re->r.mode & R_SHADOW))
-				set_phong_threshold(obr);
+	if (re->flag & R_BAKING && re->r.bake_quad_split != 0) {
+		/* Baking lets us define a quad split order */
+		split_quads(obr, re->r.bake_quad_split);
+	}
+	else if (BKE_object_is_animated(re->scene, ob))
+		split_quads(obr, 1);
+	else {
+		if ((re->r.mode & R_SIMPLIFY && re->r.simplify_flag & R_SIMPLE_NO_TRIANGULATE) == 0)
+			check_non_flat_quads(obr);
+	}
+	
+	set_fullsample_trace_flag(re, obr);
+
+	/* compute bounding boxes for clipping */
+	INIT_MINMAX(min, max);
+	for (a=0; a<obr->totvert; a++) {
+		if ((a & 255)==0) ver= obr->vertnodes[a>>8].vert;
+		else ver++;
+
+		minmax_v3v3_v3(min, max, ver->co);
+	}
+
+	if (obr->strandbuf) {
+		float width;
+		
+		/* compute average bounding box of strandpoint itself (width) */
+		if (obr->strandbuf->flag & R_STRAND_B_UNITS)
+			obr->strandbuf->maxwidth = max_ff(obr->strandbuf->ma->strand_sta, obr->strandbuf->ma->strand_end);
+		else
+			obr->strandbuf->maxwidth= 0.0f;
+		
+		width= obr->strandbuf->maxwidth;
+		sbound= obr->strandbuf->bound;
+		for (b=0; b<obr->strandbuf->totbound; b++, sbound++) {
 			
-			if (re->flag & R_BAKING && re->r.bake_quad_split != 0) {
-				/* Baking lets us define a quad split order */
-				split_quads(obr, re->r.bake_quad_split);
-			}
-			else if (BKE_object_is_animated(re->scene, ob))
-				split_quads(obr, 1);
-			else {
-				if ((re->r.mode & R_SIMPLIFY && re->r.simplify_flag & R_SIMPLE_NO_TRIANGULATE) == 0)
-					check_non_flat_quads(obr);
+			INIT_MINMAX(smin, smax);
+
+			for (a=sbound->start; a<sbound->end; a++) {
+				strand= RE_findOrAddStrand(obr, a);
+				strand_minmax(strand, smin, smax, width);
 			}
-			
-			set_fullsample_trace_flag(re, obr);
 
-			/* compute bounding boxes for clipping */
-			INIT_MINMAX(min, max);
-			for (a=0; a<obr->totvert; a++) {
-				if ((a & 255)==0) ver= obr->vertnodes[a>>8].vert;
-				else ver++;
+			copy_v3_v3(sbound->boundbox[0], smin);
+			copy_v3_v3(sbound->boundbox[1], smax);
 
-				minmax_v3v3_v3(min, max, ver->co);
-			}
+			minmax_v3v3_v3(min, max, smin);
+			minmax_v3v3_v3(min, max, smax);
+		}
+	}
 
-			if (obr->strandbuf) {
-				float width;
-				
-				/* compute average bounding box of strandpoint itself (width) */
-				if (obr->strandbuf->flag & R_STRAND_B_UNITS)
-					obr->strandbuf->maxwidth = max_ff(obr->strandbuf->ma->strand_sta, obr->strandbuf->ma->strand_end);
-				else
-					obr->strandbuf->maxwidth= 0.0f;
-				
-				width= obr->strandbuf->maxwidth;
-				sbound= obr->strandbuf->bound;
-				for (b=0; b<obr->strandbuf->totbound; b++, sbound++) {
-					
-					INIT_MINMAX(smin, smax);
+	copy_v3_v3(obr->boundbox[0], min);
+	copy_v3_v3(obr->boundbox[1], max);
 
-					for (a=sbound->start; a<sbound->end; a++) {
-						strand= RE_findOrAddStrand(obr, a);
-						strand_minmax(strand, smin, smax, width);
-					}
+	return smoothresh;
+}
 
-					copy_v3_v3(sbound->boundbox[0], smin);
-					copy_v3_v3(sbound->boundbox[1], smax);
+typedef struct FinalizeObjectTask {
+	ObjectRen *obr;
+	int totvert, totvlak;	/* before finalizing, autosmooth and quad splitting add to these */
+	float smoothresh;
+} FinalizeObjectTask;
 
-					minmax_v3v3_v3(min, max, smin);
-					minmax_v3v3_v3(min, max, smax);
-				}
-			}
+static void finalize_render_object_task(TaskPool *pool, void *taskdata, int UNUSED(threadid))
+{
+	Render *re= (Render *)BLI_task_pool_userdata(pool);
+	FinalizeObjectTask *task= (FinalizeObjectTask *)taskdata;
+	ObjectRen *obr= task->obr;
+
+	if (re->test_break(re->tbh))
+		return;
+
+	if (obr->finalize & R_FINALIZE_AUTOSMOOTH)
+		autosmooth(re, obr, obr->autosmooth_mat, obr->autosmooth_angle);
+
+	if (obr->finalize & R_FINALIZE_NORMALS)
+		calc_vertexnormals(re, obr, (obr->finalize & R_FINALIZE_TANGENT) != 0, (obr->finalize & R_FINALIZE_NMAP_TANGENT) != 0);
+
+	if (obr->finalize & R_FINALIZE_OBJECT)
+		task->smoothresh= finalize_render_object(re, obr);
+}
 
-			copy_v3_v3(obr->boundbox[0], min);
-			copy_v3_v3(obr->boundbox[1], max);
+/* conversion from blender data is done one object at a time, the remaining
+ * per object work (autosmooth, normals and tangents, quad splitting, bounds)
+ * is done for all converted objects here using multiple threads */
+static void finalize_render_objects(Render *re)
+{
+	TaskPool *task_pool;
+	FinalizeObjectTask *tasks;
+	ObjectRen *obr;
+	int a, tottask= 0;
+
+	for (obr=re->objecttable.first; obr; obr=obr->next)
+		if (obr->finalize)
+			tottask++;
+	
+	if (tottask == 0)
+		return;
+
+	tasks= MEM_callocN(sizeof(FinalizeObjectTask)*tottask, "FinalizeObjectTask");
+
+	task_pool= BLI_task_pool_create(render_task_scheduler_get(re), re);
+
+	for (obr=re->objecttable.first, a=0; obr; obr=obr->next) {
+		if (obr->finalize) {
+			FinalizeObjectTask *task= &tasks[a++];
+
+			task->obr= obr;
+			task->totvert= obr->totvert;
+			task->totvlak= obr->totvlak;
+
+			/* start with big objects, so threads don't wait for one at the end */
+			BLI_task_pool_push(task_pool, finalize_render_object_task, task, false,
+			                   (obr->totvlak > 10000)? TASK_PRIORITY_HIGH: TASK_PRIORITY_LOW);
 		}
 	}
+
+	BLI_task_pool_work_and_wait(task_pool);
+
+	BLI_task_pool_free(task_pool);
+
+	/* in object order, like conversion did before */
+	for (a=0; a<tottask; a++) {
+		obr= tasks[a].obr;
+
+		if (obr->finalize & R_FINALIZE_OBJECT)
+			obr->ob->smoothresh= tasks[a].smoothresh;
+
+		re->totvert += obr->totvert - tasks[a].totvert;
+		re->totvlak += obr->totvlak - tasks[a].totvlak;
+
+		obr->finalize= 0;
+	}
+
+	MEM_freeN(tasks);
 }
 
 /* ------------------------------------------------------------------------- */
@@ -4684,6 +4772,78 @@ static ObjectRen *find_dupligroup_dupli(Render *re, Object *ob, int psysindex)
 	return NULL;
 }
 
+/* objects that use the same mesh without modifying it can share one ObjectRen,
+ * so that e.g. linked duplicates only get an instance with their own transform */
+static int render_object_data_shareable(Render *re, Object *ob)
+{
+	Material *ma;
+	Tex *tex;
+	int a;
+
+	if (re->flag & R_BAKING)
+		return 0;
+	if (ob->type != OB_MESH || ob->modifiers.first || ob->particlesystem.first)
+		return 0;
+	if (ob->transflag & (OB_DUPLI | OB_RENDER_DUPLI))
+		return 0;
+	if (ob->parent && ob->partype == PARSKEL)
+		return 0;
+
+	/* shape keys can be pinned or weighted differently per object */
+	if (((Mesh *)ob->data)->key)
+		return 0;
+
+	/* environment maps hide the faces of their own object */
+	for (tex = re->main->tex.first; tex; tex = tex->id.next) {
+		if (tex->type == TEX_ENVMAP && tex->env && tex->env->object == ob)
+			return 0;
+	}
+
+	/* displacement textures may use global or object coordinates */
+	if (test_for_displace(re, ob))
+		return 0;
+
+	/* halos are sorted globally and volumes are not instanced */
+	for (a = 1; a <= ob->totcol; a++) {
+		ma = give_current_material(ob, a);
+		if (ma && ELEM(ma->material_type, MA_TYPE_HALO, MA_TYPE_VOLUME))
+			return 0;
+	}
+
+	return 1;
+}
+
+static ObjectRen *find_shared_data_object(Render *re, Object *ob)
+{
+	ObjectRen *obr;
+	Object *obs;
+	int a;
+
+	if (!re->shared_data_hash)
+		return NULL;
+
+	obr = BLI_ghash_lookup(re->shared_data_hash, ob->data);
+	if (!obr)
+		return NULL;
+
+	/* the converted faces store materials, and the object color and pass
+	 * index are read from the ObjectRen */
+	obs = obr->ob;
+	if (ob->totcol != obs->totcol || ob->index != obs->index || !equals_v4v4(ob->col, obs->col))
+		return NULL;
+	if (is_negative_m4(ob->obmat) != is_negative_m4(obr->obmat))
+		return NULL;
+	/* environment maps hide faces by the layers of the ObjectRen */
+	if (ob->lay != obr->lay)
+		return NULL;
+
+	for (a = 1; a <= ob->totcol; a++)
+		if (give_current_material(ob, a) != give_current_material(obs, a))
+			return NULL;
+
+	return obr;
+}
+
 static void set_dupli_tex_mat(Render *re, ObjectInstanceRen *obi, DupliObject *dob)
 {
 	/* For duplis we need to have a matrix that transform the coordinate back
@@ -4764,7 +4924,18 @@ static void init_render_object_data(Render *re, ObjectRen *obr, int timeoffset)
 			init_render_mball(re, obr);
 	}
 
-	finalize_render_object(re, obr, timeoffset);
+	if (obr->totvert || obr->totvlak || obr->tothalo || obr->totstrand) {
+		/* the exception below is because displace code now is in init_render_mesh call, 
+		 * I will look at means to have autosmooth enabled for all object types
+		 * and have it as general postprocess, like displace */
+		if (ob->type!=OB_MESH && test_for_displace(re, ob))
+			do_displacement(re, obr, NULL, NULL);
+
+		if (!timeoffset) {
+			ob->smoothresh= 0.0;
+			obr->finalize |= R_FINALIZE_OBJECT;
+		}
+	}
 
 	re->totvert += obr->totvert;
 	re->totvlak += obr->totvlak;
@@ -4796,6 +4967,20 @@ static void add_render_object(Render *re, Object *ob, Object *par, DupliObject *
 			allow_render= 0;
 	}
 
+	/* objects using the same mesh only get an instance of the first one */
+	if (allow_render && !dob && render_object_data_shareable(re, ob)) {
+		obr= find_shared_data_object(re, ob);
+
+		if (obr) {
+			float mat[4][4];
+
+			mul_m4_m4m4(mat, re->viewmat, ob->obmat);
+			obi= RE_addRenderInstance(re, NULL, ob, par, index, 0, mat, ob->lay);
+			assign_dupligroup_dupli(re, obi, obr, NULL);
+			return;
+		}
+	}
+
 	/* one render object for the data itself */
 	if (allow_render) {
 		obr= RE_addRenderObject(re, ob, par, index, 0, ob->lay);
@@ -4803,6 +4988,15 @@ static void add_render_object(Render *re, Object *ob, Object *par, DupliObject *
 			obr->flag |= R_INSTANCEABLE;
 			copy_m4_m4(obr->obmat, ob->obmat);
 		}
+		else if (!dob && render_object_data_shareable(re, ob)) {
+			obr->flag |= R_INSTANCEABLE;
+			copy_m4_m4(obr->obmat, ob->obmat);
+
+			if (!re->shared_data_hash)
+				re->shared_data_hash = BLI_ghash_ptr_new("shared_data_hash gh");
+			if (!BLI_ghash_haskey(re->shared_data_hash, ob->data))
+				BLI_ghash_insert(re->shared_data_hash, ob->data, obr);
+		}
 		init_render_object_data(re, obr, timeoffset);
 
 		/* only add instance for objects that have not been used for dupli */
@@ -5267,6 +5461,14 @@ static void database_init_objects(Render *re, unsigned int renderlay, int nolamp
 	for (group= re->main->group.first; group; group=group->id.next)
 		add_group_render_dupli_obs(re, group, nolamps, onlyselected, actob, timeoffset, 0);
 
+	if (re->shared_data_hash) {
+		BLI_ghash_free(re->shared_data_hash, NULL, NULL);
+		re->shared_data_hash = NULL;
+	}
+
+	if (!re->test_break(re->tbh))
+		finalize_render_objects(re);
+
 	if (!re->test_break(re->tbh))
 		RE_makeRenderInstances(re);
 }
@@ -130,6 +130,16 @@ typedef struct OcclusionThread {
 	int thread;
 } OcclusionThread;
 
+typedef struct OcclusionFaceThread {
+	Render *re;
+	OcclusionTree *tree;
+	float *occ;
+	float (*rad)[3];
+	float (*sum)[3];
+	int begin, end;
+	int thread;
+} OcclusionFaceThread;
+
 typedef struct OcclusionBuildThread {
 	OcclusionTree *tree;
 	int begin, end, depth;
@@ -207,28 +217,75 @@ static void occ_shade(ShadeSample *ssamp, ObjectInstanceRen *obi, VlakRen *vlr,
 	copy_v3_v3(rad, shr->combined);
 }
 
-static void occ_build_shade(Render *re, OcclusionTree *tree)
+/* run func over the faces of the tree, split in ranges over the render threads */
+static void occ_face_threads(Render *re, OcclusionTree *tree, void *(*func)(void *),
+                             float *occ, float (*rad)[3], float (*sum)[3])
 {
-	ShadeSample ssamp;
+	OcclusionFaceThread othreads[BLENDER_MAX_THREADS];
+	ListBase threads;
+	int a, totface, totthread;
+
+	totthread = (tree->totface > 10000) ? re->r.threads : 1;
+	totface = tree->totface / totthread;
+
+	for (a = 0; a < totthread; a++) {
+		othreads[a].re = re;
+		othreads[a].tree = tree;
+		othreads[a].occ = occ;
+		othreads[a].rad = rad;
+		othreads[a].sum = sum;
+		othreads[a].thread = a;
+		othreads[a].begin = a * totface;
+		othreads[a].end = (a == totthread - 1) ? tree->totface : (a + 1) * totface;
+	}
+
+	if (totthread == 1) {
+		func(&othreads[0]);
+	}
+	else {
+		BLI_init_threads(&threads, func, totthread);
+
+		for (a = 0; a < totthread; a++)
+			BLI_insert_thread(&threads, &othreads[a]);
+
+		BLI_end_threads(&threads);
+	}
+}
+
+static void *exec_occ_build_shade(void *data)
+{
+	OcclusionFaceThread *othread = (OcclusionFaceThread *)data;
+	OcclusionTree *tree = othread->tree;
+	ShadeSample *ssamp;
 	ObjectInstanceRen *obi;
 	VlakRen *vlr;
 	int a;
 
-	R = *re;
-
 	/* setup shade sample with correct passes */
-	memset(&ssamp, 0, sizeof(ShadeSample));
-	ssamp.shi[0].lay = re->lay;
-	ssamp.shi[0].passflag = SCE_PASS_DIFFUSE | SCE_PASS_RGBA;
-	ssamp.shi[0].combinedflag = ~(SCE_PASS_SPEC);
-	ssamp.tot = 1;
+	ssamp = MEM_callocN(sizeof(ShadeSample), "OcclusionShadeSample");
+	ssamp->shi[0].lay = othread->re->lay;
+	ssamp->shi[0].passflag = SCE_PASS_DIFFUSE | SCE_PASS_RGBA;
+	ssamp->shi[0].combinedflag = ~(SCE_PASS_SPEC);
+	ssamp->shi[0].thread = othread->thread;
+	ssamp->tot = 1;
 
-	for (a = 0; a < tree->totface; a++) {
+	for (a = othread->begin; a < othread->end; a++) {
 		obi = &R.objectinstance[tree->face[a].obi];
 		vlr = RE_findOrAddVlak(obi->obr, tree->face[a].facenr);
 
-		occ_shade(&ssamp, obi, vlr, tree->rad[a]);
+		occ_shade(ssamp, obi, vlr, tree->rad[a]);
 	}
+
+	MEM_freeN(ssamp);
+
+	return NULL;
+}
+
+static void occ_build_shade(Render *re, OcclusionTree *tree)
+{
+	R = *re;
+
+	occ_face_threads(re, tree, exec_occ_build_shade, NULL, NULL, NULL);
 }
 
 /* ------------------------- Spherical Harmonics --------------------------- */
@@ -920,28 +977,40 @@ static void occ_lookup(OcclusionTree *tree, int thread, OccFace *exclude,
 	if (bentn) normalize_v3(bentn);
 }
 
+static void *exec_occ_compute_bounce(void *data)
+{
+	OcclusionFaceThread *othread = (OcclusionFaceThread *)data;
+	OcclusionTree *tree = othread->tree;
+	float (*rad)[3] = othread->rad, (*sum)[3] = othread->sum, co[3], n[3], occ;
+	int i;
+
+	for (i = othread->begin; i < othread->end; i++) {
+		occ_face(&tree->face[i], co, n, NULL);
+		madd_v3_v3fl(co, n, 1e-8f);
+
+		occ_lookup(tree, othread->thread, &tree->face[i], co, n, &occ, rad[i], NULL);
+		rad[i][0] = MAX2(rad[i][0], 0.0f);
+		rad[i][1] = MAX2(rad[i][1], 0.0f);
+		rad[i][2] = MAX2(rad[i][2], 0.0f);
+		add_v3_v3(sum[i], rad[i]);
+
+		if (othread->re->test_break(othread->re->tbh))
+			break;
+	}
+
+	return NULL;
+}
+
 static void occ_compute_bounces(Render *re, OcclusionTree *tree, int totbounce)
 {
-	float (*rad)[3], (*sum)[3], (*tmp)[3], co[3], n[3], occ;
-	int bounce, i;
+	float (*rad)[3], (*sum)[3], (*tmp)[3];
+	int bounce;
 
 	rad = MEM_callocN(sizeof(float) * 3 * tree->totface, "OcclusionBounceRad");
 	sum = MEM_dupallocN(tree->rad);
 
 	for (bounce = 1; bounce < totbounce; bounce++) {
-		for (i = 0; i < tree->totface; i++) {
-			occ_face(&tree->face[i], co, n, NULL);
-			madd_v3_v3fl(co, n, 1e-8f);
-
-			occ_lookup(tree, 0, &tree->face[i], co, n, &occ, rad[i], NULL);
-			rad[i][0] = MAX2(rad[i][0], 0.0f);
-			rad[i][1] = MAX2(rad[i][1], 0.0f);
-			rad[i][2] = MAX2(rad[i][2], 0.0f);
-			add_v3_v3(sum[i], rad[i]);
-
-			if (re->test_break(re->tbh))
-				break;
-		}
+		occ_face_threads(re, tree, exec_occ_compute_bounce, NULL, rad, sum);
 
 		if (re->test_break(re->tbh))
 			break;
@@ -961,23 +1030,35 @@ static void occ_compute_bounces(Render *re, OcclusionTree *tree, int totbounce)
 		occ_sum_occlusion(tree, tree->root);
 }
 
+static void *exec_occ_compute_pass(void *data)
+{
+	OcclusionFaceThread *othread = (OcclusionFaceThread *)data;
+	OcclusionTree *tree = othread->tree;
+	float *occ = othread->occ, co[3], n[3];
+	int i;
+
+	for (i = othread->begin; i < othread->end; i++) {
+		occ_face(&tree->face[i], co, n, NULL);
+		negate_v3(n);
+		madd_v3_v3fl(co, n, 1e-8f);
+
+		occ_lookup(tree, othread->thread, &tree->face[i], co, n, &occ[i], NULL, NULL);
+		if (othread->re->test_break(othread->re->tbh))
+			break;
+	}
+
+	return NULL;
+}
+
 static void occ_compute_passes(Render *re, OcclusionTree *tree, int totpass)
 {
-	float *occ, co[3], n[3];
+	float *occ;
 	int pass, i;
 	
 	occ = MEM_callocN(sizeof(float) * tree->totface, "OcclusionPassOcc");
 
 	for (pass = 0; pass < totpass; pass++) {
-		for (i = 0; i < tree->totface; i++) {
-			occ_face(&tree->face[i], co, n, NULL);
-			negate_v3(n);
-			madd_v3_v3fl(co, n, 1e-8f);
-
-			occ_lookup(tree, 0, &tree->face[i], co, n, &occ[i], NULL, NULL);
-			if (re->test_break(re->tbh))
-				break;
-		}
+		occ_face_threads(re, tree, exec_occ_compute_pass, occ, NULL, NULL);
 
 		if (re->test_break(re->tbh))
 			break;
@@ -51,6 +51,7 @@
 #include "BLI_string.h"
 #include "BLI_path_util.h"
 #include "BLI_fileops.h"
+#include "BLI_task.h"
 #include "BLI_threads.h"
 #include "BLI_rand.h"
 #include "BLI_callbacks.h"
@@ -418,6 +419,9 @@ void RE_FreeRender(Render *re)
 	
 	render_result_free(re->result);
 	render_result_free(re->pushedresult);
+
+	if (re->task_scheduler)
+		BLI_task_scheduler_free(re->task_scheduler);
 	
 	BLI_remlink(&RenderGlobal.renderlist, re);
 	MEM_freeN(re);
@@ -2850,6 +2854,26 @@ void RE_init_threadcount(Render *re)
 	re->r.threads = BKE_render_num_threads(&re->r);
 }
 
+/* task scheduler for threaded work during rendering, the global one unless
+ * the number of render threads differs from it */
+TaskScheduler *render_task_scheduler_get(Render *re)
+{
+	TaskScheduler *scheduler = BLI_task_scheduler_get();
+
+	if (re->r.threads == BLI_task_scheduler_num_threads(scheduler))
+		return scheduler;
+
+	if (re->task_scheduler && BLI_task_scheduler_num_threads(re->task_scheduler) != re->r.threads) {
+		BLI_task_scheduler_free(re->task_scheduler);
+		re->task_scheduler = NULL;
+	}
+
+	if (re->task_scheduler == NULL)
+		re->task_scheduler = BLI_task_scheduler_create(re->r.threads);
+
+	return re->task_scheduler;
+}
+
 /* loads in image into a result, size must match
  * x/y offsets are only used on a partial copy when dimensions don't match */
 void RE_layer_load_from_file(RenderLayer *layer, ReportList *reports, const char *filename, int x, int y)
@@ -42,9 +42,11 @@
 
 #include "BLI_blenlib.h"
 #include "BLI_cpu.h"
+#include "BLI_ghash.h"
 #include "BLI_jitter.h"
 #include "BLI_math.h"
 #include "BLI_rand.h"
+#include "BLI_task.h"
 #include "BLI_utildefines.h"
 
 #include "BLF_translation.h"
@@ -93,6 +95,7 @@ static void RE_rayobject_config_control(RayObject *r, Render *re)
 		r = RE_rayobject_align(r);
 		r->control.data = re;
 		r->control.test_break = test_break;
+		r->control.task_scheduler = render_task_scheduler_get(re);
 	}
 }
 
@@ -309,6 +312,49 @@ static int has_special_rayobject(Render *re, ObjectInstanceRen *obi)
 	}
 	return 0;
 }
+static void makeraytree_object_task(TaskPool *pool, void *taskdata, int UNUSED(threadid))
+{
+	Render *re = (Render *)BLI_task_pool_userdata(pool);
+	ObjectInstanceRen *obi = (ObjectInstanceRen *)taskdata;
+
+	if (test_break(re))
+		return;
+
+	makeraytree_object(re, obi);
+}
+
+/* build the trees of objects that get their own raytree in parallel,
+ * instances sharing the same ObjectRen only build it once */
+static void makeraytree_objects(Render *re)
+{
+	TaskPool *task_pool;
+	GHash *obr_hash;
+	ObjectInstanceRen *obi;
+
+	obr_hash = BLI_ghash_ptr_new("makeraytree_objects gh");
+	task_pool = BLI_task_pool_create(render_task_scheduler_get(re), re);
+
+	for (obi = re->instancetable.first; obi; obi = obi->next) {
+		ObjectRen *obr = obi->obr;
+
+		if (obr->raytree || BLI_ghash_haskey(obr_hash, obr))
+			continue;
+
+		if (is_raytraceable(re, obi) && has_special_rayobject(re, obi)) {
+			BLI_ghash_insert(obr_hash, obr, obr);
+
+			/* start with big objects, so threads don't wait for one at the end */
+			BLI_task_pool_push(task_pool, makeraytree_object_task, obi, false,
+			                   (obr->totvlak > 10000) ? TASK_PRIORITY_HIGH : TASK_PRIORITY_LOW);
+		}
+	}
+
+	BLI_task_pool_work_and_wait(task_pool);
+	BLI_task_pool_free(task_pool);
+
+	BLI_ghash_free(obr_hash, NULL, NULL);
+}
+
 /*
  * create a single raytrace structure with all faces
  */
@@ -343,6 +389,9 @@ static void makeraytree_single(Render *re)
 		return;
 	}
 	
+	if (special)
+		makeraytree_objects(re);
+
 	//Create raytree
 	raytree = re->raytree = rayobject_create( re, re->r.raytrace_structure, faces+special );
 
@@ -35,6 +35,8 @@
 
 #include "MEM_guardedalloc.h"
 
+#include "DNA_node_types.h"
+
 #include "BLI_utildefines.h"
 #include "BLI_fileops.h"
 #include "BLI_listbase.h"
@@ -46,6 +48,7 @@
 #include "BKE_image.h"
 #include "BKE_global.h"
 #include "BKE_main.h"
+#include "BKE_node.h"
 #include "BKE_report.h"
 #include "BKE_freestyle.h"
 
@@ -439,16 +442,68 @@ static void render_layer_add_pass(RenderResult *rr, RenderLayer *rl, int channel
 	}
 }
 
-/* called by main render as well for parts */
-/* will read info from Render *re to define layers */
-/* called in threads */
-/* re->winx,winy is coordinate space of entire image, partrct the part within */
-RenderResult *render_result_new(Render *re, rcti *partrct, int crop, int savebuffers, const char *layername)
+/* pass for each render layers node output, in RRES_OUT order */
+static const int rlayers_out_passflag[] = {
+	SCE_PASS_COMBINED, SCE_PASS_COMBINED, SCE_PASS_Z, SCE_PASS_NORMAL, SCE_PASS_UV,
+	SCE_PASS_VECTOR, SCE_PASS_RGBA, SCE_PASS_DIFFUSE, SCE_PASS_SPEC, SCE_PASS_SHADOW,
+	SCE_PASS_AO, SCE_PASS_REFLECT, SCE_PASS_REFRACT, SCE_PASS_INDIRECT, SCE_PASS_INDEXOB,
+	SCE_PASS_INDEXMA, SCE_PASS_MIST, SCE_PASS_EMIT, SCE_PASS_ENVIRONMENT,
+	SCE_PASS_DIFFUSE_DIRECT, SCE_PASS_DIFFUSE_INDIRECT, SCE_PASS_DIFFUSE_COLOR,
+	SCE_PASS_GLOSSY_DIRECT, SCE_PASS_GLOSSY_INDIRECT, SCE_PASS_GLOSSY_COLOR,
+	SCE_PASS_TRANSM_DIRECT, SCE_PASS_TRANSM_INDIRECT, SCE_PASS_TRANSM_COLOR,
+	SCE_PASS_SUBSURFACE_DIRECT, SCE_PASS_SUBSURFACE_INDIRECT, SCE_PASS_SUBSURFACE_COLOR
+};
+
+/* passes of render layer nr that are used after reading back the temp files.
+ * in background renders only the output image and the compositor look at
+ * them, so passes that are not linked in any render layers node stay on disk
+ * instead of being loaded for the full frame */
+static int render_result_used_passflag(Render *re, SceneRenderLayer *srl, int nr)
+{
+	Scene *sce;
+	bNode *node;
+	bNodeSocket *sock;
+	int passflag, a;
+
+	if (!G.background || re->main == NULL || re->scene == NULL)
+		return srl->passflag;
+
+	/* multilayer output writes every pass */
+	if (re->r.im_format.imtype == R_IMF_IMTYPE_MULTILAYER)
+		return srl->passflag;
+
+	passflag = SCE_PASS_COMBINED;
+	if (re->r.im_format.flag & R_IMF_FLAG_ZBUF)
+		passflag |= SCE_PASS_Z;
+
+	/* render layers nodes of any scene may composite this layer */
+	for (sce = re->main->scene.first; sce; sce = sce->id.next) {
+		if (!sce->use_nodes || sce->nodetree == NULL)
+			continue;
+
+		for (node = sce->nodetree->nodes.first; node; node = node->next) {
+			if (node->type != CMP_NODE_R_LAYERS || node->id != &re->scene->id || node->custom1 != nr)
+				continue;
+
+			for (sock = node->outputs.first, a = 0; sock; sock = sock->next, a++) {
+				if (a >= (int)(sizeof(rlayers_out_passflag) / sizeof(int)))
+					break;
+				if (sock->flag & SOCK_IN_USE)
+					passflag |= rlayers_out_passflag[a];
+			}
+		}
+	}
+
+	return srl->passflag & passflag;
+}
+
+static RenderResult *render_result_new_ex(Render *re, rcti *partrct, int crop, int savebuffers, const char *layername,
+                                          int used_passes)
 {
 	RenderResult *rr;
 	RenderLayer *rl;
 	SceneRenderLayer *srl;
-	int rectx, recty, nr;
+	int rectx, recty, nr, passflag;
 	
 	rectx = BLI_rcti_size_x(partrct);
 	recty = BLI_rcti_size_y(partrct);
@@ -485,6 +540,8 @@ RenderResult *render_result_new(Render *re, rcti *partrct, int crop, int savebuf
 		if (srl->layflag & SCE_LAY_DISABLE)
 			continue;
 		
+		passflag = (used_passes) ? render_result_used_passflag(re, srl, nr) : srl->passflag;
+
 		rl = MEM_callocN(sizeof(RenderLayer), "new render layer");
 		BLI_addtail(&rr->layers, rl);
 		
@@ -493,7 +550,7 @@ RenderResult *render_result_new(Render *re, rcti *partrct, int crop, int savebuf
 		rl->lay_zmask = srl->lay_zmask;
 		rl->lay_exclude = srl->lay_exclude;
 		rl->layflag = srl->layflag;
-		rl->passflag = srl->passflag; /* for debugging: srl->passflag | SCE_PASS_RAYHITS; */
+		rl->passflag = passflag; /* for debugging: passflag | SCE_PASS_RAYHITS; */
 		rl->pass_xor = srl->pass_xor;
 		rl->light_override = srl->light_override;
 		rl->mat_override = srl->mat_override;
@@ -511,65 +568,65 @@ RenderResult *render_result_new(Render *re, rcti *partrct, int crop, int savebuf
 		else
 			rl->rectf = MEM_mapallocN(rectx * recty * sizeof(float) * 4, "Combined rgba");
 		
-		if (srl->passflag  & SCE_PASS_Z)
+		if (passflag  & SCE_PASS_Z)
 			render_layer_add_pass(rr, rl, 1, SCE_PASS_Z);
-		if (srl->passflag  & SCE_PASS_VECTOR)
+		if (passflag  & SCE_PASS_VECTOR)
 			render_layer_add_pass(rr, rl, 4, SCE_PASS_VECTOR);
-		if (srl->passflag  & SCE_PASS_NORMAL)
+		if (passflag  & SCE_PASS_NORMAL)
 			render_layer_add_pass(rr, rl, 3, SCE_PASS_NORMAL);
-		if (srl->passflag  & SCE_PASS_UV) 
+		if (passflag  & SCE_PASS_UV) 
 			render_layer_add_pass(rr, rl, 3, SCE_PASS_UV);
-		if (srl->passflag  & SCE_PASS_RGBA)
+		if (passflag  & SCE_PASS_RGBA)
 			render_layer_add_pass(rr, rl, 4, SCE_PASS_RGBA);
-		if (srl->passflag  & SCE_PASS_EMIT)
+		if (passflag  & SCE_PASS_EMIT)
 			render_layer_add_pass(rr, rl, 3, SCE_PASS_EMIT);
-		if (srl->passflag  & SCE_PASS_DIFFUSE)
+		if (passflag  & SCE_PASS_DIFFUSE)
 			render_layer_add_pass(rr, rl, 3, SCE_PASS_DIFFUSE);
-		if (srl->passflag  & SCE_PASS_SPEC)
+		if (passflag  & SCE_PASS_SPEC)
 			render_layer_add_pass(rr, rl, 3, SCE_PASS_SPEC);
-		if (srl->passflag  & SCE_PASS_AO)
+		if (passflag  & SCE_PASS_AO)
 			render_layer_add_pass(rr, rl, 3, SCE_PASS_AO);
-		if (srl->passflag  & SCE_PASS_ENVIRONMENT)
+		if (passflag  & SCE_PASS_ENVIRONMENT)
 			render_layer_add_pass(rr, rl, 3, SCE_PASS_ENVIRONMENT);
-		if (srl->passflag  & SCE_PASS_INDIRECT)
+		if (passflag  & SCE_PASS_INDIRECT)
 			render_layer_add_pass(rr, rl, 3, SCE_PASS_INDIRECT);
-		if (srl->passflag  & SCE_PASS_SHADOW)
+		if (passflag  & SCE_PASS_SHADOW)
 			render_layer_add_pass(rr, rl, 3, SCE_PASS_SHADOW);
-		if (srl->passflag  & SCE_PASS_REFLECT)
+		if (passflag  & SCE_PASS_REFLECT)
 			render_layer_add_pass(rr, rl, 3, SCE_PASS_REFLECT);
-		if (srl->passflag  & SCE_PASS_REFRACT)
+		if (passflag  & SCE_PASS_REFRACT)
 			render_layer_add_pass(rr, rl, 3, SCE_PASS_REFRACT);
-		if (srl->passflag  & SCE_PASS_INDEXOB)
+		if (passflag  & SCE_PASS_INDEXOB)
 			render_layer_add_pass(rr, rl, 1, SCE_PASS_INDEXOB);
-		if (srl->passflag  & SCE_PASS_INDEXMA)
+		if (passflag  & SCE_PASS_INDEXMA)
 			render_layer_add_pass(rr, rl, 1, SCE_PASS_INDEXMA);
-		if (srl->passflag  & SCE_PASS_MIST)
+		if (passflag  & SCE_PASS_MIST)
 			render_layer_add_pass(rr, rl, 1, SCE_PASS_MIST);
 		if (rl->passflag & SCE_PASS_RAYHITS)
 			render_layer_add_pass(rr, rl, 4, SCE_PASS_RAYHITS);
-		if (srl->passflag  & SCE_PASS_DIFFUSE_DIRECT)
+		if (passflag  & SCE_PASS_DIFFUSE_DIRECT)
 			render_layer_add_pass(rr, rl, 3, SCE_PASS_DIFFUSE_DIRECT);
-		if (srl->passflag  & SCE_PASS_DIFFUSE_INDIRECT)
+		if (passflag  & SCE_PASS_DIFFUSE_INDIRECT)
 			render_layer_add_pass(rr, rl, 3, SCE_PASS_DIFFUSE_INDIRECT);
-		if (srl->passflag  & SCE_PASS_DIFFUSE_COLOR)
+		if (passflag  & SCE_PASS_DIFFUSE_COLOR)
 			render_layer_add_pass(rr, rl, 3, SCE_PASS_DIFFUSE_COLOR);
-		if (srl->passflag  & SCE_PASS_GLOSSY_DIRECT)
+		if (passflag  & SCE_PASS_GLOSSY_DIRECT)
 			render_layer_add_pass(rr, rl, 3, SCE_PASS_GLOSSY_DIRECT);
-		if (srl->passflag  & SCE_PASS_GLOSSY_INDIRECT)
+		if (passflag  & SCE_PASS_GLOSSY_INDIRECT)
 			render_layer_add_pass(rr, rl, 3, SCE_PASS_GLOSSY_INDIRECT);
-		if (srl->passflag  & SCE_PASS_GLOSSY_COLOR)
+		if (passflag  & SCE_PASS_GLOSSY_COLOR)
 			render_layer_add_pass(rr, rl, 3, SCE_PASS_GLOSSY_COLOR);
-		if (srl->passflag  & SCE_PASS_TRANSM_DIRECT)
+		if (passflag  & SCE_PASS_TRANSM_DIRECT)
 			render_layer_add_pass(rr, rl, 3, SCE_PASS_TRANSM_DIRECT);
-		if (srl->passflag  & SCE_PASS_TRANSM_INDIRECT)
+		if (passflag  & SCE_PASS_TRANSM_INDIRECT)
 			render_layer_add_pass(rr, rl, 3, SCE_PASS_TRANSM_INDIRECT);
-		if (srl->passflag  & SCE_PASS_TRANSM_COLOR)
+		if (passflag  & SCE_PASS_TRANSM_COLOR)
 			render_layer_add_pass(rr, rl, 3, SCE_PASS_TRANSM_COLOR);
-		if (srl->passflag  & SCE_PASS_SUBSURFACE_DIRECT)
+		if (passflag  & SCE_PASS_SUBSURFACE_DIRECT)
 			render_layer_add_pass(rr, rl, 3, SCE_PASS_SUBSURFACE_DIRECT);
-		if (srl->passflag  & SCE_PASS_SUBSURFACE_INDIRECT)
+		if (passflag  & SCE_PASS_SUBSURFACE_INDIRECT)
 			render_layer_add_pass(rr, rl, 3, SCE_PASS_SUBSURFACE_INDIRECT);
-		if (srl->passflag  & SCE_PASS_SUBSURFACE_COLOR)
+		if (passflag  & SCE_PASS_SUBSURFACE_COLOR)
 			render_layer_add_pass(rr, rl, 3, SCE_PASS_SUBSURFACE_COLOR);
 	}
 	/* sss, previewrender and envmap don't do layers, so we make a default one */
@@ -609,6 +666,15 @@ RenderResult *render_result_new(Render *re, rcti *partrct, int crop, int savebuf
 	return rr;
 }
 
+/* called by main render as well for parts */
+/* will read info from Render *re to define layers */
+/* called in threads */
+/* re->winx,winy is coordinate space of entire image, partrct the part within */
+RenderResult *render_result_new(Render *re, rcti *partrct, int crop, int savebuffers, const char *layername)
+{
+	return render_result_new_ex(re, partrct, crop, savebuffers, layername, FALSE);
+}
+
 /* allocate osa new results for samples */
 RenderResult *render_result_new_full_sample(Render *re, ListBase *lb, rcti *partrct, int crop, int savebuffers)
 {
@@ -1028,33 +1094,9 @@ void render_result_exr_file_path(Scene *scene, const char *layname, int sample,
 	BLI_make_file_string("/", filepath, BLI_temporary_dir(), name);
 }
 
-/* only for temp buffer files, makes exact copy of render result */
-int render_result_exr_file_read(Render *re, int sample)
-{
-	RenderLayer *rl;
-	char str[FILE_MAX];
-	int success = TRUE;
-
-	RE_FreeRenderResult(re->result);
-	re->result = render_result_new(re, &re->disprect, 0, RR_USE_MEM, RR_ALL_LAYERS);
-
-	for (rl = re->result->layers.first; rl; rl = rl->next) {
-
-		render_result_exr_file_path(re->scene, rl->name, sample, str);
-		printf("read exr tmp file: %s\n", str);
-
-		if (!render_result_exr_file_read_path(re->result, rl, str)) {
-			printf("cannot read: %s\n", str);
-			success = FALSE;
-
-		}
-	}
-
-	return success;
-}
-
-/* called for reading temp files, and for external engines */
-int render_result_exr_file_read_path(RenderResult *rr, RenderLayer *rl_single, const char *filepath)
+/* used_passes: the result may leave out passes stored in the file, see
+ * render_result_used_passflag, don't warn about those channels */
+static int render_result_exr_file_read_path_ex(RenderResult *rr, RenderLayer *rl_single, const char *filepath, int used_passes)
 {
 	RenderLayer *rl;
 	RenderPass *rpass;
@@ -1099,12 +1141,45 @@ int render_result_exr_file_read_path(RenderResult *rr, RenderLayer *rl_single, c
 		}
 	}
 
-	IMB_exr_read_channels(exrhandle);
+	IMB_exr_read_channels_ex(exrhandle, used_passes);
 	IMB_exr_close(exrhandle);
 
 	return 1;
 }
 
+/* called for reading temp files, and for external engines */
+int render_result_exr_file_read_path(RenderResult *rr, RenderLayer *rl_single, const char *filepath)
+{
+	return render_result_exr_file_read_path_ex(rr, rl_single, filepath, FALSE);
+}
+
+/* only for temp buffer files, makes exact copy of render result,
+ * except for passes left out by render_result_used_passflag */
+int render_result_exr_file_read(Render *re, int sample)
+{
+	RenderLayer *rl;
+	char str[FILE_MAX];
+	int success = TRUE;
+
+	RE_FreeRenderResult(re->result);
+	re->result = render_result_new_ex(re, &re->disprect, 0, RR_USE_MEM, RR_ALL_LAYERS, TRUE);
+
+	for (rl = re->result->layers.first; rl; rl = rl->next) {
+
+		render_result_exr_file_path(re->scene, rl->name, sample, str);
+		printf("read exr tmp file: %s\n", str);
+
+		/* passes left out of the result are skipped silently */
+		if (!render_result_exr_file_read_path_ex(re->result, rl, str, TRUE)) {
+			printf("cannot read: %s\n", str);
+			success = FALSE;
+
+		}
+	}
+
+	return success;
+}
+
 /*************************** Combined Pixel Rect *****************************/
 
 ImBuf *render_result_rect_to_ibuf(RenderResult *rr, RenderData *rd)
@@ -1612,18 +1612,18 @@ static void zbufshade_sss_free(RenderPart *pa)
 #endif
 }
 
-void zbufshade_sss_tile(RenderPart *pa)
+/* shade the sss points of one material in the tile, and add them to the
+ * points of that material */
+static void zbufshade_sss_mat(RenderPart *pa, ShadeSample *ssamp, RenderLayer *rl, int lay, int mat_index, int display)
 {
 	Render *re= &R;
-	ShadeSample ssamp;
 	ZBufSSSHandle handle;
 	RenderResult *rr= pa->result;
-	RenderLayer *rl;
 	VlakRen *vlr;
-	Material *mat= re->sss_mat;
+	Material *mat= re->sss_mats[mat_index];
 	float (*co)[3], (*color)[3], *area, *fcol;
-	int x, y, seed, quad, totpoint, display = !(re->r.scemode & (R_BUTS_PREVIEW|R_VIEWPORT_PREVIEW));
-	int *ro, *rz, *rp, *rbo, *rbz, *rbp, lay;
+	int x, y, seed, quad, totpoint;
+	int *ro, *rz, *rp, *rbo, *rbz, *rbp;
 #if 0
 	PixStr *ps;
 	intptr_t *rs;
@@ -1634,46 +1634,11 @@ void zbufshade_sss_tile(RenderPart *pa)
 	handle.pa= pa;
 	handle.totps= 0;
 
-#if 0
-	handle.psmlist.first= handle.psmlist.last= NULL;
-	addpsmain(&handle.psmlist);
-
-	pa->rectall= MEM_callocN(sizeof(intptr_t)*pa->rectx*pa->recty+4, "rectall");
-#else
-	pa->recto= MEM_mallocN(sizeof(int)*pa->rectx*pa->recty, "recto");
-	pa->rectp= MEM_mallocN(sizeof(int)*pa->rectx*pa->recty, "rectp");
-	pa->rectz= MEM_mallocN(sizeof(int)*pa->rectx*pa->recty, "rectz");
-	pa->rectbacko= MEM_mallocN(sizeof(int)*pa->rectx*pa->recty, "rectbacko");
-	pa->rectbackp= MEM_mallocN(sizeof(int)*pa->rectx*pa->recty, "rectbackp");
-	pa->rectbackz= MEM_mallocN(sizeof(int)*pa->rectx*pa->recty, "rectbackz");
-#endif
-
-	/* setup shade sample with correct passes */
-	memset(&ssamp, 0, sizeof(ssamp));
-	shade_sample_initialize(&ssamp, pa, rr->layers.first);
-	ssamp.tot= 1;
-	
-	for (rl=rr->layers.first; rl; rl=rl->next) {
-		ssamp.shi[0].lay |= rl->lay;
-		ssamp.shi[0].layflag |= rl->layflag;
-		ssamp.shi[0].passflag |= rl->passflag;
-		ssamp.shi[0].combinedflag |= ~rl->pass_xor;
-	}
-
-	rl= rr->layers.first;
-	ssamp.shi[0].passflag |= SCE_PASS_RGBA|SCE_PASS_COMBINED;
-	ssamp.shi[0].combinedflag &= ~(SCE_PASS_SPEC);
-	ssamp.shi[0].mat_override= NULL;
-	ssamp.shi[0].light_override= NULL;
-	lay= ssamp.shi[0].lay;
-
 	/* create the pixelstrs to be used later */
-	zbuffer_sss(pa, lay, &handle, addps_sss);
+	zbuffer_sss(pa, lay, mat, &handle, addps_sss);
 
-	if (handle.totps==0) {
-		zbufshade_sss_free(pa);
+	if (handle.totps==0)
 		return;
-	}
 	
 	fcol= rl->rectf;
 
@@ -1689,7 +1654,7 @@ void zbufshade_sss_tile(RenderPart *pa)
 
 	if (display) {
 		/* initialize scanline updates for main thread */
-		rr->renrect.ymin = 0;
+		rr->renrect.ymin = rr->renrect.ymax = 0;
 		rr->renlay= rl;
 	}
 	
@@ -1721,7 +1686,7 @@ void zbufshade_sss_tile(RenderPart *pa)
 					quad= (ps->facenr & RE_QUAD_OFFS);
 					z= ps->z;
 
-					shade_sample_sss(&ssamp, mat, obi, vlr, quad, x, y, z,
+					shade_sample_sss(ssamp, mat, obi, vlr, quad, x, y, z,
 						co[totpoint], color[totpoint], &area[totpoint]);
 
 					totpoint++;
@@ -1742,7 +1707,7 @@ void zbufshade_sss_tile(RenderPart *pa)
 					vlr= RE_findOrAddVlak(obr, (*rp-1) & RE_QUAD_MASK);
 					quad= ((*rp) & RE_QUAD_OFFS);
 
-					shade_sample_sss(&ssamp, mat, obi, vlr, quad, x, y, *rz,
+					shade_sample_sss(ssamp, mat, obi, vlr, quad, x, y, *rz,
 						co[totpoint], color[totpoint], &area[totpoint]);
 					
 					add_v3_v3(fcol, color[totpoint]);
@@ -1762,7 +1727,7 @@ void zbufshade_sss_tile(RenderPart *pa)
 					vlr= RE_findOrAddVlak(obr, (*rbp-1) & RE_QUAD_MASK);
 					quad= ((*rbp) & RE_QUAD_OFFS);
 
-					shade_sample_sss(&ssamp, mat, obi, vlr, quad, x, y, *rbz,
+					shade_sample_sss(ssamp, mat, obi, vlr, quad, x, y, *rbz,
 						co[totpoint], color[totpoint], &area[totpoint]);
 					
 					/* to indicate this is a back sample */
@@ -1784,14 +1749,64 @@ void zbufshade_sss_tile(RenderPart *pa)
 
 	/* note: after adding we do not free these arrays, sss keeps them */
 	if (totpoint > 0) {
-		sss_add_points(re, co, color, area, totpoint);
+		sss_add_points(re, mat_index, co, color, area, totpoint);
 	}
 	else {
 		MEM_freeN(co);
 		MEM_freeN(color);
 		MEM_freeN(area);
 	}
+}
+
+void zbufshade_sss_tile(RenderPart *pa)
+{
+	Render *re= &R;
+	ShadeSample ssamp;
+	RenderResult *rr= pa->result;
+	RenderLayer *rl;
+	int a, lay, display = !(re->r.scemode & (R_BUTS_PREVIEW|R_VIEWPORT_PREVIEW));
+
+#if 0
+	handle.psmlist.first= handle.psmlist.last= NULL;
+	addpsmain(&handle.psmlist);
+
+	pa->rectall= MEM_callocN(sizeof(intptr_t)*pa->rectx*pa->recty+4, "rectall");
+#else
+	pa->recto= MEM_mallocN(sizeof(int)*pa->rectx*pa->recty, "recto");
+	pa->rectp= MEM_mallocN(sizeof(int)*pa->rectx*pa->recty, "rectp");
+	pa->rectz= MEM_mallocN(sizeof(int)*pa->rectx*pa->recty, "rectz");
+	pa->rectbacko= MEM_mallocN(sizeof(int)*pa->rectx*pa->recty, "rectbacko");
+	pa->rectbackp= MEM_mallocN(sizeof(int)*pa->rectx*pa->recty, "rectbackp");
+	pa->rectbackz= MEM_mallocN(sizeof(int)*pa->rectx*pa->recty, "rectbackz");
+#endif
+
+	/* setup shade sample with correct passes */
+	memset(&ssamp, 0, sizeof(ssamp));
+	shade_sample_initialize(&ssamp, pa, rr->layers.first);
+	ssamp.tot= 1;
 	
+	for (rl=rr->layers.first; rl; rl=rl->next) {
+		ssamp.shi[0].lay |= rl->lay;
+		ssamp.shi[0].layflag |= rl->layflag;
+		ssamp.shi[0].passflag |= rl->passflag;
+		ssamp.shi[0].combinedflag |= ~rl->pass_xor;
+	}
+
+	rl= rr->layers.first;
+	ssamp.shi[0].passflag |= SCE_PASS_RGBA|SCE_PASS_COMBINED;
+	ssamp.shi[0].combinedflag &= ~(SCE_PASS_SPEC);
+	ssamp.shi[0].mat_override= NULL;
+	ssamp.shi[0].light_override= NULL;
+	lay= ssamp.shi[0].lay;
+
+	/* all sss materials are shaded in a single pass over the tiles */
+	for (a=0; a<re->sss_totmat; a++) {
+		zbufshade_sss_mat(pa, &ssamp, rl, lay, a, display);
+
+		if (re->test_break(re->tbh))
+			break;
+	}
+
 #if 0
 	if (re->r.mode & R_SHADOW)
 		ISB_free(pa);
@@ -43,13 +43,13 @@
 #include "BLI_jitter.h"
 #include "BLI_memarena.h"
 #include "BLI_rand.h"
+#include "BLI_task.h"
+#include "BLI_threads.h"
 #include "BLI_utildefines.h"
 
 #include "BKE_global.h"
 #include "BKE_scene.h"
 
-#include "PIL_time.h"
-
 #include "renderpipeline.h"
 #include "render_types.h"
 #include "renderdatabase.h"
@@ -86,7 +86,8 @@ extern struct Render R;
 
 /* ------------------------------------------------------------------------- */
 
-static void copy_to_ztile(int *rectz, int size, int x1, int y1, int tile, char *r1)
+/* rectz holds the rows of the buffer starting at ymin */
+static void copy_to_ztile(int *rectz, int size, int ymin, int x1, int y1, int tile, char *r1)
 {
 	int len4, *rz;
 	int x2, y2;
@@ -99,7 +100,7 @@ static void copy_to_ztile(int *rectz, int size, int x1, int y1, int tile, char *
 	if (x1>=x2 || y1>=y2) return;
 
 	len4= 4*(x2- x1);
-	rz= rectz + size*y1 + x1;
+	rz= rectz + size*(y1-ymin) + x1;
 	for (; y1<y2; y1++) {
 		memcpy(r1, rz, len4);
 		rz+= size;
@@ -122,7 +123,8 @@ static int sizeoflampbuf(ShadBuf *shb)
 }
 #endif
 
-/* not threadsafe... */
+/* tables are created on first use, call init_jitter_tabs() before
+ * using this from multiple threads */
 static float *give_jitter_tab(int samp)
 {
 	/* these are all possible jitter tables, takes up some
@@ -148,6 +150,14 @@ static float *give_jitter_tab(int samp)
 	
 }
 
+static void init_jitter_tabs(void)
+{
+	int samp;
+
+	for (samp=2; samp<=16; samp++)
+		give_jitter_tab(samp);
+}
+
 static void make_jitter_weight_tab(Render *re, ShadBuf *shb, short filtertype) 
 {
 	float *jit, totw= 0.0f;
@@ -305,9 +315,23 @@ static float deep_alpha(Render *re, int obinr, int facenr, int strand)
 	return ma->shad_alpha;
 }
 
-static void compress_deepshadowbuf(Render *re, ShadBuf *shb, APixstr *apixbuf, APixstrand *apixbufstrand)
+static ShadSampleBuf *deepshadowbuf_sample_new(ShadBuf *shb)
 {
 	ShadSampleBuf *shsample;
+	const int size= shb->size;
+
+	shsample= MEM_callocN(sizeof(ShadSampleBuf), "shad sample buf");
+	BLI_addtail(&shb->buffers, shsample);
+
+	shsample->totbuf = MEM_callocN(sizeof(int) * size * size, "deeptotbuf");
+	shsample->deepbuf = MEM_callocN(sizeof(DeepSample *) * size * size, "deepbuf");
+
+	return shsample;
+}
+
+/* compress rows ymin to ymax, apixbuf and apixbufstrand hold only those rows */
+static void compress_deepshadowbuf(Render *re, ShadBuf *shb, ShadSampleBuf *shsample, APixstr *apixbuf, APixstrand *apixbufstrand, int ymin, int ymax)
+{
 	DeepSample *ds[RE_MAX_OSA], *sampleds[RE_MAX_OSA], *dsb, *newbuf;
 	APixstr *ap, *apn;
 	APixstrand *aps, *apns;
@@ -319,17 +343,11 @@ static void compress_deepshadowbuf(Render *re, ShadBuf *shb, APixstr *apixbuf, A
 	const int size= shb->size;
 
 	int a, b, c, tot, minz, found, prevtot, newtot;
-	int sampletot[RE_MAX_OSA], totsample = 0, totsamplec = 0;
-	
-	shsample= MEM_callocN(sizeof(ShadSampleBuf), "shad sample buf");
-	BLI_addtail(&shb->buffers, shsample);
-
-	shsample->totbuf = MEM_callocN(sizeof(int) * size * size, "deeptotbuf");
-	shsample->deepbuf = MEM_callocN(sizeof(DeepSample *) * size * size, "deepbuf");
+	int sampletot[RE_MAX_OSA];
 
 	ap= apixbuf;
 	aps= apixbufstrand;
-	for (a=0; a<size*size; a++, ap++, aps++) {
+	for (a=ymin*size; a<ymax*size; a++, ap++, aps++) {
 		/* count number of samples */
 		for (c=0; c<totbuf; c++)
 			sampletot[c]= 0;
@@ -484,11 +502,9 @@ static void compress_deepshadowbuf(Render *re, ShadBuf *shb, APixstr *apixbuf, A
 		}
 
 		prevtot= shsample->totbuf[a];
-		totsample += prevtot;
 
 		newtot= compress_deepsamples(shsample->deepbuf[a], prevtot, shb->compressthresh);
 		shsample->totbuf[a]= newtot;
-		totsamplec += newtot;
 
 		if (newtot < prevtot) {
 			newbuf= MEM_mallocN(sizeof(DeepSample)*newtot, "cdeepsample");
@@ -499,33 +515,39 @@ static void compress_deepshadowbuf(Render *re, ShadBuf *shb, APixstr *apixbuf, A
 
 		MEM_freeN(sampleds[0]);
 	}
-
-	//printf("%d -> %d, ratio %f\n", totsample, totsamplec, (float)totsamplec/(float)totsample);
 }
 
-/* create Z tiles (for compression): this system is 24 bits!!! */
-static void compress_shadowbuf(ShadBuf *shb, int *rectz, int square)
+static ShadSampleBuf *shadowbuf_sample_new(ShadBuf *shb)
 {
 	ShadSampleBuf *shsample;
-	float dist;
-	uintptr_t *ztile;
-	int *rz, *rz1, verg, verg1, size= shb->size;
-	int a, x, y, minx, miny, byt1, byt2;
-	char *rc, *rcline, *ctile, *zt;
-	
+	const int size= shb->size;
+
 	shsample= MEM_callocN(sizeof(ShadSampleBuf), "shad sample buf");
 	BLI_addtail(&shb->buffers, shsample);
 	
 	shsample->zbuf= MEM_mallocN(sizeof(uintptr_t)*(size*size)/256, "initshadbuf2");
 	shsample->cbuf= MEM_callocN((size*size)/256, "initshadbuf3");
+
+	return shsample;
+}
+
+/* create Z tiles (for compression): this system is 24 bits!!!
+ * compresses rows ymin to ymax, a multiple of 16, rectz holds only those rows */
+static void compress_shadowbuf(ShadBuf *shb, ShadSampleBuf *shsample, int *rectz, int ymin, int ymax, int square)
+{
+	float dist;
+	uintptr_t *ztile;
+	int *rz, *rz1, verg, verg1, size= shb->size;
+	int a, x, y, minx, miny, byt1, byt2, tilex= (size + 15)/16;
+	char *rc, *rcline, *ctile, *zt;
 	
-	ztile= (uintptr_t *)shsample->zbuf;
-	ctile= shsample->cbuf;
+	ztile= (uintptr_t *)shsample->zbuf + (ymin/16)*tilex;
+	ctile= shsample->cbuf + (ymin/16)*tilex;
 	
 	/* help buffer */
 	rcline= MEM_mallocN(256*4+sizeof(int), "makeshadbuf2");
 	
-	for (y=0; y<size; y+=16) {
+	for (y=ymin; y<ymax; y+=16) {
 		if (y< size/2) miny= y+15-size/2;
 		else miny= y-size/2;
 		
@@ -543,7 +565,7 @@ static void compress_shadowbuf(ShadBuf *shb, int *rectz, int square)
 				rz1= (&verg)+1;
 			}
 			else {
-				copy_to_ztile(rectz, size, x, y, 16, rcline);
+				copy_to_ztile(rectz, size, ymin, x, y, 16, rcline);
 				rz1= (int *)rcline;
 				
 				verg= (*rz1 & 0xFFFFFF00);
@@ -717,43 +739,125 @@ static void shadowbuf_autoclip(Render *re, LampRen *lar)
 	}
 }
 
-static void makeflatshadowbuf(Render *re, LampRen *lar, float *jitbuf)
+/* shadow buffers are built in bands of rows, each zbuffered and compressed by
+ * its own task, so a single big buffer still uses all threads */
+#define SHADBUF_BAND_SIZE 256
+
+typedef struct ShadowBandTask {
+	LampRen *lar;
+	ShadSampleBuf *shsample;
+	float *jit;
+	int ymin, ymax;
+} ShadowBandTask;
+
+static int shadowbuf_totband(ShadBuf *shb)
+{
+	return (shb->size + SHADBUF_BAND_SIZE - 1)/SHADBUF_BAND_SIZE;
+}
+
+/* while the shadow buffers are built, re->test_break is swapped for thread_break.
+ * only the thread that started building calls the original callback, it also
+ * runs tasks while waiting for the pool, other threads read the flag it sets */
+static volatile int g_break= 0;
+static int (*g_test_break)(void *)= NULL;
+static pthread_t g_break_thread;
+
+static int thread_break(void *arg)
+{
+	if (!g_break && pthread_equal(pthread_self(), g_break_thread))
+		g_break= g_test_break(arg);
+
+	return g_break;
+}
+
+static void shadowbuf_push_bands(TaskPool *task_pool, TaskRunFunction run, ShadowBandTask *tasks,
+                                 LampRen *lar, ShadSampleBuf *shsample, float *jit)
+{
+	ShadBuf *shb= lar->shb;
+	int a, totband= shadowbuf_totband(shb);
+
+	for (a=0; a<totband; a++) {
+		ShadowBandTask *task= &tasks[a];
+
+		task->lar= lar;
+		task->shsample= shsample;
+		task->jit= jit;
+		task->ymin= a*SHADBUF_BAND_SIZE;
+		task->ymax= min_ii(task->ymin + SHADBUF_BAND_SIZE, shb->size);
+
+		BLI_task_pool_push(task_pool, run, task, false, TASK_PRIORITY_HIGH);
+	}
+}
+
+static void makeflatshadowbuf_band(TaskPool *pool, void *taskdata, int UNUSED(threadid))
 {
+	Render *re= (Render *)BLI_task_pool_userdata(pool);
+	ShadowBandTask *task= (ShadowBandTask *)taskdata;
+	LampRen *lar= task->lar;
 	ShadBuf *shb= lar->shb;
-	int *rectz, samples;
+	int *rectz;
+
+	if (thread_break(re->tbh))
+		return;
 
 	/* zbuffering */
-	rectz= MEM_mapallocN(sizeof(int)*shb->size*shb->size, "makeshadbuf");
-	
+	rectz= MEM_mapallocN(sizeof(int)*shb->size*(task->ymax - task->ymin), "makeshadbuf");
+
+	zbuffer_shadow(re, shb->persmat, lar, rectz, shb->size, task->ymin, task->ymax, task->jit[0], task->jit[1]);
+	/* create Z tiles (for compression): this system is 24 bits!!! */
+	compress_shadowbuf(shb, task->shsample, rectz, task->ymin, task->ymax, lar->mode & LA_SQUARE);
+
+	MEM_freeN(rectz);
+}
+
+static void makeflatshadowbuf(Render *re, LampRen *lar, float *jitbuf)
+{
+	ShadBuf *shb= lar->shb;
+	TaskPool *task_pool;
+	ShadowBandTask *tasks;
+	int samples, totband= shadowbuf_totband(shb);
+
+	tasks= MEM_callocN(sizeof(ShadowBandTask)*totband*shb->totbuf, "ShadowBandTask");
+	task_pool= BLI_task_pool_create(render_task_scheduler_get(re), re);
+
+	/* all bands of all samples at once, each sample gets its own buffer */
 	for (samples=0; samples<shb->totbuf; samples++) {
-		zbuffer_shadow(re, shb->persmat, lar, rectz, shb->size, jitbuf[2*samples], jitbuf[2*samples+1]);
-		/* create Z tiles (for compression): this system is 24 bits!!! */
-		compress_shadowbuf(shb, rectz, lar->mode & LA_SQUARE);
+		ShadSampleBuf *shsample= shadowbuf_sample_new(shb);
 
-		if (re->test_break(re->tbh))
-			break;
+		shadowbuf_push_bands(task_pool, makeflatshadowbuf_band, tasks + samples*totband,
+		                     lar, shsample, jitbuf + 2*samples);
 	}
-	
-	MEM_freeN(rectz);
+
+	BLI_task_pool_work_and_wait(task_pool);
+	BLI_task_pool_free(task_pool);
+
+	MEM_freeN(tasks);
 }
 
-static void makedeepshadowbuf(Render *re, LampRen *lar, float *jitbuf)
+static void makedeepshadowbuf_band(TaskPool *pool, void *taskdata, int UNUSED(threadid))
 {
+	Render *re= (Render *)BLI_task_pool_userdata(pool);
+	ShadowBandTask *task= (ShadowBandTask *)taskdata;
+	LampRen *lar= task->lar;
 	ShadBuf *shb= lar->shb;
 	APixstr *apixbuf;
 	APixstrand *apixbufstrand= NULL;
 	ListBase apsmbase= {NULL, NULL};
+	int totpixel= shb->size*(task->ymax - task->ymin);
+
+	if (thread_break(re->tbh))
+		return;
 
 	/* zbuffering */
-	apixbuf= MEM_callocN(sizeof(APixstr)*shb->size*shb->size, "APixbuf");
+	apixbuf= MEM_callocN(sizeof(APixstr)*totpixel, "APixbuf");
 	if (re->totstrand)
-		apixbufstrand= MEM_callocN(sizeof(APixstrand)*shb->size*shb->size, "APixbufstrand");
+		apixbufstrand= MEM_callocN(sizeof(APixstrand)*totpixel, "APixbufstrand");
 
 	zbuffer_abuf_shadow(re, lar, shb->persmat, apixbuf, apixbufstrand, &apsmbase, shb->size,
-		shb->totbuf, (float(*)[2])jitbuf);
+		task->ymin, task->ymax, shb->totbuf, (float(*)[2])task->jit);
 
 	/* create Z tiles (for compression): this system is 24 bits!!! */
-	compress_deepshadowbuf(re, shb, apixbuf, apixbufstrand);
+	compress_deepshadowbuf(re, shb, task->shsample, apixbuf, apixbufstrand, task->ymin, task->ymax);
 	
 	MEM_freeN(apixbuf);
 	if (apixbufstrand)
@@ -761,6 +865,26 @@ static void makedeepshadowbuf(Render *re, LampRen *lar, float *jitbuf)
 	freepsA(&apsmbase);
 }
 
+static void makedeepshadowbuf(Render *re, LampRen *lar, float *jitbuf)
+{
+	ShadBuf *shb= lar->shb;
+	TaskPool *task_pool;
+	ShadowBandTask *tasks;
+	ShadSampleBuf *shsample;
+
+	tasks= MEM_callocN(sizeof(ShadowBandTask)*shadowbuf_totband(shb), "ShadowBandTask");
+	task_pool= BLI_task_pool_create(render_task_scheduler_get(re), re);
+
+	/* all samples are merged into a single buffer */
+	shsample= deepshadowbuf_sample_new(shb);
+	shadowbuf_push_bands(task_pool, makedeepshadowbuf_band, tasks, lar, shsample, jitbuf);
+
+	BLI_task_pool_work_and_wait(task_pool);
+	BLI_task_pool_free(task_pool);
+
+	MEM_freeN(tasks);
+}
+
 void makeshadowbuf(Render *re, LampRen *lar)
 {
 	ShadBuf *shb= lar->shb;
@@ -787,11 +911,9 @@ void makeshadowbuf(Render *re, LampRen *lar)
 	if (ELEM3(lar->buftype, LA_SHADBUF_REGULAR, LA_SHADBUF_HALFWAY, LA_SHADBUF_DEEP)) {
 		shb->totbuf= lar->buffers;
 
-		/* jitter, weights - not threadsafe! */
-		BLI_lock_thread(LOCK_CUSTOM1);
+		/* jitter, weights */
 		shb->jit= give_jitter_tab(get_render_shadow_samples(&re->r, shb->samp));
 		make_jitter_weight_tab(re, shb, lar->filtertype);
-		BLI_unlock_thread(LOCK_CUSTOM1);
 		
 		if (shb->totbuf==4) jitbuf= give_jitter_tab(2);
 		else if (shb->totbuf==9) jitbuf= give_jitter_tab(3);
@@ -809,101 +931,45 @@ void makeshadowbuf(Render *re, LampRen *lar)
 	}
 }
 
-static void *do_shadow_thread(void *re_v)
+static void makeshadowbuf_task(TaskPool *pool, void *taskdata, int UNUSED(threadid))
 {
-	Render *re = (Render *)re_v;
-	LampRen *lar;
-
-	do {
-		BLI_lock_thread(LOCK_CUSTOM1);
-		for (lar=re->lampren.first; lar; lar=lar->next) {
-			if (lar->shb && !lar->thread_assigned) {
-				lar->thread_assigned= 1;
-				break;
-			}
-		}
-		BLI_unlock_thread(LOCK_CUSTOM1);
-
-		/* if type is irregular, this only sets the perspective matrix and autoclips */
-		if (lar) {
-			makeshadowbuf(re, lar);
-			BLI_lock_thread(LOCK_CUSTOM1);
-			lar->thread_ready= 1;
-			BLI_unlock_thread(LOCK_CUSTOM1);
-		}
-	} while (lar && !re->test_break(re->tbh));
+	Render *re= (Render *)BLI_task_pool_userdata(pool);
+	LampRen *lar= (LampRen *)taskdata;
 
-	return NULL;
-}
+	if (thread_break(re->tbh))
+		return;
 
-static volatile int g_break= 0;
-static int thread_break(void *UNUSED(arg))
-{
-	return g_break;
+	/* if type is irregular, this only sets the perspective matrix and autoclips */
+	makeshadowbuf(re, lar);
 }
 
 void threaded_makeshadowbufs(Render *re)
 {
-	ListBase threads;
+	TaskPool *task_pool;
 	LampRen *lar;
-	int a, totthread= 0;
-	int (*test_break)(void *);
-
-	/* count number of threads to use */
-	if (G.is_rendering) {
-		for (lar=re->lampren.first; lar; lar= lar->next)
-			if (lar->shb)
-				totthread++;
-		
-		totthread = min_ii(totthread, re->r.threads);
-	}
-	else
-		totthread = 1; /* preview render */
-
-	if (totthread <= 1) {
-		for (lar=re->lampren.first; lar; lar= lar->next) {
-			if (re->test_break(re->tbh)) break;
-			if (lar->shb) {
-				/* if type is irregular, this only sets the perspective matrix and autoclips */
-				makeshadowbuf(re, lar);
-			}
-		}
-	}
-	else {
-		/* swap test break function */
-		test_break= re->test_break;
-		re->test_break= thread_break;
 
-		for (lar=re->lampren.first; lar; lar= lar->next) {
-			lar->thread_assigned= 0;
-			lar->thread_ready= 0;
-		}
+	/* jitter tables are shared by all lamps */
+	init_jitter_tabs();
 
-		BLI_init_threads(&threads, do_shadow_thread, totthread);
-		
-		for (a=0; a<totthread; a++)
-			BLI_insert_thread(&threads, re);
+	/* swap test break function */
+	g_test_break= re->test_break;
+	g_break_thread= pthread_self();
+	re->test_break= thread_break;
 
-		/* keep rendering as long as there are shadow buffers not ready */
-		do {
-			if ((g_break=test_break(re->tbh)))
-				break;
+	/* lamps are built in parallel, and each lamp splits its buffer into bands
+	 * that are built in parallel as well */
+	task_pool= BLI_task_pool_create(render_task_scheduler_get(re), re);
 
-			PIL_sleep_ms(50);
+	for (lar=re->lampren.first; lar; lar= lar->next)
+		if (lar->shb)
+			BLI_task_pool_push(task_pool, makeshadowbuf_task, lar, false, TASK_PRIORITY_LOW);
 
-			BLI_lock_thread(LOCK_CUSTOM1);
-			for (lar=re->lampren.first; lar; lar= lar->next)
-				if (lar->shb && !lar->thread_ready)
-					break;
-			BLI_unlock_thread(LOCK_CUSTOM1);
-		} while (lar);
-	
-		BLI_end_threads(&threads);
+	BLI_task_pool_work_and_wait(task_pool);
+	BLI_task_pool_free(task_pool);
 
-		/* unset threadsafety */
-		re->test_break= test_break;
-		g_break= 0;
-	}
+	/* unset threadsafety */
+	re->test_break= g_test_break;
+	g_break= 0;
 }
 
 void freeshadowbuf(LampRen *lar)
@@ -54,6 +54,7 @@
 #include "BLI_utildefines.h"
 #include "BLI_ghash.h"
 #include "BLI_memarena.h"
+#include "BLI_task.h"
 
 #include "BLF_translation.h"
 
@@ -71,6 +72,7 @@
 
 /* this module */
 #include "render_types.h"
+#include "renderpipeline.h"
 #include "rendercore.h"
 #include "renderdatabase.h" 
 #include "shading.h"
@@ -95,6 +97,9 @@
 #define MAX_OCTREE_NODE_POINTS	8
 #define MAX_OCTREE_DEPTH		15
 
+/* subtrees with fewer points are built in a single task */
+#define MIN_OCTREE_TASK_POINTS	1024
+
 /* Struct Definitions */
 
 struct ScatterSettings {
@@ -142,6 +147,8 @@ typedef struct ScatterNode {
 
 struct ScatterTree {
 	MemArena *arena;
+	MemArena **subarena;	/* one for each subtree built in a task */
+	int totsubarena;
 
 	ScatterSettings *ss[3];
 	float error, scale;
@@ -161,6 +168,29 @@ typedef struct ScatterResult {
 	float backrdsum[3];
 } ScatterResult;
 
+/* Threaded tree building: the top of the octree is built first, deferring
+ * subtrees below task_points points to tasks that build and sum them. The
+ * top nodes are then summed in the order they were completed, which has
+ * children before parents. */
+
+typedef struct ScatterBuildTask {
+	ScatterNode *node;
+	ScatterPoint **refpoints, **tmppoints;
+	float mid[3], size[3];
+	int depth;
+	MemArena *arena;
+} ScatterBuildTask;
+
+typedef struct ScatterBuild {
+	ScatterBuildTask *task;
+	int tottask, maxtask;
+
+	ScatterNode **topnode;
+	int tottopnode, maxtopnode;
+
+	int task_points;
+} ScatterBuild;
+
 /* Functions for BSSRDF reparametrization in to more intuitive parameters,
  * see [2] section 4 for more info. */
 
@@ -652,10 +682,42 @@ static void subnode_middle(int i, float *mid, float *subsize, float *submid)
 	submid[2]= mid[2] + ((z)? subsize[2]: -subsize[2]);
 }
 
-static void create_octree_node(ScatterTree *tree, ScatterNode *node, float *mid, float *size, ScatterPoint **refpoints, int depth)
+static void build_add_task(ScatterBuild *build, ScatterNode *node, float *mid, float *size,
+                           ScatterPoint **refpoints, ScatterPoint **tmppoints, int depth)
+{
+	ScatterBuildTask *task;
+
+	if (build->tottask == build->maxtask) {
+		build->maxtask= (build->maxtask)? build->maxtask*2: 64;
+		build->task= MEM_reallocN(build->task, sizeof(ScatterBuildTask)*build->maxtask);
+	}
+
+	task= &build->task[build->tottask++];
+	task->node= node;
+	task->refpoints= refpoints;
+	task->tmppoints= tmppoints;
+	copy_v3_v3(task->mid, mid);
+	copy_v3_v3(task->size, size);
+	task->depth= depth;
+}
+
+static void build_add_topnode(ScatterBuild *build, ScatterNode *node)
+{
+	if (build->tottopnode == build->maxtopnode) {
+		build->maxtopnode= (build->maxtopnode)? build->maxtopnode*2: 64;
+		build->topnode= MEM_reallocN(build->topnode, sizeof(ScatterNode*)*build->maxtopnode);
+	}
+
+	build->topnode[build->tottopnode++]= node;
+}
+
+/* tmppoints is scratch space for the same range of points as refpoints. if
+ * build is given, smaller subtrees are deferred to tasks instead of built */
+static void create_octree_node(ScatterTree *tree, MemArena *arena, ScatterBuild *build, ScatterNode *node,
+                               float *mid, float *size, ScatterPoint **refpoints, ScatterPoint **tmppoints, int depth)
 {
 	ScatterNode *subnode;
-	ScatterPoint **subrefpoints, **tmppoints= tree->tmppoints;
+	ScatterPoint **subrefpoints;
 	int index, nsize[8], noffset[8], i, subco, used_nodes, usedi;
 	float submid[3], subsize[3];
 
@@ -664,6 +726,14 @@ static void create_octree_node(ScatterTree *tree, ScatterNode *node, float *mid,
 		for (i=0; i<node->totpoint; i++)
 			node->points[i]= *(refpoints[i]);
 
+		if (build)
+			build_add_topnode(build, node);
+
+		return;
+	}
+
+	if (build && node->totpoint <= build->task_points) {
+		build_add_task(build, node, mid, size, refpoints, tmppoints, depth);
 		return;
 	}
 
@@ -699,7 +769,7 @@ static void create_octree_node(ScatterTree *tree, ScatterNode *node, float *mid,
 	
 	if (used_nodes <= 1) {
 		subnode_middle(usedi, mid, subsize, submid);
-		create_octree_node(tree, node, submid, subsize, refpoints, depth+1);
+		create_octree_node(tree, arena, build, node, submid, subsize, refpoints, tmppoints, depth+1);
 		return;
 	}
 
@@ -713,7 +783,7 @@ static void create_octree_node(ScatterTree *tree, ScatterNode *node, float *mid,
 	/* create subnodes */
 	for (subco=0, i=0; i<8; subco+=nsize[i], i++) {
 		if (nsize[i] > 0) {
-			subnode= BLI_memarena_alloc(tree->arena, sizeof(ScatterNode));
+			subnode= BLI_memarena_alloc(arena, sizeof(ScatterNode));
 			node->child[i]= subnode;
 			subnode->points= node->points + subco;
 			subnode->totpoint= nsize[i];
@@ -721,8 +791,8 @@ static void create_octree_node(ScatterTree *tree, ScatterNode *node, float *mid,
 
 			subnode_middle(i, mid, subsize, submid);
 
-			create_octree_node(tree, subnode, submid, subsize, subrefpoints,
-				depth+1);
+			create_octree_node(tree, arena, build, subnode, submid, subsize, subrefpoints,
+				tmppoints + subco, depth+1);
 		}
 		else
 			node->child[i]= NULL;
@@ -730,6 +800,69 @@ static void create_octree_node(ScatterTree *tree, ScatterNode *node, float *mid,
 
 	node->points= NULL;
 	node->totpoint= 0;
+
+	if (build)
+		build_add_topnode(build, node);
+}
+
+static void scatter_build_task(TaskPool *pool, void *taskdata, int UNUSED(threadid))
+{
+	ScatterTree *tree= (ScatterTree *)BLI_task_pool_userdata(pool);
+	ScatterBuildTask *task= (ScatterBuildTask *)taskdata;
+
+	task->arena= BLI_memarena_new(0x1000 * sizeof(ScatterNode), "sss subtree arena");
+	BLI_memarena_use_calloc(task->arena);
+
+	create_octree_node(tree, task->arena, NULL, task->node, task->mid, task->size,
+		task->refpoints, task->tmppoints, task->depth);
+
+	sum_radiance(tree, task->node);
+}
+
+static void create_octree_threaded(ScatterTree *tree, TaskScheduler *scheduler, float *mid, float *size, int totthread)
+{
+	TaskPool *task_pool;
+	ScatterBuild build;
+	int a;
+
+	memset(&build, 0, sizeof(build));
+	build.task_points= max_ii(tree->totpoint/(totthread*8), MIN_OCTREE_TASK_POINTS);
+
+	/* build top of the tree */
+	create_octree_node(tree, tree->arena, &build, tree->root, mid, size, tree->refpoints, tree->tmppoints, 0);
+
+	/* build and sum subtrees */
+	task_pool= BLI_task_pool_create(scheduler, tree);
+
+	for (a=0; a<build.tottask; a++)
+		BLI_task_pool_push(task_pool, scatter_build_task, &build.task[a], false, TASK_PRIORITY_LOW);
+
+	BLI_task_pool_work_and_wait(task_pool);
+
+	BLI_task_pool_free(task_pool);
+
+	if (build.tottask) {
+		tree->subarena= MEM_mallocN(sizeof(MemArena*)*build.tottask, "ScatterTree subarena");
+		tree->totsubarena= build.tottask;
+
+		for (a=0; a<build.tottask; a++)
+			tree->subarena[a]= build.task[a].arena;
+
+		MEM_freeN(build.task);
+	}
+
+	/* sum top of the tree, children come before their parents */
+	for (a=0; a<build.tottopnode; a++) {
+		ScatterNode *node= build.topnode[a];
+
+		if (node->totpoint > 0)
+			sum_leaf_radiance(tree, node);
+		else
+			sum_branch_radiance(tree, node);
+	}
+
+	if (build.topnode)
+		MEM_freeN(build.topnode);
 }
 
 /* public functions */
@@ -775,11 +908,12 @@ ScatterTree *scatter_tree_new(ScatterSettings *ss[3], float scale, float error,
 	return tree;
 }
 
-void scatter_tree_build(ScatterTree *tree)
+void scatter_tree_build(ScatterTree *tree, TaskScheduler *scheduler)
 {
 	ScatterPoint *newpoints, **tmppoints;
 	float mid[3], size[3];
 	int totpoint= tree->totpoint;
+	int totthread= BLI_task_scheduler_num_threads(scheduler);
 
 	newpoints = MEM_callocN(sizeof(ScatterPoint) * totpoint, "ScatterPoints");
 	tmppoints = MEM_callocN(sizeof(ScatterPoint *) * totpoint, "ScatterTmpPoints");
@@ -801,7 +935,16 @@ void scatter_tree_build(ScatterTree *tree)
 	size[1]= (tree->max[1]-tree->min[1])*0.5f;
 	size[2]= (tree->max[2]-tree->min[2])*0.5f;
 
-	create_octree_node(tree, tree->root, mid, size, tree->refpoints, 0);
+	if (totthread > 1 && totpoint > MIN_OCTREE_TASK_POINTS) {
+		/* also sums radiance */
+		create_octree_threaded(tree, scheduler, mid, size, totthread);
+	}
+	else {
+		create_octree_node(tree, tree->arena, NULL, tree->root, mid, size, tree->refpoints, tree->tmppoints, 0);
+
+		/* sum radiance at nodes */
+		sum_radiance(tree, tree->root);
+	}
 
 	MEM_freeN(tree->points);
 	MEM_freeN(tree->refpoints);
@@ -809,9 +952,6 @@ void scatter_tree_build(ScatterTree *tree)
 	tree->refpoints= NULL;
 	tree->tmppoints= NULL;
 	tree->points= newpoints;
-	
-	/* sum radiance at nodes */
-	sum_radiance(tree, tree->root);
 }
 
 void scatter_tree_sample(ScatterTree *tree, const float co[3], float color[3])
@@ -826,7 +966,12 @@ void scatter_tree_sample(ScatterTree *tree, const float co[3], float color[3])
 
 void scatter_tree_free(ScatterTree *tree)
 {
+	int a;
+
 	if (tree->arena) BLI_memarena_free(tree->arena);
+	for (a=0; a<tree->totsubarena; a++)
+		BLI_memarena_free(tree->subarena[a]);
+	if (tree->subarena) MEM_freeN(tree->subarena);
 	if (tree->points) MEM_freeN(tree->points);
 	if (tree->refpoints) MEM_freeN(tree->refpoints);
 		
@@ -851,18 +996,12 @@ typedef struct SSSPoints {
 	int totpoint;
 } SSSPoints;
 
-static void sss_create_tree_mat(Render *re, Material *mat)
+/* render the sss points of all materials in a single preprocessing pass,
+ * points[a] receives the points for mats[a] */
+static void sss_render_points(Render *re, Material **mats, int totmat, ListBase *points)
 {
-	SSSPoints *p;
 	RenderResult *rr;
-	ListBase points;
-	float (*co)[3] = NULL, (*color)[3] = NULL, *area = NULL;
-	int totpoint = 0, osa, osaflag, partsdone;
-
-	if (re->test_break(re->tbh))
-		return;
-	
-	points.first= points.last= NULL;
+	int osa, osaflag, partsdone;
 
 	/* TODO: this is getting a bit ugly, copying all those variables and
 	 * setting them back, maybe we need to create our own Render? */
@@ -876,8 +1015,9 @@ static void sss_create_tree_mat(Render *re, Material *mat)
 
 	re->osa= 0;
 	re->r.mode &= ~R_OSA;
-	re->sss_points= &points;
-	re->sss_mat= mat;
+	re->sss_points= points;
+	re->sss_mats= mats;
+	re->sss_totmat= totmat;
 	re->i.partsdone = 0;
 
 	if (!(re->r.scemode & (R_BUTS_PREVIEW|R_VIEWPORT_PREVIEW)))
@@ -894,25 +1034,33 @@ static void sss_create_tree_mat(Render *re, Material *mat)
 	BLI_rw_mutex_unlock(&re->resultmutex);
 
 	re->i.partsdone= partsdone;
-	re->sss_mat= NULL;
+	re->sss_mats= NULL;
+	re->sss_totmat= 0;
 	re->sss_points= NULL;
 	re->osa= osa;
 	if (osaflag) re->r.mode |= R_OSA;
+}
+
+static void sss_create_tree_mat(Render *re, Material *mat, ListBase *points)
+{
+	SSSPoints *p;
+	float (*co)[3] = NULL, (*color)[3] = NULL, *area = NULL;
+	int totpoint = 0;
 
 	/* no points? no tree */
-	if (!points.first)
+	if (!points->first)
 		return;
 
 	/* merge points together into a single buffer */
 	if (!re->test_break(re->tbh)) {
-		for (totpoint=0, p=points.first; p; p=p->next)
+		for (totpoint=0, p=points->first; p; p=p->next)
 			totpoint += p->totpoint;
 		
 		co= MEM_mallocN(sizeof(*co)*totpoint, "SSSCo");
 		color= MEM_mallocN(sizeof(*color)*totpoint, "SSSColor");
 		area= MEM_mallocN(sizeof(*area)*totpoint, "SSSArea");
 
-		for (totpoint=0, p=points.first; p; p=p->next) {
+		for (totpoint=0, p=points->first; p; p=p->next) {
 			memcpy(co+totpoint, p->co, sizeof(*co)*p->totpoint);
 			memcpy(color+totpoint, p->color, sizeof(*color)*p->totpoint);
 			memcpy(area+totpoint, p->area, sizeof(*area)*p->totpoint);
@@ -921,12 +1069,12 @@ static void sss_create_tree_mat(Render *re, Material *mat)
 	}
 
 	/* free points */
-	for (p=points.first; p; p=p->next) {
+	for (p=points->first; p; p=p->next) {
 		MEM_freeN(p->co);
 		MEM_freeN(p->color);
 		MEM_freeN(p->area);
 	}
-	BLI_freelistN(&points);
+	BLI_freelistN(points);
 
 	/* build tree */
 	if (!re->test_break(re->tbh)) {
@@ -950,7 +1098,7 @@ static void sss_create_tree_mat(Render *re, Material *mat)
 		MEM_freeN(color);
 		MEM_freeN(area);
 
-		scatter_tree_build(sss->tree);
+		scatter_tree_build(sss->tree, render_task_scheduler_get(re));
 
 		BLI_ghash_insert(re->sss_hash, mat, sss);
 	}
@@ -961,7 +1109,7 @@ static void sss_create_tree_mat(Render *re, Material *mat)
 	}
 }
 
-void sss_add_points(Render *re, float (*co)[3], float (*color)[3], float *area, int totpoint)
+void sss_add_points(Render *re, int mat_index, float (*co)[3], float (*color)[3], float *area, int totpoint)
 {
 	SSSPoints *p;
 	
@@ -974,7 +1122,7 @@ void sss_add_points(Render *re, float (*co)[3], float (*color)[3], float *area,
 		p->totpoint= totpoint;
 
 		BLI_lock_thread(LOCK_CUSTOM1);
-		BLI_addtail(re->sss_points, p);
+		BLI_addtail(&re->sss_points[mat_index], p);
 		BLI_unlock_thread(LOCK_CUSTOM1);
 	}
 }
@@ -990,48 +1138,65 @@ static void sss_free_tree(SSSData *sss)
 
 /* public functions */
 
-void make_sss_tree(Render *re)
+static int sss_collect_materials(ListBase *lb, Material **mats)
 {
 	Material *mat;
-	bool infostr_set = false;
+	int totmat= 0;
+
+	for (mat= lb->first; mat; mat= mat->id.next) {
+		if (mat->id.us && (mat->flag & MA_IS_USED) && (mat->sss_flag & MA_DIFF_SSS)) {
+			if (mats)
+				mats[totmat]= mat;
+			totmat++;
+		}
+	}
+
+	return totmat;
+}
+
+void make_sss_tree(Render *re)
+{
+	Material **mats;
+	ListBase *points;
 	const char *prevstr = NULL;
+	int a, totmat;
 
 	free_sss(re);
 	
 	re->sss_hash= BLI_ghash_ptr_new("make_sss_tree gh");
 
 	re->stats_draw(re->sdh, &re->i);
-	
-	for (mat= re->main->mat.first; mat; mat= mat->id.next) {
-		if (mat->id.us && (mat->flag & MA_IS_USED) && (mat->sss_flag & MA_DIFF_SSS)) {
-			if (!infostr_set) {
-				prevstr = re->i.infostr;
-				re->i.infostr = IFACE_("SSS preprocessing");
-				infostr_set = true;
-			}
 
-			sss_create_tree_mat(re, mat);
-		}
-	}
-	
 	/* XXX preview exception */
 	/* localizing preview render data is not fun for node trees :( */
-	if (re->main!=G.main) {
-		for (mat= G.main->mat.first; mat; mat= mat->id.next) {
-			if (mat->id.us && (mat->flag & MA_IS_USED) && (mat->sss_flag & MA_DIFF_SSS)) {
-				if (!infostr_set) {
-					prevstr = re->i.infostr;
-					re->i.infostr = IFACE_("SSS preprocessing");
-					infostr_set = true;
-				}
+	totmat= sss_collect_materials(&re->main->mat, NULL);
+	if (re->main!=G.main)
+		totmat += sss_collect_materials(&G.main->mat, NULL);
 
-				sss_create_tree_mat(re, mat);
-			}
-		}
-	}
-	
-	if (infostr_set)
-		re->i.infostr = prevstr;
+	if (totmat == 0 || re->test_break(re->tbh))
+		return;
+
+	mats= MEM_mallocN(sizeof(*mats)*totmat, "SSSMaterials");
+	points= MEM_callocN(sizeof(*points)*totmat, "SSSPointsLists");
+
+	a= sss_collect_materials(&re->main->mat, mats);
+	if (re->main!=G.main)
+		sss_collect_materials(&G.main->mat, mats + a);
+
+	prevstr = re->i.infostr;
+	re->i.infostr = IFACE_("SSS preprocessing");
+
+	/* shade the points of all materials at once, rather than doing a
+	 * preprocessing render for each material */
+	sss_render_points(re, mats, totmat, points);
+
+	for (a=0; a<totmat; a++)
+		sss_create_tree_mat(re, mats[a], &points[a]);
+
+	re->i.infostr = prevstr;
+
+	MEM_freeN(mats);
+	MEM_freeN(points);
 }
 
 void free_sss(Render *re)
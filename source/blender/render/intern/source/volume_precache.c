@@ -55,6 +55,7 @@
 #include "rayintersection.h"
 #include "rayobject.h"
 #include "render_types.h"
+#include "renderpipeline.h"
 #include "rendercore.h"
 #include "renderdatabase.h"
 #include "volumetric.h"
@@ -590,7 +591,6 @@ static void precache_setup_shadeinput(Render *re, ObjectInstanceRen *obi, Materi
 
 static void precache_launch_parts(Render *re, RayObject *tree, ShadeInput *shi, ObjectInstanceRen *obi)
 {
-	TaskScheduler *task_scheduler;
 	TaskPool *task_pool;
 	VolumePrecache *vp = obi->volume_precache;
 	VolPrecacheState state;
@@ -616,8 +616,7 @@ static void precache_launch_parts(Render *re, RayObject *tree, ShadeInput *shi,
 	state.totparts = parts[0]*parts[1]*parts[2];
 	state.lasttime = PIL_check_seconds_timer();
 	
-	task_scheduler = BLI_task_scheduler_create(totthread);
-	task_pool = BLI_task_pool_create(task_scheduler, &state);
+	task_pool = BLI_task_pool_create(render_task_scheduler_get(re), &state);
 
 	/* using boundbox in worldspace */
 	global_bounds_obi(re, obi, bbmin, bbmax);
@@ -674,7 +673,6 @@ static void precache_launch_parts(Render *re, RayObject *tree, ShadeInput *shi,
 
 	/* free */
 	BLI_task_pool_free(task_pool);
-	BLI_task_scheduler_free(task_scheduler);
 }
 
 /* calculate resolution from bounding box in world space */